@@ -72,11 +72,15 @@ pg_setup.1a:
 	addl	$0x1000,%eax
 	loop	pg_setup.1a
 	movl	$508,%ecx
-	/* PDPE: 4G-512G */
+	/* PDPE: 4G-512G in 1 GiB pages; %edx:%eax holds the entry */
 	movl	$0x183,%eax
+	movl	$1,%edx
 pg_setup.1b:
 	movl	%eax,(%edi)
+	movl	%edx,4(%edi)
 	addl	$8,%edi
+	addl	$0x40000000,%eax
+	adcl	$0,%edx
 	loop	pg_setup.1b
 /* Page directories (PDE) */
 	leal	0x2000(%ebx),%edi
@@ -23,6 +23,7 @@ void pause(void);
 #define E1000_REG_ICS   0x00c8
 #define E1000_REG_IMS   0x00d0
 #define E1000_REG_IMC   0x00d8
+#define E1000_REG_ITR   0x00c4  /* Interrupt throttling (256 ns unit) */
 #define E1000_REG_RCTL  0x0100
 #define E1000_REG_RDBAL 0x2800
 #define E1000_REG_RDBAH 0x2804
@@ -51,6 +52,18 @@ void pause(void);
 
 #define E1000_CTRL_EXT_LINK_MODE_MASK (u32)(3ULL<<22)
 
+#define E1000_ICR_RXT0  (1<<7)  /* Receiver timer interrupt */
+
+#define E1000_TXD_CMD_EOP       (1<<0)
+#define E1000_TXD_CMD_IFCS      (1<<1)
+#define E1000_TXD_CMD_RS        (1<<3)
+#define E1000_TXD_CMD_VLE       (1<<6)
+
+/* Packets taken by an RX burst for e1000_recvpkt() */
+#define E1000_RX_STASH          32
+/* RX burst size of e1000_routing() */
+#define E1000_ROUTING_BURST     32
+
 #define E1000_RCTL_EN   (1<<1)
 #define E1000_RCTL_SBP  (1<<2)
 #define E1000_RCTL_UPE  (1<<3)  /* Unicast promiscuous */
@@ -60,6 +73,7 @@ void pause(void);
 #define E1000_RCTL_BSEX (1<<25) /* Buffer size extension */
 #define E1000_RCTL_SECRC (1<<26) /* Strip ethernet CRC from incoming packet */
 
+#define E1000_RCTL_BSIZE_4096 (3<<16) | E1000_RCTL_BSEX
 #define E1000_RCTL_BSIZE_8192 (2<<16) | E1000_RCTL_BSEX
 #define E1000_RCTL_BSIZE_SHIFT 16
 
@@ -118,9 +132,18 @@ struct e1000_device {
     u32 rx_head_cache;
     u32 tx_head_cache;
 
+    /* Packet being received over multiple descriptors */
+    struct mbuf *rx_pkt;
+    struct mbuf *rx_last;
+    /* Received packets not taken by e1000_recvpkt() yet */
+    struct mbuf *rx_stash[E1000_RX_STASH];
+    int rx_stash_n;
+    int rx_stash_i;
+
     u8 macaddr[6];
 
     struct pci_device *pci_device;
+    struct netdev *netdev;
 };
 
 /* Prototype declarations */
@@ -132,6 +155,14 @@ int e1000_setup_tx_desc(struct e1000_device *);
 void e1000_irq_handler(int, void *);
 int e1000_recvpkt(u8 *, u32, struct netdev *);
 int e1000_sendpkt(const u8 *, u32, struct netdev *);
+int e1000_rx_burst(struct netdev *, int, struct mbuf **, int);
+int e1000_tx_buf(struct netdev *, u8 **, u16 **, u16);
+int e1000_tx_set(struct netdev *, u64, u16, u16);
+int e1000_tx_commit(struct netdev *);
+int e1000_routing(struct netdev *, int (*)(const u8 *, u32, int));
+int e1000_rx_intr(struct netdev *, int, int);
+int e1000_rx_itr(struct netdev *, int, int);
+int e1000_tx_burst(struct netdev *, int, struct mbuf **, int);
 
 static __inline__ volatile u32
 mmio_read32(u64 base, u64 offset)
@@ -210,6 +241,14 @@ e1000_update_hw(void)
                 netdev = netdev_add_device(e1000dev->macaddr, e1000dev);
                 netdev->recvpkt = e1000_recvpkt;
                 netdev->sendpkt = e1000_sendpkt;
+                netdev->rx_burst = e1000_rx_burst;
+                netdev->tx_burst = e1000_tx_burst;
+                netdev->rx_intr = e1000_rx_intr;
+                netdev->rx_itr = e1000_rx_itr;
+                e1000dev->netdev = netdev;
+                netdev->offload = NETDEV_OFFLOAD_VLAN_STRIP
+                    | NETDEV_OFFLOAD_VLAN_INSERT | NETDEV_OFFLOAD_TCP_CKSUM
+                    | NETDEV_OFFLOAD_UDP_CKSUM;
                 idx++;
                 break;
             default:
@@ -233,8 +272,9 @@ e1000_irq_handler(int irq, void *user)
     /* Read and clear */
     isr = mmio_read32(dev->mmio, E1000_REG_ICR);
 
-    if ( isr & 0x80 ) {
+    if ( (isr & E1000_ICR_RXT0) && NULL != dev->netdev ) {
         /* Packet received */
+        netdev_rx_intr(dev->netdev, 0);
     }
 }
 
@@ -341,8 +381,10 @@ e1000_init_hw(struct pci_device *pcidev)
     /* Store the parent device information */
     dev->pci_device = pcidev;
 
-    /* Enable interrupt (REG_IMS <- 0x1F6DC, then read REG_ICR ) */
-    mmio_write32(dev->mmio, E1000_REG_IMS, 0x908e);
+    /* Enable interrupt (REG_IMS <- 0x1F6DC, then read REG_ICR ); RXT0 is
+       enabled by e1000_rx_intr() */
+    dev->netdev = NULL;
+    mmio_write32(dev->mmio, E1000_REG_IMS, 0x908e & ~E1000_ICR_RXT0);
     (void)mmio_read32(dev->mmio, E1000_REG_ICR);
     /* Register IRQ handler */
     register_irq_handler((((pcidev->intr_pin -1) + pcidev->slot) % 4) + 0x10,
@@ -366,6 +408,7 @@ int
 e1000_setup_rx_desc(struct e1000_device *dev)
 {
     struct e1000_rx_desc *rxdesc;
+    struct mbuf *mbuf;
     int i;
 
     dev->rx_tail = 0;
@@ -375,6 +418,11 @@ e1000_setup_rx_desc(struct e1000_device *dev)
     dev->rx_head_cache = 0;
     dev->tx_head_cache = 0;
 
+    dev->rx_pkt = NULL;
+    dev->rx_last = NULL;
+    dev->rx_stash_n = 0;
+    dev->rx_stash_i = 0;
+
     /* ToDo: 16 bytes for alignment */
     dev->rx_mem_base = kmalloc(dev->rx_bufsz * sizeof(struct e1000_rx_desc) + 16);
     if ( 0 == dev->rx_mem_base ) {
@@ -385,8 +433,11 @@ e1000_setup_rx_desc(struct e1000_device *dev)
     for ( i = 0; i < dev->rx_bufsz; i++ ) {
         rxdesc = (struct e1000_rx_desc *)(dev->rx_base
                                           + i * sizeof(struct e1000_rx_desc));
-        rxdesc->address = (u64)kmalloc(8192 + 16);
-        /* FIXME: Memory check */
+        mbuf = mbuf_alloc(mbufpool);
+        if ( NULL == mbuf ) {
+            return -1;
+        }
+        rxdesc->address = MBUF_ADDR(mbuf);
         rxdesc->checksum = 0;
         rxdesc->status = 0;
         rxdesc->errors = 0;
@@ -403,7 +454,7 @@ e1000_setup_rx_desc(struct e1000_device *dev)
     mmio_write32(dev->mmio, E1000_REG_RCTL,
                  E1000_RCTL_SBP | E1000_RCTL_UPE
                  | E1000_RCTL_MPE | E1000_RCTL_LPE | E1000_RCTL_BAM
-                 | E1000_RCTL_BSIZE_8192 | E1000_RCTL_SECRC);
+                 | E1000_RCTL_BSIZE_4096 | E1000_RCTL_SECRC);
     /* Enable */
     mmio_write32(dev->mmio, E1000_REG_RCTL,
                  mmio_read32(dev->mmio, E1000_REG_RCTL) | E1000_RCTL_EN);
@@ -418,6 +469,7 @@ int
 e1000_setup_tx_desc(struct e1000_device *dev)
 {
     struct e1000_tx_desc *txdesc;
+    struct mbuf *mbuf;
     int i;
 
     dev->tx_tail = 0;
@@ -429,7 +481,11 @@ e1000_setup_tx_desc(struct e1000_device *dev)
     for ( i = 0; i < dev->tx_bufsz; i++ ) {
         txdesc = (struct e1000_tx_desc *)(dev->tx_base
                                           + i * sizeof(struct e1000_tx_desc));
-        txdesc->address = (u64)kmalloc(8192 + 16);
+        mbuf = mbuf_alloc(mbufpool);
+        if ( NULL == mbuf ) {
+            return -1;
+        }
+        txdesc->address = MBUF_ADDR(mbuf);
         txdesc->cmd = 0;
         txdesc->sta = 0;
         txdesc->cso = 0;
@@ -449,70 +505,434 @@ e1000_setup_tx_desc(struct e1000_device *dev)
 }
 
 
+/*
+ * Receive a packet to the buffer; the packets are taken from the ring by a
+ * burst, so RDT is written once per burst
+ */
 int
 e1000_recvpkt(u8 *pkt, u32 len, struct netdev *netdev)
 {
-    u32 rdh;
     struct e1000_device *dev;
-    int rx_que;
+    struct mbuf *m;
+    struct mbuf *seg;
+    u32 seglen;
+    u32 ret;
+
+    dev = (struct e1000_device *)netdev->vendor;
+
+    if ( dev->rx_stash_i >= dev->rx_stash_n ) {
+        dev->rx_stash_i = 0;
+        dev->rx_stash_n = e1000_rx_burst(netdev, 0, dev->rx_stash,
+                                         E1000_RX_STASH);
+        if ( dev->rx_stash_n <= 0 ) {
+            dev->rx_stash_n = 0;
+            return -1;
+        }
+    }
+    m = dev->rx_stash[dev->rx_stash_i];
+    dev->rx_stash_i++;
+
+    /* Linearize the segments */
+    ret = 0;
+    for ( seg = m; NULL != seg && ret < len; seg = seg->next ) {
+        seglen = seg->len < len - ret ? seg->len : len - ret;
+        kmemcpy(pkt + ret, MBUF_DATA(seg), seglen);
+        ret += seglen;
+    }
+    mbuf_free(m);
+
+    return ret;
+}
+
+/*
+ * Transmit a packet copied to the buffer of the TX ring
+ */
+int
+e1000_sendpkt(const u8 *pkt, u32 len, struct netdev *netdev)
+{
+    u8 *buf;
+    u16 *buflen;
+
+    /* The tail room of a TX buffer reset by _e1000_tx_mbuf() */
+    if ( len > mbufpool->bufsz - MBUF_HEADROOM ) {
+        return -1;
+    }
+    if ( e1000_tx_buf(netdev, &buf, &buflen, 0) < 0 ) {
+        return -1;
+    }
+    kmemcpy(buf, pkt, len);
+    *buflen = len;
+    e1000_tx_commit(netdev);
+
+    return len;
+}
+
+/*
+ * Check if n TX descriptors are available
+ */
+static __inline__ int
+_e1000_tx_avail(struct e1000_device *dev, int n)
+{
+    int tx_avl;
+
+    /* Keep one descriptor unused to distinguish full from empty */
+    tx_avl = (dev->tx_head_cache + dev->tx_bufsz - dev->tx_tail - 1)
+        % dev->tx_bufsz;
+    if ( tx_avl < n ) {
+        /* Update the head cache */
+        dev->tx_head_cache = mmio_read32(dev->mmio, E1000_REG_TDH);
+        tx_avl = (dev->tx_head_cache + dev->tx_bufsz - dev->tx_tail - 1)
+            % dev->tx_bufsz;
+        if ( tx_avl < n ) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Reset the buffer owned by the TX descriptor to the head of its data room; a
+ * recycled buffer may have been left at any offset
+ */
+static struct mbuf *
+_e1000_tx_mbuf(struct e1000_tx_desc *txdesc)
+{
+    struct mbuf *m;
+
+    m = mbuf_from_addr(mbufpool, txdesc->address);
+    if ( NULL == m ) {
+        m = mbuf_alloc(mbufpool);
+        if ( NULL == m ) {
+            return NULL;
+        }
+    }
+    m->off = MBUF_HEADROOM;
+    m->len = 0;
+    txdesc->address = MBUF_ADDR(m);
+
+    return m;
+}
+
+/*
+ * Take the buffer attached to the next TX descriptor to build a packet in
+ * place; the packet and its length (*len) must be written before the next TX
+ * call, and are sent by e1000_tx_commit()
+ */
+int
+e1000_tx_buf(struct netdev *netdev, u8 **pkt, u16 **len, u16 vlan)
+{
+    struct e1000_device *dev;
+    struct e1000_tx_desc *txdesc;
+
+    dev = (struct e1000_device *)netdev->vendor;
+    if ( _e1000_tx_avail(dev, 1) < 0 ) {
+        return -1;
+    }
+
+    txdesc = (struct e1000_tx_desc *)
+        (dev->tx_base + dev->tx_tail * sizeof(struct e1000_tx_desc));
+    if ( NULL == _e1000_tx_mbuf(txdesc) ) {
+        return -1;
+    }
+
+    txdesc->length = 0;
+    txdesc->sta = 0;
+    txdesc->css = 0;
+    txdesc->cso = 0;
+    txdesc->special = vlan;
+    txdesc->cmd = E1000_TXD_CMD_RS | E1000_TXD_CMD_IFCS | E1000_TXD_CMD_EOP
+        | (vlan ? E1000_TXD_CMD_VLE : 0);
+    dev->tx_tail = (dev->tx_tail + 1) % dev->tx_bufsz;
+
+    *pkt = (u8 *)txdesc->address;
+    /* The length field at the offset 8 of the descriptor */
+    *len = (u16 *)((u64)txdesc + 8);
+
+    return 0;
+}
+
+/*
+ * Copy the caller's buffer (addr) to the buffer owned by the next TX
+ * descriptor; the caller's buffer may be reused on return.  Sent by
+ * e1000_tx_commit().
+ */
+int
+e1000_tx_set(struct netdev *netdev, u64 addr, u16 len, u16 vlan)
+{
+    u8 *buf;
+    u16 *buflen;
+
+    if ( len > mbufpool->bufsz - MBUF_HEADROOM ) {
+        return -1;
+    }
+    if ( e1000_tx_buf(netdev, &buf, &buflen, vlan) < 0 ) {
+        return -1;
+    }
+    kmemcpy(buf, (u8 *)addr, len);
+    *buflen = len;
+
+    return 0;
+}
+
+/*
+ * Ring the doorbell for the descriptors queued by e1000_tx_buf() and
+ * e1000_tx_set()
+ */
+int
+e1000_tx_commit(struct netdev *netdev)
+{
+    struct e1000_device *dev;
+
+    dev = (struct e1000_device *)netdev->vendor;
+    mmio_write32(dev->mmio, E1000_REG_TDT, dev->tx_tail);
+
+    return 0;
+}
+
+/*
+ * Pass the received packets to the callback with their VLAN IDs (0 if
+ * untagged); never returns
+ */
+int
+e1000_routing(struct netdev *netdev, int (*cb)(const u8 *, u32, int))
+{
+    struct mbuf *mbufs[E1000_ROUTING_BURST];
+    struct mbuf *m;
+    int vlan;
+    int n;
+    int i;
+
+    for ( ;; ) {
+        n = netdev_rx_poll(netdev, 0, mbufs, E1000_ROUTING_BURST);
+        for ( i = 0; i < n; i++ ) {
+            m = mbufs[i];
+            /* Frames over multiple buffers are not routed */
+            if ( NULL == m->next ) {
+                vlan = (m->ol_flags & MBUF_OL_RX_VLAN) ? m->vlan & 0xfff : 0;
+                cb(MBUF_DATA(m), m->len, vlan);
+            }
+            mbuf_free(m);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Enable/disable the RX interrupt
+ */
+int
+e1000_rx_intr(struct netdev *netdev, int q, int on)
+{
+    struct e1000_device *dev;
+
+    dev = (struct e1000_device *)netdev->vendor;
+    if ( 0 != q ) {
+        return -1;
+    }
+    if ( on ) {
+        mmio_write32(dev->mmio, E1000_REG_IMS, E1000_ICR_RXT0);
+    } else {
+        mmio_write32(dev->mmio, E1000_REG_IMC, E1000_ICR_RXT0);
+    }
+
+    return 0;
+}
+
+/*
+ * Set the minimum interval between the interrupts
+ */
+int
+e1000_rx_itr(struct netdev *netdev, int q, int usec)
+{
+    struct e1000_device *dev;
+
+    dev = (struct e1000_device *)netdev->vendor;
+    if ( 0 != q ) {
+        return -1;
+    }
+    /* In 256 ns */
+    mmio_write32(dev->mmio, E1000_REG_ITR, (u32)usec * 1000 / 256);
+
+    return 0;
+}
+
+/*
+ * Receive up to n packets without copy; the buffers attached to the RX
+ * descriptors are handed to the caller and replaced with new ones
+ */
+int
+e1000_rx_burst(struct netdev *netdev, int q, struct mbuf **mbufs, int n)
+{
+    struct e1000_device *dev;
     struct e1000_rx_desc *rxdesc;
-    int ret;
+    struct mbuf *m;
+    struct mbuf *nm;
+    struct netdev_stats *st;
+    u64 bytes;
+    int nrx;
+    int last;
+    int nobuf;
 
     dev = (struct e1000_device *)netdev->vendor;
-    rdh = mmio_read32(dev->mmio, E1000_REG_RDH);
 
-    rx_que = (dev->rx_bufsz - dev->rx_tail + rdh) % dev->rx_bufsz;
-    if ( rx_que > 0 ) {
-        /* Check the head of RX ring buffer */
+    nrx = 0;
+    last = -1;
+    bytes = 0;
+    nobuf = 0;
+    while ( nrx < n ) {
         rxdesc = (struct e1000_rx_desc *)
-            (dev->rx_base + (dev->rx_tail % dev->rx_bufsz)
-             * sizeof(struct e1000_rx_desc));
-        ret = len < rxdesc->length ? len : rxdesc->length;
-        kmemcpy(pkt, (void *)rxdesc->address, ret);
+            (dev->rx_base + dev->rx_tail * sizeof(struct e1000_rx_desc));
+        if ( !(rxdesc->status & 1) ) {
+            /* Not written back yet */
+            break;
+        }
 
-        mmio_write32(dev->mmio, E1000_REG_RDT, dev->rx_tail);
+        /* Allocate a new buffer first not to lose the descriptor */
+        nm = mbuf_alloc(mbufpool);
+        if ( NULL == nm ) {
+            nobuf = 1;
+            break;
+        }
+        m = mbuf_from_addr(mbufpool, rxdesc->address);
+        m->len = rxdesc->length;
+        m->pktlen = rxdesc->length;
+
+        /* Chain the segments until EOP */
+        if ( NULL == dev->rx_pkt ) {
+            dev->rx_pkt = m;
+        } else {
+            dev->rx_last->next = m;
+            dev->rx_pkt->pktlen += m->len;
+        }
+        dev->rx_last = m;
+        if ( rxdesc->status & (1<<1) ) {
+            if ( rxdesc->status & (1<<3) ) {
+                /* VP: the VLAN tag was stripped by CTRL.VME */
+                dev->rx_pkt->vlan = rxdesc->special;
+                dev->rx_pkt->ol_flags |= MBUF_OL_RX_VLAN;
+            }
+            mbufs[nrx] = dev->rx_pkt;
+            bytes += dev->rx_pkt->pktlen;
+            nrx++;
+            dev->rx_pkt = NULL;
+            dev->rx_last = NULL;
+        }
+
+        /* Refill */
+        rxdesc->address = MBUF_ADDR(nm);
+        rxdesc->status = 0;
+        last = dev->rx_tail;
         dev->rx_tail = (dev->rx_tail + 1) % dev->rx_bufsz;
+    }
 
-        return ret;
+    if ( last >= 0 ) {
+        mmio_write32(dev->mmio, E1000_REG_RDT, last);
+    }
+    if ( last >= 0 || nobuf ) {
+        st = netdev_stats(netdev);
+        st->c[NETDEV_STAT_RX_PKTS] += nrx;
+        st->c[NETDEV_STAT_RX_BYTES] += bytes;
+        st->c[NETDEV_STAT_RX_DOORBELL] += last >= 0 ? 1 : 0;
+        st->c[NETDEV_STAT_NOBUF] += nobuf;
     }
 
-    return -1;
+    return nrx;
 }
 
+/*
+ * Transmit up to n packets without copy; the buffers are owned by the TX
+ * ring and released when their descriptors are reused.  The TCP/UDP
+ * checksum is offloaded with CSS/CSO of the legacy descriptors.
+ */
 int
-e1000_sendpkt(const u8 *pkt, u32 len, struct netdev *netdev)
+e1000_tx_burst(struct netdev *netdev, int q, struct mbuf **mbufs, int n)
 {
-    u32 tdh;
     struct e1000_device *dev;
-    int tx_avl;
     struct e1000_tx_desc *txdesc;
+    struct mbuf *m;
+    struct mbuf *next;
+    struct netdev_stats *st;
+    u64 bytes;
+    u8 css;
+    u8 cso;
+    u8 ic;
+    u16 special;
+    int nseg;
+    int ntx;
 
     dev = (struct e1000_device *)netdev->vendor;
-    tdh = mmio_read32(dev->mmio, E1000_REG_TDH);
-
-    tx_avl = dev->tx_bufsz - ((dev->tx_bufsz - tdh + dev->tx_tail)
-                              % dev->tx_bufsz);
-
-    if ( tx_avl > 0 ) {
-        /* Check the head of TX ring buffer */
-        txdesc = (struct e1000_tx_desc *)
-            (dev->tx_base + (dev->tx_tail % dev->tx_bufsz)
-             * sizeof(struct e1000_tx_desc));
-        kmemcpy((void *)txdesc->address, pkt, len);
-        txdesc->length = len;
-        txdesc->sta = 0;
-        txdesc->css = 0;
-        txdesc->cso = 0;
-        txdesc->special = 0;
-        txdesc->cmd = (1<<3) | (1<<1) | 1;
 
-        dev->tx_tail = (dev->tx_tail + 1) % dev->tx_bufsz;
-        mmio_write32(dev->mmio, E1000_REG_TDT, dev->tx_tail);
+    bytes = 0;
+    for ( ntx = 0; ntx < n; ntx++ ) {
+        nseg = 0;
+        for ( m = mbufs[ntx]; NULL != m; m = m->next ) {
+            nseg++;
+        }
+        if ( _e1000_tx_avail(dev, nseg) < 0 ) {
+            break;
+        }
+
+        /* Checksum offload; CSS is the start of the L4 header */
+        m = mbufs[ntx];
+        bytes += m->pktlen;
+        css = 0;
+        cso = 0;
+        ic = 0;
+        if ( m->ol_flags & MBUF_OL_TX_TCP_CKSUM ) {
+            css = m->l2len + m->l3len;
+            cso = css + 16;
+            ic = (1<<2);
+        } else if ( m->ol_flags & MBUF_OL_TX_UDP_CKSUM ) {
+            css = m->l2len + m->l3len;
+            cso = css + 6;
+            ic = (1<<2);
+        }
+        if ( m->ol_flags & MBUF_OL_TX_VLAN ) {
+            /* VLE: insert the tag in the special field */
+            ic |= (1<<6);
+            special = m->vlan;
+        } else {
+            special = 0;
+        }
+
+        for ( ; NULL != m; m = next ) {
+            next = m->next;
+            txdesc = (struct e1000_tx_desc *)
+                (dev->tx_base + dev->tx_tail * sizeof(struct e1000_tx_desc));
+            /* Release the buffer previously attached */
+            mbuf_free(mbuf_from_addr(mbufpool, txdesc->address));
+
+            m->next = NULL;
+            txdesc->address = MBUF_ADDR(m);
+            txdesc->length = m->len;
+            txdesc->sta = 0;
+            txdesc->css = css;
+            txdesc->cso = cso;
+            txdesc->special = special;
+            if ( NULL == next ) {
+                txdesc->cmd = E1000_TXD_CMD_RS | ic | E1000_TXD_CMD_IFCS
+                    | E1000_TXD_CMD_EOP;
+            } else {
+                txdesc->cmd = E1000_TXD_CMD_RS | ic | E1000_TXD_CMD_IFCS;
+            }
+            dev->tx_tail = (dev->tx_tail + 1) % dev->tx_bufsz;
+        }
+    }
 
-        return len;
+    if ( ntx > 0 ) {
+        mmio_write32(dev->mmio, E1000_REG_TDT, dev->tx_tail);
+    }
+    if ( n > 0 ) {
+        st = netdev_stats(netdev);
+        st->c[NETDEV_STAT_TX_PKTS] += ntx;
+        st->c[NETDEV_STAT_TX_BYTES] += bytes;
+        st->c[NETDEV_STAT_TX_DOORBELL] += ntx > 0 ? 1 : 0;
+        st->c[NETDEV_STAT_TXFULL] += ntx < n ? 1 : 0;
     }
 
-    return -1;
+    return ntx;
 }
 
 
@@ -57,12 +57,20 @@
 #define E1000E_RCTL_BAM         (1<<15)
 #define E1000E_RCTL_SECRC       (1<<26)
 #define E1000E_RCTL_BSIZE_2048  (0<<16)
+#define E1000E_RCTL_BSIZE_4096  ((3<<16) | (1<<25))
 #define E1000E_RCTL_BSIZE_8192  ((2<<16) | (1<<25))
 
 
 #define E1000E_TCTL_EN          (1<<1)
 #define E1000E_TCTL_PSP         (1<<3)
 
+#define E1000E_TXD_CMD_EOP      (1<<0)
+#define E1000E_TXD_CMD_IFCS     (1<<1)
+#define E1000E_TXD_CMD_RS       (1<<3)
+
+/* Packets taken by an RX burst for e1000e_recvpkt() */
+#define E1000E_RX_STASH         32
+
 struct e1000e_tx_desc {
     u64 address;
     u16 length;
@@ -100,6 +108,14 @@ struct e1000e_device {
     u32 rx_head_cache;
     u32 tx_head_cache;
 
+    /* Packet being received over multiple descriptors */
+    struct mbuf *rx_pkt;
+    struct mbuf *rx_last;
+    /* Received packets not taken by e1000e_recvpkt() yet */
+    struct mbuf *rx_stash[E1000E_RX_STASH];
+    int rx_stash_n;
+    int rx_stash_i;
+
     u8 macaddr[6];
 
     struct pci_device *pci_device;
@@ -112,6 +128,10 @@ int e1000e_setup_rx_desc(struct e1000e_device *);
 int e1000e_setup_tx_desc(struct e1000e_device *);
 int e1000e_recvpkt(u8 *, u32, struct netdev *);
 int e1000e_sendpkt(const u8 *, u32, struct netdev *);
+int e1000e_rx_burst(struct netdev *, int, struct mbuf **, int);
+int e1000e_tx_burst(struct netdev *, int, struct mbuf **, int);
+int e1000e_tx_buf(struct netdev *, u8 **, u16 **);
+int e1000e_tx_commit(struct netdev *);
 
 static __inline__ volatile u32
 mmio_read32(u64 base, u64 offset)
@@ -158,6 +178,10 @@ e1000e_update_hw(void)
                 netdev = netdev_add_device(dev->macaddr, dev);
                 netdev->recvpkt = e1000e_recvpkt;
                 netdev->sendpkt = e1000e_sendpkt;
+                netdev->rx_burst = e1000e_rx_burst;
+                netdev->tx_burst = e1000e_tx_burst;
+                netdev->offload = NETDEV_OFFLOAD_TCP_CKSUM
+                    | NETDEV_OFFLOAD_UDP_CKSUM;
                 idx++;
                 break;
             default:
@@ -282,10 +306,16 @@ int
 e1000e_setup_rx_desc(struct e1000e_device *dev)
 {
     struct e1000e_rx_desc *rxdesc;
+    struct mbuf *mbuf;
     int i;
 
     dev->rx_tail = 0;
     dev->rx_bufsz = 128;
+    dev->rx_head_cache = 0;
+    dev->rx_pkt = NULL;
+    dev->rx_last = NULL;
+    dev->rx_stash_n = 0;
+    dev->rx_stash_i = 0;
 
     /* Allocate memory for RX descriptors */
     dev->rx_desc = kmalloc(dev->rx_bufsz * sizeof(struct e1000e_rx_desc));
@@ -295,7 +325,11 @@ e1000e_setup_rx_desc(struct e1000e_device *dev)
 
     for ( i = 0; i < dev->rx_bufsz; i++ ) {
         rxdesc = &(dev->rx_desc[i]);
-        rxdesc->address = (u64)kmalloc(2048);
+        mbuf = mbuf_alloc(mbufpool);
+        if ( NULL == mbuf ) {
+            return -1;
+        }
+        rxdesc->address = MBUF_ADDR(mbuf);
         rxdesc->checksum = 0;
         rxdesc->status = 0;
         rxdesc->errors = 0;
@@ -350,7 +384,7 @@ e1000e_setup_rx_desc(struct e1000e_device *dev)
                  mmio_read32(dev->mmio, E1000E_REG_RCTL)
                  | E1000E_RCTL_SBP | E1000E_RCTL_UPE
                  | E1000E_RCTL_MPE | E1000E_RCTL_LPE | E1000E_RCTL_BAM
-                 | E1000E_RCTL_BSIZE_2048 | E1000E_RCTL_SECRC | E1000E_RCTL_EN);
+                 | E1000E_RCTL_BSIZE_4096 | E1000E_RCTL_SECRC | E1000E_RCTL_EN);
 
 
 #if 0
@@ -378,10 +412,12 @@ int
 e1000e_setup_tx_desc(struct e1000e_device *dev)
 {
     struct e1000e_tx_desc *txdesc;
+    struct mbuf *mbuf;
     int i;
 
     dev->tx_tail = 0;
     dev->tx_bufsz = 128;
+    dev->tx_head_cache = 0;
 
     /* Allocate memory for TX descriptors */
     dev->tx_desc = kmalloc(dev->tx_bufsz * sizeof(struct e1000e_tx_desc));
@@ -391,7 +427,11 @@ e1000e_setup_tx_desc(struct e1000e_device *dev)
 
     for ( i = 0; i < dev->tx_bufsz; i++ ) {
         txdesc = &(dev->tx_desc[i]);
-        txdesc->address = (u64)kmalloc(2048);
+        mbuf = mbuf_alloc(mbufpool);
+        if ( NULL == mbuf ) {
+            return -1;
+        }
+        txdesc->address = MBUF_ADDR(mbuf);
         txdesc->cmd = 0;
         txdesc->sta = 0;
         txdesc->cso = 0;
@@ -411,76 +451,329 @@ e1000e_setup_tx_desc(struct e1000e_device *dev)
     return 0;
 }
 
+/*
+ * Receive a packet to the buffer; the packets are taken from the ring by a
+ * burst, so RDT is written once per burst
+ */
 int
 e1000e_recvpkt(u8 *pkt, u32 len, struct netdev *netdev)
 {
-    u32 rdh;
     struct e1000e_device *dev;
-    int rx_que;
+    struct mbuf *m;
+    struct mbuf *seg;
+    u32 seglen;
+    u32 ret;
+
+    dev = (struct e1000e_device *)netdev->vendor;
+
+    if ( dev->rx_stash_i >= dev->rx_stash_n ) {
+        dev->rx_stash_i = 0;
+        dev->rx_stash_n = e1000e_rx_burst(netdev, 0, dev->rx_stash,
+                                          E1000E_RX_STASH);
+        if ( dev->rx_stash_n <= 0 ) {
+            dev->rx_stash_n = 0;
+            return -1;
+        }
+    }
+    m = dev->rx_stash[dev->rx_stash_i];
+    dev->rx_stash_i++;
+
+    /* Linearize the segments */
+    ret = 0;
+    for ( seg = m; NULL != seg && ret < len; seg = seg->next ) {
+        seglen = seg->len < len - ret ? seg->len : len - ret;
+        kmemcpy(pkt + ret, MBUF_DATA(seg), seglen);
+        ret += seglen;
+    }
+    mbuf_free(m);
+
+    return ret;
+}
+
+/*
+ * Transmit a packet copied to the buffer of the TX ring
+ */
+int
+e1000e_sendpkt(const u8 *pkt, u32 len, struct netdev *netdev)
+{
+    u8 *buf;
+    u16 *buflen;
+
+    /* The tail room of a TX buffer reset by _e1000e_tx_mbuf() */
+    if ( len > mbufpool->bufsz - MBUF_HEADROOM ) {
+        return -1;
+    }
+    if ( e1000e_tx_buf(netdev, &buf, &buflen) < 0 ) {
+        return -1;
+    }
+    kmemcpy(buf, pkt, len);
+    *buflen = len;
+    e1000e_tx_commit(netdev);
+
+    return len;
+}
+
+/*
+ * Check if n TX descriptors are available
+ */
+static __inline__ int
+_e1000e_tx_avail(struct e1000e_device *dev, int n)
+{
+    int tx_avl;
+
+    /* Keep one descriptor unused to distinguish full from empty */
+    tx_avl = (dev->tx_head_cache + dev->tx_bufsz - dev->tx_tail - 1)
+        % dev->tx_bufsz;
+    if ( tx_avl < n ) {
+        /* Update the head cache */
+        dev->tx_head_cache = mmio_read32(dev->mmio, E1000E_REG_TDH(0));
+        tx_avl = (dev->tx_head_cache + dev->tx_bufsz - dev->tx_tail - 1)
+            % dev->tx_bufsz;
+        if ( tx_avl < n ) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Reset the buffer owned by the TX descriptor to the head of its data room;
+ * the buffer attached by e1000e_tx_burst() may be left at any offset
+ */
+static struct mbuf *
+_e1000e_tx_mbuf(struct e1000e_tx_desc *txdesc)
+{
+    struct mbuf *m;
+
+    m = mbuf_from_addr(mbufpool, txdesc->address);
+    if ( NULL == m ) {
+        m = mbuf_alloc(mbufpool);
+        if ( NULL == m ) {
+            return NULL;
+        }
+    }
+    m->off = MBUF_HEADROOM;
+    m->len = 0;
+    txdesc->address = MBUF_ADDR(m);
+
+    return m;
+}
+
+/*
+ * Take the buffer attached to the next TX descriptor to build a packet in
+ * place; the packet and its length (*len) must be written before the next TX
+ * call, and are sent by e1000e_tx_commit()
+ */
+int
+e1000e_tx_buf(struct netdev *netdev, u8 **pkt, u16 **len)
+{
+    struct e1000e_device *dev;
+    struct e1000e_tx_desc *txdesc;
+
+    dev = (struct e1000e_device *)netdev->vendor;
+    if ( _e1000e_tx_avail(dev, 1) < 0 ) {
+        return -1;
+    }
+
+    /* Reuse the buffer previously attached */
+    txdesc = &(dev->tx_desc[dev->tx_tail]);
+    if ( NULL == _e1000e_tx_mbuf(txdesc) ) {
+        return -1;
+    }
+    txdesc->length = 0;
+    txdesc->sta = 0;
+    txdesc->css = 0;
+    txdesc->cso = 0;
+    txdesc->special = 0;
+    txdesc->cmd = E1000E_TXD_CMD_RS | E1000E_TXD_CMD_IFCS
+        | E1000E_TXD_CMD_EOP;
+    dev->tx_tail = (dev->tx_tail + 1) % dev->tx_bufsz;
+
+    *pkt = (u8 *)txdesc->address;
+    /* The length field at the offset 8 of the descriptor */
+    *len = (u16 *)((u64)txdesc + 8);
+
+    return 0;
+}
+
+/*
+ * Ring the doorbell for the descriptors queued by e1000e_tx_buf()
+ */
+int
+e1000e_tx_commit(struct netdev *netdev)
+{
+    struct e1000e_device *dev;
+
+    dev = (struct e1000e_device *)netdev->vendor;
+    mmio_write32(dev->mmio, E1000E_REG_TDT(0), dev->tx_tail);
+
+    return 0;
+}
+
+/*
+ * Receive up to n packets without copy; the buffers attached to the RX
+ * descriptors are handed to the caller and replaced with new ones
+ */
+int
+e1000e_rx_burst(struct netdev *netdev, int q, struct mbuf **mbufs, int n)
+{
+    struct e1000e_device *dev;
     struct e1000e_rx_desc *rxdesc;
-    int ret;
+    struct mbuf *m;
+    struct mbuf *nm;
+    struct netdev_stats *st;
+    u64 bytes;
+    int nrx;
+    int last;
+    int nobuf;
 
     dev = (struct e1000e_device *)netdev->vendor;
 
-    rdh = mmio_read32(dev->mmio, E1000E_REG_RDH(0));
-    rx_que = (dev->rx_bufsz - dev->rx_tail + rdh) % dev->rx_bufsz;
-    if ( rx_que > 0 ) {
-        /* Check the head of RX ring buffer */
-        rxdesc = (struct e1000e_rx_desc *)
-            (((u64)dev->rx_desc) + (dev->rx_tail % dev->rx_bufsz)
-             * sizeof(struct e1000e_rx_desc));
-        ret = len < rxdesc->length ? len : rxdesc->length;
-        kmemcpy(pkt, (void *)rxdesc->address, ret);
+    nrx = 0;
+    last = -1;
+    bytes = 0;
+    nobuf = 0;
+    while ( nrx < n ) {
+        rxdesc = &(dev->rx_desc[dev->rx_tail]);
+        if ( !(rxdesc->status & 1) ) {
+            /* Not written back yet */
+            break;
+        }
+
+        /* Allocate a new buffer first not to lose the descriptor */
+        nm = mbuf_alloc(mbufpool);
+        if ( NULL == nm ) {
+            nobuf = 1;
+            break;
+        }
+        m = mbuf_from_addr(mbufpool, rxdesc->address);
+        m->len = rxdesc->length;
+        m->pktlen = rxdesc->length;
+
+        /* Chain the segments until EOP */
+        if ( NULL == dev->rx_pkt ) {
+            dev->rx_pkt = m;
+        } else {
+            dev->rx_last->next = m;
+            dev->rx_pkt->pktlen += m->len;
+        }
+        dev->rx_last = m;
+        if ( rxdesc->status & (1<<1) ) {
+            mbufs[nrx] = dev->rx_pkt;
+            bytes += dev->rx_pkt->pktlen;
+            nrx++;
+            dev->rx_pkt = NULL;
+            dev->rx_last = NULL;
+        }
 
+        /* Refill */
+        rxdesc->address = MBUF_ADDR(nm);
         rxdesc->checksum = 0;
         rxdesc->status = 0;
         rxdesc->errors = 0;
         rxdesc->special = 0;
-
-        mmio_write32(dev->mmio, E1000E_REG_RDT(0), dev->rx_tail);
+        last = dev->rx_tail;
         dev->rx_tail = (dev->rx_tail + 1) % dev->rx_bufsz;
+    }
 
-        return ret;
+    if ( last >= 0 ) {
+        mmio_write32(dev->mmio, E1000E_REG_RDT(0), last);
+    }
+    if ( last >= 0 || nobuf ) {
+        st = netdev_stats(netdev);
+        st->c[NETDEV_STAT_RX_PKTS] += nrx;
+        st->c[NETDEV_STAT_RX_BYTES] += bytes;
+        st->c[NETDEV_STAT_RX_DOORBELL] += last >= 0 ? 1 : 0;
+        st->c[NETDEV_STAT_NOBUF] += nobuf;
     }
 
-    return -1;
+    return nrx;
 }
 
+/*
+ * Transmit up to n packets without copy; the buffers are owned by the TX
+ * ring and released when their descriptors are reused.  The TCP/UDP
+ * checksum is offloaded with CSS/CSO of the legacy descriptors.
+ */
 int
-e1000e_sendpkt(const u8 *pkt, u32 len, struct netdev *netdev)
+e1000e_tx_burst(struct netdev *netdev, int q, struct mbuf **mbufs, int n)
 {
-    u32 tdh;
     struct e1000e_device *dev;
-    int tx_avl;
     struct e1000e_tx_desc *txdesc;
+    struct mbuf *m;
+    struct mbuf *next;
+    struct netdev_stats *st;
+    u64 bytes;
+    u8 css;
+    u8 cso;
+    u8 ic;
+    int nseg;
+    int ntx;
 
     dev = (struct e1000e_device *)netdev->vendor;
-    tdh = mmio_read32(dev->mmio, E1000E_REG_TDH(0));
-
-    tx_avl = dev->tx_bufsz - ((dev->tx_bufsz - tdh + dev->tx_tail)
-                              % dev->tx_bufsz);
-
-    if ( tx_avl > 0 ) {
-        /* Check the head of TX ring buffer */
-        txdesc = (struct e1000e_tx_desc *)
-            (((u64)dev->tx_desc) + (dev->tx_tail % dev->tx_bufsz)
-             * sizeof(struct e1000e_tx_desc));
-        kmemcpy((void *)txdesc->address, pkt, len);
-
-        dev->tx_desc[dev->tx_tail].length = len;
-        dev->tx_desc[dev->tx_tail].sta = 0;
-        dev->tx_desc[dev->tx_tail].css = 0;
-        dev->tx_desc[dev->tx_tail].cso = 0;
-        dev->tx_desc[dev->tx_tail].special = 0;
-        dev->tx_desc[dev->tx_tail].cmd = (1<<3) | (1<<1) | 1;
-
-        dev->tx_tail = (dev->tx_tail + 1) % dev->tx_bufsz;
-        mmio_write32(dev->mmio, E1000E_REG_TDT(0), dev->tx_tail);
 
-        return len;
+    bytes = 0;
+    for ( ntx = 0; ntx < n; ntx++ ) {
+        nseg = 0;
+        for ( m = mbufs[ntx]; NULL != m; m = m->next ) {
+            nseg++;
+        }
+        if ( _e1000e_tx_avail(dev, nseg) < 0 ) {
+            break;
+        }
+
+        /* Checksum offload; CSS is the start of the L4 header */
+        m = mbufs[ntx];
+        bytes += m->pktlen;
+        css = 0;
+        cso = 0;
+        ic = 0;
+        if ( m->ol_flags & MBUF_OL_TX_TCP_CKSUM ) {
+            css = m->l2len + m->l3len;
+            cso = css + 16;
+            ic = (1<<2);
+        } else if ( m->ol_flags & MBUF_OL_TX_UDP_CKSUM ) {
+            css = m->l2len + m->l3len;
+            cso = css + 6;
+            ic = (1<<2);
+        }
+
+        for ( ; NULL != m; m = next ) {
+            next = m->next;
+            txdesc = &(dev->tx_desc[dev->tx_tail]);
+            /* Release the buffer previously attached */
+            mbuf_free(mbuf_from_addr(mbufpool, txdesc->address));
+
+            m->next = NULL;
+            txdesc->address = MBUF_ADDR(m);
+            txdesc->length = m->len;
+            txdesc->sta = 0;
+            txdesc->css = css;
+            txdesc->cso = cso;
+            txdesc->special = 0;
+            if ( NULL == next ) {
+                txdesc->cmd = E1000E_TXD_CMD_RS | ic | E1000E_TXD_CMD_IFCS
+                    | E1000E_TXD_CMD_EOP;
+            } else {
+                txdesc->cmd = E1000E_TXD_CMD_RS | ic | E1000E_TXD_CMD_IFCS;
+            }
+            dev->tx_tail = (dev->tx_tail + 1) % dev->tx_bufsz;
+        }
+    }
+
+    if ( ntx > 0 ) {
+        mmio_write32(dev->mmio, E1000E_REG_TDT(0), dev->tx_tail);
+    }
+    if ( n > 0 ) {
+        st = netdev_stats(netdev);
+        st->c[NETDEV_STAT_TX_PKTS] += ntx;
+        st->c[NETDEV_STAT_TX_BYTES] += bytes;
+        st->c[NETDEV_STAT_TX_DOORBELL] += ntx > 0 ? 1 : 0;
+        st->c[NETDEV_STAT_TXFULL] += ntx < n ? 1 : 0;
     }
 
-    return -1;
+    return ntx;
 }
 
 
@@ -53,7 +53,20 @@
 
 #define I40E_GLLAN_RCTL_0       0x0012a500
 
+/* Port statistics; 48-bit (64-bit read) or 32-bit counters running since
+   the reset, indexed by the port number in PFGEN_PORTNUM */
+#define I40E_PFGEN_PORTNUM      0x001c0480
+#define I40E_GLPRT_CRCERRS(n)   (0x00300080 + 0x8 * (n))
+#define I40E_GLPRT_GORC(n)      (0x00300000 + 0x8 * (n))
+#define I40E_GLPRT_UPRC(n)      (0x003005a0 + 0x8 * (n))
+#define I40E_GLPRT_MPRC(n)      (0x003005c0 + 0x8 * (n))
+#define I40E_GLPRT_BPRC(n)      (0x003005e0 + 0x8 * (n))
+#define I40E_GLPRT_RDPC(n)      (0x00300600 + 0x8 * (n))
 #define I40E_GLPRT_GOTC(n)      (0x00300680 + 0x8 * (n))
+#define I40E_GLPRT_UPTC(n)      (0x003009c0 + 0x8 * (n))
+#define I40E_GLPRT_MPTC(n)      (0x003009e0 + 0x8 * (n))
+#define I40E_GLPRT_BPTC(n)      (0x00300a00 + 0x8 * (n))
+#define I40E_STAT48_MASK        0xffffffffffffULL
 
 #define I40E_PRTGL_SAL          0x001e2120
 #define I40E_PRTGL_SAH          0x001e2140
@@ -77,6 +90,63 @@
 #define I40E_PF_ARQT            0x00080480
 
 #define I40E_TXQ_NUM            16
+/* TX queue reserved for the flow director programming */
+#define I40E_TXQ_FD             (I40E_TXQ_NUM - 1)
+#define I40E_RXQ_NUM            16
+
+/* RSS */
+#define I40E_PFQF_CTL_0         0x001c0ac0
+#define I40E_PFQF_CTL_0_HASHLUTSIZE_512 (1<<16)
+#define I40E_PFQF_CTL_0_FD_ENA          (1<<17)
+#define I40E_PFQF_CTL_0_ETYPE_ENA       (1<<18)
+#define I40E_PFQF_HKEY(n)       (0x00244800 + 0x80 * (n)) /* n=0..12 */
+#define I40E_PFQF_HKEY_NUM      13
+#define I40E_PFQF_HLUT(n)       (0x00250000 + 0x80 * (n)) /* n=0..127 */
+#define I40E_PFQF_HLUT_NUM      128
+#define I40E_PFQF_HENA(n)       (0x00245900 + 0x80 * (n)) /* n=0..1 */
+/* Packet classifier types to be hashed */
+#define I40E_PCTYPE_NONF_IPV4_UDP       31
+#define I40E_PCTYPE_NONF_IPV4_TCP       33
+#define I40E_PCTYPE_NONF_IPV4_OTHER     35
+#define I40E_PCTYPE_FRAG_IPV4           36
+
+/* Admin queue */
+#define I40E_AQ_FLAG_DD         (1<<0)
+#define I40E_AQ_FLAG_CMP        (1<<1)
+#define I40E_AQ_FLAG_ERR        (1<<2)
+#define I40E_AQ_FLAG_LB         (1<<9)
+#define I40E_AQ_FLAG_RD         (1<<10)
+#define I40E_AQ_FLAG_BUF        (1<<12)
+#define I40E_AQ_FLAG_SI         (1<<13)
+#define I40E_AQ_BUFSZ           4096
+#define I40E_AQ_TIMEOUT         1000000000ULL   /* 1 sec in nanoseconds */
+#define I40E_AQ_OPC_GET_VERSION         0x0001
+#define I40E_AQ_OPC_CLEAR_PXE_MODE      0x0110
+#define I40E_AQ_OPC_GET_SWITCH_CONFIG   0x0200
+#define I40E_AQ_OPC_UPDATE_VSI          0x0211
+#define I40E_AQ_OPC_ADD_CTRL_PKT_FILTER 0x025a
+#define I40E_AQ_OPC_DEL_CTRL_PKT_FILTER 0x025b
+#define I40E_AQ_OPC_SET_MAC_CONFIG      0x0603
+#define I40E_AQ_OPC_GET_LINK_STATUS     0x0607
+#define I40E_AQ_LSE_ENABLE              0x3
+#define I40E_AQ_LINK_UP                 (1<<0)
+#define I40E_AQ_SW_ELEM_TYPE_VSI        19
+#define I40E_AQ_VSI_PROP_VLAN_VALID             0x04
+#define I40E_AQ_VSI_PROP_QUEUE_MAP_VALID        0x40
+#define I40E_AQ_VSI_PVLAN_MODE_ALL              0x03
+#define I40E_AQ_VSI_PVLAN_EMOD_STR_BOTH         0x00
+#define I40E_AQ_CTRL_PKT_IGNORE_MAC     0x0001
+#define I40E_AQ_CTRL_PKT_TO_QUEUE       0x0008
+
+/* Filters: EtherType filters take IDs from 0 and flow director filters follow */
+#define I40E_ETF_NUM            8
+#define I40E_FDF_NUM            128
+/* Flow director programming descriptor */
+#define I40E_FD_DTYPE           0x8
+#define I40E_FD_PCMD_ADD        1
+#define I40E_FD_PCMD_REMOVE     2
+#define I40E_FD_DEST_QINDEX     1
+#define I40E_FD_TIMEOUT         100000000ULL    /* 100 ms in nanoseconds */
 
 //PFHMC_SDCMD
 //PFHMC_SDDATALOW
@@ -113,8 +183,9 @@ struct i40e_rx_desc_read {
 
 struct i40e_rx_desc_wb {
     /* Write back */
+    u16 mirr;
+    u16 l2tag1;                 /* Stripped VLAN tag if L2TAG1P */
     u32 filter_stat;
-    u32 l2tag_mirr_fcoe_ctx;
     u64 len_ptype_err_status;
 } __attribute__ ((packed));
 union i40e_rx_desc {
@@ -122,6 +193,13 @@ union i40e_rx_desc {
     struct i40e_rx_desc_wb wb;
 } __attribute__ ((packed));
 
+struct i40e_fd_prog_desc {
+    u32 qindex_pctype_vsi;      /* qindex:11 flexoff:3 rsv:3 pctype:6 vsi:9 */
+    u32 rsv;
+    u32 dtype_cmd_cntindex;     /* dtype:4 pcmd:2 rsv:1 dest:2 ... */
+    u32 fd_id;
+} __attribute__ ((packed));
+
 struct i40e_aq_desc {
     volatile u16 flags;
     u16 opcode;
@@ -137,28 +215,65 @@ struct i40e_aq_desc {
 
 
 
+struct i40e_device;
+
+/*
+ * Admin command in flight; the callback is called with the status (the
+ * return value of the command, or -1 on timeout) on completion
+ */
+struct i40e_aq_cmd {
+    void (*cb)(struct i40e_device *dev, struct i40e_aq_desc *desc, u8 *buf,
+               int status, void *arg);
+    void *arg;
+    /* Buffer of the caller to receive the response */
+    u8 *buf;
+    u16 len;
+    u64 deadline;
+};
+
 struct i40e_device {
     u64 mmio;
 
-    /* Admin queue */
+    /* Admin queue: commands in [head, tail) are in flight */
     struct {
         struct i40e_aq_desc *base;
+        u32 head;
         u32 tail;
         int len;
         u8 *bufset;
+        struct i40e_aq_cmd *cmds;
     } atq;
+    /* Admin receive queue for the events; tail is the next to be processed */
     struct {
         struct i40e_aq_desc *base;
         u32 tail;
         int len;
         u8 *bufset;
     } arq;
+    /* Lock of the admin queues; the callbacks are called without it */
+    volatile int aq_lock;
+
+    /* Link status updated through the admin queue */
+    int link_up;
+    int link_speed;
 
 
-    u64 rx_base;
-    u32 rx_tail;
-    u32 rx_bufsz;
-    u32 rx_bufmask;
+    /* RX queues */
+    struct {
+        u64 base;
+        u32 tail;
+        u32 bufsz;
+        u32 bufmask;
+
+        struct i40e_rx_desc_read *read;
+        /* Packet being received over multiple descriptors */
+        struct mbuf *pkt;
+        struct mbuf *last;
+
+        /* LAN RX queue context in the HMC */
+        struct i40e_lan_rxq_ctx *ctx;
+    } rxq[I40E_RXQ_NUM];
+    int nrxq;
 
     struct {
         u64 base;
@@ -170,6 +285,9 @@ struct i40e_device {
         u32 headwb;
 
         u64 cnt;
+
+        /* Buffers attached to the descriptors */
+        struct mbuf **mbufs;
     } txq[I40E_TXQ_NUM];
 
     u64 tx_base;
@@ -178,7 +296,24 @@ struct i40e_device {
     u32 tx_bufmask;
     u32 tx_head_cache;
 
-    struct i40e_rx_desc_read *rx_read;
+    /* Header split; hdr_addr of rxq[].read[] holds header buffers if set */
+    int rx_hsplit;
+
+    /* SEID and number of the main VSI */
+    u16 vsi_seid;
+    u16 vsi_num;
+
+    /* RX queue for the control traffic (-1 if none) */
+    int ctrlq;
+
+    /* EtherType filters and flow director filters in use */
+    struct {
+        u16 etype;
+        u16 q;
+        int used;
+    } etf[I40E_ETF_NUM];
+    struct netdev_filter fdf[I40E_FDF_NUM];
+    u8 fdf_used[I40E_FDF_NUM];
 
     u8 macaddr[6];
 
@@ -273,12 +408,86 @@ struct i40e_lan_txq_ctx {
 
 
 
+/*
+ * Admin command builders
+ */
+static __inline__ void
+_i40e_aq_cmd(struct i40e_aq_desc *desc, u16 opcode)
+{
+    kmemset(desc, 0, sizeof(struct i40e_aq_desc));
+    desc->opcode = opcode;
+}
+static __inline__ void
+i40e_aq_cmd_get_version(struct i40e_aq_desc *desc)
+{
+    _i40e_aq_cmd(desc, I40E_AQ_OPC_GET_VERSION);
+}
+static __inline__ void
+i40e_aq_cmd_clear_pxe_mode(struct i40e_aq_desc *desc)
+{
+    _i40e_aq_cmd(desc, I40E_AQ_OPC_CLEAR_PXE_MODE);
+    desc->param0 = 2;           /* rx_cnt */
+}
+static __inline__ void
+i40e_aq_cmd_set_mac_config(struct i40e_aq_desc *desc, u16 maxfrm)
+{
+    _i40e_aq_cmd(desc, I40E_AQ_OPC_SET_MAC_CONFIG);
+    /* Max frame size, CRC enable */
+    desc->param0 = maxfrm | (1<<18) | (0<<24);
+}
+static __inline__ void
+i40e_aq_cmd_get_switch_config(struct i40e_aq_desc *desc, u16 seid)
+{
+    _i40e_aq_cmd(desc, I40E_AQ_OPC_GET_SWITCH_CONFIG);
+    desc->param0 = seid;        /* Starting SEID */
+}
+static __inline__ void
+i40e_aq_cmd_update_vsi(struct i40e_aq_desc *desc, u16 seid)
+{
+    _i40e_aq_cmd(desc, I40E_AQ_OPC_UPDATE_VSI);
+    desc->flags = I40E_AQ_FLAG_RD;
+    desc->param0 = seid;
+}
+static __inline__ void
+i40e_aq_cmd_ctrl_pkt_filter(struct i40e_aq_desc *desc, int add, u16 etype,
+                            u16 seid, u16 q)
+{
+    u8 *params;
+
+    _i40e_aq_cmd(desc, add ? I40E_AQ_OPC_ADD_CTRL_PKT_FILTER
+                 : I40E_AQ_OPC_DEL_CTRL_PKT_FILTER);
+    /* MAC address (ignored), flags, EtherType, SEID, queue */
+    params = (u8 *)&desc->param0;
+    *(u16 *)(params + 6) = I40E_AQ_CTRL_PKT_IGNORE_MAC
+        | I40E_AQ_CTRL_PKT_TO_QUEUE;
+    *(u16 *)(params + 8) = etype;
+    *(u16 *)(params + 10) = seid;
+    *(u16 *)(params + 12) = q;
+}
+static __inline__ void
+i40e_aq_cmd_get_link_status(struct i40e_aq_desc *desc, int lse)
+{
+    _i40e_aq_cmd(desc, I40E_AQ_OPC_GET_LINK_STATUS);
+    desc->param0 = lse ? I40E_AQ_LSE_ENABLE : 0;
+}
+
 /* Prototype declarations */
 void i40e_update_hw(void);
 struct i40e_device * i40e_init_hw(struct pci_device *);
 int i40e_setup_rx_desc(struct i40e_device *);
 int i40e_setup_tx_desc(struct i40e_device *);
 int i40e_init_fpm(struct i40e_device *);
+int i40e_rx_burst(struct netdev *, int, struct mbuf **, int);
+int i40e_tx_burst(struct netdev *, int, struct mbuf **, int);
+int i40e_rx_hsplit(struct netdev *, int);
+int i40e_poll_ctrl(struct netdev *);
+int i40e_link_update(struct i40e_device *);
+int i40e_filter_add(struct netdev *, const struct netdev_filter *);
+int i40e_filter_del(struct netdev *, int);
+int i40e_hwstats(struct netdev *, struct netdev_hwstats *);
+static int _i40e_aq_init(struct i40e_device *);
+static void _i40e_arq_post(struct i40e_device *, int);
+int this_cpu(void);
 
 /*
  * Read data from a PCI register by MMIO
@@ -321,6 +530,7 @@ i40e_update_hw(void)
 {
     struct pci *pci;
     struct i40e_device *dev;
+    struct netdev *netdev;
     int idx;
 
     /* Get the list of PCI devices */
@@ -334,7 +544,21 @@ i40e_update_hw(void)
             case I40E_XL710_QDA1:
             case I40E_XL710_QDA2:
                 dev = i40e_init_hw(pci->device);
-                netdev_add_device(dev->macaddr, dev);
+                netdev = netdev_add_device(dev->macaddr, dev);
+                netdev->rx_burst = i40e_rx_burst;
+                netdev->tx_burst = i40e_tx_burst;
+                netdev->rx_hsplit = i40e_rx_hsplit;
+                netdev->poll_ctrl = i40e_poll_ctrl;
+                netdev->filter_add = i40e_filter_add;
+                netdev->filter_del = i40e_filter_del;
+                netdev->hwstats = i40e_hwstats;
+                netdev->nrxq = dev->nrxq;
+                netdev->ctrlq = dev->ctrlq;
+                netdev->ntxq = I40E_TXQ_FD;
+                netdev->offload = NETDEV_OFFLOAD_IP_CKSUM
+                    | NETDEV_OFFLOAD_TCP_CKSUM | NETDEV_OFFLOAD_UDP_CKSUM
+                    | NETDEV_OFFLOAD_TSO | NETDEV_OFFLOAD_VLAN_STRIP
+                    | NETDEV_OFFLOAD_VLAN_INSERT;
                 idx++;
                 break;
             default:
@@ -385,22 +609,501 @@ i40e_init_hw(struct pci_device *pcidev)
     dev->macaddr[5] = (m32 >> 8) & 0xff;
 
     dev->pci_device = pcidev;
+    dev->link_up = 0;
+    dev->link_speed = 0;
 
     i40e_init_fpm(dev);
 
+    /* Completed by i40e_poll_ctrl() */
+    i40e_link_update(dev);
+
     return dev;
 }
 
 
+/*
+ * Initialize the admin send/receive queues
+ */
+static int
+_i40e_aq_init(struct i40e_device *dev)
+{
+    int i;
+
+    dev->aq_lock = 0;
+    dev->atq.len = 128;
+    dev->atq.head = 0;
+    dev->atq.tail = 0;
+    dev->atq.base = kmalloc(sizeof(struct i40e_aq_desc) * dev->atq.len);
+    dev->atq.bufset = kmalloc(I40E_AQ_BUFSZ * dev->atq.len);
+    dev->atq.cmds = kmalloc(sizeof(struct i40e_aq_cmd) * dev->atq.len);
+    dev->arq.len = 128;
+    dev->arq.tail = 0;
+    dev->arq.base = kmalloc(sizeof(struct i40e_aq_desc) * dev->arq.len);
+    dev->arq.bufset = kmalloc(I40E_AQ_BUFSZ * dev->arq.len);
+    if ( NULL == dev->atq.base || NULL == dev->atq.bufset
+         || NULL == dev->atq.cmds || NULL == dev->arq.base
+         || NULL == dev->arq.bufset ) {
+        return -1;
+    }
+    kmemset(dev->atq.base, 0, sizeof(struct i40e_aq_desc) * dev->atq.len);
+    kmemset(dev->atq.cmds, 0, sizeof(struct i40e_aq_cmd) * dev->atq.len);
+    for ( i = 0; i < dev->arq.len; i++ ) {
+        _i40e_arq_post(dev, i);
+    }
+
+    mmio_write32(dev->mmio, I40E_PF_ATQH, 0);
+    mmio_write32(dev->mmio, I40E_PF_ATQT, 0);
+    mmio_write32(dev->mmio, I40E_PF_ATQBAL, (u64)dev->atq.base);
+    mmio_write32(dev->mmio, I40E_PF_ATQBAH, (u64)dev->atq.base >> 32);
+    mmio_write32(dev->mmio, I40E_PF_ATQLEN, dev->atq.len | (1<<31));
+
+    mmio_write32(dev->mmio, I40E_PF_ARQH, 0);
+    mmio_write32(dev->mmio, I40E_PF_ARQT, 0);
+    mmio_write32(dev->mmio, I40E_PF_ARQBAL, (u64)dev->arq.base);
+    mmio_write32(dev->mmio, I40E_PF_ARQBAH, (u64)dev->arq.base >> 32);
+    mmio_write32(dev->mmio, I40E_PF_ARQLEN, dev->arq.len | (1<<31));
+    /* Post all the buffers */
+    mmio_write32(dev->mmio, I40E_PF_ARQT, dev->arq.len - 1);
+
+    return 0;
+}
+
+/*
+ * Submit an admin command without waiting for the completion; buf of len
+ * bytes is sent with the command if the RD flag is set in the descriptor,
+ * and receives the response otherwise.  Return the index of the command, or
+ * -1 if the queue is full.
+ */
+int
+i40e_aq_submit(struct i40e_device *dev, struct i40e_aq_desc *desc, u8 *buf,
+               u16 len, void (*cb)(struct i40e_device *, struct i40e_aq_desc *,
+                                   u8 *, int, void *), void *arg)
+{
+    struct i40e_aq_desc *d;
+    struct i40e_aq_cmd *cmd;
+    u8 *abuf;
+    int idx;
+
+    if ( len > I40E_AQ_BUFSZ ) {
+        return -1;
+    }
+
+    arch_spin_lock(&dev->aq_lock);
+    idx = dev->atq.tail;
+    if ( (idx + 1) % dev->atq.len == dev->atq.head ) {
+        /* Full */
+        arch_spin_unlock(&dev->aq_lock);
+        return -1;
+    }
+    d = &dev->atq.base[idx];
+    abuf = dev->atq.bufset + (idx * I40E_AQ_BUFSZ);
+
+    *d = *desc;
+    d->flags &= ~(I40E_AQ_FLAG_DD | I40E_AQ_FLAG_CMP | I40E_AQ_FLAG_ERR);
+    d->ret = 0;
+    if ( NULL != buf ) {
+        if ( d->flags & I40E_AQ_FLAG_RD ) {
+            kmemcpy(abuf, buf, len);
+        }
+        d->flags |= I40E_AQ_FLAG_BUF;
+        if ( len > I40E_AQ_LARGE_BUF ) {
+            d->flags |= I40E_AQ_FLAG_LB;
+        }
+        d->len = len;
+        d->addrh = (u64)abuf >> 32;
+        d->addrl = (u64)abuf;
+    }
+
+    cmd = &dev->atq.cmds[idx];
+    cmd->cb = cb;
+    cmd->arg = arg;
+    cmd->buf = buf;
+    cmd->len = len;
+    cmd->deadline = arch_clock_get() + I40E_AQ_TIMEOUT;
+
+    dev->atq.tail = (dev->atq.tail + 1) % dev->atq.len;
+    mmio_write32(dev->mmio, I40E_PF_ATQT, dev->atq.tail);
+    arch_spin_unlock(&dev->aq_lock);
+
+    return idx;
+}
+
+/*
+ * Process the completed admin commands; the commands are completed in order
+ * by the firmware.  A command timed out is reported to its callback, but its
+ * slot is held until the firmware writes it back.  Each command is claimed
+ * under the lock and its callback is called without it, so the callbacks may
+ * submit commands and concurrent pollers never call one twice.
+ */
+int
+i40e_aq_poll(struct i40e_device *dev)
+{
+    struct i40e_aq_desc *d;
+    struct i40e_aq_desc desc;
+    struct i40e_aq_cmd *cmd;
+    void (*cb)(struct i40e_device *, struct i40e_aq_desc *, u8 *, int,
+               void *);
+    void *arg;
+    u8 *buf;
+    int status;
+    int n;
+
+    n = 0;
+    for ( ;; ) {
+        arch_spin_lock(&dev->aq_lock);
+        if ( dev->atq.head == dev->atq.tail ) {
+            arch_spin_unlock(&dev->aq_lock);
+            break;
+        }
+        d = &dev->atq.base[dev->atq.head];
+        cmd = &dev->atq.cmds[dev->atq.head];
+        cb = cmd->cb;
+        arg = cmd->arg;
+        buf = cmd->buf;
+        desc = *d;
+        if ( !(d->flags & I40E_AQ_FLAG_DD) ) {
+            if ( NULL != cb && arch_clock_get() > cmd->deadline ) {
+                /* Timeout */
+                cmd->cb = NULL;
+                arch_spin_unlock(&dev->aq_lock);
+                cb(dev, &desc, NULL, -1, arg);
+            } else {
+                arch_spin_unlock(&dev->aq_lock);
+            }
+            break;
+        }
+        status = 0;
+        if ( NULL != cb ) {
+            if ( NULL != buf && !(d->flags & I40E_AQ_FLAG_RD) ) {
+                kmemcpy(buf, dev->atq.bufset
+                        + (dev->atq.head * I40E_AQ_BUFSZ), cmd->len);
+            }
+            status = (d->flags & I40E_AQ_FLAG_ERR) && 0 == d->ret
+                ? -1 : d->ret;
+            cmd->cb = NULL;
+        }
+        dev->atq.head = (dev->atq.head + 1) % dev->atq.len;
+        arch_spin_unlock(&dev->aq_lock);
+
+        if ( NULL != cb ) {
+            cb(dev, &desc, buf, status, arg);
+        }
+        n++;
+    }
+
+    return n;
+}
+
+/*
+ * Completion of a synchronous command
+ */
+struct i40e_aq_sync {
+    volatile int done;
+    int status;
+    struct i40e_aq_desc *desc;
+};
+static void
+_i40e_aq_sync_cb(struct i40e_device *dev, struct i40e_aq_desc *desc, u8 *buf,
+                 int status, void *arg)
+{
+    struct i40e_aq_sync *sync;
+
+    sync = (struct i40e_aq_sync *)arg;
+    *sync->desc = *desc;
+    sync->status = status;
+    sync->done = 1;
+}
+
+/*
+ * Execute an admin command and wait for its completion; the descriptor and
+ * the buffer are updated with the response.  Return the return value of the
+ * command, or -1 on error or timeout.  Only for the initialization and the
+ * control plane; use i40e_aq_submit() not to block the datapath.
+ */
+int
+i40e_aq_exec(struct i40e_device *dev, struct i40e_aq_desc *desc, u8 *buf,
+             u16 len)
+{
+    struct i40e_aq_sync sync;
+
+    sync.done = 0;
+    sync.status = -1;
+    sync.desc = desc;
+    if ( i40e_aq_submit(dev, desc, buf, len, _i40e_aq_sync_cb, &sync) < 0 ) {
+        return -1;
+    }
+    while ( !sync.done ) {
+        i40e_aq_poll(dev);
+        if ( !sync.done ) {
+            arch_busy_usleep(10);
+        }
+    }
+
+    return sync.status;
+}
+
+/*
+ * Update the link status from the response or the event of get link status
+ */
+static void
+_i40e_link_status(struct i40e_device *dev, struct i40e_aq_desc *desc)
+{
+    int up;
+    int speed;
+
+    /* link_speed at byte 3 of param0, link_info at byte 0 of param1 */
+    up = (desc->param1 & I40E_AQ_LINK_UP) ? 1 : 0;
+    switch ( (desc->param0 >> 24) & 0xff ) {
+    case 0x02:
+        speed = 100;
+        break;
+    case 0x04:
+        speed = 1000;
+        break;
+    case 0x08:
+        speed = 10000;
+        break;
+    case 0x10:
+        speed = 40000;
+        break;
+    case 0x20:
+        speed = 20000;
+        break;
+    default:
+        speed = 0;
+    }
+    if ( up != dev->link_up || speed != dev->link_speed ) {
+        dev->link_up = up;
+        dev->link_speed = speed;
+        if ( up ) {
+            kprintf("i40e: Link up (%d Mbps)\r\n", speed);
+        } else {
+            kprintf("i40e: Link down\r\n");
+        }
+    }
+}
+static void
+_i40e_link_status_cb(struct i40e_device *dev, struct i40e_aq_desc *desc,
+                     u8 *buf, int status, void *arg)
+{
+    if ( 0 == status ) {
+        _i40e_link_status(dev, desc);
+    }
+}
+
+/*
+ * (Re)post the receive buffer to the i-th descriptor of the ARQ
+ */
+static void
+_i40e_arq_post(struct i40e_device *dev, int i)
+{
+    u64 addr;
+
+    addr = (u64)(dev->arq.bufset + (i * I40E_AQ_BUFSZ));
+    dev->arq.base[i].flags = I40E_AQ_FLAG_LB | I40E_AQ_FLAG_BUF;
+    dev->arq.base[i].opcode = 0;
+    dev->arq.base[i].len = I40E_AQ_BUFSZ;
+    dev->arq.base[i].ret = 0;
+    dev->arq.base[i].cookieh = 0;
+    dev->arq.base[i].cookiel = 0;
+    dev->arq.base[i].param0 = 0;
+    dev->arq.base[i].param1 = 0;
+    dev->arq.base[i].addrh = addr >> 32;
+    dev->arq.base[i].addrl = addr;
+}
+
+/*
+ * Drain the events from the admin receive queue
+ */
+int
+i40e_arq_drain(struct i40e_device *dev)
+{
+    struct i40e_aq_desc *d;
+    u32 head;
+    int last;
+    int n;
+
+    arch_spin_lock(&dev->aq_lock);
+    head = mmio_read32(dev->mmio, I40E_PF_ARQH) & 0x3ff;
+    n = 0;
+    last = -1;
+    while ( dev->arq.tail != head ) {
+        d = &dev->arq.base[dev->arq.tail];
+        switch ( d->opcode ) {
+        case I40E_AQ_OPC_GET_LINK_STATUS:
+            /* Link status event */
+            _i40e_link_status(dev, d);
+            break;
+        default:
+            /* Ignore the others */
+            ;
+        }
+        _i40e_arq_post(dev, dev->arq.tail);
+        last = dev->arq.tail;
+        dev->arq.tail = (dev->arq.tail + 1) % dev->arq.len;
+        n++;
+    }
+    if ( last >= 0 ) {
+        mmio_write32(dev->mmio, I40E_PF_ARQT, last);
+    }
+    arch_spin_unlock(&dev->aq_lock);
+
+    return n;
+}
+
+/*
+ * Slow-path processing of the admin queue; called from a control core
+ */
+int
+i40e_poll_ctrl(struct netdev *netdev)
+{
+    struct i40e_device *dev;
+
+    dev = (struct i40e_device *)netdev->vendor;
+    i40e_aq_poll(dev);
+    i40e_arq_drain(dev);
+
+    return 0;
+}
+
+/*
+ * Request the link status asynchronously and enable the link status events
+ */
+int
+i40e_link_update(struct i40e_device *dev)
+{
+    struct i40e_aq_desc desc;
+
+    i40e_aq_cmd_get_link_status(&desc, 1);
+
+    return i40e_aq_submit(dev, &desc, NULL, 0, _i40e_link_status_cb, NULL);
+}
+
+/*
+ * Find the main VSI and map the RX queues to its traffic class 0; the VLAN
+ * tags of the received packets are stripped to the descriptors
+ */
+static int
+_i40e_setup_vsi_qmap(struct i40e_device *dev)
+{
+    struct i40e_aq_desc desc;
+    u8 *buf;
+    int n;
+    int i;
+    int lg;
+
+    buf = kmalloc(4096);
+    if ( NULL == buf ) {
+        return -1;
+    }
+
+    /* Get the switch configuration to find the SEID of the VSI */
+    i40e_aq_cmd_get_switch_config(&desc, 0);
+    kmemset(buf, 0, 4096);
+    if ( 0 != i40e_aq_exec(dev, &desc, buf, 4096) ) {
+        kfree(buf);
+        return -1;
+    }
+    /* 16-byte header followed by 16-byte elements */
+    n = *(u16 *)buf;
+    for ( i = 0; i < n && 16 + (i + 1) * 16 <= 4096; i++ ) {
+        if ( I40E_AQ_SW_ELEM_TYPE_VSI == buf[16 + i * 16] ) {
+            break;
+        }
+    }
+    if ( i >= n ) {
+        kfree(buf);
+        return -1;
+    }
+    dev->vsi_seid = *(u16 *)(buf + 16 + i * 16 + 2);
+    dev->vsi_num = *(u16 *)(buf + 16 + i * 16 + 14);
+
+    /* Update the queue map: contiguous queues from 0 to TC0 */
+    for ( lg = 0; (1 << lg) < dev->nrxq; lg++ );
+    kmemset(buf, 0, 128);
+    *(u16 *)(buf + 0) = I40E_AQ_VSI_PROP_QUEUE_MAP_VALID
+        | I40E_AQ_VSI_PROP_VLAN_VALID;
+    buf[12] = I40E_AQ_VSI_PVLAN_MODE_ALL | I40E_AQ_VSI_PVLAN_EMOD_STR_BOTH;
+    *(u16 *)(buf + 28) = 0;                     /* Contiguous */
+    *(u16 *)(buf + 30) = 0;                     /* First queue */
+    *(u16 *)(buf + 62) = (0 << 0) | (lg << 9);  /* TC0: offset/# of queues */
+    i40e_aq_cmd_update_vsi(&desc, dev->vsi_seid);
+    if ( 0 != i40e_aq_exec(dev, &desc, buf, 128) ) {
+        kfree(buf);
+        return -1;
+    }
+
+    kfree(buf);
+
+    return 0;
+}
+
+/*
+ * Set up RSS with the PF hash key and lookup table
+ */
+static int
+_i40e_setup_rss(struct i40e_device *dev)
+{
+    int nq;
+    int ret;
+    int i;
+    int j;
+    u32 m32;
+
+    ret = 0;
+    nq = dev->nrxq;
+    if ( _i40e_setup_vsi_qmap(dev) < 0 ) {
+        /* The other queues are not reachable */
+        nq = 1;
+        dev->ctrlq = -1;
+        ret = -1;
+    }
+    if ( dev->ctrlq >= 0 ) {
+        /* The last queue only receives the packets steered by the filters */
+        nq--;
+    }
+
+    /* Symmetric key so that both directions of a flow go to a queue */
+    for ( i = 0; i < I40E_PFQF_HKEY_NUM; i++ ) {
+        mmio_write32(dev->mmio, I40E_PFQF_HKEY(i), 0x6d5a6d5a);
+    }
+
+    /* 512-entry lookup table, and the flow director and EtherType filters */
+    m32 = mmio_read32(dev->mmio, I40E_PFQF_CTL_0);
+    mmio_write32(dev->mmio, I40E_PFQF_CTL_0,
+                 m32 | I40E_PFQF_CTL_0_HASHLUTSIZE_512
+                 | I40E_PFQF_CTL_0_FD_ENA | I40E_PFQF_CTL_0_ETYPE_ENA);
+    for ( i = 0; i < I40E_PFQF_HLUT_NUM; i++ ) {
+        m32 = 0;
+        for ( j = 0; j < 4; j++ ) {
+            m32 |= (u32)((i * 4 + j) % nq) << (j * 8);
+        }
+        mmio_write32(dev->mmio, I40E_PFQF_HLUT(i), m32);
+    }
+
+    /* Hash IPv4 TCP/UDP/other and fragments */
+    mmio_write32(dev->mmio, I40E_PFQF_HENA(0),
+                 1U << I40E_PCTYPE_NONF_IPV4_UDP);
+    mmio_write32(dev->mmio, I40E_PFQF_HENA(1),
+                 (1U << (I40E_PCTYPE_NONF_IPV4_TCP - 32))
+                 | (1U << (I40E_PCTYPE_NONF_IPV4_OTHER - 32))
+                 | (1U << (I40E_PCTYPE_FRAG_IPV4 - 32)));
+
+    return ret;
+}
+
 
 int
 i40e_init_fpm(struct i40e_device *dev)
 {
     //u16 func;
+    struct i40e_aq_desc desc;
     u32 qalloc;
     int i;
     int j;
+    int k;
     u32 m32;
+    struct mbuf *mbuf;
 
     /* Get function number to determine the HMC function index */
     //func = dev->pci_device->func;
@@ -417,109 +1120,31 @@ i40e_init_fpm(struct i40e_device *dev)
 
 
     /* Initialize the admin queue */
-    dev->atq.len = 128;
-    dev->atq.base = kmalloc(sizeof(struct i40e_aq_desc) * dev->atq.len);
-    dev->atq.tail = 0;
-    dev->atq.bufset = kmalloc(4096 * dev->atq.len);
-    dev->arq.base = kmalloc(sizeof(struct i40e_aq_desc) * dev->arq.len);
-    dev->arq.tail = 0;
-    dev->arq.len = 128;
-    dev->arq.bufset = kmalloc(4096 * dev->atq.len);
-    for ( i = 0; i < dev->arq.len; i++ ) {
-        dev->arq.base[i].flags = (1<<9) | (1<<12);
-        dev->arq.base[i].opcode = 0;
-        dev->arq.base[i].len = 4096;
-        dev->arq.base[i].ret = 0;
-        dev->arq.base[i].cookieh = 0;
-        dev->arq.base[i].cookiel = 0;
-        dev->arq.base[i].param0 = 0;
-        dev->arq.base[i].param1 = 0;
-        dev->arq.base[i].addrh = (u64)(dev->arq.bufset + (i * 4096)) >> 32;
-        dev->arq.base[i].addrl = (u64)(dev->arq.bufset + (i * 4096));
+    if ( _i40e_aq_init(dev) < 0 ) {
+        kprintf("Error on admin queue initialization\r\n");
+        return -1;
     }
 
-    mmio_write32(dev->mmio, I40E_PF_ATQH, 0);
-    mmio_write32(dev->mmio, I40E_PF_ATQT, 0);
-    mmio_write32(dev->mmio, I40E_PF_ATQBAL, (u64)dev->atq.base);
-    mmio_write32(dev->mmio, I40E_PF_ATQBAH, (u64)dev->atq.base >> 32);
-    mmio_write32(dev->mmio, I40E_PF_ATQLEN, dev->atq.len | (1<<31));
-
-    mmio_write32(dev->mmio, I40E_PF_ARQH, 0);
-    mmio_write32(dev->mmio, I40E_PF_ARQT, 0);
-    mmio_write32(dev->mmio, I40E_PF_ARQBAL, (u64)dev->arq.base);
-    mmio_write32(dev->mmio, I40E_PF_ARQBAH, (u64)dev->arq.base >> 32);
-    mmio_write32(dev->mmio, I40E_PF_ARQLEN, dev->arq.len | (1<<31));
-
-    /* Issue get ver admin command */
-    int idx = dev->atq.tail;
-    dev->atq.base[idx].flags = 0;
-    dev->atq.base[idx].opcode = 0x0001;
-    dev->atq.base[idx].len = 0;
-    dev->atq.base[idx].ret = 0;
-    dev->atq.base[idx].cookieh = 0x1234;
-    dev->atq.base[idx].cookiel = 0xabcd;
-    dev->atq.base[idx].param0 = 0;
-    dev->atq.base[idx].param1 = 0;
-    dev->atq.base[idx].addrh = 0;
-    dev->atq.base[idx].addrl = 0x00010001;
-    dev->atq.tail++;
-    mmio_write32(dev->mmio, I40E_PF_ATQT, dev->atq.tail);
-    while ( !(dev->atq.base[idx].flags & 0x1) ) {
-        arch_busy_usleep(10);
+    /* Get version */
+    i40e_aq_cmd_get_version(&desc);
+    if ( 0 != i40e_aq_exec(dev, &desc, NULL, 0) ) {
+        kprintf("Error on admin command: get version\r\n");
     }
 #if 0
-    kprintf("ATQH ARQT/ARQH: %x (%x,%x,%x,%x) %x %x\r\n",
-            mmio_read32(dev->mmio, I40E_PF_ATQH),
-            dev->atq.base[0].flags,
-            dev->atq.base[0].param0,
-            dev->atq.base[0].param1,
-            dev->atq.base[0].addrh,
-            mmio_read32(dev->mmio, I40E_PF_ARQT),
-            mmio_read32(dev->mmio, I40E_PF_ARQH));
+    kprintf("FW: %d.%d API: %d.%d\r\n", desc.param1 & 0xffff,
+            desc.param1 >> 16, desc.addrh & 0xffff, desc.addrh >> 16);
 #endif
-    idx = dev->atq.tail;
-    dev->atq.base[idx].flags = 0;
-    dev->atq.base[idx].opcode = 0x0110;
-    dev->atq.base[idx].len = 0;
-    dev->atq.base[idx].ret = 0;
-    dev->atq.base[idx].cookieh = 0x5678;
-    dev->atq.base[idx].cookiel = 0xef01;
-    dev->atq.base[idx].param0 = 2;
-    dev->atq.base[idx].param1 = 0;
-    dev->atq.base[idx].addrh = 0;
-    dev->atq.base[idx].addrl = 0;
-    dev->atq.tail++;
-    mmio_write32(dev->mmio, I40E_PF_ATQT, dev->atq.tail);
-    while ( !(dev->atq.base[idx].flags & 0x1) ) {
-        arch_busy_usleep(10);
+
+    /* Clear PXE mode */
+    i40e_aq_cmd_clear_pxe_mode(&desc);
+    if ( 0 != i40e_aq_exec(dev, &desc, NULL, 0) ) {
+        kprintf("Error on admin command: clear PXE mode\r\n");
     }
-#if 0
-    kprintf("ATQH ARQT/ARQH: %x (%x,%x,%x,%x) %x %x\r\n",
-            mmio_read32(dev->mmio, I40E_PF_ATQH),
-            dev->atq.base[1].flags,
-            dev->atq.base[1].param0,
-            dev->atq.base[1].param1,
-            dev->atq.base[1].ret,
-            mmio_read32(dev->mmio, I40E_PF_ARQT),
-            mmio_read32(dev->mmio, I40E_PF_ARQH));
-#endif
 #if 1
     /* Set MAC config */
-    idx = dev->atq.tail;
-    dev->atq.base[idx].flags = 0;
-    dev->atq.base[idx].opcode = 0x0603;
-    dev->atq.base[idx].len = 0;
-    dev->atq.base[idx].ret = 0;
-    dev->atq.base[idx].cookieh = 0x9abc;
-    dev->atq.base[idx].cookiel = 0xdef0;
-    dev->atq.base[idx].param0 = 1518 | (1<<18) | (0<<24);
-    dev->atq.base[idx].param1 = 0;
-    dev->atq.base[idx].addrh = 0;
-    dev->atq.base[idx].addrl = 0;
-    dev->atq.tail++;
-    mmio_write32(dev->mmio, I40E_PF_ATQT, dev->atq.tail);
-    while ( !(dev->atq.base[idx].flags & 0x1) ) {
-        arch_busy_usleep(10);
+    i40e_aq_cmd_set_mac_config(&desc, 1518);
+    if ( 0 != i40e_aq_exec(dev, &desc, NULL, 0) ) {
+        kprintf("Error on admin command: set MAC config\r\n");
     }
 #endif
 
@@ -633,9 +1258,18 @@ i40e_init_fpm(struct i40e_device *dev)
         dev->txq[i].bufmask = (1<<10) - 1;
         /* ToDo: 16 bytes for alignment */
         dev->txq[i].base = (u64)kmalloc(dev->txq[i].bufsz * sizeof(struct i40e_tx_desc_data));
+        dev->txq[i].mbufs = kmalloc(dev->txq[i].bufsz * sizeof(struct mbuf *));
+        if ( NULL == dev->txq[i].mbufs ) {
+            return -1;
+        }
         for ( j = 0; j < dev->txq[i].bufsz; j++ ) {
             txdesc = (struct i40e_tx_desc_data *)(dev->txq[i].base + j * sizeof(struct i40e_tx_desc_data));
-            txdesc->pkt_addr = (u64)kmalloc(4096);
+            mbuf = mbuf_alloc(mbufpool);
+            if ( NULL == mbuf ) {
+                return -1;
+            }
+            dev->txq[i].mbufs[j] = mbuf;
+            txdesc->pkt_addr = MBUF_ADDR(mbuf);
             txdesc->rsv_cmd_dtyp = 0;
             txdesc->txbufsz_offset = 0;
             txdesc->l2tag = 0;
@@ -643,32 +1277,63 @@ i40e_init_fpm(struct i40e_device *dev)
     }
 
 
-    /* Rx descriptor */
+    /* Rx descriptors; the number of queues is rounded down to a power of
+       two for the queue map of the VSI */
     union i40e_rx_desc *rxdesc;
-    /* Previous tail */
-    dev->rx_tail = 0;
-    /* up to 64 K minus 8 */
-    dev->rx_bufsz = (1<<10);
-    dev->rx_bufmask = (1<<10) - 1;
-    /* Allocate memory for RX descriptors */
-    dev->rx_read = kmalloc(dev->rx_bufsz * sizeof(struct i40e_rx_desc_read));
-    if ( 0 == dev->rx_read ) {
-        kfree(dev);
-        return NULL;
+    if ( qalloc & (1U<<31) ) {
+        k = ((qalloc >> 16) & 0x7ff) - (qalloc & 0x7ff) + 1;
+    } else {
+        k = 1;
     }
-    /* ToDo: 16 bytes for alignment */
-    dev->rx_base = (u64)kmalloc(dev->rx_bufsz * sizeof(union i40e_rx_desc));
-    if ( 0 == dev->rx_base ) {
-        kfree(dev);
-        return NULL;
+    dev->nrxq = 1;
+    while ( dev->nrxq * 2 <= k && dev->nrxq * 2 <= I40E_RXQ_NUM ) {
+        dev->nrxq *= 2;
+    }
+    dev->rx_hsplit = 0;
+    /* No control queue: nothing polls one on i40e, and the firmware rejects
+       the IPv6 EtherType filter needed to steer ND; every queue takes RSS
+       traffic.  Filters can still steer packets to a queue explicitly. */
+    dev->ctrlq = -1;
+    for ( i = 0; i < I40E_ETF_NUM; i++ ) {
+        dev->etf[i].used = 0;
+    }
+    for ( i = 0; i < I40E_FDF_NUM; i++ ) {
+        dev->fdf_used[i] = 0;
     }
-    for ( i = 0; i < dev->rx_bufsz; i++ ) {
-        rxdesc = (union i40e_rx_desc *)(dev->rx_base + i * sizeof(union i40e_rx_desc));
-        rxdesc->read.pkt_addr = (u64)kmalloc(4096);
-        rxdesc->read.hdr_addr = (u64)kmalloc(4096);
+    for ( i = 0; i < dev->nrxq; i++ ) {
+        /* Previous tail */
+        dev->rxq[i].tail = 0;
+        /* up to 8 K minus 32 */
+        dev->rxq[i].bufsz = (1<<10);
+        dev->rxq[i].bufmask = (1<<10) - 1;
+        dev->rxq[i].pkt = NULL;
+        dev->rxq[i].last = NULL;
+        /* Allocate memory for RX descriptors */
+        dev->rxq[i].read = kmalloc(dev->rxq[i].bufsz
+                                   * sizeof(struct i40e_rx_desc_read));
+        if ( NULL == dev->rxq[i].read ) {
+            return -1;
+        }
+        /* ToDo: 16 bytes for alignment */
+        dev->rxq[i].base = (u64)kmalloc(dev->rxq[i].bufsz
+                                        * sizeof(union i40e_rx_desc));
+        if ( 0 == dev->rxq[i].base ) {
+            return -1;
+        }
+        for ( j = 0; j < dev->rxq[i].bufsz; j++ ) {
+            rxdesc = (union i40e_rx_desc *)
+                (dev->rxq[i].base + j * sizeof(union i40e_rx_desc));
+            mbuf = mbuf_alloc(mbufpool);
+            if ( NULL == mbuf ) {
+                return -1;
+            }
+            rxdesc->read.pkt_addr = MBUF_ADDR(mbuf);
+            /* Header buffers are attached by i40e_rx_hsplit() */
+            rxdesc->read.hdr_addr = 0;
 
-        dev->rx_read[i].pkt_addr = rxdesc->read.pkt_addr;
-        dev->rx_read[i].hdr_addr = rxdesc->read.hdr_addr;
+            dev->rxq[i].read[j].pkt_addr = rxdesc->read.pkt_addr;
+            dev->rxq[i].read[j].hdr_addr = rxdesc->read.hdr_addr;
+        }
     }
 
 
@@ -679,7 +1344,7 @@ i40e_init_fpm(struct i40e_device *dev)
     u64 rxbase;
     u32 cnt = 1536;
     u32 txobjsz = mmio_read32(dev->mmio, I40E_GLHMC_LANTXOBJSZ);
-    //u32 rxobjsz = mmio_read32(dev->mmio, I40E_GLHMC_LANRXOBJSZ);
+    u32 rxobjsz = mmio_read32(dev->mmio, I40E_GLHMC_LANRXOBJSZ) & 0xf;
 
     hmc = kmalloc(4 * 1024 * 1024);
     kmemset(hmc, 0, 4 * 1024 * 1024);
@@ -693,7 +1358,7 @@ i40e_init_fpm(struct i40e_device *dev)
     rxbase = (((txbase * 512) + (cnt * (1<<txobjsz))) + 511) / 512;
 
 #if 0
-    kprintf("HMC: %llx, Rx: %llx\r\n", hmcint, dev->rx_base);
+    kprintf("HMC: %llx, Rx: %llx\r\n", hmcint, dev->rxq[0].base);
 #endif
 
     struct i40e_lan_txq_ctx *txq_ctx;
@@ -711,23 +1376,29 @@ i40e_init_fpm(struct i40e_device *dev)
         txq_ctx->tphrpacket = 1;
         txq_ctx->tphwdesc = 1;
         txq_ctx->rdylist = 0x0;
+        /* Flow director programming descriptors */
+        txq_ctx->fdena = (I40E_TXQ_FD == i) ? 1 : 0;
     }
 
     struct i40e_lan_rxq_ctx *rxq_ctx;
-    rxq_ctx = (struct i40e_lan_rxq_ctx *)(hmcint + rxbase * 512);
-    rxq_ctx->head = 0;
-    rxq_ctx->base = dev->rx_base / 128;
-    rxq_ctx->qlen = dev->rx_bufsz;
-    rxq_ctx->dbuff = 4096/128;
-    rxq_ctx->hbuff = 128/64;
-    rxq_ctx->dtype = 0x0;
-    rxq_ctx->dsize = 0x0;
-    rxq_ctx->crcstrip = 0x1;
-    rxq_ctx->rxmax = 4096;
-    rxq_ctx->tphrdesc = 1;
-    rxq_ctx->tphwdesc = 1;
-    rxq_ctx->tphdata = 1;
-    rxq_ctx->tphhead = 1;
+    for ( i = 0; i < dev->nrxq; i++ ) {
+        rxq_ctx = (struct i40e_lan_rxq_ctx *)
+            (hmcint + rxbase * 512 + i * (1 << rxobjsz));
+        rxq_ctx->head = 0;
+        rxq_ctx->base = dev->rxq[i].base / 128;
+        rxq_ctx->qlen = dev->rxq[i].bufsz;
+        rxq_ctx->dbuff = MBUF_DATAROOM/128;
+        rxq_ctx->hbuff = 128/64;
+        rxq_ctx->dtype = 0x0;
+        rxq_ctx->dsize = 0x0;
+        rxq_ctx->crcstrip = 0x1;
+        rxq_ctx->rxmax = 4096;
+        rxq_ctx->tphrdesc = 1;
+        rxq_ctx->tphwdesc = 1;
+        rxq_ctx->tphdata = 1;
+        rxq_ctx->tphhead = 1;
+        dev->rxq[i].ctx = rxq_ctx;
+    }
 
 #if 0
     kprintf("HMC: %.8llx %.8llx %.8llx %.8llx\r\n",
@@ -783,19 +1454,26 @@ i40e_init_fpm(struct i40e_device *dev)
 
 
     /* Enable Rx */
-    mmio_write32(dev->mmio, I40E_QRX_TAIL(0), dev->rx_bufsz - 1);
+    for ( i = 0; i < dev->nrxq; i++ ) {
+        mmio_write32(dev->mmio, I40E_QRX_TAIL(i), dev->rxq[i].bufsz - 1);
 
-    mmio_write32(dev->mmio, I40E_QRX_ENA(0), 1);
-    for ( i = 0; i < 10; i++ ) {
-        arch_busy_usleep(1);
-        m32 = mmio_read32(dev->mmio, I40E_QRX_ENA(0));
-        if ( 5 == (m32 & 5) ) {
-            break;
+        mmio_write32(dev->mmio, I40E_QRX_ENA(i), 1);
+        for ( j = 0; j < 10; j++ ) {
+            arch_busy_usleep(1);
+            m32 = mmio_read32(dev->mmio, I40E_QRX_ENA(i));
+            if ( 5 == (m32 & 5) ) {
+                break;
+            }
+        }
+        if ( 5 != (m32 & 5) ) {
+            kprintf("Error on enable a RX queue (%d)\r\n", i);
+            return -1;
         }
     }
-    if ( 5 != (m32 & 5) ) {
-        kprintf("Error on enable a RX queue\r\n");
-        return -1;
+
+    /* Distribute the flows over the RX queues */
+    if ( _i40e_setup_rss(dev) < 0 ) {
+        kprintf("Error on RSS setup; only the first RX queue is used\r\n");
     }
 
     //kprintf("GLLAN_RCTL_0: %x\r\n", mmio_read32(dev->mmio, I40E_GLLAN_RCTL_0));
@@ -993,91 +1671,642 @@ i40e_tx_test3(struct netdev *netdev, u8 *pkt, int len, int blksize,
     return 0;
 }
 
+/*
+ * Receive up to n packets without copy; the buffers attached to the RX
+ * descriptors are handed to the caller and replaced with new ones.  With the
+ * header split, the header buffer is chained in front of the payload buffer.
+ */
 int
-i40e_forwarding_test(struct netdev *netdev1, struct netdev *netdev2)
+i40e_rx_burst(struct netdev *netdev, int q, struct mbuf **mbufs, int n)
 {
-    struct i40e_device *dev1;
-    struct i40e_device *dev2;
-    union i40e_rx_desc * rxdesc;
-    struct i40e_tx_desc_data *txdesc;
-    u8 *txpkt;
+    struct i40e_device *dev;
+    union i40e_rx_desc *rxdesc;
+    struct i40e_rx_desc_read *read;
+    struct mbuf *m;
+    struct mbuf *h;
+    struct mbuf *nm;
+    struct mbuf *nh;
+    struct netdev_stats *st;
+    u64 qw1;
+    u64 bytes;
+    u32 hlen;
+    int nrx;
+    int last;
+    int nobuf;
 
-    dev1 = (struct i40e_device *)netdev1->vendor;
-    dev2 = (struct i40e_device *)netdev2->vendor;
-    static int cnt = 0;
-    for ( ;; ) {
+    dev = (struct i40e_device *)netdev->vendor;
+    if ( q >= dev->nrxq ) {
+        return 0;
+    }
 
+    nrx = 0;
+    last = -1;
+    nh = NULL;
+    bytes = 0;
+    nobuf = 0;
+    while ( nrx < n ) {
         rxdesc = (union i40e_rx_desc *)
-            (dev1->rx_base + dev1->rx_tail * sizeof(union i40e_rx_desc));
-        txdesc = (struct i40e_tx_desc_data *)
-            (dev2->txq[0].base + dev2->txq[0].tail * sizeof(struct i40e_tx_desc_data));
+            (dev->rxq[q].base + dev->rxq[q].tail * sizeof(union i40e_rx_desc));
+        read = &dev->rxq[q].read[dev->rxq[q].tail];
+        qw1 = rxdesc->wb.len_ptype_err_status;
+        if ( !(qw1 & 1) ) {
+            /* Not written back yet */
+            break;
+        }
 
-#if 0
-        kprintf("%llx %x %x %x\r\n", *(volatile u64 *)((u64)rxdesc + 8),
-                *(u32 *)0x14e30000,
-                mmio_read32(dev1->mmio, 0x00300480),
-                mmio_read32(dev1->mmio, 0x00300000));
-#endif
-        if ( rxdesc->read.hdr_addr & 0x1 ) {
+        /* Allocate new buffers first not to lose the descriptor */
+        nm = mbuf_alloc(mbufpool);
+        if ( NULL == nm ) {
+            nobuf = 1;
+            break;
+        }
+        if ( dev->rx_hsplit ) {
+            nh = mbuf_alloc(mbufhdrpool);
+            if ( NULL == nh ) {
+                mbuf_free(nm);
+                nobuf = 1;
+                break;
+            }
+        }
+        m = mbuf_from_addr(mbufpool, read->pkt_addr);
+        m->len = (qw1 >> 38) & 0x3fff;
+        m->pktlen = m->len;
+
+        if ( dev->rx_hsplit ) {
+            h = mbuf_from_addr(mbufhdrpool, read->hdr_addr);
+            hlen = (qw1 >> 52) & 0x7ff;
+            if ( (qw1 & (1ULL << 63)) && hlen > 0 ) {
+                /* Headers were split to the header buffer */
+                h->len = hlen;
+                h->pktlen = hlen + m->len;
+                if ( m->len > 0 ) {
+                    h->next = m;
+                } else {
+                    mbuf_free(m);
+                }
+                m = h;
+            } else {
+                mbuf_free(h);
+            }
+        }
 
-            txpkt = (u8 *)dev1->rx_read[dev1->rx_tail].pkt_addr;
-            *(u32 *)(txpkt + 0) =  0x67664000LLU;
-            *(u16 *)(txpkt + 4) =  0x2472LLU;
-            /* src */
-            *(u8 *)(txpkt + 6) =  *((u8 *)netdev2->macaddr);
-            *(u8 *)(txpkt + 7) =  *((u8 *)netdev2->macaddr + 1);
-            *(u32 *)(txpkt + 8) =  *((u32 *)(netdev2->macaddr + 2));
+        /* Chain the segments until EOF */
+        if ( NULL == dev->rxq[q].pkt ) {
+            dev->rxq[q].pkt = m;
+        } else {
+            dev->rxq[q].last->next = m;
+            dev->rxq[q].pkt->pktlen += m->pktlen;
+        }
+        dev->rxq[q].last = m->next ? m->next : m;
+        if ( qw1 & (1<<1) ) {
+            if ( qw1 & (1<<2) ) {
+                /* L2TAG1P: stripped VLAN tag */
+                dev->rxq[q].pkt->vlan = rxdesc->wb.l2tag1;
+                dev->rxq[q].pkt->ol_flags |= MBUF_OL_RX_VLAN;
+            }
+            mbufs[nrx] = dev->rxq[q].pkt;
+            bytes += dev->rxq[q].pkt->pktlen;
+            nrx++;
+            dev->rxq[q].pkt = NULL;
+            dev->rxq[q].last = NULL;
+        }
 
-#if 0
-            /* TTL -= 1 */
-            txpkt[22]--;
-            /* Compute checksum */
-            u16 *ctmp;
-            u32 cs;
-            txpkt[24] = 0x0;
-            txpkt[25] = 0x0;
-            ctmp = (u16 *)txpkt;
-            cs = 0;
-            for ( i = 7; i < 17; i++ ) {
-                cs += (u32)ctmp[i];
-                cs = (cs & 0xffff) + (cs >> 16);
+        /* Refill */
+        read->pkt_addr = MBUF_ADDR(nm);
+        read->hdr_addr = dev->rx_hsplit ? MBUF_ADDR(nh) : 0;
+        rxdesc->read.pkt_addr = read->pkt_addr;
+        rxdesc->read.hdr_addr = read->hdr_addr;
+        last = dev->rxq[q].tail;
+        dev->rxq[q].tail = (dev->rxq[q].tail + 1) & dev->rxq[q].bufmask;
+    }
+
+    if ( last >= 0 ) {
+        mmio_write32(dev->mmio, I40E_QRX_TAIL(q), last);
+    }
+    if ( last >= 0 || nobuf ) {
+        st = netdev_stats(netdev);
+        st->c[NETDEV_STAT_RX_PKTS] += nrx;
+        st->c[NETDEV_STAT_RX_BYTES] += bytes;
+        st->c[NETDEV_STAT_RX_DOORBELL] += last >= 0 ? 1 : 0;
+        st->c[NETDEV_STAT_NOBUF] += nobuf;
+    }
+
+    return nrx;
+}
+
+/*
+ * Enable/disable the header split; the L2/IP/TCP/UDP headers are written to
+ * the buffers from mbufhdrpool and the payload to the packet buffers.  The RX
+ * queues are stopped to update their contexts in the HMC.
+ */
+int
+i40e_rx_hsplit(struct netdev *netdev, int on)
+{
+    struct i40e_device *dev;
+    union i40e_rx_desc *rxdesc;
+    struct mbuf *h;
+    int ret;
+    int q;
+    int i;
+    u32 m32;
+
+    dev = (struct i40e_device *)netdev->vendor;
+
+    ret = 0;
+    on = on ? 1 : 0;
+    if ( on == dev->rx_hsplit ) {
+        return 0;
+    }
+
+    /* Stop the queues */
+    for ( q = 0; q < dev->nrxq; q++ ) {
+        mmio_write32(dev->mmio, I40E_QRX_ENA(q), 0);
+        for ( i = 0; i < 10; i++ ) {
+            arch_busy_usleep(1);
+            m32 = mmio_read32(dev->mmio, I40E_QRX_ENA(q));
+            if ( 0 == (m32 & 5) ) {
+                break;
             }
-            cs = 0xffff - cs;
-            txpkt[24] = cs & 0xff;
-            txpkt[25] = cs >> 8;
-#endif
+        }
+        if ( 0 != (m32 & 5) ) {
+            kprintf("Error on disable a RX queue (%d)\r\n", q);
+            return -1;
+        }
+    }
+
+    for ( q = 0; q < dev->nrxq; q++ ) {
+        /* Drop the packet being received */
+        mbuf_free(dev->rxq[q].pkt);
+        dev->rxq[q].pkt = NULL;
+        dev->rxq[q].last = NULL;
+
+        /* Attach or detach the header buffers */
+        for ( i = 0; i < dev->rxq[q].bufsz; i++ ) {
+            if ( on ) {
+                h = mbuf_alloc(mbufhdrpool);
+                if ( NULL == h ) {
+                    ret = -1;
+                    break;
+                }
+                dev->rxq[q].read[i].hdr_addr = MBUF_ADDR(h);
+            } else {
+                mbuf_free(mbuf_from_addr(mbufhdrpool,
+                                         dev->rxq[q].read[i].hdr_addr));
+                dev->rxq[q].read[i].hdr_addr = 0;
+            }
+        }
+        if ( ret < 0 ) {
+            break;
+        }
+    }
+    if ( ret < 0 ) {
+        /* Roll back; detach the header buffers attached so far */
+        on = 0;
+        for ( q = 0; q < dev->nrxq; q++ ) {
+            for ( i = 0; i < dev->rxq[q].bufsz; i++ ) {
+                if ( 0 != dev->rxq[q].read[i].hdr_addr ) {
+                    mbuf_free(mbuf_from_addr(mbufhdrpool,
+                                             dev->rxq[q].read[i].hdr_addr));
+                    dev->rxq[q].read[i].hdr_addr = 0;
+                }
+            }
+        }
+    }
+    dev->rx_hsplit = on;
+
+    for ( q = 0; q < dev->nrxq; q++ ) {
+        for ( i = 0; i < dev->rxq[q].bufsz; i++ ) {
+            rxdesc = (union i40e_rx_desc *)
+                (dev->rxq[q].base + i * sizeof(union i40e_rx_desc));
+            rxdesc->read.pkt_addr = dev->rxq[q].read[i].pkt_addr;
+            rxdesc->read.hdr_addr = dev->rxq[q].read[i].hdr_addr;
+        }
 
-            /* Save Tx */
-            u8 *tmp = (u8 *)((u64)txdesc->pkt_addr & 0xfffffffffffffff0ULL);
+        /* Context: header split by L2, IP and TCP/UDP */
+        dev->rxq[q].ctx->head = 0;
+        if ( on ) {
+            dev->rxq[q].ctx->hbuff = MBUF_HDRROOM / 64;
+            dev->rxq[q].ctx->dtype = 0x1;
+            dev->rxq[q].ctx->hsplit_0 = (1<<0) | (1<<1) | (1<<2);
+        } else {
+            dev->rxq[q].ctx->hbuff = 128 / 64;
+            dev->rxq[q].ctx->dtype = 0x0;
+            dev->rxq[q].ctx->hsplit_0 = 0;
+        }
 
-            txdesc->pkt_addr = (u64)txpkt;
-            txdesc->l2tag = 0;
-            txdesc->txbufsz_offset
-                = (((rxdesc->wb.len_ptype_err_status >> 38) & 0x3ffffffULL) << 18)
-                | 14/2;
-            txdesc->rsv_cmd_dtyp = 0 | (((1) | (1<<1)) << 4);
+        /* Restart the queue */
+        dev->rxq[q].tail = 0;
+        mmio_write32(dev->mmio, I40E_QRX_TAIL(q), dev->rxq[q].bufsz - 1);
+        mmio_write32(dev->mmio, I40E_QRX_ENA(q), 1);
+        for ( i = 0; i < 10; i++ ) {
+            arch_busy_usleep(1);
+            m32 = mmio_read32(dev->mmio, I40E_QRX_ENA(q));
+            if ( 5 == (m32 & 5) ) {
+                break;
+            }
+        }
+        if ( 5 != (m32 & 5) ) {
+            kprintf("Error on enable a RX queue (%d)\r\n", q);
+            return -1;
+        }
+    }
+
+    return ret;
+}
+
+
+
+/*
+ * Transmit up to n packets to the TX queue q without copy; the buffers are
+ * owned by the TX ring and released when their descriptors are reused.  The
+ * checksum offload is specified in the data descriptors, and TSO takes a
+ * context descriptor in front of the data descriptors.
+ */
+int
+i40e_tx_burst(struct netdev *netdev, int q, struct mbuf **mbufs, int n)
+{
+    struct i40e_device *dev;
+    struct i40e_tx_desc_data *txdesc;
+    struct i40e_tx_desc_ctx *ctx;
+    struct mbuf *m;
+    struct mbuf *next;
+    struct netdev_stats *st;
+    u16 cmd;
+    u16 l2tag;
+    u32 off;
+    u64 tsolen;
+    u64 bytes;
+    int tx_avl;
+    int nseg;
+    int ntx;
 
-            dev1->rx_read[dev1->rx_tail].pkt_addr = (u64)tmp;
-            rxdesc->read.pkt_addr = dev1->rx_read[dev1->rx_tail].pkt_addr;
-            rxdesc->read.hdr_addr = dev1->rx_read[dev1->rx_tail].hdr_addr;
+    dev = (struct i40e_device *)netdev->vendor;
 
-            dev2->txq[0].tail = (dev2->txq[0].tail + 1) & dev2->txq[0].bufmask;
-            if ( 0 == ((++cnt) & 0xff) ) {
-                mmio_write32(dev2->mmio, I40E_QTX_TAIL(0), dev2->txq[0].tail);
-                mmio_write32(dev1->mmio, I40E_QRX_TAIL(0), dev1->rx_tail);
+    /* Keep one descriptor unused to distinguish full from empty; the head
+       is written back by the hardware to headwb */
+    tx_avl = (dev->txq[q].headwb + dev->txq[q].bufsz - dev->txq[q].tail - 1)
+        & dev->txq[q].bufmask;
+
+    bytes = 0;
+    for ( ntx = 0; ntx < n; ntx++ ) {
+        m = mbufs[ntx];
+        nseg = (m->ol_flags & MBUF_OL_TX_TSO) ? 1 : 0;
+        for ( ; NULL != m; m = m->next ) {
+            nseg++;
+        }
+        if ( tx_avl < nseg ) {
+            break;
+        }
+        tx_avl -= nseg;
+
+        /* Offload: MACLEN in 2 bytes, IPLEN and L4LEN in 4 bytes */
+        m = mbufs[ntx];
+        bytes += m->pktlen;
+        cmd = 0;
+        off = 14/2;
+        if ( m->ol_flags & (MBUF_OL_TX_IP_CKSUM | MBUF_OL_TX_TCP_CKSUM
+                            | MBUF_OL_TX_UDP_CKSUM | MBUF_OL_TX_TSO) ) {
+            off = (m->l2len / 2) | ((u32)(m->l3len / 4) << 7);
+            /* IIPT: IPv4 with or without checksum */
+            if ( m->ol_flags & (MBUF_OL_TX_IP_CKSUM | MBUF_OL_TX_TSO) ) {
+                cmd |= (3 << 5);
+            } else {
+                cmd |= (2 << 5);
+            }
+            /* L4T */
+            if ( m->ol_flags & (MBUF_OL_TX_TCP_CKSUM | MBUF_OL_TX_TSO) ) {
+                cmd |= (1 << 8);
+                off |= (u32)(m->l4len / 4) << 14;
+            } else if ( m->ol_flags & MBUF_OL_TX_UDP_CKSUM ) {
+                cmd |= (3 << 8);
+                off |= (u32)(8 / 4) << 14;
             }
-            dev1->rx_tail = (dev1->rx_tail + 1) & dev1->rx_bufmask;
+        }
+        l2tag = 0;
+        if ( m->ol_flags & MBUF_OL_TX_VLAN ) {
+            /* IL2TAG1: insert the tag in L2TAG1 */
+            cmd |= (1 << 3);
+            l2tag = m->vlan;
+        }
+        if ( m->ol_flags & MBUF_OL_TX_TSO ) {
+            /* The context descriptor takes a slot */
+            mbuf_free(dev->txq[q].mbufs[dev->txq[q].tail]);
+            dev->txq[q].mbufs[dev->txq[q].tail] = NULL;
+            ctx = (struct i40e_tx_desc_ctx *)
+                (dev->txq[q].base
+                 + dev->txq[q].tail * sizeof(struct i40e_tx_desc_ctx));
+            tsolen = m->pktlen - m->l2len - m->l3len - m->l4len;
+            ctx->tunnel = 0;
+            ctx->l2tag = 0;
+            ctx->rsv = 0;
+            /* DTYP = 1, CMD = TSO, TSO length, MSS */
+            ctx->mss_tsolen_cmd_dtyp = 1 | (1ULL << 4) | (tsolen << 30)
+                | ((u64)m->mss << 50);
+            dev->txq[q].tail = (dev->txq[q].tail + 1) & dev->txq[q].bufmask;
+        }
 
-#if 0
-            if ( 0 == (cnt & 0xffffff) ) {
-                kprintf("%.16llx %.16llx\r\n",
-                        mmio_read32(dev1->mmio, 0x0036e400),
-                        mmio_read32(dev1->mmio, 0x00300480));
-                //kprintf("%.16llx %.16llx\r\n", cnt, mmio_read32(dev1->mmio, 0x00300480));
-                //kprintf("%llx\r\n", mmio_read32(dev1->mmio, 0x00310000));
+        for ( ; NULL != m; m = next ) {
+            next = m->next;
+            txdesc = (struct i40e_tx_desc_data *)
+                (dev->txq[q].base
+                 + dev->txq[q].tail * sizeof(struct i40e_tx_desc_data));
+            /* Release the buffer previously attached */
+            mbuf_free(dev->txq[q].mbufs[dev->txq[q].tail]);
+            dev->txq[q].mbufs[dev->txq[q].tail] = m;
+
+            m->next = NULL;
+            txdesc->pkt_addr = MBUF_ADDR(m);
+            txdesc->l2tag = l2tag;
+            txdesc->txbufsz_offset = ((u32)m->len << 18) | off;
+            if ( NULL == next ) {
+                txdesc->rsv_cmd_dtyp = (cmd | (1) | (1<<1)) << 4;
+            } else {
+                txdesc->rsv_cmd_dtyp = cmd << 4;
             }
-#endif
+            dev->txq[q].tail = (dev->txq[q].tail + 1) & dev->txq[q].bufmask;
+        }
+    }
+
+    if ( ntx > 0 ) {
+        mmio_write32(dev->mmio, I40E_QTX_TAIL(q), dev->txq[q].tail);
+    }
+    if ( n > 0 ) {
+        st = netdev_stats(netdev);
+        st->c[NETDEV_STAT_TX_PKTS] += ntx;
+        st->c[NETDEV_STAT_TX_BYTES] += bytes;
+        st->c[NETDEV_STAT_TX_DOORBELL] += ntx > 0 ? 1 : 0;
+        st->c[NETDEV_STAT_TXFULL] += ntx < n ? 1 : 0;
+    }
+
+    return ntx;
+}
+
+/*
+ * Read the port counters; the counters are not cleared on read.  The packet
+ * counts per queue are not maintained by the port.
+ */
+int
+i40e_hwstats(struct netdev *netdev, struct netdev_hwstats *hw)
+{
+    struct i40e_device *dev;
+    u64 mmio;
+    int p;
+
+    dev = (struct i40e_device *)netdev->vendor;
+    mmio = dev->mmio;
+    p = mmio_read32(mmio, I40E_PFGEN_PORTNUM) & 0x3;
+
+    kmemset(hw, 0, sizeof(struct netdev_hwstats));
+    hw->rx_pkts = (mmio_read64(mmio, I40E_GLPRT_UPRC(p))
+                   + mmio_read64(mmio, I40E_GLPRT_MPRC(p))
+                   + mmio_read64(mmio, I40E_GLPRT_BPRC(p))) & I40E_STAT48_MASK;
+    hw->rx_bytes = mmio_read64(mmio, I40E_GLPRT_GORC(p)) & I40E_STAT48_MASK;
+    hw->tx_pkts = (mmio_read64(mmio, I40E_GLPRT_UPTC(p))
+                   + mmio_read64(mmio, I40E_GLPRT_MPTC(p))
+                   + mmio_read64(mmio, I40E_GLPRT_BPTC(p))) & I40E_STAT48_MASK;
+    hw->tx_bytes = mmio_read64(mmio, I40E_GLPRT_GOTC(p)) & I40E_STAT48_MASK;
+    hw->rx_missed = mmio_read32(mmio, I40E_GLPRT_RDPC(p));
+    hw->rx_crcerrs = mmio_read32(mmio, I40E_GLPRT_CRCERRS(p));
+    hw->nq = 0;
+
+    return 0;
+}
+
+/*
+ * Program a flow director filter through the reserved TX queue; a programming
+ * descriptor is followed by a dummy packet of the flow
+ */
+static int
+_i40e_fd_program(struct i40e_device *dev, const struct netdev_filter *f,
+                 int id, int add)
+{
+    struct i40e_fd_prog_desc *prog;
+    struct i40e_tx_desc_data *txdesc;
+    struct mbuf *m;
+    u8 *pkt;
+    int q;
+    int len;
+    int pctype;
+    u64 deadline;
+
+    q = I40E_TXQ_FD;
+    if ( 6 == f->proto ) {
+        pctype = I40E_PCTYPE_NONF_IPV4_TCP;
+        len = 14 + 20 + 20;
+    } else {
+        pctype = I40E_PCTYPE_NONF_IPV4_UDP;
+        len = 14 + 20 + 8;
+    }
+
+    /* Programming descriptor */
+    prog = (struct i40e_fd_prog_desc *)
+        (dev->txq[q].base + dev->txq[q].tail * sizeof(struct i40e_fd_prog_desc));
+    mbuf_free(dev->txq[q].mbufs[dev->txq[q].tail]);
+    dev->txq[q].mbufs[dev->txq[q].tail] = NULL;
+    prog->qindex_pctype_vsi = (f->q & 0x7ff) | ((u32)pctype << 17)
+        | ((u32)(dev->vsi_num & 0x1ff) << 23);
+    prog->rsv = 0;
+    prog->dtype_cmd_cntindex = I40E_FD_DTYPE
+        | ((add ? I40E_FD_PCMD_ADD : I40E_FD_PCMD_REMOVE) << 4)
+        | (I40E_FD_DEST_QINDEX << 7);
+    prog->fd_id = id;
+    dev->txq[q].tail = (dev->txq[q].tail + 1) & dev->txq[q].bufmask;
+
+    /* Dummy packet */
+    m = dev->txq[q].mbufs[dev->txq[q].tail];
+    if ( NULL == m ) {
+        m = mbuf_alloc(mbufpool);
+        if ( NULL == m ) {
+            return -1;
+        }
+        dev->txq[q].mbufs[dev->txq[q].tail] = m;
+    }
+    pkt = MBUF_DATA(m);
+    kmemset(pkt, 0, len);
+    pkt[12] = 0x08;
+    pkt[13] = 0x00;
+    pkt[14] = 0x45;
+    pkt[16] = (len - 14) >> 8;
+    pkt[17] = (len - 14) & 0xff;
+    pkt[22] = 64;
+    pkt[23] = f->proto;
+    *(u32 *)(pkt + 26) = f->saddr;
+    *(u32 *)(pkt + 30) = f->daddr;
+    *(u16 *)(pkt + 34) = f->sport;
+    *(u16 *)(pkt + 36) = f->dport;
+    if ( 6 == f->proto ) {
+        pkt[46] = 0x50;
+    } else {
+        pkt[38] = 0;
+        pkt[39] = 8;
+    }
+    txdesc = (struct i40e_tx_desc_data *)
+        (dev->txq[q].base + dev->txq[q].tail * sizeof(struct i40e_tx_desc_data));
+    txdesc->pkt_addr = MBUF_ADDR(m);
+    txdesc->l2tag = 0;
+    txdesc->txbufsz_offset = ((u32)len << 18);
+    /* EOP, RS, DUMMY */
+    txdesc->rsv_cmd_dtyp = ((1) | (1<<1) | (1<<4)) << 4;
+    dev->txq[q].tail = (dev->txq[q].tail + 1) & dev->txq[q].bufmask;
+
+    mmio_write32(dev->mmio, I40E_QTX_TAIL(q), dev->txq[q].tail);
+
+    /* Wait for the descriptors to be consumed */
+    deadline = arch_clock_get() + I40E_FD_TIMEOUT;
+    while ( *(volatile u32 *)&dev->txq[q].headwb != dev->txq[q].tail ) {
+        if ( arch_clock_get() > deadline ) {
+            return -1;
+        }
+        arch_busy_usleep(1);
+    }
+
+    return 0;
+}
+
+/*
+ * Add a queue filter; EtherType filters are added by the admin command, and
+ * 5-tuple filters are programmed to the flow director.  Return the filter ID.
+ */
+int
+i40e_filter_add(struct netdev *netdev, const struct netdev_filter *f)
+{
+    struct i40e_device *dev;
+    struct i40e_aq_desc desc;
+    int i;
+
+    dev = (struct i40e_device *)netdev->vendor;
+
+    if ( f->q < 0 || f->q >= dev->nrxq ) {
+        return -1;
+    }
 
+    if ( NETDEV_FILTER_ETYPE == f->type ) {
+        for ( i = 0; i < I40E_ETF_NUM; i++ ) {
+            if ( !dev->etf[i].used ) {
+                break;
+            }
+        }
+        if ( i >= I40E_ETF_NUM ) {
+            return -1;
+        }
+        /* Note that the firmware rejects IPv4 and IPv6 */
+        i40e_aq_cmd_ctrl_pkt_filter(&desc, 1, f->etype, dev->vsi_seid, f->q);
+        if ( 0 != i40e_aq_exec(dev, &desc, NULL, 0) ) {
+            return -1;
+        }
+        dev->etf[i].etype = f->etype;
+        dev->etf[i].q = f->q;
+        dev->etf[i].used = 1;
+
+        return i;
+    } else if ( NETDEV_FILTER_5TUPLE == f->type ) {
+        /* The input set of the flow director is the full 5-tuple of TCP and
+           UDP over IPv4 */
+        if ( (f->fields & 0x1f) != 0x1f ) {
+            return -1;
+        }
+        if ( 6 != f->proto && 17 != f->proto ) {
+            return -1;
+        }
+        for ( i = 0; i < I40E_FDF_NUM; i++ ) {
+            if ( !dev->fdf_used[i] ) {
+                break;
+            }
+        }
+        if ( i >= I40E_FDF_NUM ) {
+            return -1;
+        }
+        if ( _i40e_fd_program(dev, f, i, 1) < 0 ) {
+            return -1;
+        }
+        dev->fdf[i] = *f;
+        dev->fdf_used[i] = 1;
+
+        return I40E_ETF_NUM + i;
+    }
+
+    return -1;
+}
+
+/*
+ * Delete a queue filter
+ */
+int
+i40e_filter_del(struct netdev *netdev, int id)
+{
+    struct i40e_device *dev;
+    struct i40e_aq_desc desc;
+
+    dev = (struct i40e_device *)netdev->vendor;
+
+    if ( id < 0 ) {
+        return -1;
+    } else if ( id < I40E_ETF_NUM ) {
+        if ( !dev->etf[id].used ) {
+            return -1;
+        }
+        i40e_aq_cmd_ctrl_pkt_filter(&desc, 0, dev->etf[id].etype,
+                                    dev->vsi_seid, dev->etf[id].q);
+        if ( 0 != i40e_aq_exec(dev, &desc, NULL, 0) ) {
+            return -1;
+        }
+        dev->etf[id].used = 0;
+    } else if ( id < I40E_ETF_NUM + I40E_FDF_NUM ) {
+        id -= I40E_ETF_NUM;
+        if ( !dev->fdf_used[id] ) {
+            return -1;
+        }
+        if ( _i40e_fd_program(dev, &dev->fdf[id], id, 0) < 0 ) {
+            return -1;
+        }
+        dev->fdf_used[id] = 0;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Forward the packets from netdev1 to netdev2 on this processor; the RX queue
+ * is the one assigned to this processor, so that the forwarding scales by
+ * running this on multiple processors.  This runs on the burst API, not on
+ * the ixgbe forwarder, which drives the ixgbe descriptors directly.
+ */
+#define I40E_FWD_BURST  32
+int
+i40e_forwarding_test(struct netdev *netdev1, struct netdev *netdev2)
+{
+    struct mbuf *mbufs[I40E_FWD_BURST];
+    u8 *txpkt;
+    int q;
+    int txq;
+    int n;
+    int ntx;
+    int i;
+
+    q = netdev_rxq(netdev1, this_cpu());
+    txq = q % netdev2->ntxq;
+    kprintf("Forwarding %s (queue %d) => %s (queue %d)\r\n", netdev1->name,
+            q, netdev2->name, txq);
+
+    for ( ;; ) {
+        n = netdev1->rx_burst(netdev1, q, mbufs, I40E_FWD_BURST);
+        for ( i = 0; i < n; i++ ) {
+            txpkt = MBUF_DATA(mbufs[i]);
+            *(u32 *)(txpkt + 0) =  0x67664000LLU;
+            *(u16 *)(txpkt + 4) =  0x2472LLU;
+            /* src */
+            *(u8 *)(txpkt + 6) =  *((u8 *)netdev2->macaddr);
+            *(u8 *)(txpkt + 7) =  *((u8 *)netdev2->macaddr + 1);
+            *(u32 *)(txpkt + 8) =  *((u32 *)(netdev2->macaddr + 2));
+        }
+        if ( n > 0 ) {
+            ntx = netdev2->tx_burst(netdev2, txq, mbufs, n);
+            if ( ntx < n ) {
+                /* Drop */
+                mbuf_free_bulk(mbufs + ntx, n - ntx);
+            }
         }
     }
 
@@ -13,7 +13,8 @@
 
 void pause(void);
 
-#define PKTSZ   4096
+/* Must be equal to or smaller than the dataroom of the packet buffer pool */
+#define PKTSZ   MBUF_DATAROOM
 //#define PKTSZ   256
 
 #define PCI_VENDOR_INTEL        0x8086
@@ -25,11 +26,20 @@ void pause(void);
 #define IXGBE_REG_RAH(n)        0xa204 + 8 * (n)
 #define IXGBE_REG_CTRL          0x0000
 #define IXGBE_REG_CTRL_EXT      0x0018
+#define IXGBE_REG_EICR          0x0800
+#define IXGBE_REG_EITR(n)       (0x0820 + 4 * (n))      /* n < 24 */
+#define IXGBE_REG_EIMS          0x0880
 #define IXGBE_REG_EIMC          0x0888
+#define IXGBE_REG_IVAR(n)       (0x0900 + 4 * (n))
+#define IXGBE_REG_EIAC          0x0810
+#define IXGBE_REG_GPIE          0x0898
 #define IXGBE_REG_MTA           0x5200  /* x128 */
 #define IXGBE_REG_SRRCTL0       0x2100
+#define IXGBE_REG_PSRTYPE(n)    (0x0ea00 + 4 * (n))
 #define IXGBE_REG_RDRXCTL       0x2f00
 #define IXGBE_REG_RXDCTL0       0x1028
+#define IXGBE_REG_RXDCTL(n)     (0x1028 + 0x40 * (n))   /* n < 64 */
+#define IXGBE_REG_SRRCTL(n)     (0x2100 + 4 * (n))      /* n < 16 */
 #define IXGBE_REG_RXCTL         0x3000
 #define IXGBE_REG_RSCCTL        0x102c
 #define IXGBE_REG_FCTRL         0x5080
@@ -53,6 +63,65 @@ void pause(void);
 #define IXGBE_REG_TDWBAH(n)     (0x603c + 0x40 * (n))
 #define IXGBE_REG_DMATXCTL      0x4a80
 
+/* Statistics; cleared on read.  The queues are mapped to the per-queue
+   counters by RQSMR/TQSM (four queues per register). */
+#define IXGBE_REG_CRCERRS       0x04000
+#define IXGBE_REG_MPC(n)        (0x03fa0 + 4 * (n))     /* n < 8 */
+#define IXGBE_REG_GPRC          0x04074
+#define IXGBE_REG_GPTC          0x04080
+#define IXGBE_REG_GORCL         0x04088
+#define IXGBE_REG_GORCH         0x0408c
+#define IXGBE_REG_GOTCL         0x04090
+#define IXGBE_REG_GOTCH         0x04094
+#define IXGBE_REG_QPRC(n)       (0x01030 + 0x40 * (n))  /* n < 16 */
+#define IXGBE_REG_QPTC(n)       (0x08680 + 4 * (n))     /* n < 16 */
+#define IXGBE_REG_RQSMR(n)      (0x02300 + 4 * (n))     /* n < 32 */
+#define IXGBE_REG_TQSM(n)       (0x08600 + 4 * (n))     /* n < 32 */
+#define IXGBE_STAT_NQ           16
+
+/* Queue filters */
+#define IXGBE_REG_ETQF(n)       (0x05128 + 4 * (n))
+#define IXGBE_REG_ETQS(n)       (0x0ec00 + 4 * (n))
+#define IXGBE_REG_SAQF(n)       (0x0e000 + 4 * (n))
+#define IXGBE_REG_DAQF(n)       (0x0e200 + 4 * (n))
+#define IXGBE_REG_SDPQF(n)      (0x0e400 + 4 * (n))
+#define IXGBE_REG_FTQF(n)       (0x0e600 + 4 * (n))
+#define IXGBE_REG_L34T_IMIR(n)  (0x0e800 + 4 * (n))
+#define IXGBE_ETQF_NUM          8
+#define IXGBE_FTQF_NUM          128
+#define IXGBE_ETQF_FILTER_EN    (1U<<31)
+#define IXGBE_ETQS_QUEUE_EN     (1U<<31)
+#define IXGBE_ETQS_RX_QUEUE(q)  ((u32)(q) << 16)
+#define IXGBE_FTQF_PROTO_TCP    0
+#define IXGBE_FTQF_PROTO_UDP    1
+#define IXGBE_FTQF_PROTO_SCTP   2
+#define IXGBE_FTQF_PROTO_OTHER  3
+#define IXGBE_FTQF_PRIO(p)      ((u32)(p) << 2)
+#define IXGBE_FTQF_MASK_SADDR   (1<<25)         /* Do not compare */
+#define IXGBE_FTQF_MASK_DADDR   (1<<26)
+#define IXGBE_FTQF_MASK_SPORT   (1<<27)
+#define IXGBE_FTQF_MASK_DPORT   (1<<28)
+#define IXGBE_FTQF_MASK_PROTO   (1<<29)
+#define IXGBE_FTQF_MASK_POOL    (1<<30)
+#define IXGBE_FTQF_QUEUE_EN     (1U<<31)
+#define IXGBE_IMIR_SIZE_BP      (1<<12)
+#define IXGBE_IMIR_CTRL_BP      (1<<19)
+#define IXGBE_IMIR_RX_QUEUE(q)  ((u32)(q) << 21)
+
+/* RX queue for the control traffic steered by the filters */
+#define IXGBE_RXQ_CTRL          1
+/* The forwarder polls the control queue when idle or every this iterations */
+#define IXGBE_CTRL_POLL_INTVL   1024
+#define IXGBE_CTRL_BURST        8
+
+/* Interrupt causes; the RX queue q is mapped to the cause bit q by IVAR */
+#define IXGBE_IVAR_ALLOC_VAL    (1<<7)
+#define IXGBE_EICR_RTXQ(q)      (1U<<(q))
+#define IXGBE_EITR_INTVL(usec)  ((u32)((usec) / 2) << 3)        /* 2 us */
+#define IXGBE_GPIE_MSIX_MODE    (1<<4)
+#define IXGBE_GPIE_EIAME        (1<<30)
+#define IXGBE_GPIE_PBA_SUPPORT  (1U<<31)
+
 /* RSS */
 #define IXGBE_REG_RETA(n)       (0x05c00 + 4 * (n))
 #define IXGBE_REG_MRQC          0x05818
@@ -65,6 +134,15 @@ void pause(void);
 #define IXGBE_REG_DCA_ID        0x11070
 #define IXGBE_REG_DCA_CTRL      0x11074
 
+#define IXGBE_DCA_CTRL_DIS              (1<<0)
+#define IXGBE_DCA_CTRL_MODE_CB2         (1<<1)
+#define IXGBE_DCA_RXCTRL_DESC_EN        (1<<5)
+#define IXGBE_DCA_RXCTRL_HEAD_EN        (1<<6)
+#define IXGBE_DCA_RXCTRL_DATA_EN        (1<<7)
+#define IXGBE_DCA_TXCTRL_DESC_EN        (1<<5)
+#define IXGBE_DCA_CPUID(id)             ((u32)(id) << 24)
+#define IXGBE_DCA_CPUID_MASK            (0xffU << 24)
+
 #define IXGBE_CTRL_LRST (1<<3)  /* Link reset */
 #define IXGBE_CTRL_PCIE_MASTER_DISABLE  (u32)(1<<2)
 #define IXGBE_CTRL_RST  (1<<26)
@@ -79,6 +157,26 @@ void pause(void);
 #define IXGBE_SRRCTL_BSIZE_PKT16K       (16)
 #define IXGBE_SRRCTL_BSIZE_HDR256       (4<<8)
 #define IXGBE_SRRCTL_DESCTYPE_LEGACY    (0)
+#define IXGBE_SRRCTL_DESCTYPE_ADV       (1<<25)
+#define IXGBE_SRRCTL_DESCTYPE_HSPLIT    (2<<25)
+#define IXGBE_SRRCTL_DROP_EN            (1<<28)
+
+/* Headers to be split */
+#define IXGBE_PSRTYPE_TCPHDR    (1<<4)
+#define IXGBE_PSRTYPE_UDPHDR    (1<<5)
+#define IXGBE_PSRTYPE_IPV4HDR   (1<<8)
+#define IXGBE_PSRTYPE_L2HDR     (1<<12)
+
+/* Write-back of the header split */
+#define IXGBE_RXDADV_HDRLEN(info0)      (((info0) >> 21) & 0x3ff)
+#define IXGBE_RXDADV_SPH                (1U<<31)
+/* VLAN tag stripped to wb.vlan */
+#define IXGBE_RXDADV_STAT_VP            (1<<3)
+
+/* TX descriptor command and options */
+#define IXGBE_TXD_CMD_VLE       (1<<6)
+#define IXGBE_TXD_POPTS_CC      (1<<7)
+#define IXGBE_TXD_IDX(n)        ((n) << 4)
 
 #define IXGBE_RXDCTL_ENABLE     (1<<25)
 #define IXGBE_RXDCTL_VME        (1<<30)
@@ -144,25 +242,75 @@ struct ixgbe_tx_ring {
     u32 bufsz;
     u32 divisorm;
     u32 head_cache;
-    u64 dummy[5];
+    /* Buffers attached to the descriptors */
+    struct mbuf **mbufs;
+    /* Offload parameters of the last context descriptor */
+    u64 ctx;
+    u64 dummy[3];
+} __attribute__ ((aligned(64)));
+
+/* Simple RX ring without header split */
+struct ixgbe_rx_ring {
+    u64 base;
+    u32 tail;
+    u32 bufsz;
+    u32 divisorm;
+    struct ixgbe_adv_rx_desc_read *read;
+    /* Packet being received over multiple descriptors */
+    struct mbuf *pkt;
+    struct mbuf *last;
 } __attribute__ ((aligned(64)));
 
+struct ixgbe_device;
+
+/* MSI-X vector of an RX queue; the entry q of the table is used for the
+   queue q */
+struct ixgbe_intr {
+    struct ixgbe_device *dev;
+    int q;
+    int vec;
+    /* Destination processor (APIC ID) */
+    int cpu;
+};
+
 struct ixgbe_device {
     u64 mmio;
 
     u8 macaddr[6];
     struct pci_device *pci_device;
 
-    u64 rx_base;
+    /* Cursors of the first RX queue, apart from the read-mostly fields */
+    u64 rx_base __attribute__ ((aligned(64)));
     u32 rx_tail;
     u32 rx_bufsz;
     u32 rx_divisorm;
     /* Cache */
     u32 rx_head_cache;
     struct ixgbe_adv_rx_desc_read *rx_read[1];
+    /* Packet being received over multiple descriptors */
+    struct mbuf *rx_pkt;
+    struct mbuf *rx_last;
+    /* Header split; hdr_addr of rx_read[] holds header buffers if set */
+    int rx_hsplit;
+
+    /* Control queue (IXGBE_RXQ_CTRL) and the filters in use */
+    struct ixgbe_rx_ring rxc;
+    u8 etqf_used;
+    u32 ftqf_used[IXGBE_FTQF_NUM / 32];
+    /* Control traffic steered for the forwarder */
+    int fwd_ctrl;
 
     struct ixgbe_tx_ring tx[8];
     u32 *tx_head;
+
+    struct netdev *netdev;
+    /* Per-queue interrupts with MSI-X; INTx is used otherwise */
+    int msix;
+    struct ixgbe_intr rxintr[IXGBE_RXQ_CTRL + 1];
+
+    /* Hardware counters accumulated by ixgbe_hwstats() */
+    struct netdev_hwstats hw;
+    volatile int hw_lock;
 };
 
 struct my_cpu_dev {
@@ -171,13 +319,30 @@ struct my_cpu_dev {
         u64 base;
         struct ixgbe_adv_rx_desc_read *read;
         u32 tail;
+        int hsplit;
+        /* Descriptors and headers are pushed to the cache by DCA */
+        int dca;
+        /* Device whose control queue is polled at low priority; NULL if
+           the control traffic is not steered */
+        struct netdev *ctrl;
+        u32 ctrl_cnt;
+        /* Device of the RX queue; sleeps on its interrupt in the hybrid
+           mode (see netdev_rx_idle()) */
+        struct netdev *netdev;
+        /* Counters of this processor for the device */
+        struct netdev_stats *stats;
     } rx[1];
     struct {
         u64 mmio;
         u64 base;
         u32 tail;
         u32 head_cache;
+        /* VLAN tag in the context descriptor of index 1 (0 if none) */
+        u16 vlan;
+        struct netdev_stats *stats;
     } tx[8];
+    /* FIB replica on the NUMA node of this processor */
+    struct dxr *fib;
 } __attribute__ ((aligned(64)));
 
 
@@ -188,6 +353,23 @@ int ixgbe_setup_rx_desc(struct ixgbe_device *);
 int ixgbe_setup_tx_desc(struct ixgbe_device *);
 int ixgbe_recvpkt(u8 *, u32, struct netdev *);
 int ixgbe_sendpkt(const u8 *, u32, struct netdev *);
+int ixgbe_rx_burst(struct netdev *, int, struct mbuf **, int);
+int ixgbe_tx_burst(struct netdev *, int, struct mbuf **, int);
+int ixgbe_rx_hsplit(struct netdev *, int);
+int ixgbe_filter_add(struct netdev *, const struct netdev_filter *);
+int ixgbe_filter_del(struct netdev *, int);
+int ixgbe_rx_intr(struct netdev *, int, int);
+int ixgbe_rx_itr(struct netdev *, int, int);
+int ixgbe_hwstats(struct netdev *, struct netdev_hwstats *);
+void ixgbe_irq_handler(int, void *);
+static int _ixgbe_setup_msix(struct ixgbe_device *);
+static void _ixgbe_hwstats_update(struct ixgbe_device *);
+int this_cpu(void);
+
+/* Direct cache access for the forwarder instead of the software prefetch */
+static int ixgbe_dca = 0;
+/* ACL in front of the forwarder */
+static struct acl_tree * volatile ixgbe_acl = NULL;
 
 int ixgbe_routing_test(struct netdev *);
 
@@ -245,6 +427,22 @@ ixgbe_update_hw(void)
                 netdev = netdev_add_device(dev->macaddr, dev);
                 netdev->recvpkt = ixgbe_recvpkt;
                 netdev->sendpkt = ixgbe_sendpkt;
+                netdev->rx_burst = ixgbe_rx_burst;
+                netdev->tx_burst = ixgbe_tx_burst;
+                netdev->rx_hsplit = ixgbe_rx_hsplit;
+                netdev->ntxq = 8;
+                netdev->nrxq = 2;
+                netdev->ctrlq = IXGBE_RXQ_CTRL;
+                netdev->filter_add = ixgbe_filter_add;
+                netdev->filter_del = ixgbe_filter_del;
+                netdev->rx_intr = ixgbe_rx_intr;
+                netdev->rx_itr = ixgbe_rx_itr;
+                netdev->hwstats = ixgbe_hwstats;
+                dev->netdev = netdev;
+                netdev->offload = NETDEV_OFFLOAD_IP_CKSUM
+                    | NETDEV_OFFLOAD_TCP_CKSUM | NETDEV_OFFLOAD_UDP_CKSUM
+                    | NETDEV_OFFLOAD_TSO | NETDEV_OFFLOAD_VLAN_STRIP
+                    | NETDEV_OFFLOAD_VLAN_INSERT;
                 idx++;
                 break;
             default:
@@ -337,11 +535,244 @@ ixgbe_init_hw(struct pci_device *pcidev)
     ixgbe_setup_rx_desc(dev);
     ixgbe_setup_tx_desc(dev);
 
+    /* Map the queue i to the per-queue counter i, and clear the counters */
+    for ( i = 0; i < IXGBE_STAT_NQ / 4; i++ ) {
+        m32 = (4 * i) | ((4 * i + 1) << 8) | ((4 * i + 2) << 16)
+            | ((u32)(4 * i + 3) << 24);
+        mmio_write32(dev->mmio, IXGBE_REG_RQSMR(i), m32);
+        mmio_write32(dev->mmio, IXGBE_REG_TQSM(i), m32);
+    }
+    kmemset(&dev->hw, 0, sizeof(struct netdev_hwstats));
+    dev->hw_lock = 0;
+    _ixgbe_hwstats_update(dev);
+    kmemset(&dev->hw, 0, sizeof(struct netdev_hwstats));
+
     dev->pci_device = pcidev;
 
+    /* Map the RX queues to the interrupt causes (masked until
+       ixgbe_rx_intr()), which are the MSI-X vectors of the same indices,
+       then set up MSI-X or the legacy IRQ handler */
+    dev->netdev = NULL;
+    mmio_write32(dev->mmio, IXGBE_REG_IVAR(0),
+                 (IXGBE_IVAR_ALLOC_VAL | 0)
+                 | ((IXGBE_IVAR_ALLOC_VAL | IXGBE_RXQ_CTRL) << 16));
+    (void)mmio_read32(dev->mmio, IXGBE_REG_EICR);
+    dev->msix = 0;
+    if ( _ixgbe_setup_msix(dev) < 0 ) {
+        register_irq_handler((((pcidev->intr_pin -1) + pcidev->slot) % 4)
+                             + 0x10, &ixgbe_irq_handler, dev);
+    }
+
     return dev;
 }
 
+/*
+ * MSI-X handler of an RX queue
+ */
+static void
+_ixgbe_msix_handler(int vec, void *user)
+{
+    struct ixgbe_intr *intr;
+
+    intr = (struct ixgbe_intr *)user;
+    if ( NULL != intr->dev->netdev ) {
+        netdev_rx_intr(intr->dev->netdev, intr->q);
+    }
+}
+
+/*
+ * Allocate a vector to each RX queue and enable MSI-X
+ */
+static int
+_ixgbe_setup_msix(struct ixgbe_device *dev)
+{
+    int q;
+    int vec;
+
+    if ( pci_msix_enable(dev->pci_device) < IXGBE_RXQ_CTRL + 1 ) {
+        pci_msix_disable(dev->pci_device);
+        return -1;
+    }
+
+    for ( q = 0; q <= IXGBE_RXQ_CTRL; q++ ) {
+        vec = alloc_intr_vector(&_ixgbe_msix_handler, &dev->rxintr[q]);
+        if ( vec < 0 ) {
+            /* Exhausted */
+            while ( --q >= 0 ) {
+                free_intr_vector(dev->rxintr[q].vec);
+            }
+            pci_msix_disable(dev->pci_device);
+            return -1;
+        }
+        dev->rxintr[q].dev = dev;
+        dev->rxintr[q].q = q;
+        dev->rxintr[q].vec = vec;
+        /* Retargeted to the processor owning the queue by ixgbe_rx_intr() */
+        dev->rxintr[q].cpu = this_cpu();
+        pci_msix_set_vector(dev->pci_device, q, vec, dev->rxintr[q].cpu);
+    }
+
+    /* The causes are cleared on the messages */
+    mmio_write32(dev->mmio, IXGBE_REG_GPIE, IXGBE_GPIE_MSIX_MODE
+                 | IXGBE_GPIE_EIAME | IXGBE_GPIE_PBA_SUPPORT);
+    mmio_write32(dev->mmio, IXGBE_REG_EIAC,
+                 IXGBE_EICR_RTXQ(0) | IXGBE_EICR_RTXQ(IXGBE_RXQ_CTRL));
+    dev->msix = 1;
+
+    return 0;
+}
+
+/*
+ * IRQ handler
+ */
+void
+ixgbe_irq_handler(int irq, void *user)
+{
+    struct ixgbe_device *dev;
+    u32 eicr;
+    int q;
+
+    dev = (struct ixgbe_device *)user;
+    /* Read and clear */
+    eicr = mmio_read32(dev->mmio, IXGBE_REG_EICR);
+    if ( NULL == dev->netdev ) {
+        return;
+    }
+    for ( q = 0; q < dev->netdev->nrxq; q++ ) {
+        if ( eicr & IXGBE_EICR_RTXQ(q) ) {
+            netdev_rx_intr(dev->netdev, q);
+        }
+    }
+}
+
+/*
+ * Enable/disable the RX interrupt of the queue q
+ */
+int
+ixgbe_rx_intr(struct netdev *netdev, int q, int on)
+{
+    struct ixgbe_device *dev;
+
+    dev = (struct ixgbe_device *)netdev->vendor;
+    if ( q < 0 || q >= netdev->nrxq ) {
+        return -1;
+    }
+    if ( on ) {
+        if ( dev->msix && dev->rxintr[q].cpu != this_cpu() ) {
+            /* Deliver to the local APIC of this processor polling the
+               queue */
+            dev->rxintr[q].cpu = this_cpu();
+            pci_msix_set_vector(dev->pci_device, q, dev->rxintr[q].vec,
+                                dev->rxintr[q].cpu);
+        }
+        mmio_write32(dev->mmio, IXGBE_REG_EIMS, IXGBE_EICR_RTXQ(q));
+    } else {
+        mmio_write32(dev->mmio, IXGBE_REG_EIMC, IXGBE_EICR_RTXQ(q));
+    }
+
+    return 0;
+}
+
+/*
+ * Set the minimum interval between the interrupts of the queue q
+ */
+int
+ixgbe_rx_itr(struct netdev *netdev, int q, int usec)
+{
+    struct ixgbe_device *dev;
+
+    dev = (struct ixgbe_device *)netdev->vendor;
+    if ( q < 0 || q >= netdev->nrxq ) {
+        return -1;
+    }
+    mmio_write32(dev->mmio, IXGBE_REG_EITR(q), IXGBE_EITR_INTVL(usec));
+
+    return 0;
+}
+
+/*
+ * Allocate the memory of a descriptor ring from the NUMA node; freed with
+ * kfree().  The rings are allocated on the node of the processor initializing
+ * the device, then moved to the node of the forwarder binding them (see
+ * _ixgbe_rx_ring_move() and _ixgbe_tx_ring_move()).
+ */
+static void *
+_ixgbe_ring_alloc(u64 sz, int node)
+{
+    return phys_mem_alloc_pages_node((sz + PAGESIZE - 1) / PAGESIZE, node);
+}
+
+/*
+ * Setup an RX ring of the queue q other than the first one
+ */
+static int
+_ixgbe_setup_rx_ring(struct ixgbe_device *dev, struct ixgbe_rx_ring *ring,
+                     int q, int bufsz)
+{
+    union ixgbe_adv_rx_desc *rxdesc;
+    struct mbuf *mbuf;
+    int i;
+    u32 m32;
+
+    ring->tail = 0;
+    ring->bufsz = bufsz;
+    ring->divisorm = bufsz - 1;
+    ring->pkt = NULL;
+    ring->last = NULL;
+    ring->read = _ixgbe_ring_alloc(bufsz
+                                   * sizeof(struct ixgbe_adv_rx_desc_read),
+                                   PERCPU(node));
+    if ( NULL == ring->read ) {
+        return -1;
+    }
+    ring->base = (u64)_ixgbe_ring_alloc(bufsz
+                                        * sizeof(union ixgbe_adv_rx_desc),
+                                        PERCPU(node));
+    if ( 0 == ring->base ) {
+        kfree(ring->read);
+        return -1;
+    }
+    for ( i = 0; i < bufsz; i++ ) {
+        rxdesc = (union ixgbe_adv_rx_desc *)
+            (ring->base + i * sizeof(union ixgbe_adv_rx_desc));
+        mbuf = mbuf_alloc(mbufpool);
+        if ( NULL == mbuf ) {
+            return -1;
+        }
+        rxdesc->read.pkt_addr = MBUF_ADDR(mbuf);
+        rxdesc->read.hdr_addr = 0;
+        ring->read[i].pkt_addr = rxdesc->read.pkt_addr;
+        ring->read[i].hdr_addr = 0;
+    }
+
+    mmio_write32(dev->mmio, IXGBE_REG_RDBAH(q), ring->base >> 32);
+    mmio_write32(dev->mmio, IXGBE_REG_RDBAL(q), ring->base & 0xffffffff);
+    mmio_write32(dev->mmio, IXGBE_REG_RDLEN(q),
+                 bufsz * sizeof(union ixgbe_adv_rx_desc));
+    mmio_write32(dev->mmio, IXGBE_REG_SRRCTL(q),
+                 IXGBE_SRRCTL_BSIZE_PKT4K | IXGBE_SRRCTL_DESCTYPE_ADV
+                 | IXGBE_SRRCTL_DROP_EN);
+
+    mmio_write32(dev->mmio, IXGBE_REG_RXDCTL(q),
+                 IXGBE_RXDCTL_ENABLE | IXGBE_RXDCTL_VME);
+    for ( i = 0; i < 10; i++ ) {
+        arch_busy_usleep(1);
+        m32 = mmio_read32(dev->mmio, IXGBE_REG_RXDCTL(q));
+        if ( m32 & IXGBE_RXDCTL_ENABLE ) {
+            break;
+        }
+    }
+    if ( !(m32 & IXGBE_RXDCTL_ENABLE) ) {
+        kprintf("Error on enable an RX queue (%d)\r\n", q);
+        return -1;
+    }
+
+    mmio_write32(dev->mmio, IXGBE_REG_RDH(q), 0);
+    mmio_write32(dev->mmio, IXGBE_REG_RDT(q), bufsz - 1);
+
+    return 0;
+}
+
 /*
  * Setup RX descriptor
  */
@@ -349,6 +780,7 @@ int
 ixgbe_setup_rx_desc(struct ixgbe_device *dev)
 {
     union ixgbe_adv_rx_desc *rxdesc;
+    struct mbuf *mbuf;
     int i;
     u32 m32;
 
@@ -359,18 +791,23 @@ ixgbe_setup_rx_desc(struct ixgbe_device *dev)
     dev->rx_divisorm = (1<<8) - 1;
     /* Cache */
     dev->rx_head_cache = 0;
+    dev->rx_pkt = NULL;
+    dev->rx_last = NULL;
+    dev->rx_hsplit = 0;
 
     /* Allocate memory for RX descriptors */
-    dev->rx_read[0] = kmalloc(dev->rx_bufsz
-                              * sizeof(struct ixgbe_adv_rx_desc_read));
+    dev->rx_read[0] = _ixgbe_ring_alloc(dev->rx_bufsz
+                                        * sizeof(struct ixgbe_adv_rx_desc_read),
+                                        PERCPU(node));
     if ( 0 == dev->rx_read[0] ) {
         kfree(dev);
         return NULL;
     }
 
     /* ToDo: 16 bytes for alignment */
-    dev->rx_base = (u64)kmalloc(dev->rx_bufsz
-                                * sizeof(union ixgbe_adv_rx_desc));
+    dev->rx_base = (u64)_ixgbe_ring_alloc(dev->rx_bufsz
+                                          * sizeof(union ixgbe_adv_rx_desc),
+                                          PERCPU(node));
     if ( 0 == dev->rx_base ) {
         kfree(dev);
         return NULL;
@@ -378,7 +815,11 @@ ixgbe_setup_rx_desc(struct ixgbe_device *dev)
     for ( i = 0; i < dev->rx_bufsz; i++ ) {
         rxdesc = (union ixgbe_adv_rx_desc *)(dev->rx_base
                                              + i * sizeof(union ixgbe_adv_rx_desc));
-        rxdesc->read.pkt_addr = (u64)kmalloc(PKTSZ);
+        mbuf = mbuf_alloc(mbufpool);
+        if ( NULL == mbuf ) {
+            return -1;
+        }
+        rxdesc->read.pkt_addr = MBUF_ADDR(mbuf);
         //rxdesc->read.pkt_addr += (i * 64) % 1024;
         rxdesc->read.hdr_addr = 0;//(u64)kmalloc(4096);
 
@@ -391,10 +832,11 @@ ixgbe_setup_rx_desc(struct ixgbe_device *dev)
     mmio_write32(dev->mmio, IXGBE_REG_RDLEN(0),
                  dev->rx_bufsz * sizeof(union ixgbe_adv_rx_desc));
 
+    /* Header split is disabled by default; see ixgbe_rx_hsplit() */
     mmio_write32(dev->mmio, IXGBE_REG_SRRCTL0,
-                 IXGBE_SRRCTL_BSIZE_PKT4K /*| IXGBE_SRRCTL_BSIZE_HDR256*/
-                 | /*IXGBE_SRRCTL_DESCTYPE_LEGACY*/(1<<25) | (1<<28)
-                 | (0<<22));
+                 IXGBE_SRRCTL_BSIZE_PKT4K | IXGBE_SRRCTL_DESCTYPE_ADV
+                 | IXGBE_SRRCTL_DROP_EN | (0<<22));
+    mmio_write32(dev->mmio, IXGBE_REG_PSRTYPE(0), 0);
 
     /* Support jumbo frame */
 #if 1
@@ -428,6 +870,18 @@ ixgbe_setup_rx_desc(struct ixgbe_device *dev)
     /* RDT must be larger than 0 for the initial value to receive the first
        packet but I don't know why: See 4.6.7 */
     mmio_write32(dev->mmio, IXGBE_REG_RDT(0), dev->rx_bufsz - 1);
+
+    /* Control queue */
+    if ( _ixgbe_setup_rx_ring(dev, &dev->rxc, IXGBE_RXQ_CTRL, 64) < 0 ) {
+        kprintf("Error on setup the control queue\r\n");
+        return -1;
+    }
+    dev->etqf_used = 0;
+    dev->fwd_ctrl = 0;
+    for ( i = 0; i < IXGBE_FTQF_NUM / 32; i++ ) {
+        dev->ftqf_used[i] = 0;
+    }
+
     mmio_write32(dev->mmio, IXGBE_REG_RXCTL, IXGBE_RXCTL_RXEN);
 
 
@@ -441,6 +895,7 @@ int
 ixgbe_setup_tx_desc(struct ixgbe_device *dev)
 {
     struct ixgbe_adv_tx_desc_data *txdesc;
+    struct mbuf *mbuf;
     int i;
     u32 m32;
     int q;
@@ -452,14 +907,27 @@ ixgbe_setup_tx_desc(struct ixgbe_device *dev)
         dev->tx[q].divisorm = (1<<8) - 1;
         /* Cache */
         dev->tx[q].head_cache = 0;
+        dev->tx[q].ctx = 0;
 
         /* ToDo: 16 bytes for alignment */
-        dev->tx[q].base = (u64)kmalloc(dev->tx[q].bufsz
-                                       * sizeof(struct ixgbe_adv_tx_desc_data));
+        dev->tx[q].base = (u64)_ixgbe_ring_alloc(dev->tx[q].bufsz
+                                                 * sizeof(struct ixgbe_adv_tx_desc_data),
+                                                 PERCPU(node));
+        dev->tx[q].mbufs = _ixgbe_ring_alloc(dev->tx[q].bufsz
+                                             * sizeof(struct mbuf *),
+                                             PERCPU(node));
+        if ( NULL == dev->tx[q].mbufs ) {
+            return -1;
+        }
         for ( i = 0; i < dev->tx[q].bufsz; i++ ) {
             txdesc = (struct ixgbe_adv_tx_desc_data *)
                 (dev->tx[q].base + i * sizeof(struct ixgbe_adv_tx_desc_data));
-            txdesc->pkt_addr = (u64)kmalloc(PKTSZ);
+            mbuf = mbuf_alloc(mbufpool);
+            if ( NULL == mbuf ) {
+                return -1;
+            }
+            dev->tx[q].mbufs[i] = mbuf;
+            txdesc->pkt_addr = MBUF_ADDR(mbuf);
             //txdesc->pkt_addr += (i * 64) % 1024;
             txdesc->length = 0;
             txdesc->dtyp_mac = (3 << 4);
@@ -506,84 +974,883 @@ ixgbe_setup_tx_desc(struct ixgbe_device *dev)
                 break;
             }
         }
-        if ( !(m32 & IXGBE_TXDCTL_ENABLE) ) {
-            kprintf("Error on enable a TX queue\r\n");
+        if ( !(m32 & IXGBE_TXDCTL_ENABLE) ) {
+            kprintf("Error on enable a TX queue\r\n");
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Move the RX ring of the queue 0 to the NUMA node; the buffers stay armed in
+ * the same slots, but the packets received and not yet processed are dropped
+ */
+static int
+_ixgbe_rx_ring_move(struct ixgbe_device *dev, int node)
+{
+    union ixgbe_adv_rx_desc *rxdesc;
+    struct ixgbe_adv_rx_desc_read *read;
+    u64 base;
+    int i;
+    u32 m32;
+
+    if ( phys_mem_node((void *)dev->rx_base) == node ) {
+        return 0;
+    }
+    read = _ixgbe_ring_alloc(dev->rx_bufsz
+                             * sizeof(struct ixgbe_adv_rx_desc_read), node);
+    if ( NULL == read ) {
+        return -1;
+    }
+    base = (u64)_ixgbe_ring_alloc(dev->rx_bufsz
+                                  * sizeof(union ixgbe_adv_rx_desc), node);
+    if ( 0 == base ) {
+        kfree(read);
+        return -1;
+    }
+
+    /* Disable the queue before replacing the ring */
+    mmio_write32(dev->mmio, IXGBE_REG_RXDCTL0,
+                 mmio_read32(dev->mmio, IXGBE_REG_RXDCTL0)
+                 & ~IXGBE_RXDCTL_ENABLE);
+    for ( i = 0; i < 100; i++ ) {
+        arch_busy_usleep(1);
+        m32 = mmio_read32(dev->mmio, IXGBE_REG_RXDCTL0);
+        if ( !(m32 & IXGBE_RXDCTL_ENABLE) ) {
+            break;
+        }
+    }
+    if ( m32 & IXGBE_RXDCTL_ENABLE ) {
+        kprintf("Error on disable an RX queue\r\n");
+        kfree((void *)base);
+        kfree(read);
+        return -1;
+    }
+
+    /* Re-arm the buffers of the slots */
+    for ( i = 0; i < dev->rx_bufsz; i++ ) {
+        rxdesc = (union ixgbe_adv_rx_desc *)
+            (base + i * sizeof(union ixgbe_adv_rx_desc));
+        read[i] = dev->rx_read[0][i];
+        rxdesc->read.pkt_addr = read[i].pkt_addr;
+        rxdesc->read.hdr_addr = read[i].hdr_addr;
+    }
+    kfree(dev->rx_read[0]);
+    kfree((void *)dev->rx_base);
+    dev->rx_read[0] = read;
+    dev->rx_base = base;
+    dev->rx_tail = 0;
+    dev->rx_head_cache = 0;
+    if ( NULL != dev->rx_pkt ) {
+        /* Drop the packet partially received */
+        mbuf_free(dev->rx_pkt);
+    }
+    dev->rx_pkt = NULL;
+    dev->rx_last = NULL;
+
+    mmio_write32(dev->mmio, IXGBE_REG_RDBAH(0), dev->rx_base >> 32);
+    mmio_write32(dev->mmio, IXGBE_REG_RDBAL(0), dev->rx_base & 0xffffffff);
+    mmio_write32(dev->mmio, IXGBE_REG_RDLEN(0),
+                 dev->rx_bufsz * sizeof(union ixgbe_adv_rx_desc));
+    mmio_write32(dev->mmio, IXGBE_REG_RXDCTL0,
+                 IXGBE_RXDCTL_ENABLE | IXGBE_RXDCTL_VME);
+    for ( i = 0; i < 10; i++ ) {
+        arch_busy_usleep(1);
+        m32 = mmio_read32(dev->mmio, IXGBE_REG_RXDCTL0);
+        if ( m32 & IXGBE_RXDCTL_ENABLE ) {
+            break;
+        }
+    }
+    if ( !(m32 & IXGBE_RXDCTL_ENABLE) ) {
+        kprintf("Error on enable an RX queue\r\n");
+        return -1;
+    }
+    mmio_write32(dev->mmio, IXGBE_REG_RDH(0), 0);
+    mmio_write32(dev->mmio, IXGBE_REG_RDT(0), dev->rx_bufsz - 1);
+
+    return 0;
+}
+
+/*
+ * Move the TX ring of the queue q to the NUMA node after the queued packets
+ * are sent; the descriptors keep their buffers
+ */
+static int
+_ixgbe_tx_ring_move(struct ixgbe_device *dev, int q, int node)
+{
+    struct mbuf **mbufs;
+    u64 base;
+    int i;
+    u32 m32;
+
+    if ( phys_mem_node((void *)dev->tx[q].base) == node ) {
+        return 0;
+    }
+    base = (u64)_ixgbe_ring_alloc(dev->tx[q].bufsz
+                                  * sizeof(struct ixgbe_adv_tx_desc_data),
+                                  node);
+    if ( 0 == base ) {
+        return -1;
+    }
+    mbufs = _ixgbe_ring_alloc(dev->tx[q].bufsz * sizeof(struct mbuf *), node);
+    if ( NULL == mbufs ) {
+        kfree((void *)base);
+        return -1;
+    }
+
+    /* Wait for the queued packets (up to 100 ms, e.g., when the link is
+       down), then disable the queue */
+    for ( i = 0; i < 10000; i++ ) {
+        if ( mmio_read32(dev->mmio, IXGBE_REG_TDH(q)) == dev->tx[q].tail ) {
+            break;
+        }
+        arch_busy_usleep(10);
+    }
+    if ( i >= 10000 ) {
+        kprintf("TX queue %d not drained; the ring is not moved\r\n", q);
+        kfree(mbufs);
+        kfree((void *)base);
+        return -1;
+    }
+    mmio_write32(dev->mmio, IXGBE_REG_TXDCTL(q), 0);
+    for ( i = 0; i < 100; i++ ) {
+        arch_busy_usleep(1);
+        m32 = mmio_read32(dev->mmio, IXGBE_REG_TXDCTL(q));
+        if ( !(m32 & IXGBE_TXDCTL_ENABLE) ) {
+            break;
+        }
+    }
+    if ( m32 & IXGBE_TXDCTL_ENABLE ) {
+        kprintf("Error on disable a TX queue\r\n");
+        kfree(mbufs);
+        kfree((void *)base);
+        return -1;
+    }
+
+    kmemcpy((void *)base, (void *)dev->tx[q].base,
+            dev->tx[q].bufsz * sizeof(struct ixgbe_adv_tx_desc_data));
+    kmemcpy(mbufs, dev->tx[q].mbufs, dev->tx[q].bufsz * sizeof(struct mbuf *));
+    kfree(dev->tx[q].mbufs);
+    kfree((void *)dev->tx[q].base);
+    dev->tx[q].base = base;
+    dev->tx[q].mbufs = mbufs;
+    dev->tx[q].tail = 0;
+    dev->tx[q].head_cache = 0;
+    /* The context is lost with the queue */
+    dev->tx[q].ctx = 0;
+
+    mmio_write32(dev->mmio, IXGBE_REG_TDBAH(q), dev->tx[q].base >> 32);
+    mmio_write32(dev->mmio, IXGBE_REG_TDBAL(q),
+                 dev->tx[q].base & 0xffffffffUL);
+    mmio_write32(dev->mmio, IXGBE_REG_TDLEN(q),
+                 dev->tx[q].bufsz * sizeof(struct ixgbe_tx_desc));
+    mmio_write32(dev->mmio, IXGBE_REG_TDH(q), 0);
+    mmio_write32(dev->mmio, IXGBE_REG_TDT(q), 0);
+    mmio_write32(dev->mmio, IXGBE_REG_TXDCTL(q), IXGBE_TXDCTL_ENABLE
+                 | (64<<16) /* WTHRESH */
+                 | (16<<8) /* HTHRESH */| (16) /* PTHRESH */);
+    for ( i = 0; i < 10; i++ ) {
+        arch_busy_usleep(1);
+        m32 = mmio_read32(dev->mmio, IXGBE_REG_TXDCTL(q));
+        if ( m32 & IXGBE_TXDCTL_ENABLE ) {
+            break;
+        }
+    }
+    if ( !(m32 & IXGBE_TXDCTL_ENABLE) ) {
+        kprintf("Error on enable a TX queue\r\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+ixgbe_recvpkt(u8 *pkt, u32 len, struct netdev *netdev)
+{
+    u32 rdh;
+    struct ixgbe_device *dev;
+    int rx_que;
+    struct ixgbe_rx_desc *rxdesc;
+    int ret;
+
+    dev = (struct ixgbe_device *)netdev->vendor;
+
+    rdh = mmio_read32(dev->mmio, IXGBE_REG_RDH(0));
+    rx_que = (dev->rx_bufsz - dev->rx_tail + rdh) % dev->rx_bufsz;
+    if ( rx_que > 0 ) {
+        /* Check the head of RX ring buffer */
+        rxdesc = (struct ixgbe_rx_desc *)
+            (((u64)dev->rx_base) + (dev->rx_tail % dev->rx_bufsz)
+             * sizeof(struct ixgbe_rx_desc));
+        ret = len < rxdesc->length ? len : rxdesc->length;
+        kmemcpy(pkt, (void *)rxdesc->address, ret);
+
+        rxdesc->checksum = 0;
+        rxdesc->status = 0;
+        rxdesc->errors = 0;
+        rxdesc->special = 0;
+
+        mmio_write32(dev->mmio, IXGBE_REG_RDT(0), dev->rx_tail);
+        dev->rx_tail = (dev->rx_tail + 1) % dev->rx_bufsz;
+
+        return ret;
+    }
+
+    return -1;
+}
+
+int
+ixgbe_sendpkt(const u8 *pkt, u32 len, struct netdev *netdev)
+{
+    u32 tdh;
+    struct ixgbe_device *dev;
+    int tx_avl;
+    struct ixgbe_tx_desc *txdesc;
+
+    dev = (struct ixgbe_device *)netdev->vendor;
+    tdh = mmio_read32(dev->mmio, IXGBE_REG_TDH(0));
+
+    tx_avl = dev->tx[0].bufsz - ((dev->tx[0].bufsz - tdh + dev->tx[0].tail)
+                                 % dev->tx[0].bufsz);
+
+    if ( tx_avl > 0 ) {
+        /* Check the head of TX ring buffer */
+        txdesc = (struct ixgbe_tx_desc *)
+            (((u64)dev->tx[0].base) + (dev->tx[0].tail % dev->tx[0].bufsz)
+             * sizeof(struct ixgbe_tx_desc));
+        if ( NULL == dev->tx[0].mbufs[dev->tx[0].tail] ) {
+            /* The slot was used by a context descriptor */
+            dev->tx[0].mbufs[dev->tx[0].tail] = mbuf_alloc(mbufpool);
+            if ( NULL == dev->tx[0].mbufs[dev->tx[0].tail] ) {
+                return -1;
+            }
+        }
+        txdesc->address = MBUF_ADDR(dev->tx[0].mbufs[dev->tx[0].tail]);
+        kmemcpy((void *)txdesc->address, pkt, len);
+
+        txdesc->length = len;
+        txdesc->sta = 0;
+        txdesc->css = 0;
+        txdesc->cso = 0;
+        txdesc->special = 0;
+        txdesc->cmd = (1<<3) | (1<<1) | 1;
+
+        dev->tx[0].tail = (dev->tx[0].tail + 1) % dev->tx[0].bufsz;
+        mmio_write32(dev->mmio, IXGBE_REG_TDT(0), dev->tx[0].tail);
+
+        return len;
+    }
+
+    return -1;
+}
+
+/*
+ * Receive up to n packets from a simple RX ring of the queue q
+ */
+static int
+_ixgbe_rx_burst_ring(struct ixgbe_device *dev, struct ixgbe_rx_ring *ring,
+                     int q, struct mbuf **mbufs, int n)
+{
+    union ixgbe_adv_rx_desc *rxdesc;
+    struct mbuf *m;
+    struct mbuf *nm;
+    u32 staterr;
+    int nrx;
+    int last;
+
+    nrx = 0;
+    last = -1;
+    while ( nrx < n ) {
+        rxdesc = (union ixgbe_adv_rx_desc *)
+            (ring->base + ring->tail * sizeof(union ixgbe_adv_rx_desc));
+        staterr = rxdesc->wb.staterr;
+        if ( !(staterr & 1) ) {
+            break;
+        }
+        nm = mbuf_alloc(mbufpool);
+        if ( NULL == nm ) {
+            break;
+        }
+        m = mbuf_from_addr(mbufpool, ring->read[ring->tail].pkt_addr);
+        m->len = rxdesc->wb.length;
+        m->pktlen = rxdesc->wb.length;
+        if ( NULL == ring->pkt ) {
+            ring->pkt = m;
+        } else {
+            ring->last->next = m;
+            ring->pkt->pktlen += m->len;
+        }
+        ring->last = m;
+        if ( staterr & (1<<1) ) {
+            if ( staterr & IXGBE_RXDADV_STAT_VP ) {
+                ring->pkt->vlan = rxdesc->wb.vlan;
+                ring->pkt->ol_flags |= MBUF_OL_RX_VLAN;
+            }
+            mbufs[nrx] = ring->pkt;
+            nrx++;
+            ring->pkt = NULL;
+            ring->last = NULL;
+        }
+
+        /* Refill */
+        ring->read[ring->tail].pkt_addr = MBUF_ADDR(nm);
+        rxdesc->read.pkt_addr = MBUF_ADDR(nm);
+        rxdesc->read.hdr_addr = 0;
+        last = ring->tail;
+        ring->tail = (ring->tail + 1) & ring->divisorm;
+    }
+
+    if ( last >= 0 ) {
+        mmio_write32(dev->mmio, IXGBE_REG_RDT(q), last);
+    }
+
+    return nrx;
+}
+
+/*
+ * Receive up to n packets without copy; the buffers attached to the RX
+ * descriptors are handed to the caller and replaced with new ones.  The
+ * buffer addresses are taken from rx_read[] since the write-back overwrites
+ * them in the descriptors.  With the header split, the header buffer is
+ * chained in front of the payload buffer.
+ */
+int
+ixgbe_rx_burst(struct netdev *netdev, int q, struct mbuf **mbufs, int n)
+{
+    struct ixgbe_device *dev;
+    union ixgbe_adv_rx_desc *rxdesc;
+    struct ixgbe_adv_rx_desc_read *read;
+    struct mbuf *m;
+    struct mbuf *h;
+    struct mbuf *nm;
+    struct mbuf *nh;
+    struct netdev_stats *st;
+    u32 staterr;
+    u32 hlen;
+    u64 bytes;
+    int nrx;
+    int last;
+    int nobuf;
+    int i;
+
+    dev = (struct ixgbe_device *)netdev->vendor;
+    if ( IXGBE_RXQ_CTRL == q ) {
+        nrx = _ixgbe_rx_burst_ring(dev, &dev->rxc, q, mbufs, n);
+        if ( nrx > 0 ) {
+            st = netdev_stats(netdev);
+            for ( i = 0; i < nrx; i++ ) {
+                st->c[NETDEV_STAT_RX_BYTES] += mbufs[i]->pktlen;
+            }
+            st->c[NETDEV_STAT_RX_PKTS] += nrx;
+        }
+        return nrx;
+    }
+
+    nrx = 0;
+    last = -1;
+    nh = NULL;
+    bytes = 0;
+    nobuf = 0;
+    while ( nrx < n ) {
+        rxdesc = (union ixgbe_adv_rx_desc *)
+            (dev->rx_base + dev->rx_tail * sizeof(union ixgbe_adv_rx_desc));
+        read = &dev->rx_read[0][dev->rx_tail];
+        staterr = rxdesc->wb.staterr;
+        if ( !(staterr & 1) ) {
+            /* Not written back yet */
+            break;
+        }
+
+        /* Allocate new buffers first not to lose the descriptor */
+        nm = mbuf_alloc(mbufpool);
+        if ( NULL == nm ) {
+            nobuf = 1;
+            break;
+        }
+        if ( dev->rx_hsplit ) {
+            nh = mbuf_alloc(mbufhdrpool);
+            if ( NULL == nh ) {
+                mbuf_free(nm);
+                nobuf = 1;
+                break;
+            }
+        }
+        m = mbuf_from_addr(mbufpool, read->pkt_addr);
+        m->len = rxdesc->wb.length;
+        m->pktlen = rxdesc->wb.length;
+
+        if ( dev->rx_hsplit ) {
+            h = mbuf_from_addr(mbufhdrpool, read->hdr_addr);
+            hlen = IXGBE_RXDADV_HDRLEN(rxdesc->wb.info0);
+            if ( (rxdesc->wb.info0 & IXGBE_RXDADV_SPH) && hlen > 0 ) {
+                /* Headers were split to the header buffer */
+                h->len = hlen;
+                h->pktlen = hlen + m->len;
+                if ( m->len > 0 ) {
+                    h->next = m;
+                } else {
+                    mbuf_free(m);
+                }
+                m = h;
+            } else {
+                mbuf_free(h);
+            }
+        }
+
+        /* Chain the segments until EOP */
+        if ( NULL == dev->rx_pkt ) {
+            dev->rx_pkt = m;
+        } else {
+            dev->rx_last->next = m;
+            dev->rx_pkt->pktlen += m->pktlen;
+        }
+        dev->rx_last = m->next ? m->next : m;
+        if ( staterr & (1<<1) ) {
+            if ( staterr & IXGBE_RXDADV_STAT_VP ) {
+                /* Stripped VLAN tag */
+                dev->rx_pkt->vlan = rxdesc->wb.vlan;
+                dev->rx_pkt->ol_flags |= MBUF_OL_RX_VLAN;
+            }
+            mbufs[nrx] = dev->rx_pkt;
+            bytes += dev->rx_pkt->pktlen;
+            nrx++;
+            dev->rx_pkt = NULL;
+            dev->rx_last = NULL;
+        }
+
+        /* Refill */
+        read->pkt_addr = MBUF_ADDR(nm);
+        read->hdr_addr = dev->rx_hsplit ? MBUF_ADDR(nh) : 0;
+        rxdesc->read.pkt_addr = read->pkt_addr;
+        rxdesc->read.hdr_addr = read->hdr_addr;
+        last = dev->rx_tail;
+        dev->rx_tail = (dev->rx_tail + 1) & dev->rx_divisorm;
+    }
+
+    if ( last >= 0 ) {
+        mmio_write32(dev->mmio, IXGBE_REG_RDT(0), last);
+    }
+    if ( last >= 0 || nobuf ) {
+        st = netdev_stats(netdev);
+        st->c[NETDEV_STAT_RX_PKTS] += nrx;
+        st->c[NETDEV_STAT_RX_BYTES] += bytes;
+        st->c[NETDEV_STAT_RX_DOORBELL] += last >= 0 ? 1 : 0;
+        st->c[NETDEV_STAT_NOBUF] += nobuf;
+    }
+
+    return nrx;
+}
+
+/*
+ * Enable/disable the header split; the L2/L3/L4 headers are written to the
+ * buffers from mbufhdrpool and the payload to the packet buffers.  The RX
+ * queue is stopped and all the descriptors are rebuilt.
+ */
+int
+ixgbe_rx_hsplit(struct netdev *netdev, int on)
+{
+    struct ixgbe_device *dev;
+    union ixgbe_adv_rx_desc *rxdesc;
+    struct mbuf *h;
+    int ret;
+    int i;
+    u32 m32;
+
+    dev = (struct ixgbe_device *)netdev->vendor;
+
+    ret = 0;
+    on = on ? 1 : 0;
+    if ( on == dev->rx_hsplit ) {
+        return 0;
+    }
+
+    /* Stop the queue */
+    mmio_write32(dev->mmio, IXGBE_REG_RXDCTL0,
+                 mmio_read32(dev->mmio, IXGBE_REG_RXDCTL0)
+                 & ~IXGBE_RXDCTL_ENABLE);
+    for ( i = 0; i < 10; i++ ) {
+        arch_busy_usleep(1);
+        m32 = mmio_read32(dev->mmio, IXGBE_REG_RXDCTL0);
+        if ( !(m32 & IXGBE_RXDCTL_ENABLE) ) {
+            break;
+        }
+    }
+    if ( m32 & IXGBE_RXDCTL_ENABLE ) {
+        kprintf("Error on disable an RX queue\r\n");
+        return -1;
+    }
+
+    /* Drop the packet being received */
+    mbuf_free(dev->rx_pkt);
+    dev->rx_pkt = NULL;
+    dev->rx_last = NULL;
+
+    /* Attach or detach the header buffers */
+    for ( i = 0; i < dev->rx_bufsz; i++ ) {
+        if ( on ) {
+            h = mbuf_alloc(mbufhdrpool);
+            if ( NULL == h ) {
+                /* Roll back */
+                while ( i > 0 ) {
+                    i--;
+                    mbuf_free(mbuf_from_addr(mbufhdrpool,
+                                             dev->rx_read[0][i].hdr_addr));
+                    dev->rx_read[0][i].hdr_addr = 0;
+                }
+                on = 0;
+                ret = -1;
+                break;
+            }
+            dev->rx_read[0][i].hdr_addr = MBUF_ADDR(h);
+        } else {
+            mbuf_free(mbuf_from_addr(mbufhdrpool,
+                                     dev->rx_read[0][i].hdr_addr));
+            dev->rx_read[0][i].hdr_addr = 0;
+        }
+    }
+    for ( i = 0; i < dev->rx_bufsz; i++ ) {
+        rxdesc = (union ixgbe_adv_rx_desc *)(dev->rx_base
+                                             + i * sizeof(union ixgbe_adv_rx_desc));
+        rxdesc->read.pkt_addr = dev->rx_read[0][i].pkt_addr;
+        rxdesc->read.hdr_addr = dev->rx_read[0][i].hdr_addr;
+    }
+    dev->rx_hsplit = on;
+
+    if ( on ) {
+        mmio_write32(dev->mmio, IXGBE_REG_SRRCTL0,
+                     IXGBE_SRRCTL_BSIZE_PKT4K | IXGBE_SRRCTL_BSIZE_HDR256
+                     | IXGBE_SRRCTL_DESCTYPE_HSPLIT | IXGBE_SRRCTL_DROP_EN);
+        mmio_write32(dev->mmio, IXGBE_REG_PSRTYPE(0),
+                     IXGBE_PSRTYPE_L2HDR | IXGBE_PSRTYPE_IPV4HDR
+                     | IXGBE_PSRTYPE_TCPHDR | IXGBE_PSRTYPE_UDPHDR);
+    } else {
+        mmio_write32(dev->mmio, IXGBE_REG_SRRCTL0,
+                     IXGBE_SRRCTL_BSIZE_PKT4K | IXGBE_SRRCTL_DESCTYPE_ADV
+                     | IXGBE_SRRCTL_DROP_EN);
+        mmio_write32(dev->mmio, IXGBE_REG_PSRTYPE(0), 0);
+    }
+
+    /* Restart the queue */
+    dev->rx_tail = 0;
+    mmio_write32(dev->mmio, IXGBE_REG_RDH(0), 0);
+    mmio_write32(dev->mmio, IXGBE_REG_RXDCTL0,
+                 IXGBE_RXDCTL_ENABLE | IXGBE_RXDCTL_VME);
+    for ( i = 0; i < 10; i++ ) {
+        arch_busy_usleep(1);
+        m32 = mmio_read32(dev->mmio, IXGBE_REG_RXDCTL0);
+        if ( m32 & IXGBE_RXDCTL_ENABLE ) {
+            break;
+        }
+    }
+    if ( !(m32 & IXGBE_RXDCTL_ENABLE) ) {
+        kprintf("Error on enable an RX queue\r\n");
+        return -1;
+    }
+    mmio_write32(dev->mmio, IXGBE_REG_RDT(0), dev->rx_bufsz - 1);
+
+    return ret;
+}
+
+/*
+ * Add a queue filter; EtherType filters use ETQF/ETQS and 5-tuple filters use
+ * the L3/L4 5-tuple queue filters.  Return the filter ID.
+ */
+int
+ixgbe_filter_add(struct netdev *netdev, const struct netdev_filter *f)
+{
+    struct ixgbe_device *dev;
+    int i;
+    u32 ftqf;
+
+    dev = (struct ixgbe_device *)netdev->vendor;
+
+    if ( f->q < 0 || f->q >= netdev->nrxq ) {
+        return -1;
+    }
+
+    if ( NETDEV_FILTER_ETYPE == f->type ) {
+        for ( i = 0; i < IXGBE_ETQF_NUM; i++ ) {
+            if ( !(dev->etqf_used & (1 << i)) ) {
+                break;
+            }
+        }
+        if ( i >= IXGBE_ETQF_NUM ) {
+            return -1;
+        }
+        dev->etqf_used |= (1 << i);
+        mmio_write32(dev->mmio, IXGBE_REG_ETQS(i),
+                     IXGBE_ETQS_QUEUE_EN | IXGBE_ETQS_RX_QUEUE(f->q));
+        mmio_write32(dev->mmio, IXGBE_REG_ETQF(i),
+                     IXGBE_ETQF_FILTER_EN | f->etype);
+
+        return i;
+    } else if ( NETDEV_FILTER_5TUPLE == f->type ) {
+        ftqf = IXGBE_FTQF_QUEUE_EN | IXGBE_FTQF_MASK_POOL | IXGBE_FTQF_PRIO(1);
+        if ( f->fields & NETDEV_FILTER_PROTO ) {
+            switch ( f->proto ) {
+            case 6:
+                ftqf |= IXGBE_FTQF_PROTO_TCP;
+                break;
+            case 17:
+                ftqf |= IXGBE_FTQF_PROTO_UDP;
+                break;
+            case 132:
+                ftqf |= IXGBE_FTQF_PROTO_SCTP;
+                break;
+            default:
+                ftqf |= IXGBE_FTQF_PROTO_OTHER;
+            }
+        } else {
+            ftqf |= IXGBE_FTQF_MASK_PROTO;
+        }
+        if ( !(f->fields & NETDEV_FILTER_SADDR) ) {
+            ftqf |= IXGBE_FTQF_MASK_SADDR;
+        }
+        if ( !(f->fields & NETDEV_FILTER_DADDR) ) {
+            ftqf |= IXGBE_FTQF_MASK_DADDR;
+        }
+        if ( !(f->fields & NETDEV_FILTER_SPORT) ) {
+            ftqf |= IXGBE_FTQF_MASK_SPORT;
+        }
+        if ( !(f->fields & NETDEV_FILTER_DPORT) ) {
+            ftqf |= IXGBE_FTQF_MASK_DPORT;
+        }
+
+        for ( i = 0; i < IXGBE_FTQF_NUM; i++ ) {
+            if ( !(dev->ftqf_used[i / 32] & (1U << (i % 32))) ) {
+                break;
+            }
+        }
+        if ( i >= IXGBE_FTQF_NUM ) {
+            return -1;
         }
+        dev->ftqf_used[i / 32] |= (1U << (i % 32));
+
+        /* Addresses and ports in network byte order */
+        mmio_write32(dev->mmio, IXGBE_REG_SAQF(i), f->saddr);
+        mmio_write32(dev->mmio, IXGBE_REG_DAQF(i), f->daddr);
+        mmio_write32(dev->mmio, IXGBE_REG_SDPQF(i),
+                     (u32)f->sport | ((u32)f->dport << 16));
+        mmio_write32(dev->mmio, IXGBE_REG_L34T_IMIR(i),
+                     IXGBE_IMIR_SIZE_BP | IXGBE_IMIR_CTRL_BP
+                     | IXGBE_IMIR_RX_QUEUE(f->q));
+        mmio_write32(dev->mmio, IXGBE_REG_FTQF(i), ftqf);
+
+        return IXGBE_ETQF_NUM + i;
     }
 
-    return 0;
+    return -1;
 }
 
+/*
+ * Delete a queue filter
+ */
 int
-ixgbe_recvpkt(u8 *pkt, u32 len, struct netdev *netdev)
+ixgbe_filter_del(struct netdev *netdev, int id)
 {
-    u32 rdh;
     struct ixgbe_device *dev;
-    int rx_que;
-    struct ixgbe_rx_desc *rxdesc;
-    int ret;
 
     dev = (struct ixgbe_device *)netdev->vendor;
 
-    rdh = mmio_read32(dev->mmio, IXGBE_REG_RDH(0));
-    rx_que = (dev->rx_bufsz - dev->rx_tail + rdh) % dev->rx_bufsz;
-    if ( rx_que > 0 ) {
-        /* Check the head of RX ring buffer */
-        rxdesc = (struct ixgbe_rx_desc *)
-            (((u64)dev->rx_base) + (dev->rx_tail % dev->rx_bufsz)
-             * sizeof(struct ixgbe_rx_desc));
-        ret = len < rxdesc->length ? len : rxdesc->length;
-        kmemcpy(pkt, (void *)rxdesc->address, ret);
+    if ( id < 0 ) {
+        return -1;
+    } else if ( id < IXGBE_ETQF_NUM ) {
+        if ( !(dev->etqf_used & (1 << id)) ) {
+            return -1;
+        }
+        mmio_write32(dev->mmio, IXGBE_REG_ETQF(id), 0);
+        mmio_write32(dev->mmio, IXGBE_REG_ETQS(id), 0);
+        dev->etqf_used &= ~(1 << id);
+    } else if ( id < IXGBE_ETQF_NUM + IXGBE_FTQF_NUM ) {
+        id -= IXGBE_ETQF_NUM;
+        if ( !(dev->ftqf_used[id / 32] & (1U << (id % 32))) ) {
+            return -1;
+        }
+        mmio_write32(dev->mmio, IXGBE_REG_FTQF(id), 0);
+        mmio_write32(dev->mmio, IXGBE_REG_L34T_IMIR(id), 0);
+        dev->ftqf_used[id / 32] &= ~(1U << (id % 32));
+    } else {
+        return -1;
+    }
 
-        rxdesc->checksum = 0;
-        rxdesc->status = 0;
-        rxdesc->errors = 0;
-        rxdesc->special = 0;
+    return 0;
+}
 
-        mmio_write32(dev->mmio, IXGBE_REG_RDT(0), dev->rx_tail);
-        dev->rx_tail = (dev->rx_tail + 1) % dev->rx_bufsz;
+/*
+ * Offload parameters of a packet to be compared with the context cached in
+ * the ring; zero if no offload is requested
+ */
+static __inline__ u64
+_ixgbe_tx_ctx_key(struct mbuf *m)
+{
+    u32 flags;
 
-        return ret;
+    flags = m->ol_flags & (MBUF_OL_TX_IP_CKSUM | MBUF_OL_TX_TCP_CKSUM
+                           | MBUF_OL_TX_UDP_CKSUM | MBUF_OL_TX_TSO
+                           | MBUF_OL_TX_VLAN);
+    if ( !flags ) {
+        return 0;
+    }
+    if ( !(flags & MBUF_OL_TX_VLAN) ) {
+        return ((u64)(flags >> 8) << 56) | ((u64)m->mss << 24)
+            | ((u64)m->l4len << 16) | ((u64)m->l3len << 8) | m->l2len;
     }
 
-    return -1;
+    return ((u64)(flags >> 8) << 56) | ((u64)m->vlan << 40)
+        | ((u64)m->mss << 24) | ((u64)m->l4len << 16)
+        | ((u64)m->l3len << 8) | m->l2len;
+}
+
+/*
+ * Write an advanced context descriptor for the checksum offload, TSO and the
+ * VLAN tag insertion
+ */
+static __inline__ void
+_ixgbe_tx_ctx(struct ixgbe_adv_tx_desc_ctx *ctx, struct mbuf *m)
+{
+    u64 tucmd;
+
+    /* IPV4 */
+    tucmd = (1ULL << 10);
+    if ( m->ol_flags & (MBUF_OL_TX_TCP_CKSUM | MBUF_OL_TX_TSO) ) {
+        /* L4T = TCP */
+        tucmd |= (1ULL << 11);
+    } else if ( !(m->ol_flags & MBUF_OL_TX_UDP_CKSUM) ) {
+        /* L4T = reserved (no L4 offload) */
+        tucmd |= (3ULL << 11);
+    }
+
+    ctx->vlan_maclen_iplen = ((u32)m->l2len << 9) | m->l3len;
+    if ( m->ol_flags & MBUF_OL_TX_VLAN ) {
+        ctx->vlan_maclen_iplen |= (u32)m->vlan << 16;
+    }
+    ctx->fcoef_ipsec_sa_idx = 0;
+    ctx->other = tucmd | (2ULL << 20) | (1ULL << 29)
+        | ((u64)m->l4len << 40) | ((u64)m->mss << 48);
 }
 
+/*
+ * Transmit up to n packets to the TX queue q without copy; the buffers are
+ * owned by the TX ring and released when their descriptors are reused.
+ * A context descriptor is inserted when the offload parameters change.
+ */
 int
-ixgbe_sendpkt(const u8 *pkt, u32 len, struct netdev *netdev)
+ixgbe_tx_burst(struct netdev *netdev, int q, struct mbuf **mbufs, int n)
 {
-    u32 tdh;
     struct ixgbe_device *dev;
+    struct ixgbe_tx_ring *txr;
+    struct ixgbe_adv_tx_desc_data *txdesc;
+    struct mbuf *m;
+    struct mbuf *next;
+    struct netdev_stats *st;
+    u64 key;
+    u64 bytes;
+    u32 popts;
+    u32 paylen;
+    u8 dcmd;
     int tx_avl;
-    struct ixgbe_tx_desc *txdesc;
+    int nseg;
+    int ntx;
 
     dev = (struct ixgbe_device *)netdev->vendor;
-    tdh = mmio_read32(dev->mmio, IXGBE_REG_TDH(0));
-
-    tx_avl = dev->tx[0].bufsz - ((dev->tx[0].bufsz - tdh + dev->tx[0].tail)
-                                 % dev->tx[0].bufsz);
-
-    if ( tx_avl > 0 ) {
-        /* Check the head of TX ring buffer */
-        txdesc = (struct ixgbe_tx_desc *)
-            (((u64)dev->tx[0].base) + (dev->tx[0].tail % dev->tx[0].bufsz)
-             * sizeof(struct ixgbe_tx_desc));
-        kmemcpy((void *)txdesc->address, pkt, len);
+    txr = &dev->tx[q];
+
+    /* Keep one descriptor unused to distinguish full from empty */
+    tx_avl = (txr->head_cache + txr->bufsz - txr->tail - 1) & txr->divisorm;
+
+    bytes = 0;
+    for ( ntx = 0; ntx < n; ntx++ ) {
+        m = mbufs[ntx];
+        key = _ixgbe_tx_ctx_key(m);
+        nseg = (0 != key && key != txr->ctx) ? 1 : 0;
+        for ( ; NULL != m; m = m->next ) {
+            nseg++;
+        }
+        if ( tx_avl < nseg ) {
+            /* Update the head cache */
+            txr->head_cache = mmio_read32(dev->mmio, IXGBE_REG_TDH(q));
+            tx_avl = (txr->head_cache + txr->bufsz - txr->tail - 1)
+                & txr->divisorm;
+            if ( tx_avl < nseg ) {
+                break;
+            }
+        }
+        tx_avl -= nseg;
+
+        m = mbufs[ntx];
+        popts = 0;
+        dcmd = (1<<5) | (1<<1);
+        paylen = m->pktlen;
+        bytes += m->pktlen;
+        if ( 0 != key ) {
+            if ( key != txr->ctx ) {
+                /* The context descriptor takes a slot */
+                mbuf_free(txr->mbufs[txr->tail]);
+                txr->mbufs[txr->tail] = NULL;
+                _ixgbe_tx_ctx((struct ixgbe_adv_tx_desc_ctx *)
+                              (txr->base + txr->tail
+                               * sizeof(struct ixgbe_adv_tx_desc_data)), m);
+                txr->ctx = key;
+                txr->tail = (txr->tail + 1) & txr->divisorm;
+            }
+            /* CC */
+            popts |= IXGBE_TXD_POPTS_CC;
+            if ( m->ol_flags & MBUF_OL_TX_VLAN ) {
+                /* VLAN tag from the context descriptor */
+                dcmd |= IXGBE_TXD_CMD_VLE;
+            }
+            if ( m->ol_flags & MBUF_OL_TX_IP_CKSUM ) {
+                /* IXSM */
+                popts |= (1<<8);
+            }
+            if ( m->ol_flags & (MBUF_OL_TX_TCP_CKSUM | MBUF_OL_TX_UDP_CKSUM
+                                | MBUF_OL_TX_TSO) ) {
+                /* TXSM */
+                popts |= (1<<9);
+            }
+            if ( m->ol_flags & MBUF_OL_TX_TSO ) {
+                /* TSE; PAYLEN excludes the headers */
+                dcmd |= (1<<7);
+                paylen -= m->l2len + m->l3len + m->l4len;
+            }
+        }
 
-        txdesc->length = len;
-        txdesc->sta = 0;
-        txdesc->css = 0;
-        txdesc->cso = 0;
-        txdesc->special = 0;
-        txdesc->cmd = (1<<3) | (1<<1) | 1;
+        for ( ; NULL != m; m = next ) {
+            next = m->next;
+            txdesc = (struct ixgbe_adv_tx_desc_data *)
+                (txr->base + txr->tail * sizeof(struct ixgbe_adv_tx_desc_data));
+            /* Release the buffer previously attached */
+            mbuf_free(txr->mbufs[txr->tail]);
+            txr->mbufs[txr->tail] = m;
 
-        dev->tx[0].tail = (dev->tx[0].tail + 1) % dev->tx[0].bufsz;
-        mmio_write32(dev->mmio, IXGBE_REG_TDT(0), dev->tx[0].tail);
+            txdesc->pkt_addr = MBUF_ADDR(m);
+            txdesc->length = m->len;
+            txdesc->dtyp_mac = (3 << 4);
+            txdesc->paylen_popts_cc_idx_sta = (paylen << 14) | popts;
+            if ( NULL == next ) {
+                txdesc->dcmd = dcmd | 1;
+            } else {
+                txdesc->dcmd = dcmd;
+            }
+            m->next = NULL;
+            txr->tail = (txr->tail + 1) & txr->divisorm;
+        }
+    }
 
-        return len;
+    if ( ntx > 0 ) {
+        mmio_write32(dev->mmio, IXGBE_REG_TDT(q), txr->tail);
+    }
+    if ( n > 0 ) {
+        st = netdev_stats(netdev);
+        st->c[NETDEV_STAT_TX_PKTS] += ntx;
+        st->c[NETDEV_STAT_TX_BYTES] += bytes;
+        st->c[NETDEV_STAT_TX_DOORBELL] += ntx > 0 ? 1 : 0;
+        /* The ring is full; the caller keeps or drops the rest */
+        st->c[NETDEV_STAT_TXFULL] += ntx < n ? 1 : 0;
     }
 
-    return -1;
+    return ntx;
 }
 
 
@@ -598,6 +1865,53 @@ ixgbe_sendpkt(const u8 *pkt, u32 len, struct netdev *netdev)
 
 
 
+/*
+ * Accumulate the counters cleared on read; the high register is read after
+ * the low one to latch the 36-bit octet counters
+ */
+static void
+_ixgbe_hwstats_update(struct ixgbe_device *dev)
+{
+    u64 lo;
+    int i;
+
+    dev->hw.rx_crcerrs += mmio_read32(dev->mmio, IXGBE_REG_CRCERRS);
+    for ( i = 0; i < 8; i++ ) {
+        dev->hw.rx_missed += mmio_read32(dev->mmio, IXGBE_REG_MPC(i));
+    }
+    dev->hw.rx_pkts += mmio_read32(dev->mmio, IXGBE_REG_GPRC);
+    dev->hw.tx_pkts += mmio_read32(dev->mmio, IXGBE_REG_GPTC);
+    lo = mmio_read32(dev->mmio, IXGBE_REG_GORCL);
+    dev->hw.rx_bytes += lo
+        | ((u64)mmio_read32(dev->mmio, IXGBE_REG_GORCH) << 32);
+    lo = mmio_read32(dev->mmio, IXGBE_REG_GOTCL);
+    dev->hw.tx_bytes += lo
+        | ((u64)mmio_read32(dev->mmio, IXGBE_REG_GOTCH) << 32);
+    for ( i = 0; i < IXGBE_STAT_NQ; i++ ) {
+        dev->hw.rxq_pkts[i] += mmio_read32(dev->mmio, IXGBE_REG_QPRC(i));
+        dev->hw.txq_pkts[i] += mmio_read32(dev->mmio, IXGBE_REG_QPTC(i));
+    }
+}
+
+/*
+ * Read the hardware counters; not for the datapath as it reads the registers
+ */
+int
+ixgbe_hwstats(struct netdev *netdev, struct netdev_hwstats *hw)
+{
+    struct ixgbe_device *dev;
+
+    dev = (struct ixgbe_device *)netdev->vendor;
+
+    arch_spin_lock(&dev->hw_lock);
+    _ixgbe_hwstats_update(dev);
+    kmemcpy(hw, &dev->hw, sizeof(struct netdev_hwstats));
+    arch_spin_unlock(&dev->hw_lock);
+    hw->nq = netdev->nrxq > netdev->ntxq ? netdev->nrxq : netdev->ntxq;
+
+    return 0;
+}
+
 int
 ixgbe_check_buffer(struct netdev *netdev)
 {
@@ -2059,6 +3373,7 @@ _100g_mgmt2(struct my_cpu_dev *dev, int q, union ixgbe_adv_rx_desc *rxdesc,
     u32 prefix;
     int plen;
     int port;
+    u16 vlan;
     u64 mac;
     struct ixgbe_adv_tx_desc_data *txdesc;
 
@@ -2080,8 +3395,14 @@ _100g_mgmt2(struct my_cpu_dev *dev, int q, union ixgbe_adv_rx_desc *rxdesc,
             mac = ((u64)data[7] << 40) | ((u64)data[8] << 32)
                 | ((u64)data[9] << 24) | ((u64)data[10] << 16)
                 | ((u64)data[11] << 8) | ((u64)data[12]);
-            kprintf("Inserting %x/%d %d\r\n", prefix, plen, port);
-            dxr_route_add(dxr, prefix, plen, port + 1);
+            /* Optional egress VLAN of the 802.1Q sub-interface */
+            vlan = 0;
+            if ( (((u16)udp[4] << 8) | udp[5]) >= 8 + 15 ) {
+                vlan = (((u16)data[13] << 8) | data[14]) & 0xfff;
+            }
+            kprintf("Inserting %x/%d %d.%d\r\n", prefix, plen, port, vlan);
+            dxr_route_add(dxr, prefix, plen,
+                          ((u32)vlan << 16) | (port + 1));
             kprintf("done\r\n");
         } else if ( 2 == data[0] ) {
             /* Compile FIB */
@@ -2132,17 +3453,100 @@ _100g_mgmt2(struct my_cpu_dev *dev, int q, union ixgbe_adv_rx_desc *rxdesc,
     return 0;
 }
 
+/*
+ * Enable/disable the direct cache access for the forwarder; it takes effect
+ * when the forwarder is (re)started
+ */
+void
+ixgbe_set_dca(int on)
+{
+    ixgbe_dca = on ? 1 : 0;
+}
+
+/*
+ * Set the ACL of the forwarder (NULL to remove); return the previous one
+ */
+struct acl_tree *
+ixgbe_set_acl(struct acl_tree *acl)
+{
+    struct acl_tree *old;
+
+    old = ixgbe_acl;
+    ixgbe_acl = acl;
+
+    return old;
+}
+
+/*
+ * Steer the descriptor and header writes of the RX queue rxq and the
+ * descriptor write-backs of the TX queue txq to the cache of the processor
+ * specified by the APIC ID
+ */
+static void
+_ixgbe_dca_setup(struct ixgbe_device *dev, int rxq, int txq, int apicid,
+                 int on)
+{
+    u32 m32;
+
+    /* The global mode follows the switch since every forwarding core
+       applies the same one (ixgbe_dca) */
+    if ( on ) {
+        mmio_write32(dev->mmio, IXGBE_REG_DCA_CTRL, IXGBE_DCA_CTRL_MODE_CB2);
+    } else {
+        mmio_write32(dev->mmio, IXGBE_REG_DCA_CTRL, IXGBE_DCA_CTRL_DIS);
+    }
+
+    if ( rxq >= 0 ) {
+        m32 = mmio_read32(dev->mmio, IXGBE_REG_DCA_RXCTRL(rxq));
+        m32 &= ~(IXGBE_DCA_CPUID_MASK | IXGBE_DCA_RXCTRL_DESC_EN
+                 | IXGBE_DCA_RXCTRL_HEAD_EN | IXGBE_DCA_RXCTRL_DATA_EN);
+        if ( on ) {
+            m32 |= IXGBE_DCA_CPUID(apicid) | IXGBE_DCA_RXCTRL_DESC_EN
+                | IXGBE_DCA_RXCTRL_HEAD_EN;
+            /* With the header split, the payload is not touched by the
+               forwarder; otherwise the headers are read from the packet
+               buffer */
+            if ( !dev->rx_hsplit ) {
+                m32 |= IXGBE_DCA_RXCTRL_DATA_EN;
+            }
+        }
+        mmio_write32(dev->mmio, IXGBE_REG_DCA_RXCTRL(rxq), m32);
+    }
+
+    if ( txq >= 0 ) {
+        m32 = mmio_read32(dev->mmio, IXGBE_REG_DCA_TXCTRL(txq));
+        m32 &= ~(IXGBE_DCA_CPUID_MASK | IXGBE_DCA_TXCTRL_DESC_EN);
+        if ( on ) {
+            m32 |= IXGBE_DCA_CPUID(apicid) | IXGBE_DCA_TXCTRL_DESC_EN;
+        }
+        mmio_write32(dev->mmio, IXGBE_REG_DCA_TXCTRL(txq), m32);
+    }
+}
+
+/*
+ * Route an IPv4 packet; with the header split, pkt points to the header
+ * buffer of hlen bytes and the payload of len bytes follows in payload.
+ * Otherwise hlen is zero and pkt holds the whole packet of len bytes.
+ */
 static int
 _100g_routing2_ipv4(struct my_cpu_dev *cpudev, int q,
                    union ixgbe_adv_rx_desc *rxdesc, u32 rdt, u8 *pkt, int len,
-                   int off)
+                   int off, int hlen, u8 *payload)
 {
     u32 dst;
     struct ixgbe_adv_tx_desc_data *txdesc;
+    struct ixgbe_adv_tx_desc_ctx *ctx;
     u64 txpkt;
+    u64 nh;
+    u32 popts;
+    u16 vlan;
+    u8 dcmd;
+    u8 *buf;
+    int nd;
 
     if ( unlikely(0x45 != pkt[off]) ) {
-        kprintf("FIXME: header size is not normal");
+        /* FIXME: header size is not normal */
+        cpudev->rx[0].stats->c[NETDEV_STAT_DROP_ERROR]++;
         return -1;
     }
 
@@ -2150,11 +3554,12 @@ _100g_routing2_ipv4(struct my_cpu_dev *cpudev, int q,
         /* Checksum is validated */
         if ( unlikely(rxdesc->wb.staterr & (1ULL << (20 + 11))) ) {
             /* Checksum error */
-            kprintf("FIXME: Checksum error\r\n");
+            cpudev->rx[0].stats->c[NETDEV_STAT_DROP_ERROR]++;
             return -1;
         }
     } else {
-        kprintf("FIXME: Checksum offloading\r\n");
+        /* FIXME: Checksum offloading */
+        cpudev->rx[0].stats->c[NETDEV_STAT_DROP_ERROR]++;
         return -1;
     }
 
@@ -2171,8 +3576,17 @@ _100g_routing2_ipv4(struct my_cpu_dev *cpudev, int q,
     /* Get the destination address */
     dst = bswap32(*(u32 *)(pkt + off + 16));
 
-    if ( unlikely(0xc0a80004 == dst) ) {
-        _100g_mgmt2(cpudev, q, rxdesc, pkt, len, off);
+    if ( NULL == cpudev->rx[0].ctrl && unlikely(0xc0a80004 == dst) ) {
+        /* Not steered to the control queue */
+        if ( hlen > 0 ) {
+            /* Linearize the split packet */
+            buf = alloca(hlen + len);
+            kmemcpy(buf, pkt, hlen);
+            kmemcpy(buf + hlen, payload, len);
+            _100g_mgmt2(cpudev, q, rxdesc, buf, hlen + len, off);
+        } else {
+            _100g_mgmt2(cpudev, q, rxdesc, pkt, len, off);
+        }
         return 0;
     }
     u32 idx;
@@ -2191,23 +3605,36 @@ _100g_routing2_ipv4(struct my_cpu_dev *cpudev, int q,
     //idx = (q & 6) | (dst & 0x1);
 #if 1
     //kprintf("%x %x\r\n", dst, dxr_lookup(dxr, dst));
-    idx = dxr_lookup(dxr, dst) - 1;
+    /* Next hop: the egress VLAN in the upper 16 bits and the port + 1 */
+    nh = dxr_lookup(cpudev->fib, dst);
+    idx = (nh & 0xffff) - 1;
+    vlan = (nh >> 16) & 0xfff;
     if ( idx >= 8 ) {
         /* Drop */
+        cpudev->rx[0].stats->c[NETDEV_STAT_LOOKUP_MISS]++;
         idx = 0;
+        vlan = 0;
         //return 0;
     }
 #endif
 
-    u32 next_tdt = (cpudev->tx[idx].tail + 1) & 0xff;
+    /* Two descriptors for the header and the payload with the split, and a
+       context descriptor when the egress VLAN changes */
+    nd = hlen > 0 ? 2 : 1;
+    if ( vlan && vlan != cpudev->tx[idx].vlan ) {
+        nd++;
+    }
+    u32 next_tdt = (cpudev->tx[idx].tail + nd) & 0xff;
 
 #if 1
     u32 tdh;
     tdh = cpudev->tx[idx].head_cache;
-    if ( next_tdt == tdh ) {
+    if ( ((tdh - cpudev->tx[idx].tail - 1) & 0xff) < nd ) {
         tdh = mmio_read32(cpudev->tx[idx].mmio, IXGBE_REG_TDH(q));
-        if ( unlikely(cpudev->tx[idx].head_cache == tdh) ) {
+        if ( unlikely(((tdh - cpudev->tx[idx].tail - 1) & 0xff) < nd) ) {
             /* Buffer full */
+            cpudev->tx[idx].stats->c[NETDEV_STAT_TXFULL]++;
+            cpudev->tx[idx].stats->c[NETDEV_STAT_DROP_TXFULL]++;
             return 0;
         }
         cpudev->tx[idx].head_cache = tdh;
@@ -2232,7 +3659,7 @@ _100g_routing2_ipv4(struct my_cpu_dev *cpudev, int q,
     pkt[off + 8] -= 1;
     if ( unlikely(0 == pkt[off + 8]) ) {
         /* Time exceed; discards */
-        kprintf("FIXME: TTL\r\n");
+        cpudev->rx[0].stats->c[NETDEV_STAT_DROP_ERROR]++;
         return -1;
     }
 
@@ -2245,12 +3672,50 @@ _100g_routing2_ipv4(struct my_cpu_dev *cpudev, int q,
 #if 0 // too optimistic
     cpudev->rx[0].read[rdt].pkt_addr = txpkt;
 #endif
-    txdesc->pkt_addr = (u64)pkt;
-    txdesc->length = len;
-    txdesc->dtyp_mac = (3 << 4);
-    txdesc->dcmd = (1<<5) | (1<<1) | 1;
-    txdesc->paylen_popts_cc_idx_sta = ((u64)len << 14) | (1ULL << 8);
+    dcmd = (1<<5) | (1<<1);
+    popts = (1 << 8);
+    if ( vlan ) {
+        if ( vlan != cpudev->tx[idx].vlan ) {
+            /* Context descriptor of index 1 with the VLAN tag */
+            ctx = (struct ixgbe_adv_tx_desc_ctx *)txdesc;
+            ctx->vlan_maclen_iplen = ((u32)vlan << 16) | (14 << 9) | 20;
+            ctx->fcoef_ipsec_sa_idx = 0;
+            ctx->other = (1ULL << 36) | (1ULL << 29) | (2ULL << 20)
+                | (2ULL << 9);
+            cpudev->tx[idx].vlan = vlan;
+            txdesc = (struct ixgbe_adv_tx_desc_data *)
+                (cpudev->tx[idx].base + ((cpudev->tx[idx].tail + 1) & 0xff)
+                 * sizeof(struct ixgbe_adv_tx_desc_data));
+        }
+        /* Insert the tag instead of moving the Ethernet header */
+        dcmd |= IXGBE_TXD_CMD_VLE;
+        popts |= IXGBE_TXD_POPTS_CC | IXGBE_TXD_IDX(1);
+    }
+    if ( hlen > 0 ) {
+        /* Header (without EOP) followed by the untouched payload */
+        txdesc->pkt_addr = (u64)pkt;
+        txdesc->length = hlen;
+        txdesc->dtyp_mac = (3 << 4);
+        txdesc->dcmd = dcmd;
+        txdesc->paylen_popts_cc_idx_sta = ((u64)(hlen + len) << 14) | popts;
+        txdesc = (struct ixgbe_adv_tx_desc_data *)
+            (cpudev->tx[idx].base + ((next_tdt - 1) & 0xff)
+             * sizeof(struct ixgbe_adv_tx_desc_data));
+        txdesc->pkt_addr = (u64)payload;
+        txdesc->length = len;
+        txdesc->dtyp_mac = (3 << 4);
+        txdesc->dcmd = dcmd | 1;
+        txdesc->paylen_popts_cc_idx_sta = ((u64)(hlen + len) << 14) | popts;
+    } else {
+        txdesc->pkt_addr = (u64)pkt;
+        txdesc->length = len;
+        txdesc->dtyp_mac = (3 << 4);
+        txdesc->dcmd = dcmd | 1;
+        txdesc->paylen_popts_cc_idx_sta = ((u64)len << 14) | popts;
+    }
     cpudev->tx[idx].tail = next_tdt;
+    cpudev->tx[idx].stats->c[NETDEV_STAT_TX_PKTS]++;
+    cpudev->tx[idx].stats->c[NETDEV_STAT_TX_BYTES] += hlen + len;
 
 
 #if 0
@@ -2276,12 +3741,22 @@ _100g_routing2_ipv4(struct my_cpu_dev *cpudev, int q,
     return 0;
 }
 
+static void _100g_ctrl(struct my_cpu_dev *, int);
+
 static int
 _100g_routing2(struct my_cpu_dev *cpudev, int q)
 {
     union ixgbe_adv_rx_desc *rxdesc;
+    struct acl_tree *acl;
+    struct acl_key keys[64];
+    int verdict[64];
+    int res[64];
+    u8 idx[64];
+    int nkeys;
     u8 *pkt;
+    u8 *payload;
     u16 etype;
+    int hlen;
     int rdt;
     int ret;
     int cnt;
@@ -2289,6 +3764,10 @@ _100g_routing2(struct my_cpu_dev *cpudev, int q)
     /* Destination check */
     u8 macaddr[6] = {0x90, 0xe2, 0xba, 0x6a, 0x0c, 0x40};
 
+    /* No FIB lookup nor ACL classification is in progress between the
+       bursts */
+    processor_quiescent();
+
     for ( i = 0; i < 64; i++ ) {
         rdt = (cpudev->rx[0].tail + i) & 0xff;
         rxdesc = (union ixgbe_adv_rx_desc *)
@@ -2297,10 +3776,52 @@ _100g_routing2(struct my_cpu_dev *cpudev, int q)
             /* Buffer is empty */
             break;
         }
-        __asm__ ("prefetcht1 (%0)" :: "r"(cpudev->rx[0].read[rdt].pkt_addr));
+        if ( cpudev->rx[0].dca ) {
+            /* Already in the cache; the header buffer with the header split,
+               or the packet buffer otherwise (see _ixgbe_dca_setup()) */
+            continue;
+        }
+        /* Only the header buffer is touched with the header split */
+        if ( cpudev->rx[0].hsplit ) {
+            __asm__ ("prefetcht1 (%0)"
+                     :: "r"(cpudev->rx[0].read[rdt].hdr_addr));
+        } else {
+            __asm__ ("prefetcht1 (%0)"
+                     :: "r"(cpudev->rx[0].read[rdt].pkt_addr));
+        }
     }
     cnt = i;
 
+    /* Classify the IPv4 packets received at once */
+    acl = ixgbe_acl;
+    if ( NULL != acl && cnt > 0 ) {
+        nkeys = 0;
+        for ( i = 0; i < cnt; i++ ) {
+            verdict[i] = ACL_PERMIT;
+            rdt = (cpudev->rx[0].tail + i) & 0xff;
+            rxdesc = (union ixgbe_adv_rx_desc *)
+                (cpudev->rx[0].base + rdt * sizeof(union ixgbe_adv_rx_desc));
+            if ( cpudev->rx[0].hsplit
+                 && (rxdesc->wb.info0 & IXGBE_RXDADV_SPH) ) {
+                pkt = (u8 *)cpudev->rx[0].read[rdt].hdr_addr;
+                hlen = IXGBE_RXDADV_HDRLEN(rxdesc->wb.info0);
+            } else {
+                pkt = (u8 *)cpudev->rx[0].read[rdt].pkt_addr;
+                hlen = rxdesc->wb.length;
+            }
+            if ( 0x0008 != *(u16 *)(pkt + 12)
+                 || acl_key_ipv4(pkt + 14, hlen - 14, &keys[nkeys]) < 0 ) {
+                continue;
+            }
+            idx[nkeys] = i;
+            nkeys++;
+        }
+        acl_classify_bulk(acl, keys, res, nkeys);
+        for ( i = 0; i < nkeys; i++ ) {
+            verdict[idx[i]] = res[i];
+        }
+    }
+
     if ( cnt > 0 ) {
         for ( i = 0; i < cnt; i++ ) {
             rxdesc = (union ixgbe_adv_rx_desc *)
@@ -2308,11 +3829,29 @@ _100g_routing2(struct my_cpu_dev *cpudev, int q)
                  + cpudev->rx[0].tail * sizeof(union ixgbe_adv_rx_desc));
             rdt = cpudev->rx[0].tail;
             /* Buffer is not empty */
-            pkt = (u8 *)cpudev->rx[0].read[rdt].pkt_addr;
+            payload = (u8 *)cpudev->rx[0].read[rdt].pkt_addr;
+            if ( cpudev->rx[0].hsplit
+                 && (rxdesc->wb.info0 & IXGBE_RXDADV_SPH) ) {
+                pkt = (u8 *)cpudev->rx[0].read[rdt].hdr_addr;
+                hlen = IXGBE_RXDADV_HDRLEN(rxdesc->wb.info0);
+            } else {
+                pkt = payload;
+                hlen = 0;
+            }
+            cpudev->rx[0].stats->c[NETDEV_STAT_RX_BYTES]
+                += hlen + rxdesc->wb.length;
             if ( 0 != kmemcmp(pkt, macaddr, 6) ) {
+                cpudev->rx[0].stats->c[NETDEV_STAT_DROP_FILTER]++;
+                verdict[i] = ACL_DENY;
+            } else if ( NULL != acl && ACL_DENY == verdict[i] ) {
+                cpudev->rx[0].stats->c[NETDEV_STAT_DROP_ACL]++;
+            } else {
+                verdict[i] = ACL_PERMIT;
+            }
+            if ( ACL_DENY == verdict[i] ) {
                 /* Drop */
                 rxdesc->read.pkt_addr = cpudev->rx[0].read[rdt].pkt_addr;
-                rxdesc->read.hdr_addr = 0;
+                rxdesc->read.hdr_addr = cpudev->rx[0].read[rdt].hdr_addr;
                 cpudev->rx[0].tail = (cpudev->rx[0].tail + 1) & 0xff;
                 continue;
             }
@@ -2322,7 +3861,8 @@ _100g_routing2(struct my_cpu_dev *cpudev, int q)
             case 0x0008:
                 /* IPv4: 0x0800 */
                 ret = _100g_routing2_ipv4(cpudev, q, rxdesc, rdt, pkt,
-                                          rxdesc->wb.length, 14);
+                                          rxdesc->wb.length, 14, hlen,
+                                          payload);
                 if ( ret < 0 ) {
                 }
                 break;
@@ -2330,14 +3870,15 @@ _100g_routing2(struct my_cpu_dev *cpudev, int q)
                 /* ARP: 0x0806 */
                 break;
             case 0x0081:
-                /* VLAN: 0x8100 */
+                /* VLAN: 0x8100; the outer tag is stripped to wb.vlan by the
+                   hardware, so only stacked tags reach here */
                 break;
             default:
                 /* Other */
                 ;
             }
             rxdesc->read.pkt_addr = cpudev->rx[0].read[rdt].pkt_addr;
-            rxdesc->read.hdr_addr = 0;
+            rxdesc->read.hdr_addr = cpudev->rx[0].read[rdt].hdr_addr;
             cpudev->rx[0].tail = (cpudev->rx[0].tail + 1) & 0xff;
 
 
@@ -2369,13 +3910,95 @@ _100g_routing2(struct my_cpu_dev *cpudev, int q)
         for ( i = 0; i < 8; i++ ) {
             mmio_write32(cpudev->tx[i].mmio, IXGBE_REG_TDT(q),
                          cpudev->tx[i].tail);
+            cpudev->tx[i].stats->c[NETDEV_STAT_TX_DOORBELL]++;
         }
         mmio_write32(cpudev->rx[0].mmio, IXGBE_REG_RDT(0), rdt);
+        cpudev->rx[0].stats->c[NETDEV_STAT_RX_PKTS] += cnt;
+        cpudev->rx[0].stats->c[NETDEV_STAT_RX_DOORBELL]++;
     }
 
-    return 0;
+    if ( NULL != cpudev->rx[0].ctrl ) {
+        cpudev->rx[0].ctrl_cnt++;
+        if ( 0 == cnt || cpudev->rx[0].ctrl_cnt >= IXGBE_CTRL_POLL_INTVL ) {
+            cpudev->rx[0].ctrl_cnt = 0;
+            _100g_ctrl(cpudev, q);
+        }
+    }
+
+    return cnt;
+}
+
+/*
+ * Steer ARP, IPv6 and the management packets (UDP/5000 to 192.168.0.4) to the
+ * control queue
+ */
+static struct netdev *
+_100g_ctrl_setup(struct netdev *netdev)
+{
+    struct ixgbe_device *dev;
+    struct netdev_filter f;
+    int ids[2];
+    int n;
+    int i;
+
+    dev = (struct ixgbe_device *)netdev->vendor;
+    if ( dev->fwd_ctrl ) {
+        /* Already steered */
+        return netdev;
+    }
+
+    n = netdev_steer_ctrl(netdev, ids, 2);
+    if ( n < 2 ) {
+        for ( i = 0; i < n; i++ ) {
+            netdev->filter_del(netdev, ids[i]);
+        }
+        return NULL;
+    }
+
+    f.type = NETDEV_FILTER_5TUPLE;
+    f.fields = NETDEV_FILTER_DADDR | NETDEV_FILTER_DPORT | NETDEV_FILTER_PROTO;
+    f.proto = 17;
+    f.saddr = 0;
+    f.daddr = bswap32(0xc0a80004);
+    f.sport = 0;
+    f.dport = (5000 >> 8) | ((5000 & 0xff) << 8);
+    f.q = netdev->ctrlq;
+    if ( netdev->filter_add(netdev, &f) < 0 ) {
+        for ( i = 0; i < n; i++ ) {
+            netdev->filter_del(netdev, ids[i]);
+        }
+        return NULL;
+    }
+    dev->fwd_ctrl = 1;
+
+    return netdev;
 }
 
+/*
+ * Process the packets in the control queue
+ */
+static void
+_100g_ctrl(struct my_cpu_dev *cpudev, int q)
+{
+    struct netdev *netdev;
+    struct mbuf *mbufs[IXGBE_CTRL_BURST];
+    u8 *pkt;
+    int n;
+    int i;
+
+    netdev = cpudev->rx[0].ctrl;
+    n = netdev->rx_burst(netdev, netdev->ctrlq, mbufs, IXGBE_CTRL_BURST);
+    for ( i = 0; i < n; i++ ) {
+        pkt = MBUF_DATA(mbufs[i]);
+        if ( NULL == mbufs[i]->next && mbufs[i]->len >= 42
+             && 0x0008 == *(u16 *)(pkt + 12) ) {
+            /* IPv4: 0x0800 */
+            _100g_mgmt2(cpudev, q, NULL, pkt, mbufs[i]->len, 14);
+        }
+        /* ARP and ND are not handled by the forwarder */
+        mbuf_free(mbufs[i]);
+    }
+}
 
 int
 ixgbe_100g_routing(struct netdev_list *list, int q)
@@ -2389,9 +4012,24 @@ ixgbe_100g_routing(struct netdev_list *list, int q)
     cpudev = kmalloc(sizeof(struct my_cpu_dev));
 
     /* Prepare 8 ports */
+    cpudev->rx[0].ctrl = NULL;
+    cpudev->rx[0].ctrl_cnt = 0;
+    cpudev->rx[0].netdev = NULL;
+    cpudev->fib = dxr_local(dxr);
+    processor_qs_register();
     for ( i = 0; i < 8; i++ ) {
         netdev = list->netdev;
         dev[i] = (struct ixgbe_device *)netdev->vendor;
+        /* Move the rings polled by this processor to its node */
+        _ixgbe_tx_ring_move(dev[i], q, PERCPU(node));
+        if ( i == q ) {
+            _ixgbe_rx_ring_move(dev[i], PERCPU(node));
+            /* Control traffic to the low-priority queue */
+            cpudev->rx[0].ctrl = _100g_ctrl_setup(netdev);
+            cpudev->rx[0].netdev = netdev;
+            cpudev->rx[0].stats = netdev_stats(netdev);
+        }
+        cpudev->tx[i].stats = netdev_stats(netdev);
 
         /* Set up context */
         struct ixgbe_adv_tx_desc_ctx *ctx;
@@ -2408,6 +4046,9 @@ ixgbe_100g_routing(struct netdev_list *list, int q)
         ctx->other = (1ULL << 29) | (2ULL << 20) | (2ULL << 9);
         dev[i]->tx[q].tail = ((dev[i]->tx[q].tail + 1) & dev[i]->tx[q].divisorm);
         mmio_write32(dev[i]->mmio, IXGBE_REG_TDT(q), dev[i]->tx[q].tail);
+        /* The forwarder writes its own context descriptors to this queue
+           without going through the key cached for ixgbe_tx_burst() */
+        dev[i]->tx[q].ctx = 0;
         /* Send one packet */
         tmpdesc = (struct ixgbe_adv_tx_desc_data *)
             (dev[i]->tx[q].base
@@ -2430,6 +4071,7 @@ ixgbe_100g_routing(struct netdev_list *list, int q)
         cpudev->tx[i].base = dev[i]->tx[q].base;
         cpudev->tx[i].tail = dev[i]->tx[q].tail;
         cpudev->tx[i].head_cache = dev[i]->tx[q].head_cache;
+        cpudev->tx[i].vlan = 0;
 
         list = list->next;
     }
@@ -2437,6 +4079,13 @@ ixgbe_100g_routing(struct netdev_list *list, int q)
     cpudev->rx[0].base = dev[q]->rx_base;
     cpudev->rx[0].tail = dev[q]->rx_tail;
     cpudev->rx[0].read = dev[q]->rx_read[0];
+    cpudev->rx[0].hsplit = dev[q]->rx_hsplit;
+
+    /* Direct cache access to this processor */
+    cpudev->rx[0].dca = ixgbe_dca;
+    for ( i = 0; i < 8; i++ ) {
+        _ixgbe_dca_setup(dev[i], i == q ? 0 : -1, q, this_cpu(), ixgbe_dca);
+    }
 
 #if 0
     arch_busy_usleep(q * 100 + 1000);
@@ -2468,6 +4117,9 @@ ixgbe_100g_routing(struct netdev_list *list, int q)
     for ( ;; ) {
         //ret = _100g_routing(dev, dev[q], q);
         ret = _100g_routing2(cpudev, q);
+        /* Sleep while idle in the hybrid mode; the control queue is polled
+           on the wakeup (10 ms at latest) */
+        netdev_rx_idle(cpudev->rx[0].netdev, 0, ret);
 #if 0
         for ( i = 0; i < 8; i++ ) {
             /* Poll i-th port */
@@ -2493,9 +4145,21 @@ ixgbe_100g_routing_1core(struct netdev_list *list)
     for ( q = 0; q < 8; q++ ) {
         list = first;
     /* Prepare 8 ports */
+    cpudev[q].rx[0].ctrl = NULL;
+    cpudev[q].rx[0].ctrl_cnt = 0;
+    cpudev[q].rx[0].netdev = NULL;
+    cpudev[q].fib = dxr_local(dxr);
+    processor_qs_register();
     for ( i = 0; i < 8; i++ ) {
         netdev = list->netdev;
         dev[i] = (struct ixgbe_device *)netdev->vendor;
+        _ixgbe_tx_ring_move(dev[i], q, PERCPU(node));
+        if ( i == q ) {
+            _ixgbe_rx_ring_move(dev[i], PERCPU(node));
+            cpudev[q].rx[0].ctrl = _100g_ctrl_setup(netdev);
+            cpudev[q].rx[0].stats = netdev_stats(netdev);
+        }
+        cpudev[q].tx[i].stats = netdev_stats(netdev);
 
         /* Set up context */
         struct ixgbe_adv_tx_desc_ctx *ctx;
@@ -2508,11 +4172,15 @@ ixgbe_100g_routing_1core(struct netdev_list *list)
         ctx->other = (1ULL << 29) | (2ULL << 20) | (2ULL << 9);
         dev[i]->tx[q].tail = ((dev[i]->tx[q].tail + 1) & dev[i]->tx[q].divisorm);
         mmio_write32(dev[i]->mmio, IXGBE_REG_TDT(q), dev[i]->tx[q].tail);
+        /* The forwarder writes its own context descriptors to this queue
+           without going through the key cached for ixgbe_tx_burst() */
+        dev[i]->tx[q].ctx = 0;
 
         cpudev[q].tx[i].mmio = dev[i]->mmio;
         cpudev[q].tx[i].base = dev[i]->tx[q].base;
         cpudev[q].tx[i].tail = dev[i]->tx[q].tail;
         cpudev[q].tx[i].head_cache = dev[i]->tx[q].head_cache;
+        cpudev[q].tx[i].vlan = 0;
 
         list = list->next;
     }
@@ -2520,6 +4188,11 @@ ixgbe_100g_routing_1core(struct netdev_list *list)
     cpudev[q].rx[0].base = dev[q]->rx_base;
     cpudev[q].rx[0].tail = dev[q]->rx_tail;
     cpudev[q].rx[0].read = dev[q]->rx_read[0];
+    cpudev[q].rx[0].hsplit = dev[q]->rx_hsplit;
+    cpudev[q].rx[0].dca = ixgbe_dca;
+    for ( i = 0; i < 8; i++ ) {
+        _ixgbe_dca_setup(dev[i], i == q ? 0 : -1, q, this_cpu(), ixgbe_dca);
+    }
     }
 
     for ( ;; ) {
@@ -0,0 +1,955 @@
+/*_
+ * Copyright (c) 2014 Hirochika Asai
+ * All rights reserved.
+ *
+ * Authors:
+ *      Hirochika Asai  <asai@jar.jp>
+ */
+
+#include <aos/const.h>
+#include "../../kernel/kernel.h"
+#include "netdev.h"
+#include "bridge.h"
+
+extern struct processor_table *processors;
+int this_cpu(void);
+u16 bswap16(u16);
+
+#define MACADDR_MASK            0xffffffffffffULL
+#define ETHERTYPE_IPV4          0x0800
+#define ETHERTYPE_VLAN          0x8100
+
+/* Maximum length of a cuckoo path to make room for a new entry */
+#define NET_FDB_MAX_PATH        32
+/* Interval to refresh the time of an entry seen (in nanoseconds) */
+#define NET_FDB_REFRESH         1000000000ULL
+
+/* Packets received at once */
+#define NET_BRIDGE_BURST        32
+/* The forwarder sweeps NET_BRIDGE_AGING_BUCKETS buckets of the FDB every
+   NET_BRIDGE_AGING_INTERVAL nanoseconds */
+#define NET_BRIDGE_AGING_INTERVAL   10000000ULL
+#define NET_BRIDGE_AGING_BUCKETS    256
+
+/* Packets to be sent to a port */
+struct net_bridge_txbuf {
+    int n;
+    struct mbuf *mbufs[NET_BRIDGE_BURST];
+};
+
+#define barrier()   __asm__ __volatile__ ("" ::: "memory")
+
+/*
+ * Hash key of (MAC address, VLAN)
+ */
+static __inline__ u64
+_key(u64 macaddr, u16 vid)
+{
+    return (macaddr & MACADDR_MASK) | ((u64)vid << 48);
+}
+
+/*
+ * The first bucket of a key, and the other bucket of a key in the bucket b;
+ * the two buckets are swapped by XOR so that an entry can be moved without
+ * knowing which one it is in
+ */
+static __inline__ u32
+_bucket(struct net_fdb *fdb, u64 key)
+{
+    return (u32)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (fdb->nbuckets - 1);
+}
+static __inline__ u32
+_alt(struct net_fdb *fdb, u32 b, u64 key)
+{
+    return (b ^ (u32)((key * 0xc2b2ae3d27d4eb4fULL) >> 32))
+        & (fdb->nbuckets - 1);
+}
+
+/*
+ * Find the entry of the key in the bucket b
+ */
+static __inline__ struct net_fdb_entry *
+_find(struct net_fdb *fdb, u32 b, u64 macaddr, u16 vid)
+{
+    struct net_fdb_entry *e;
+    int i;
+
+    e = &fdb->entries[b * NET_FDB_WAYS];
+    for ( i = 0; i < NET_FDB_WAYS; i++ ) {
+        if ( NET_FDB_INVAL != e[i].type && macaddr == e[i].macaddr
+             && vid == e[i].vid ) {
+            return &e[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Find a free slot in the bucket b
+ */
+static __inline__ int
+_free_slot(struct net_fdb *fdb, u32 b)
+{
+    int i;
+
+    for ( i = 0; i < NET_FDB_WAYS; i++ ) {
+        if ( NET_FDB_INVAL == fdb->entries[b * NET_FDB_WAYS + i].type ) {
+            return b * NET_FDB_WAYS + i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Initialize an FDB with nbuckets buckets (rounded up to a power of 2)
+ */
+int
+net_fdb_init(struct net_fdb *fdb, u32 nbuckets)
+{
+    u32 n;
+    int i;
+
+    n = 2;
+    while ( n < nbuckets ) {
+        n <<= 1;
+    }
+    fdb->entries = kmalloc(sizeof(struct net_fdb_entry) * n * NET_FDB_WAYS);
+    if ( NULL == fdb->entries ) {
+        return -1;
+    }
+    fdb->nbuckets = n;
+    fdb->nr = n * NET_FDB_WAYS;
+    for ( i = 0; i < fdb->nr; i++ ) {
+        fdb->entries[i].type = NET_FDB_INVAL;
+    }
+    fdb->ver = 0;
+    fdb->lock = 0;
+    fdb->aging = NET_FDB_AGING * 1000000000ULL;
+    fdb->sweep = 0;
+
+    return 0;
+}
+
+/*
+ * Look up the entry of (macaddr, vid); the entry is copied to e
+ */
+int
+net_fdb_lookup(struct net_fdb *fdb, u64 macaddr, u16 vid,
+               struct net_fdb_entry *e)
+{
+    struct net_fdb_entry *r;
+    u64 key;
+    u32 b;
+    u32 ver;
+
+    macaddr &= MACADDR_MASK;
+    key = _key(macaddr, vid);
+    b = _bucket(fdb, key);
+
+    for ( ;; ) {
+        ver = fdb->ver;
+        barrier();
+        r = _find(fdb, b, macaddr, vid);
+        if ( NULL == r ) {
+            r = _find(fdb, _alt(fdb, b, key), macaddr, vid);
+        }
+        if ( NULL != r ) {
+            *e = *r;
+        }
+        barrier();
+        if ( !(ver & 1) && ver == fdb->ver ) {
+            break;
+        }
+        /* Entries have been moved; retry */
+        __asm__ __volatile__ ("pause");
+    }
+
+    return NULL != r ? 0 : -1;
+}
+
+/*
+ * Search a cuckoo path from the bucket b to a free slot (the lock must be
+ * held); the entry at path[k] is to be moved to path[k + 1].  Return the
+ * length of the path.
+ */
+static int
+_cuckoo_path(struct net_fdb *fdb, u32 b, int *path)
+{
+    struct net_fdb_entry *e;
+    int d;
+    int i;
+    int j;
+    int k;
+    int slot;
+    int free;
+
+    for ( d = 0; d < NET_FDB_MAX_PATH - 1; d++ ) {
+        /* Pick an entry not on the path yet */
+        slot = -1;
+        for ( i = 0; i < NET_FDB_WAYS; i++ ) {
+            j = b * NET_FDB_WAYS + (i + d) % NET_FDB_WAYS;
+            for ( k = 0; k < d; k++ ) {
+                if ( path[k] == j ) {
+                    break;
+                }
+            }
+            if ( k == d ) {
+                slot = j;
+                break;
+            }
+        }
+        if ( slot < 0 ) {
+            return -1;
+        }
+        path[d] = slot;
+
+        e = &fdb->entries[slot];
+        b = _alt(fdb, b, _key(e->macaddr, e->vid));
+        free = _free_slot(fdb, b);
+        if ( free >= 0 ) {
+            path[d + 1] = free;
+            return d + 2;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Add or update the entry of (macaddr, vid); a dynamic entry does not
+ * override a static one
+ */
+int
+net_fdb_add(struct net_fdb *fdb, u64 macaddr, u16 vid, int type,
+            struct net_port *port)
+{
+    struct net_fdb_entry *e;
+    int path[NET_FDB_MAX_PATH];
+    u64 key;
+    u64 now;
+    u32 b;
+    int slot;
+    int n;
+    int k;
+
+    macaddr &= MACADDR_MASK;
+    key = _key(macaddr, vid);
+    b = _bucket(fdb, key);
+    now = arch_clock_get();
+
+    arch_spin_lock(&fdb->lock);
+
+    e = _find(fdb, b, macaddr, vid);
+    if ( NULL == e ) {
+        e = _find(fdb, _alt(fdb, b, key), macaddr, vid);
+    }
+    if ( NULL != e ) {
+        /* Update */
+        if ( NET_FDB_PORT_STATIC == e->type
+             && NET_FDB_PORT_DYNAMIC == type ) {
+            arch_spin_unlock(&fdb->lock);
+            return 0;
+        }
+        if ( e->type != type || e->u.port != port ) {
+            fdb->ver++;
+            barrier();
+            e->type = type;
+            e->u.port = port;
+            barrier();
+            fdb->ver++;
+        }
+        e->atime = now;
+        arch_spin_unlock(&fdb->lock);
+        return 0;
+    }
+
+    slot = _free_slot(fdb, b);
+    if ( slot < 0 ) {
+        slot = _free_slot(fdb, _alt(fdb, b, key));
+    }
+    if ( slot >= 0 ) {
+        /* The type is written last to publish the entry */
+        e = &fdb->entries[slot];
+        e->macaddr = macaddr;
+        e->vid = vid;
+        e->atime = now;
+        e->u.port = port;
+        barrier();
+        e->type = type;
+        arch_spin_unlock(&fdb->lock);
+        return 0;
+    }
+
+    /* Make room by moving entries to their other buckets */
+    n = _cuckoo_path(fdb, b, path);
+    if ( n < 0 ) {
+        n = _cuckoo_path(fdb, _alt(fdb, b, key), path);
+        if ( n < 0 ) {
+            /* Full */
+            arch_spin_unlock(&fdb->lock);
+            return -1;
+        }
+    }
+    fdb->ver++;
+    barrier();
+    for ( k = n - 1; k > 0; k-- ) {
+        fdb->entries[path[k]] = fdb->entries[path[k - 1]];
+    }
+    e = &fdb->entries[path[0]];
+    e->type = type;
+    e->macaddr = macaddr;
+    e->vid = vid;
+    e->atime = now;
+    e->u.port = port;
+    barrier();
+    fdb->ver++;
+
+    arch_spin_unlock(&fdb->lock);
+
+    return 0;
+}
+
+/*
+ * Delete the entry of (macaddr, vid)
+ */
+int
+net_fdb_del(struct net_fdb *fdb, u64 macaddr, u16 vid)
+{
+    struct net_fdb_entry *e;
+    u64 key;
+    u32 b;
+
+    macaddr &= MACADDR_MASK;
+    key = _key(macaddr, vid);
+    b = _bucket(fdb, key);
+
+    arch_spin_lock(&fdb->lock);
+    e = _find(fdb, b, macaddr, vid);
+    if ( NULL == e ) {
+        e = _find(fdb, _alt(fdb, b, key), macaddr, vid);
+    }
+    if ( NULL == e ) {
+        arch_spin_unlock(&fdb->lock);
+        return -1;
+    }
+    fdb->ver++;
+    barrier();
+    e->type = NET_FDB_INVAL;
+    barrier();
+    fdb->ver++;
+    arch_spin_unlock(&fdb->lock);
+
+    return 0;
+}
+
+/*
+ * Remove the dynamic entries expired in the next n buckets; return the
+ * number of the entries removed
+ */
+int
+net_fdb_age(struct net_fdb *fdb, u64 now, u32 n)
+{
+    struct net_fdb_entry *e;
+    u32 i;
+    int j;
+    int cnt;
+
+    if ( n > fdb->nbuckets ) {
+        n = fdb->nbuckets;
+    }
+    cnt = 0;
+    arch_spin_lock(&fdb->lock);
+    for ( i = 0; i < n; i++ ) {
+        e = &fdb->entries[fdb->sweep * NET_FDB_WAYS];
+        for ( j = 0; j < NET_FDB_WAYS; j++ ) {
+            if ( NET_FDB_PORT_DYNAMIC == e[j].type
+                 && now - e[j].atime > fdb->aging ) {
+                fdb->ver++;
+                barrier();
+                e[j].type = NET_FDB_INVAL;
+                barrier();
+                fdb->ver++;
+                cnt++;
+            }
+        }
+        fdb->sweep = (fdb->sweep + 1) & (fdb->nbuckets - 1);
+    }
+    arch_spin_unlock(&fdb->lock);
+
+    return cnt;
+}
+
+/*
+ * Remove the dynamic entries of the port on the VLAN
+ */
+static void
+_fdb_flush(struct net_fdb *fdb, struct net_port *port, u16 vid)
+{
+    int i;
+
+    arch_spin_lock(&fdb->lock);
+    fdb->ver++;
+    barrier();
+    for ( i = 0; i < fdb->nr; i++ ) {
+        if ( NET_FDB_PORT_DYNAMIC == fdb->entries[i].type
+             && port == fdb->entries[i].u.port
+             && vid == fdb->entries[i].vid ) {
+            fdb->entries[i].type = NET_FDB_INVAL;
+        }
+    }
+    barrier();
+    fdb->ver++;
+    arch_spin_unlock(&fdb->lock);
+}
+
+/*
+ * Create a bridge
+ */
+struct net_bridge *
+net_bridge_create(u32 nbuckets)
+{
+    struct net_bridge *br;
+
+    br = kmalloc(sizeof(struct net_bridge));
+    if ( NULL == br ) {
+        return NULL;
+    }
+    kmemset(br, 0, sizeof(struct net_bridge));
+    if ( net_fdb_init(&br->fdb, nbuckets) < 0 ) {
+        kfree(br);
+        return NULL;
+    }
+
+    return br;
+}
+
+/*
+ * Add a device to the bridge as a port; untagged frames belong to pvid (0 to
+ * drop them).  Return the port ID.
+ */
+int
+net_bridge_add_port(struct net_bridge *br, struct netdev *netdev, u16 pvid)
+{
+    struct net_port *port;
+    int i;
+
+    if ( NULL != netdev->port ) {
+        for ( i = 0; i < br->nports; i++ ) {
+            if ( netdev->port == br->ports[i] ) {
+                /* Already added */
+                return i;
+            }
+        }
+        return -1;
+    }
+    if ( br->nports >= NET_BRIDGE_MAX_PORTS || pvid >= NET_VLAN_NUM ) {
+        return -1;
+    }
+
+    port = kmalloc(sizeof(struct net_port));
+    if ( NULL == port ) {
+        return -1;
+    }
+    kmemset(port, 0, sizeof(struct net_port));
+    port->netdev = netdev;
+    port->next.func = NULL;
+    port->next.data = NULL;
+    port->id = br->nports;
+    port->pvid = pvid;
+
+    br->ports[port->id] = port;
+    br->nports++;
+    netdev->port = port;
+
+    if ( pvid ) {
+        net_bridge_vlan_add(br, port->id, pvid, 1);
+    }
+
+    return port->id;
+}
+
+/*
+ * Add the port to the VLAN
+ */
+int
+net_bridge_vlan_add(struct net_bridge *br, int id, u16 vid, int untagged)
+{
+    u64 bit;
+
+    if ( id < 0 || id >= br->nports || vid < 1 || vid >= NET_VLAN_NUM - 1 ) {
+        return -1;
+    }
+    bit = 1ULL << id;
+    if ( untagged ) {
+        br->untagged[vid] |= bit;
+    } else {
+        br->untagged[vid] &= ~bit;
+    }
+    br->members[vid] |= bit;
+    br->ports[id]->bridges[vid] = br;
+
+    return 0;
+}
+
+/*
+ * Remove the port from the VLAN
+ */
+int
+net_bridge_vlan_del(struct net_bridge *br, int id, u16 vid)
+{
+    u64 bit;
+
+    if ( id < 0 || id >= br->nports || vid < 1 || vid >= NET_VLAN_NUM - 1 ) {
+        return -1;
+    }
+    bit = 1ULL << id;
+    br->members[vid] &= ~bit;
+    br->untagged[vid] &= ~bit;
+    br->ports[id]->bridges[vid] = NULL;
+    if ( br->ports[id]->pvid == vid ) {
+        br->ports[id]->pvid = 0;
+    }
+    _fdb_flush(&br->fdb, br->ports[id], vid);
+
+    return 0;
+}
+
+/*
+ * Copy a packet to a new buffer for flooding
+ */
+static struct mbuf *
+_clone(struct mbuf *m)
+{
+    struct mbuf *c;
+    struct mbuf *s;
+    u8 *p;
+
+    c = mbuf_alloc(mbufpool);
+    if ( NULL == c ) {
+        return NULL;
+    }
+    if ( m->pktlen > MBUF_TAILROOM_LEN(c) ) {
+        mbuf_free(c);
+        return NULL;
+    }
+    p = MBUF_DATA(c);
+    for ( s = m; NULL != s; s = s->next ) {
+        kmemcpy(p, MBUF_DATA(s), s->len);
+        p += s->len;
+    }
+    c->len = m->pktlen;
+    c->pktlen = m->pktlen;
+    c->port = m->port;
+    c->vlan = m->vlan;
+    c->ol_flags = m->ol_flags;
+
+    return c;
+}
+
+/*
+ * Get the VLAN tag (TCI) of a received packet; an in-line tag is removed so
+ * that every packet is handled as stripped.  Return -1 to drop it.
+ */
+static __inline__ int
+_vlan_in(struct net_port *port, struct mbuf *m)
+{
+    u8 *pkt;
+    u16 tci;
+    int i;
+
+    if ( m->len < 14 ) {
+        return -1;
+    }
+    pkt = MBUF_DATA(m);
+    if ( m->ol_flags & MBUF_OL_RX_VLAN ) {
+        /* Stripped by the device */
+        tci = m->vlan;
+    } else if ( ETHERTYPE_VLAN == bswap16(*(u16 *)(pkt + 12)) ) {
+        if ( m->len < 18 ) {
+            return -1;
+        }
+        tci = bswap16(*(u16 *)(pkt + 14));
+        /* Move the MAC addresses over the tag */
+        for ( i = 11; i >= 0; i-- ) {
+            pkt[i + 4] = pkt[i];
+        }
+        mbuf_adj(m, 4);
+    } else {
+        tci = 0;
+    }
+    if ( 0 == (tci & 0xfff) ) {
+        /* Untagged or priority tagged */
+        if ( 0 == port->pvid ) {
+            return -1;
+        }
+        tci |= port->pvid;
+    }
+    m->vlan = tci;
+
+    return tci;
+}
+
+/*
+ * Tag the packet for the output port, by the device if it can insert the
+ * tag
+ */
+static __inline__ int
+_vlan_out(struct net_bridge *br, struct net_port *port, struct mbuf *m)
+{
+    u8 *pkt;
+    int i;
+
+    m->ol_flags = 0;
+    if ( br->untagged[m->vlan & 0xfff] & (1ULL << port->id) ) {
+        return 0;
+    }
+    if ( port->netdev->offload & NETDEV_OFFLOAD_VLAN_INSERT ) {
+        m->ol_flags = MBUF_OL_TX_VLAN;
+        return 0;
+    }
+    pkt = mbuf_prepend(m, 4);
+    if ( NULL == pkt ) {
+        return -1;
+    }
+    for ( i = 0; i < 12; i++ ) {
+        pkt[i] = pkt[i + 4];
+    }
+    *(u16 *)(pkt + 12) = bswap16(ETHERTYPE_VLAN);
+    *(u16 *)(pkt + 14) = bswap16(m->vlan);
+
+    return 0;
+}
+
+/*
+ * Queue a packet to the output port
+ */
+static __inline__ void
+_output(struct net_bridge *br, struct net_bridge_txbuf *tx,
+        struct net_port *port, struct mbuf *m)
+{
+    if ( _vlan_out(br, port, m) < 0 ) {
+        mbuf_free(m);
+        return;
+    }
+    tx[port->id].mbufs[tx[port->id].n] = m;
+    tx[port->id].n++;
+}
+
+/*
+ * Apply the ACL to a burst of packets; the packets denied are freed.  Return
+ * the number of the packets remaining.
+ */
+static int
+_acl(struct acl_tree *acl, struct mbuf **mbufs, int n)
+{
+    struct acl_key keys[NET_BRIDGE_BURST];
+    int res[NET_BRIDGE_BURST];
+    u8 idx[NET_BRIDGE_BURST];
+    u8 *pkt;
+    int nkeys;
+    int i;
+    int j;
+
+    nkeys = 0;
+    for ( i = 0; i < n; i++ ) {
+        pkt = MBUF_DATA(mbufs[i]);
+        if ( ETHERTYPE_IPV4 != bswap16(*(u16 *)(pkt + 12))
+             || acl_key_ipv4(pkt + 14, mbufs[i]->len - 14, &keys[nkeys])
+             < 0 ) {
+            /* Not subject to the ACL */
+            continue;
+        }
+        idx[nkeys] = i;
+        nkeys++;
+    }
+    acl_classify_bulk(acl, keys, res, nkeys);
+    for ( i = 0; i < nkeys; i++ ) {
+        if ( ACL_DENY == res[i] ) {
+            mbuf_free(mbufs[idx[i]]);
+            mbufs[idx[i]] = NULL;
+        }
+    }
+
+    /* Compaction */
+    j = 0;
+    for ( i = 0; i < n; i++ ) {
+        if ( NULL != mbufs[i] ) {
+            mbufs[j] = mbufs[i];
+            j++;
+        }
+    }
+
+    return j;
+}
+
+/*
+ * Bridge a burst of packets received at the port; at most one packet per
+ * received packet is queued to each output port
+ */
+static void
+_input(struct net_bridge *br, struct net_port *port, struct mbuf **mbufs,
+       int n, struct net_bridge_txbuf *tx, u64 now, struct netdev_stats *st)
+{
+    struct net_fdb_entry e;
+    struct acl_tree *acl;
+    struct mbuf *m;
+    struct mbuf *c;
+    u8 *pkt;
+    u64 dst;
+    u64 src;
+    u64 inbit;
+    u64 ports;
+    int vid;
+    int i;
+    int j;
+
+    /* VLAN and ingress filtering */
+    inbit = 1ULL << port->id;
+    j = 0;
+    for ( i = 0; i < n; i++ ) {
+        m = mbufs[i];
+        vid = _vlan_in(port, m);
+        if ( vid < 0 || !(br->members[vid & 0xfff] & inbit) ) {
+            st->c[NETDEV_STAT_DROP_FILTER]++;
+            mbuf_free(m);
+            continue;
+        }
+        m->port = port->id;
+        mbufs[j] = m;
+        j++;
+    }
+    n = j;
+
+    acl = br->acl;
+    if ( NULL != acl ) {
+        j = _acl(acl, mbufs, n);
+        st->c[NETDEV_STAT_DROP_ACL] += n - j;
+        n = j;
+    }
+
+    for ( i = 0; i < n; i++ ) {
+        m = mbufs[i];
+        if ( i + 1 < n ) {
+            __builtin_prefetch(MBUF_DATA(mbufs[i + 1]));
+        }
+        vid = m->vlan & 0xfff;
+
+        pkt = MBUF_DATA(m);
+        dst = *(u64 *)pkt & MACADDR_MASK;
+        src = *(u64 *)(pkt + 6) & MACADDR_MASK;
+
+        /* Learn the source */
+        if ( src & 1 ) {
+            /* Multicast source address */
+            st->c[NETDEV_STAT_DROP_ERROR]++;
+            mbuf_free(m);
+            continue;
+        }
+        if ( net_fdb_lookup(&br->fdb, src, vid, &e) < 0
+             || (NET_FDB_PORT_DYNAMIC == e.type && e.u.port != port)
+             || now - e.atime > NET_FDB_REFRESH ) {
+            net_fdb_add(&br->fdb, src, vid, NET_FDB_PORT_DYNAMIC, port);
+        }
+
+        /* Forward to the known unicast destination */
+        if ( !(dst & 1) && net_fdb_lookup(&br->fdb, dst, vid, &e) >= 0 ) {
+            if ( (NET_FDB_PORT_DYNAMIC != e.type
+                  && NET_FDB_PORT_STATIC != e.type)
+                 || e.u.port == port
+                 || !(br->members[vid] & (1ULL << e.u.port->id)) ) {
+                /* Local, or filtered */
+                st->c[NETDEV_STAT_DROP_FILTER]++;
+                mbuf_free(m);
+                continue;
+            }
+            _output(br, tx, e.u.port, m);
+            continue;
+        }
+
+        /* Flood to the other members of the VLAN */
+        if ( !(dst & 1) ) {
+            st->c[NETDEV_STAT_LOOKUP_MISS]++;
+        }
+        ports = br->members[vid] & ~inbit;
+        while ( ports ) {
+            j = __builtin_ctzll(ports);
+            ports &= ports - 1;
+            if ( ports ) {
+                c = _clone(m);
+                if ( NULL == c ) {
+                    continue;
+                }
+            } else {
+                c = m;
+                m = NULL;
+            }
+            _output(br, tx, br->ports[j], c);
+        }
+        if ( NULL != m ) {
+            /* No other members */
+            mbuf_free(m);
+        }
+    }
+}
+
+/*
+ * Assign the RX queue and the TX queue of each port to this processor; the
+ * queues are not locked, so fail if another processor bridging already uses
+ * one of them.  The RX queue is pinned in rxqmap of the device.
+ */
+static int
+_claim_queues(struct net_bridge *br, int cpu, int nports, int *rxq, int *txq)
+{
+    struct netdev *netdev;
+    int c;
+    int i;
+
+    arch_spin_lock(&br->lock);
+    for ( i = 0; i < nports; i++ ) {
+        if ( rxq[i] < 0 ) {
+            continue;
+        }
+        netdev = br->ports[i]->netdev;
+        for ( c = 0; c < MAX_PROCESSORS; c++ ) {
+            if ( c == cpu || !br->cpus[c] ) {
+                continue;
+            }
+            if ( netdev->rxqmap[c] == rxq[i] ) {
+                kprintf("RX queue %d of %s is polled by CPU #%d\r\n", rxq[i],
+                        netdev->name, c);
+                arch_spin_unlock(&br->lock);
+                return -1;
+            }
+            if ( processors->map[c] % netdev->ntxq == txq[i] ) {
+                kprintf("TX queue %d of %s is used by CPU #%d\r\n", txq[i],
+                        netdev->name, c);
+                arch_spin_unlock(&br->lock);
+                return -1;
+            }
+        }
+    }
+    for ( i = 0; i < nports; i++ ) {
+        if ( rxq[i] >= 0 ) {
+            br->ports[i]->netdev->rxqmap[cpu] = rxq[i];
+        }
+    }
+    br->cpus[cpu] = 1;
+    arch_spin_unlock(&br->lock);
+
+    return 0;
+}
+
+/*
+ * Bridge the packets received at the RX queue assigned to this processor of
+ * each port.  Running this on multiple processors scales the bridge only if
+ * the devices have an RX queue and a TX queue for each of them (see
+ * netdev_set_rxq()); a processor whose queues are already used by another
+ * one is refused.
+ */
+int
+net_bridge_forward(struct net_bridge *br)
+{
+    struct mbuf *mbufs[NET_BRIDGE_BURST];
+    struct net_bridge_txbuf *tx;
+    struct netdev *netdev;
+    struct netdev_stats *st[NET_BRIDGE_MAX_PORTS];
+    int rxq[NET_BRIDGE_MAX_PORTS];
+    int txq[NET_BRIDGE_MAX_PORTS];
+    int nports;
+    int cpu;
+    int ntx;
+    int n;
+    int i;
+    int j;
+    u64 now;
+    u64 next;
+
+    tx = kmalloc(sizeof(struct net_bridge_txbuf) * NET_BRIDGE_MAX_PORTS);
+    if ( NULL == tx ) {
+        return -1;
+    }
+
+    /* Queues of this processor; ports added later are not polled */
+    cpu = this_cpu();
+    nports = br->nports;
+    for ( i = 0; i < nports; i++ ) {
+        netdev = br->ports[i]->netdev;
+        tx[i].n = 0;
+        st[i] = netdev_stats(netdev);
+        if ( NULL == netdev->rx_burst || NULL == netdev->tx_burst ) {
+            rxq[i] = -1;
+            txq[i] = -1;
+            continue;
+        }
+        rxq[i] = netdev_rxq(netdev, cpu);
+        txq[i] = processors->map[cpu] % netdev->ntxq;
+    }
+    if ( _claim_queues(br, cpu, nports, rxq, txq) < 0 ) {
+        kfree(tx);
+        return -1;
+    }
+    for ( i = 0; i < nports; i++ ) {
+        if ( rxq[i] >= 0 ) {
+            kprintf("Bridging %s (rx queue %d, tx queue %d)\r\n",
+                    br->ports[i]->netdev->name, rxq[i], txq[i]);
+        }
+    }
+
+    /* The ACL is replaced after a quiescent state of this processor */
+    processor_qs_register();
+
+    next = arch_clock_get() + NET_BRIDGE_AGING_INTERVAL;
+    for ( ;; ) {
+        processor_quiescent();
+        now = arch_clock_get();
+        for ( i = 0; i < nports; i++ ) {
+            if ( rxq[i] < 0 ) {
+                continue;
+            }
+            netdev = br->ports[i]->netdev;
+            n = netdev->rx_burst(netdev, rxq[i], mbufs, NET_BRIDGE_BURST);
+            if ( n <= 0 ) {
+                continue;
+            }
+            _input(br, br->ports[i], mbufs, n, tx, now, st[i]);
+
+            /* Flush */
+            for ( j = 0; j < nports; j++ ) {
+                if ( 0 == tx[j].n ) {
+                    continue;
+                }
+                if ( txq[j] < 0 ) {
+                    mbuf_free_bulk(tx[j].mbufs, tx[j].n);
+                    tx[j].n = 0;
+                    continue;
+                }
+                netdev = br->ports[j]->netdev;
+                ntx = netdev->tx_burst(netdev, txq[j], tx[j].mbufs, tx[j].n);
+                if ( ntx < tx[j].n ) {
+                    /* Drop */
+                    st[j]->c[NETDEV_STAT_DROP_TXFULL] += tx[j].n - ntx;
+                    mbuf_free_bulk(tx[j].mbufs + ntx, tx[j].n - ntx);
+                }
+                tx[j].n = 0;
+            }
+        }
+
+        if ( now > next ) {
+            net_fdb_age(&br->fdb, now, NET_BRIDGE_AGING_BUCKETS);
+            next = now + NET_BRIDGE_AGING_INTERVAL;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,40 @@
+/*_
+ * Copyright (c) 2014 Hirochika Asai
+ * All rights reserved.
+ *
+ * Authors:
+ *      Hirochika Asai  <asai@jar.jp>
+ */
+
+#ifndef _DRIVERS_NET_BRIDGE_H
+#define _DRIVERS_NET_BRIDGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    int net_fdb_init(struct net_fdb *, u32);
+    int net_fdb_lookup(struct net_fdb *, u64, u16, struct net_fdb_entry *);
+    int net_fdb_add(struct net_fdb *, u64, u16, int, struct net_port *);
+    int net_fdb_del(struct net_fdb *, u64, u16);
+    int net_fdb_age(struct net_fdb *, u64, u32);
+    struct net_bridge * net_bridge_create(u32);
+    int net_bridge_add_port(struct net_bridge *, struct netdev *, u16);
+    int net_bridge_vlan_add(struct net_bridge *, int, u16, int);
+    int net_bridge_vlan_del(struct net_bridge *, int, u16);
+    int net_bridge_forward(struct net_bridge *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DRIVERS_NET_BRIDGE_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
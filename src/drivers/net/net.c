@@ -95,6 +95,8 @@ struct tcpopts {
 };
 
 #define TCP_MAX_SESSIONS 64
+/* Maximum payload of a segment handed to the NIC for TSO */
+#define TCP_TSO_MAX     (63 * 1024)
 static struct tcp_session sessions[TCP_MAX_SESSIONS];
 
 
@@ -175,6 +177,23 @@ _ip_checksum(const u8 *data, int len)
     return cs;
 }
 
+/*
+ * Sum of the pseudo header (not complemented) to be filled in the checksum
+ * field for the L4 checksum offload
+ */
+static u16
+_phdr_sum(u32 saddr, u32 daddr, u8 proto, u16 len)
+{
+    u32 sum;
+
+    sum = (saddr & 0xffff) + (saddr >> 16) + (daddr & 0xffff) + (daddr >> 16)
+        + bswap16(proto) + bswap16(len);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+
+    return sum;
+}
+
 
 /*
  * Allocate a packet
@@ -286,7 +305,11 @@ net_papp_host_port_ip_xmit(struct net_papp_ctx *ctx, u8 *hdr, int off,
 {
     struct iphdr *iphdr;
     struct net_papp_meta_host_port_ip *mdata;
+    struct netdev *netdev;
+    struct mbuf *m;
+    struct mbuf *seg;
     int len;
+    int ret;
 
     /* Meta data */
     mdata = (struct net_papp_meta_host_port_ip *)ctx->data;
@@ -297,13 +320,38 @@ net_papp_host_port_ip_xmit(struct net_papp_ctx *ctx, u8 *hdr, int off,
     iphdr->ip_len = bswap16(iplen + sizeof(struct iphdr));
     len = iplen + sizeof(struct ethhdr) + sizeof(struct iphdr);
 
+    netdev = mdata->hport->port->netdev;
+    m = mbuf_from_addr(mbufpool, (u64)pkt);
+
     /* Checksum */
     iphdr->ip_sum = 0;
-    iphdr->ip_sum = _ip_checksum((u8 *)iphdr, sizeof(struct iphdr));
+    if ( NULL != netdev->tx_burst
+         && (netdev->offload & NETDEV_OFFLOAD_IP_CKSUM) ) {
+        m->ol_flags |= MBUF_OL_TX_IP_CKSUM;
+    } else {
+        iphdr->ip_sum = _ip_checksum((u8 *)iphdr, sizeof(struct iphdr));
+    }
+    m->l2len = sizeof(struct ethhdr);
+    m->l3len = sizeof(struct iphdr);
 
+    /* Hand the buffer to the driver; it is consumed in any case */
+    if ( NULL == netdev->tx_burst ) {
+        ret = netdev->sendpkt(pkt, len, netdev);
+        mbuf_free(m);
+        return ret;
+    }
+    /* The following segments (if any) have their own lengths */
+    m->len = len;
+    m->pktlen = len;
+    for ( seg = m->next; NULL != seg; seg = seg->next ) {
+        m->len -= seg->len;
+    }
+    if ( netdev->tx_burst(netdev, 0, &m, 1) < 1 ) {
+        mbuf_free(m);
+        return -1;
+    }
 
-    return mdata->hport->port->netdev->sendpkt(pkt, len,
-                                               mdata->hport->port->netdev);
+    return len;
 }
 
 
@@ -413,30 +461,38 @@ void *
 papp_alloc(struct net_papp_ctx *ctx, struct net_papp_status *stat)
 {
     int idx;
-    u64 pkt;
+    struct mbuf *m;
     u64 hdr;
     u8 *p;
     int ret;
 
-    /* Pop a packet buffer from the pool */
+    /* Pop a header buffer from the pool */
     idx = palloc(ctx->net);
     if ( idx < 0 ) {
         return NULL;
     }
-    pkt = ctx->net->papp.pkt.base + (idx * ctx->net->papp.pkt.sz);
+    /* Packet buffer, which is passed to the driver without copy */
+    m = mbuf_alloc(mbufpool);
+    if ( NULL == m ) {
+        pfree(ctx->net, idx);
+        return NULL;
+    }
+    m->udata = idx;
     hdr = ctx->net->papp.hdr.base + (idx * ctx->net->papp.hdr.sz);
     ctx->net->papp.hdr.off[idx] = 0;
 
     /* Call the papp function of the corresponding context */
     ret = ctx->alloc(ctx, (u8 *)hdr, stat);
     if ( ret < 0 ) {
+        mbuf_free(m);
+        pfree(ctx->net, idx);
         return NULL;
     }
     stat->errno = 0;
 
     /* Set offset */
     ctx->net->papp.hdr.off[idx] = ret;
-    p = (u8 *)(pkt + ret);
+    p = MBUF_DATA(m) + ret;
 
     return p;
 }
@@ -449,10 +505,16 @@ papp_xmit(struct net_papp_ctx *ctx, u8 *pkt, int len)
 {
     int idx;
     int ret;
+    struct mbuf *m;
     u8 *hdr;
 
     /* Packet address to index */
-    idx = ((u64)pkt - ctx->net->papp.pkt.base) / ctx->net->papp.pkt.sz;
+    m = mbuf_from_addr(mbufpool, (u64)pkt);
+    if ( unlikely(NULL == m) ) {
+        /* Invalid packet address */
+        return -1;
+    }
+    idx = m->udata;
 
     /* Check the index whether being in the valid range */
     if ( unlikely(idx < 0 || idx >= ctx->net->papp.len) ) {
@@ -460,14 +522,11 @@ papp_xmit(struct net_papp_ctx *ctx, u8 *pkt, int len)
         return -1;
     }
 
-    pkt = (u8 *)(ctx->net->papp.pkt.base + (idx * ctx->net->papp.pkt.sz));
+    pkt = MBUF_DATA(m);
     hdr = (u8 *)(ctx->net->papp.hdr.base + (idx * ctx->net->papp.hdr.sz));
 
-    /* Transmit */
+    /* Transmit (the packet buffer is consumed) */
     ret = ctx->xmit(ctx, hdr, ctx->net->papp.hdr.off[idx], pkt, len);
-    if ( ret < 0 ) {
-        return ret;
-    }
 
     /* Free */
     pfree(ctx->net, idx);
@@ -482,9 +541,15 @@ void
 papp_free(struct net_papp_ctx *ctx, u8 *pkt)
 {
     int idx;
+    struct mbuf *m;
 
     /* Packet address to index */
-    idx = ((u64)pkt - ctx->net->papp.pkt.base) / ctx->net->papp.pkt.sz;
+    m = mbuf_from_addr(mbufpool, (u64)pkt);
+    if ( unlikely(NULL == m) ) {
+        /* Invalid packet address */
+        return;
+    }
+    idx = m->udata;
 
     /* Check the index whether being in the valid range */
     if ( unlikely(idx < 0 || idx >= ctx->net->papp.len) ) {
@@ -493,6 +558,7 @@ papp_free(struct net_papp_ctx *ctx, u8 *pkt)
     }
 
     /* Free */
+    mbuf_free(m);
     pfree(ctx->net, idx);
 }
 
@@ -556,6 +622,40 @@ tcp_opt_parse(u8 *tcpopts, int optlen, struct tcpopts *opts)
     return 0;
 }
 
+/*
+ * Request the TCP checksum offload (or TSO for the payload longer than the
+ * MSS) to the device for the packet buffer of the TCP header
+ */
+static int
+_tcp_offload(struct netdev *netdev, struct tcp_hdr *tcp, u32 saddr,
+             u32 daddr, int hlen, u32 plen, u32 mss)
+{
+    struct mbuf *m;
+
+    if ( NULL == netdev->tx_burst ) {
+        return -1;
+    }
+    m = mbuf_from_addr(mbufpool, (u64)tcp);
+    if ( plen > mss ) {
+        if ( !(netdev->offload & NETDEV_OFFLOAD_TSO) ) {
+            return -1;
+        }
+        m->ol_flags |= MBUF_OL_TX_TSO;
+        m->mss = mss;
+        /* The length is excluded for TSO */
+        tcp->checksum = _phdr_sum(saddr, daddr, IP_TCP, 0);
+    } else {
+        if ( !(netdev->offload & NETDEV_OFFLOAD_TCP_CKSUM) ) {
+            return -1;
+        }
+        m->ol_flags |= MBUF_OL_TX_TCP_CKSUM;
+        tcp->checksum = _phdr_sum(saddr, daddr, IP_TCP, hlen + plen);
+    }
+    m->l4len = hlen;
+
+    return 0;
+}
+
 /*
  * Send an ACK packet
  */
@@ -630,19 +730,23 @@ tcp_send_ack(struct net *net, struct net_stack_chain_next *tx,
     }
 
     /* Pseudo checksum */
-    struct tcp_phdr4 *ptcp;
-    plen = sizeof(struct tcp_phdr4);
-    if ( syn ) {
-        plen += 8;
+    ret = _tcp_offload(mdata.hport->port->netdev, tcp, sess->lipaddr,
+                       sess->ripaddr, len, 0, sess->mss);
+    if ( ret < 0 ) {
+        struct tcp_phdr4 *ptcp;
+        plen = sizeof(struct tcp_phdr4);
+        if ( syn ) {
+            plen += 8;
+        }
+        ptcp = alloca(plen);
+        kmemcpy(&ptcp->sport, tcp, len);
+        ptcp->saddr = sess->lipaddr;
+        ptcp->daddr = sess->ripaddr;
+        ptcp->zeros = 0;
+        ptcp->proto = IP_TCP;
+        ptcp->tcplen = bswap16(len + 0 /*payload*/);
+        tcp->checksum = _checksum((u8 *)ptcp, plen);
     }
-    ptcp = alloca(plen);
-    kmemcpy(&ptcp->sport, tcp, len);
-    ptcp->saddr = sess->lipaddr;
-    ptcp->daddr = sess->ripaddr;
-    ptcp->zeros = 0;
-    ptcp->proto = IP_TCP;
-    ptcp->tcplen = bswap16(len + 0 /*payload*/);
-    tcp->checksum = _checksum((u8 *)ptcp, plen);
 
     if ( syn || fin ) {
         sess->seq++;
@@ -661,6 +765,11 @@ tcp_send_data(struct net *net, struct net_stack_chain_next *tx,
     u8 *p;
     struct net_papp_meta_host_port_ip mdata;
     struct tcp_hdr *tcp2;
+    struct mbuf *m;
+    struct mbuf *seg;
+    struct mbuf *last;
+    u32 room;
+    u32 pos;
     int ret;
 
     mdata.hport = ((struct net_port *)(tx->data))->next.data;
@@ -706,18 +815,50 @@ tcp_send_data(struct net *net, struct net_stack_chain_next *tx,
     tcp2->urgptr = 0;    /* Check the buffer */
 
     /* Pseudo checksum */
-    struct tcp_phdr4 *ptcp;
-    ptcp = alloca(sizeof(struct tcp_phdr4) + plen);
-    kmemcpy(&ptcp->sport, tcp2, len);
-    ptcp->saddr = sess->lipaddr;
-    ptcp->daddr = sess->ripaddr;
-    ptcp->zeros = 0;
-    ptcp->proto = IP_TCP;
-    ptcp->tcplen = bswap16(len + plen /*payload*/);
-    kmemcpy((u8 *)ptcp + sizeof(struct tcp_phdr4), pkt, plen);
-    tcp2->checksum = _checksum((u8 *)ptcp, sizeof(struct tcp_phdr4) + plen);
+    ret = _tcp_offload(mdata.hport->port->netdev, tcp2, sess->lipaddr,
+                       sess->ripaddr, len, plen, sess->mss);
+    if ( ret < 0 ) {
+        if ( plen > sess->mss ) {
+            /* TSO is not supported */
+            papp_free(&ctx, p);
+            return -1;
+        }
+        struct tcp_phdr4 *ptcp;
+        ptcp = alloca(sizeof(struct tcp_phdr4) + plen);
+        kmemcpy(&ptcp->sport, tcp2, len);
+        ptcp->saddr = sess->lipaddr;
+        ptcp->daddr = sess->ripaddr;
+        ptcp->zeros = 0;
+        ptcp->proto = IP_TCP;
+        ptcp->tcplen = bswap16(len + plen /*payload*/);
+        kmemcpy((u8 *)ptcp + sizeof(struct tcp_phdr4), pkt, plen);
+        tcp2->checksum = _checksum((u8 *)ptcp, sizeof(struct tcp_phdr4) + plen);
+    }
 
-    kmemcpy(p + sizeof(struct tcp_hdr), pkt, plen);
+    /* Copy the payload; a large segment for TSO continues to the following
+       buffers */
+    m = mbuf_from_addr(mbufpool, (u64)p);
+    room = MBUF_BUF(m) + m->pool->bufsz - (p + sizeof(struct tcp_hdr));
+    if ( room > plen ) {
+        room = plen;
+    }
+    kmemcpy(p + sizeof(struct tcp_hdr), pkt, room);
+    last = m;
+    for ( pos = room; pos < plen; pos += seg->len ) {
+        seg = mbuf_alloc(mbufpool);
+        if ( NULL == seg ) {
+            /* Free the chain with the packet */
+            papp_free(&ctx, p);
+            return -1;
+        }
+        seg->len = MBUF_TAILROOM_LEN(seg);
+        if ( seg->len > plen - pos ) {
+            seg->len = plen - pos;
+        }
+        kmemcpy(MBUF_DATA(seg), pkt + pos, seg->len);
+        last->next = seg;
+        last = seg;
+    }
 
     ret = papp_xmit(&ctx, p, len + plen);
 
@@ -1629,6 +1770,11 @@ net_tcp_trigger(struct net *net)
     int i;
     int sz;
     int rcvwin;
+    int maxsz;
+    int pktsz;
+    int pos;
+    u32 seq;
+    struct netdev *netdev;
 
     for ( i = 0; i < TCP_MAX_SESSIONS; i++ ) {
         if ( TCP_CLOSED == sessions[i].state ) {
@@ -1652,35 +1798,27 @@ net_tcp_trigger(struct net *net)
                 continue;
             }
 
+            /* Hand a large segment to the NIC if TSO is available */
+            netdev = ((struct net_port *)(sessions[i].tx->data))->netdev;
+            if ( NULL != netdev->tx_burst
+                 && (netdev->offload & NETDEV_OFFLOAD_TSO) ) {
+                maxsz = TCP_TSO_MAX;
+            } else {
+                maxsz = sessions[i].mss;
+            }
+
             /* Send packets */
-            u8 *pkt = alloca(sessions[i].mss);
-            int pktsz;
-            int pos = 0;
-            u32 seq = sessions[i].seq;
+            pos = sessions[i].twin.pos0;
+            seq = sessions[i].seq;
             while ( sz > 0 ) {
-                if ( sz > sessions[i].mss ) {
-                    pktsz = sessions[i].mss;
-                } else {
-                    pktsz = sz;
-                }
-#if 0
-                if ( sessions[i].twin.pos0  ) {
-                    sessions[i].mss;
-                }
-#endif
-                pos = sessions[i].twin.pos0;
+                pktsz = sz > maxsz ? maxsz : sz;
                 if ( pos + pktsz > sessions[i].twin.sz ) {
-                    kmemcpy(pkt, sessions[i].twin.buf + pos,
-                            sessions[i].twin.sz - pos);
-                    kmemcpy(pkt,
-                            sessions[i].twin.buf + sessions[i].twin.sz - pos,
-                            pktsz - sessions[i].twin.sz + pos);
-                } else {
-                    kmemcpy(pkt, sessions[i].twin.buf + pos, pktsz);
+                    /* Split at the end of the buffer */
+                    pktsz = sessions[i].twin.sz - pos;
                 }
                 //kprintf("**** %x %x\r\n", pos, sz);
                 tcp_send_data(net, sessions[i].tx, &sessions[i],
-                              seq, pkt, pktsz);
+                              seq, sessions[i].twin.buf + pos, pktsz);
                 sz -= pktsz;
                 pos = (pos + pktsz) % sessions[i].twin.sz;
                 seq += pktsz;
@@ -1714,8 +1852,7 @@ net_init(struct net *net)
     /* Initialize PAPP */
     net->papp.len = 1<<7/*128*/;
     net->papp.wrap = (1<<7) - 1;
-    net->papp.pkt.sz = ((net->sys_mtu + 4095) / 4096) * 4096;
-    net->papp.pkt.base = (u64)kmalloc(net->papp.pkt.sz * net->papp.len);
+    net->papp.pkt.sz = MBUF_DATAROOM;
     net->papp.hdr.sz = 256;
     net->papp.hdr.base = (u64)kmalloc(net->papp.hdr.sz * net->papp.len);
     net->papp.hdr.off = kmalloc(sizeof(int) * net->papp.len);
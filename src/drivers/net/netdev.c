@@ -10,6 +10,23 @@
 
 struct netdev_list *netdev_head;
 
+extern struct processor_table *processors;
+int this_cpu(void);
+void lapic_send_ns_fixed_ipi(u8, u8);
+void lapic_start_oneshot(u64, u8);
+u32 lapic_timer_count(void);
+void lapic_stop_timer(void);
+
+/* Empty polls before a queue in the hybrid mode goes to sleep */
+#define NETDEV_RX_IDLE_POLLS    256
+/* Maximum sleep in nanoseconds; bounds the latency of the traffic not
+   covered by the interrupt */
+#define NETDEV_RX_SLEEP_MAX     10000000ULL
+/* Interrupt throttling intervals in microseconds */
+#define NETDEV_RX_ITR_LOWEST    14
+#define NETDEV_RX_ITR_LOW       50
+#define NETDEV_RX_ITR_BULK      250
+
 /*
  * Initialize
  */
@@ -48,6 +65,18 @@ netdev_add_device(const u8 *macaddr, void *vendor)
         kfree(*list);
         return NULL;
     }
+    /* Per-processor counters; the allocation is page-aligned so that each
+       entry occupies its own cache lines */
+    (*list)->netdev->stats
+        = kmalloc(sizeof(struct netdev_stats) * MAX_PROCESSORS);
+    if ( NULL == (*list)->netdev->stats ) {
+        kfree((*list)->netdev);
+        kfree(*list);
+        *list = NULL;
+        return NULL;
+    }
+    kmemset((*list)->netdev->stats, 0,
+            sizeof(struct netdev_stats) * MAX_PROCESSORS);
     (*list)->netdev->name[0] = 'e';
     (*list)->netdev->name[1] = '0' + num;
     (*list)->netdev->name[2] = '\0';
@@ -57,10 +86,319 @@ netdev_add_device(const u8 *macaddr, void *vendor)
     }
 
     (*list)->netdev->vendor = vendor;
+    (*list)->netdev->offload = 0;
+    (*list)->netdev->nrxq = 1;
+    (*list)->netdev->ntxq = 1;
+    (*list)->netdev->ctrlq = -1;
+    for ( i = 0; i < MAX_PROCESSORS; i++ ) {
+        (*list)->netdev->rxqmap[i] = NETDEV_RXQ_ANY;
+    }
+    (*list)->netdev->sendpkt = NULL;
+    (*list)->netdev->recvpkt = NULL;
+    (*list)->netdev->rx_burst = NULL;
+    (*list)->netdev->tx_burst = NULL;
+    (*list)->netdev->rx_hsplit = NULL;
+    (*list)->netdev->poll_ctrl = NULL;
+    (*list)->netdev->filter_add = NULL;
+    (*list)->netdev->filter_del = NULL;
+    (*list)->netdev->rx_intr = NULL;
+    (*list)->netdev->rx_itr = NULL;
+    (*list)->netdev->hwstats = NULL;
+    (*list)->netdev->rxmode = NETDEV_RXMODE_POLL;
+    kmemset((*list)->netdev->rxqstat, 0, sizeof((*list)->netdev->rxqstat));
+    (*list)->netdev->port = NULL;
 
     return (*list)->netdev;
 }
 
+/*
+ * Assign the RX queue q of the device to the processor (APIC ID)
+ */
+int
+netdev_set_rxq(struct netdev *netdev, int cpu, int q)
+{
+    if ( cpu < 0 || cpu >= MAX_PROCESSORS ) {
+        return -1;
+    }
+    if ( q < 0 || q >= netdev->nrxq ) {
+        return -1;
+    }
+    netdev->rxqmap[cpu] = q;
+
+    return 0;
+}
+
+/*
+ * Get the RX queue polled by the processor (APIC ID); the queues are
+ * distributed over the processors in order unless assigned
+ */
+int
+netdev_rxq(struct netdev *netdev, int cpu)
+{
+    int nq;
+    int q;
+
+    if ( NETDEV_RXQ_ANY != netdev->rxqmap[cpu] ) {
+        return netdev->rxqmap[cpu];
+    }
+
+    nq = netdev->nrxq;
+    if ( netdev->ctrlq >= 0 && nq > 1 ) {
+        /* Skip the control queue */
+        nq--;
+        q = processors->map[cpu] % nq;
+        return q >= netdev->ctrlq ? q + 1 : q;
+    }
+
+    return processors->map[cpu] % nq;
+}
+
+/*
+ * Steer the control traffic (ARP and IPv6 including ND) to the control queue;
+ * return the number of filters installed and their IDs in ids
+ */
+int
+netdev_steer_ctrl(struct netdev *netdev, int *ids, int n)
+{
+    static const u16 etypes[] = { 0x0806, 0x86dd };
+    struct netdev_filter f;
+    int i;
+    int nf;
+
+    if ( netdev->ctrlq < 0 || NULL == netdev->filter_add ) {
+        return -1;
+    }
+
+    nf = 0;
+    for ( i = 0; i < (int)(sizeof(etypes) / sizeof(etypes[0])) && nf < n;
+          i++ ) {
+        f.type = NETDEV_FILTER_ETYPE;
+        f.fields = 0;
+        f.etype = etypes[i];
+        f.q = netdev->ctrlq;
+        ids[nf] = netdev->filter_add(netdev, &f);
+        if ( ids[nf] < 0 ) {
+            /* Not supported by the device; left to the data queues */
+            continue;
+        }
+        nf++;
+    }
+
+    return nf;
+}
+
+/*
+ * Set the RX mode (NETDEV_RXMODE_*) of the device
+ */
+int
+netdev_set_rxmode(struct netdev *netdev, int mode)
+{
+    switch ( mode ) {
+    case NETDEV_RXMODE_POLL:
+        break;
+    case NETDEV_RXMODE_HYBRID:
+        if ( NULL == netdev->rx_intr ) {
+            /* The RX interrupt is not supported */
+            return -1;
+        }
+        break;
+    default:
+        return -1;
+    }
+    netdev->rxmode = mode;
+
+    return 0;
+}
+
+/*
+ * Select the interrupt throttling interval from the average burst size; a
+ * sparse flow is woken up at once, while bursts are coalesced
+ */
+static __inline__ u32
+_rx_itr(u32 burst)
+{
+    if ( burst < 4 * 16 ) {
+        return NETDEV_RX_ITR_LOWEST;
+    } else if ( burst < 32 * 16 ) {
+        return NETDEV_RX_ITR_LOW;
+    } else {
+        return NETDEV_RX_ITR_BULK;
+    }
+}
+
+/*
+ * Account the result (n packets) of a poll of the RX queue q; in the hybrid
+ * mode, the processor sleeps on the RX interrupt once the queue has been idle
+ * for a while.  Return 1 if it has slept.
+ */
+int
+netdev_rx_idle(struct netdev *netdev, int q, int n)
+{
+    struct netdev_rxq_stat *st;
+    u64 t0;
+    u64 t1;
+    u32 itr;
+    int oneshot;
+    int expired;
+
+    if ( q < 0 || q >= NETDEV_MAX_RXQ ) {
+        return 0;
+    }
+    st = &netdev->rxqstat[q];
+    st->polls++;
+    if ( n > 0 ) {
+        /* Busy; keep polling */
+        st->pkts += n;
+        st->idle = 0;
+        st->burst = (st->burst * 7 + n * 16) / 8;
+        return 0;
+    }
+    st->empty++;
+    if ( NETDEV_RXMODE_HYBRID != netdev->rxmode || NULL == netdev->rx_intr ) {
+        return 0;
+    }
+    st->idle++;
+    if ( st->idle < NETDEV_RX_IDLE_POLLS ) {
+        return 0;
+    }
+    st->idle = 0;
+
+    /* Adapt the interrupt moderation to the traffic seen */
+    itr = _rx_itr(st->burst);
+    if ( itr != st->itr && NULL != netdev->rx_itr ) {
+        if ( netdev->rx_itr(netdev, q, itr) >= 0 ) {
+            st->itr = itr;
+        }
+    }
+
+    /* Arm the interrupt; a packet received after the last poll has latched
+       the interrupt cause, so it fires as soon as it is enabled. */
+    st->cpu = this_cpu();
+    st->intr_at = 0;
+    st->armed = 1;
+    if ( netdev->rx_intr(netdev, q, 1) < 0 ) {
+        st->armed = 0;
+        return 0;
+    }
+    st->state = NETDEV_RXQ_SLEEPING;
+    st->sleeps++;
+
+    /* No tick wakes up a tickless processor; the one-shot timer bounds the
+       sleep so that the traffic not covered by the interrupt (e.g., the
+       control queue polled by the same processor) is not starved */
+    oneshot = (PROCESSOR_AP_TICKLESS == processor_this()->type);
+    if ( oneshot ) {
+        lapic_start_oneshot(NETDEV_RX_SLEEP_MAX / 1000, IV_IPI);
+    }
+    t0 = arch_clock_get();
+    for ( ;; ) {
+        /* Check and halt atomically against the interrupt (sti; hlt) */
+        __asm__ __volatile__ ("cli");
+        if ( !st->armed ) {
+            __asm__ __volatile__ ("sti");
+            break;
+        }
+        __asm__ __volatile__ ("sti; hlt");
+        if ( oneshot ) {
+            expired = (0 == lapic_timer_count());
+        } else {
+            t1 = arch_clock_get();
+            expired = (t1 - t0 > NETDEV_RX_SLEEP_MAX);
+        }
+        if ( st->armed && expired ) {
+            /* Timed out */
+            st->armed = 0;
+            netdev->rx_intr(netdev, q, 0);
+            st->timeouts++;
+            break;
+        }
+    }
+    if ( oneshot ) {
+        lapic_stop_timer();
+    }
+    st->state = NETDEV_RXQ_POLLING;
+
+    if ( st->intr_at ) {
+        t1 = arch_clock_get() - st->intr_at;
+        st->lat_sum += t1;
+        if ( t1 > st->lat_max ) {
+            st->lat_max = t1;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Receive packets from the RX queue q with netdev_rx_idle()
+ */
+int
+netdev_rx_poll(struct netdev *netdev, int q, struct mbuf **mbufs, int n)
+{
+    int ret;
+
+    ret = netdev->rx_burst(netdev, q, mbufs, n);
+    netdev_rx_idle(netdev, q, ret > 0 ? ret : 0);
+
+    return ret;
+}
+
+/*
+ * RX interrupt of the queue q; called from the interrupt handler of the
+ * driver to wake up the processor sleeping on the queue
+ */
+void
+netdev_rx_intr(struct netdev *netdev, int q)
+{
+    struct netdev_rxq_stat *st;
+
+    if ( q < 0 || q >= NETDEV_MAX_RXQ ) {
+        return;
+    }
+    st = &netdev->rxqstat[q];
+    st->intrs++;
+    if ( !st->armed ) {
+        /* Spurious */
+        return;
+    }
+    /* Back to polling */
+    netdev->rx_intr(netdev, q, 0);
+    st->intr_at = arch_clock_get();
+    st->armed = 0;
+    if ( st->cpu != this_cpu() ) {
+        lapic_send_ns_fixed_ipi(st->cpu, IV_IPI);
+    }
+}
+
+/*
+ * Get the counters of this processor; the datapath calls it once per burst
+ * and updates the counters without lock since no other processor writes them
+ */
+struct netdev_stats *
+netdev_stats(struct netdev *netdev)
+{
+    return &netdev->stats[PERCPU(idx)];
+}
+
+/*
+ * Aggregate the counters of all the processors into sum; the counters being
+ * updated may be read in the middle, but each 64-bit word is consistent
+ */
+void
+netdev_stats_read(struct netdev *netdev, struct netdev_stats *sum)
+{
+    volatile u64 *c;
+    int i;
+    int j;
+
+    kmemset(sum, 0, sizeof(struct netdev_stats));
+    for ( i = 0; i < processors->n && i < MAX_PROCESSORS; i++ ) {
+        c = netdev->stats[i].c;
+        for ( j = 0; j < NETDEV_STAT_NUM; j++ ) {
+            sum->c[j] += c[j];
+        }
+    }
+}
 
 /*
  * Local variables:
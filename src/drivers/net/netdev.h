@@ -24,12 +24,23 @@ struct netdev_list {
 };
 #endif
 
+struct mbuf;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
     void netdev_init(void);
     struct netdev * netdev_add_device(const u8 *, void *);
+    int netdev_set_rxq(struct netdev *, int, int);
+    int netdev_rxq(struct netdev *, int);
+    int netdev_steer_ctrl(struct netdev *, int *, int);
+    int netdev_set_rxmode(struct netdev *, int);
+    int netdev_rx_idle(struct netdev *, int, int);
+    int netdev_rx_poll(struct netdev *, int, struct mbuf **, int);
+    void netdev_rx_intr(struct netdev *, int);
+    struct netdev_stats * netdev_stats(struct netdev *);
+    void netdev_stats_read(struct netdev *, struct netdev_stats *);
 
 
 #ifdef __cplusplus
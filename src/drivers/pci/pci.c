@@ -17,6 +17,40 @@
 #define PCI_CONFIG_ADDR 0xcf8
 #define PCI_CONFIG_DATA 0xcfc
 
+#define PCI_REG_COMMAND 0x04
+#define PCI_REG_STATUS  0x06
+#define PCI_REG_CAP_PTR 0x34
+
+#define PCI_COMMAND_INTX_DISABLE        (1<<10)
+#define PCI_STATUS_CAP_LIST             (1<<4)
+
+/* MSI capability */
+#define PCI_MSI_CTRL            0x02
+#define PCI_MSI_ADDR_LO         0x04
+#define PCI_MSI_ADDR_HI         0x08
+#define PCI_MSI_DATA_32         0x08
+#define PCI_MSI_DATA_64         0x0c
+#define PCI_MSI_CTRL_EN         (1<<0)
+#define PCI_MSI_CTRL_MME_MASK   (7<<4)
+#define PCI_MSI_CTRL_64BIT      (1<<7)
+
+/* MSI-X capability and table */
+#define PCI_MSIX_CTRL           0x02
+#define PCI_MSIX_TABLE          0x04
+#define PCI_MSIX_CTRL_SIZE(c)   (((c) & 0x7ff) + 1)
+#define PCI_MSIX_CTRL_MASK      (1<<14)
+#define PCI_MSIX_CTRL_EN        (1<<15)
+#define PCI_MSIX_ENTRY_SIZE     16
+#define PCI_MSIX_ENTRY_ADDR_LO  0x0
+#define PCI_MSIX_ENTRY_ADDR_HI  0x4
+#define PCI_MSIX_ENTRY_DATA     0x8
+#define PCI_MSIX_ENTRY_CTRL     0xc
+#define PCI_MSIX_ENTRY_MASKED   (1<<0)
+
+/* Message address to the local APIC; fixed delivery, edge triggered */
+#define PCI_MSI_ADDR(apicid)    (0xfee00000 | ((u32)(apicid) << 12))
+#define PCI_MSI_DATA(vec)       ((u32)(vec) & 0xff)
+
 
 
 static struct pci *pci_head;
@@ -35,8 +69,51 @@ pci_read_config(u16 bus, u16 slot, u16 func, u16 offset)
     return (inl(0xcfc) >> ((offset & 2) * 8)) & 0xffff;
 }
 
+u32
+pci_read_config32(u16 bus, u16 slot, u16 func, u16 offset)
+{
+    u32 addr;
+
+    addr = ((u32)bus << 16) | ((u32)slot << 11) | ((u32)func << 8)
+        | ((u32)offset & 0xfc);
+    /* Set enable bit */
+    addr |= (u32)0x80000000;
+
+    outl(PCI_CONFIG_ADDR, addr);
+    return inl(PCI_CONFIG_DATA);
+}
+
+void
+pci_write_config32(u16 bus, u16 slot, u16 func, u16 offset, u32 val)
+{
+    u32 addr;
+
+    addr = ((u32)bus << 16) | ((u32)slot << 11) | ((u32)func << 8)
+        | ((u32)offset & 0xfc);
+    /* Set enable bit */
+    addr |= (u32)0x80000000;
+
+    outl(PCI_CONFIG_ADDR, addr);
+    outl(PCI_CONFIG_DATA, val);
+}
+
+void
+pci_write_config(u16 bus, u16 slot, u16 func, u16 offset, u16 val)
+{
+    u32 m32;
+
+    /* Read-modify-write the dword */
+    m32 = pci_read_config32(bus, slot, func, offset);
+    m32 &= ~((u32)0xffff << ((offset & 2) * 8));
+    m32 |= (u32)val << ((offset & 2) * 8);
+    pci_write_config32(bus, slot, func, offset, m32);
+}
+
+/*
+ * Read the memory address of the base address register n
+ */
 u64
-pci_read_mmio(u8 bus, u8 slot, u8 func)
+pci_read_bar(u8 bus, u8 slot, u8 func, int n)
 {
     u64 addr;
     u32 bar0;
@@ -46,8 +123,15 @@ pci_read_mmio(u8 bus, u8 slot, u8 func)
     u8 prefetchable;
 #endif
 
-    bar0 = pci_read_config(bus, slot, func, 0x10);
-    bar0 |= (u32)pci_read_config(bus, slot, func, 0x12) << 16;
+    if ( n < 0 || n > 5 ) {
+        return 0;
+    }
+
+    bar0 = pci_read_config32(bus, slot, func, 0x10 + n * 4);
+    if ( bar0 & 1 ) {
+        /* I/O space */
+        return 0;
+    }
 
     type = (bar0 >> 1) & 0x3;
 #if 0
@@ -57,10 +141,9 @@ pci_read_mmio(u8 bus, u8 slot, u8 func)
 
     if ( 0x00 == type ) {
         /* 32bit */
-    } else if ( 0x02 == type ) {
+    } else if ( 0x02 == type && n < 5 ) {
         /* 64bit */
-        bar1 = pci_read_config(bus, slot, func, 0x14);
-        bar1 |= (u32)pci_read_config(bus, slot, func, 0x16) << 16;
+        bar1 = pci_read_config32(bus, slot, func, 0x14 + n * 4);
         addr |= ((u64)bar1) << 32;
     } else {
         return 0;
@@ -69,6 +152,216 @@ pci_read_mmio(u8 bus, u8 slot, u8 func)
     return addr;
 }
 
+u64
+pci_read_mmio(u8 bus, u8 slot, u8 func)
+{
+    return pci_read_bar(bus, slot, func, 0);
+}
+
+/*
+ * Find the capability id in the capability list; return the offset, or 0 if
+ * not found
+ */
+u8
+pci_find_capability(struct pci_device *dev, u8 id)
+{
+    u8 ptr;
+    u16 m16;
+    int ttl;
+
+    if ( !(pci_read_config(dev->bus, dev->slot, dev->func, PCI_REG_STATUS)
+           & PCI_STATUS_CAP_LIST) ) {
+        return 0;
+    }
+
+    ptr = pci_read_config(dev->bus, dev->slot, dev->func, PCI_REG_CAP_PTR)
+        & 0xfc;
+    /* Bound the walk against a broken (looped) list */
+    for ( ttl = 48; ptr >= 0x40 && ttl > 0; ttl-- ) {
+        m16 = pci_read_config(dev->bus, dev->slot, dev->func, ptr);
+        if ( id == (m16 & 0xff) ) {
+            return ptr;
+        }
+        ptr = (m16 >> 8) & 0xfc;
+    }
+
+    return 0;
+}
+
+/*
+ * Disable/enable the legacy INTx
+ */
+static void
+_pci_intx(struct pci_device *dev, int on)
+{
+    u16 cmd;
+
+    cmd = pci_read_config(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND);
+    if ( on ) {
+        cmd &= ~PCI_COMMAND_INTX_DISABLE;
+    } else {
+        cmd |= PCI_COMMAND_INTX_DISABLE;
+    }
+    pci_write_config(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND, cmd);
+}
+
+/*
+ * Enable MSI with a single message of the vector vec to the local APIC of
+ * the processor apicid
+ */
+int
+pci_msi_enable(struct pci_device *dev, int vec, int apicid)
+{
+    u16 ctrl;
+    u8 cap;
+
+    cap = dev->msi_cap;
+    if ( 0 == cap ) {
+        return -1;
+    }
+
+    ctrl = pci_read_config(dev->bus, dev->slot, dev->func,
+                           cap + PCI_MSI_CTRL);
+    pci_write_config32(dev->bus, dev->slot, dev->func, cap + PCI_MSI_ADDR_LO,
+                       PCI_MSI_ADDR(apicid));
+    if ( ctrl & PCI_MSI_CTRL_64BIT ) {
+        pci_write_config32(dev->bus, dev->slot, dev->func,
+                           cap + PCI_MSI_ADDR_HI, 0);
+        pci_write_config(dev->bus, dev->slot, dev->func,
+                         cap + PCI_MSI_DATA_64, PCI_MSI_DATA(vec));
+    } else {
+        pci_write_config(dev->bus, dev->slot, dev->func,
+                         cap + PCI_MSI_DATA_32, PCI_MSI_DATA(vec));
+    }
+    /* Single message */
+    ctrl &= ~PCI_MSI_CTRL_MME_MASK;
+    ctrl |= PCI_MSI_CTRL_EN;
+    pci_write_config(dev->bus, dev->slot, dev->func, cap + PCI_MSI_CTRL,
+                     ctrl);
+    _pci_intx(dev, 0);
+
+    return 0;
+}
+
+void
+pci_msi_disable(struct pci_device *dev)
+{
+    u16 ctrl;
+
+    if ( 0 == dev->msi_cap ) {
+        return;
+    }
+    ctrl = pci_read_config(dev->bus, dev->slot, dev->func,
+                           dev->msi_cap + PCI_MSI_CTRL);
+    pci_write_config(dev->bus, dev->slot, dev->func,
+                     dev->msi_cap + PCI_MSI_CTRL, ctrl & ~PCI_MSI_CTRL_EN);
+    _pci_intx(dev, 1);
+}
+
+/*
+ * Enable MSI-X with all the entries masked; return the number of entries
+ */
+int
+pci_msix_enable(struct pci_device *dev)
+{
+    u16 ctrl;
+    u32 tbl;
+    u64 bar;
+    u8 cap;
+    int i;
+
+    cap = dev->msix_cap;
+    if ( 0 == cap ) {
+        return -1;
+    }
+
+    ctrl = pci_read_config(dev->bus, dev->slot, dev->func,
+                           cap + PCI_MSIX_CTRL);
+    tbl = pci_read_config32(dev->bus, dev->slot, dev->func,
+                            cap + PCI_MSIX_TABLE);
+    /* BIR and offset */
+    bar = pci_read_bar(dev->bus, dev->slot, dev->func, tbl & 0x7);
+    if ( 0 == bar ) {
+        return -1;
+    }
+    dev->msix_table = bar + (tbl & ~0x7U);
+    dev->msix_n = PCI_MSIX_CTRL_SIZE(ctrl);
+
+    /* Mask the function while the entries are initialized */
+    pci_write_config(dev->bus, dev->slot, dev->func, cap + PCI_MSIX_CTRL,
+                     ctrl | PCI_MSIX_CTRL_EN | PCI_MSIX_CTRL_MASK);
+    for ( i = 0; i < dev->msix_n; i++ ) {
+        pci_msix_mask(dev, i, 1);
+    }
+    pci_write_config(dev->bus, dev->slot, dev->func, cap + PCI_MSIX_CTRL,
+                     (ctrl | PCI_MSIX_CTRL_EN) & ~PCI_MSIX_CTRL_MASK);
+    _pci_intx(dev, 0);
+
+    return dev->msix_n;
+}
+
+void
+pci_msix_disable(struct pci_device *dev)
+{
+    u16 ctrl;
+
+    if ( 0 == dev->msix_cap ) {
+        return;
+    }
+    ctrl = pci_read_config(dev->bus, dev->slot, dev->func,
+                           dev->msix_cap + PCI_MSIX_CTRL);
+    pci_write_config(dev->bus, dev->slot, dev->func,
+                     dev->msix_cap + PCI_MSIX_CTRL, ctrl & ~PCI_MSIX_CTRL_EN);
+    dev->msix_table = 0;
+    dev->msix_n = 0;
+    _pci_intx(dev, 1);
+}
+
+/*
+ * Route the MSI-X entry to the vector vec of the local APIC of the processor
+ * apicid, and unmask it
+ */
+int
+pci_msix_set_vector(struct pci_device *dev, int entry, int vec, int apicid)
+{
+    volatile u32 *e;
+
+    if ( 0 == dev->msix_table || entry < 0 || entry >= dev->msix_n ) {
+        return -1;
+    }
+    e = (volatile u32 *)(dev->msix_table + entry * PCI_MSIX_ENTRY_SIZE);
+
+    /* Must be masked while the message is updated */
+    e[PCI_MSIX_ENTRY_CTRL / 4] |= PCI_MSIX_ENTRY_MASKED;
+    e[PCI_MSIX_ENTRY_ADDR_LO / 4] = PCI_MSI_ADDR(apicid);
+    e[PCI_MSIX_ENTRY_ADDR_HI / 4] = 0;
+    e[PCI_MSIX_ENTRY_DATA / 4] = PCI_MSI_DATA(vec);
+    e[PCI_MSIX_ENTRY_CTRL / 4] &= ~PCI_MSIX_ENTRY_MASKED;
+
+    return 0;
+}
+
+/*
+ * Mask/unmask the MSI-X entry
+ */
+int
+pci_msix_mask(struct pci_device *dev, int entry, int mask)
+{
+    volatile u32 *e;
+
+    if ( 0 == dev->msix_table || entry < 0 || entry >= dev->msix_n ) {
+        return -1;
+    }
+    e = (volatile u32 *)(dev->msix_table + entry * PCI_MSIX_ENTRY_SIZE);
+    if ( mask ) {
+        e[PCI_MSIX_ENTRY_CTRL / 4] |= PCI_MSIX_ENTRY_MASKED;
+    } else {
+        e[PCI_MSIX_ENTRY_CTRL / 4] &= ~PCI_MSIX_ENTRY_MASKED;
+    }
+
+    return 0;
+}
+
 
 u32
 pci_read_rom_bar(u8 bus, u8 slot, u8 func)
@@ -157,6 +450,10 @@ pci_check_function(u8 bus, u8 slot, u8 func)
     pci_dev->subclass = (u8)(class & 0xff);
     pci_dev->progif = (u8)(prog >> 8);
     pci_dev->revision = (u8)(prog & 0xff);
+    pci_dev->msi_cap = pci_find_capability(pci_dev, PCI_CAP_MSI);
+    pci_dev->msix_cap = pci_find_capability(pci_dev, PCI_CAP_MSIX);
+    pci_dev->msix_n = 0;
+    pci_dev->msix_table = 0;
     pci->device = pci_dev;
     pci->next = NULL;
 
@@ -10,6 +10,10 @@
 #ifndef _DRIVERS_PCI_H
 #define _DRIVERS_PCI_H
 
+/* Capability IDs */
+#define PCI_CAP_MSI     0x05
+#define PCI_CAP_MSIX    0x11
+
 struct pci_device {
     u16 bus;
     u16 slot;
@@ -22,6 +26,12 @@ struct pci_device {
     u8 subclass;
     u8 progif;
     u8 revision;
+    /* Offset of the MSI/MSI-X capabilities (0 if not present), and the
+       MSI-X table mapped by pci_msix_enable() */
+    u8 msi_cap;
+    u8 msix_cap;
+    u16 msix_n;
+    u64 msix_table;
 };
 struct pci {
     struct pci_device *device;
@@ -29,7 +39,18 @@ struct pci {
 };
 
 u16 pci_read_config(u16, u16, u16, u16);
+void pci_write_config(u16, u16, u16, u16, u16);
+u32 pci_read_config32(u16, u16, u16, u16);
+void pci_write_config32(u16, u16, u16, u16, u32);
+u64 pci_read_bar(u8, u8, u8, int);
 u64 pci_read_mmio(u8, u8, u8);
+u8 pci_find_capability(struct pci_device *, u8);
+int pci_msi_enable(struct pci_device *, int, int);
+void pci_msi_disable(struct pci_device *);
+int pci_msix_enable(struct pci_device *);
+void pci_msix_disable(struct pci_device *);
+int pci_msix_set_vector(struct pci_device *, int, int, int);
+int pci_msix_mask(struct pci_device *, int, int);
 u32 pci_read_rom_bar(u8, u8, u8);
 u8 pci_get_header_type(u16, u16, u16);
 struct pci * pci_list(void);
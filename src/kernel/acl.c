@@ -0,0 +1,622 @@
+/*_
+ * Copyright (c) 2014 Hirochika Asai
+ * All rights reserved.
+ *
+ * Authors:
+ *      Hirochika Asai  <asai@jar.jp>
+ */
+
+#include "kernel.h"
+
+u16 bswap16(u16);
+u32 bswap32(u32);
+
+/* Maximum rules in a leaf (unless the depth reaches ACL_MAX_DEPTH) */
+#define ACL_BINTH       8
+/* Space factor; the rules replicated over the children of a node is
+   bounded by ACL_SPFAC times the rules of the node */
+#define ACL_SPFAC       4
+#define ACL_MAX_CUTS    256
+#define ACL_MAX_DEPTH   24
+/* Keys traversed together by acl_classify_bulk() */
+#define ACL_BULK        32
+
+/* Width of the fields in bits */
+static const int _bits[ACL_FIELDS] = { 32, 32, 16, 16, 8 };
+
+struct acl_build {
+    struct acl_tree *t;
+    /* Allocated entries of nodes, children, and leaves */
+    u32 sznodes;
+    u32 szchildren;
+    u32 szleaves;
+};
+
+/*
+ * Initialize a rule list
+ */
+struct acl *
+acl_init(void)
+{
+    struct acl *acl;
+
+    acl = kmalloc(sizeof(struct acl));
+    if ( NULL == acl ) {
+        return NULL;
+    }
+    acl->nr = 0;
+    acl->sz = 0;
+    acl->rules = NULL;
+    acl->defact = ACL_PERMIT;
+
+    return acl;
+}
+
+/*
+ * Grow an array to hold need elements
+ */
+static int
+_grow(void **p, u32 *sz, u32 need, u32 eltsz)
+{
+    void *np;
+    u32 nsz;
+
+    if ( need <= *sz ) {
+        return 0;
+    }
+    nsz = *sz ? *sz : 64;
+    while ( nsz < need ) {
+        nsz <<= 1;
+    }
+    np = kmalloc((u64)nsz * eltsz);
+    if ( NULL == np ) {
+        return -1;
+    }
+    if ( NULL != *p ) {
+        kmemcpy(np, *p, (u64)*sz * eltsz);
+        kfree(*p);
+    }
+    *p = np;
+    *sz = nsz;
+
+    return 0;
+}
+
+/*
+ * Append a rule (lowest priority)
+ */
+int
+acl_add_rule(struct acl *acl, const struct acl_rule *rule)
+{
+    u32 sz;
+    int d;
+
+    if ( acl->nr >= ACL_MAX_RULES ) {
+        return -1;
+    }
+    for ( d = 0; d < ACL_FIELDS; d++ ) {
+        if ( rule->lo[d] > rule->hi[d] ) {
+            return -1;
+        }
+    }
+    sz = acl->sz;
+    if ( _grow((void **)&acl->rules, &sz, acl->nr + 1,
+               sizeof(struct acl_rule)) < 0 ) {
+        return -1;
+    }
+    acl->sz = sz;
+    acl->rules[acl->nr] = *rule;
+    acl->nr++;
+
+    return 0;
+}
+
+/*
+ * Remove all the rules
+ */
+void
+acl_clear(struct acl *acl)
+{
+    acl->nr = 0;
+}
+
+/*
+ * Check if the rule covers the box of the node
+ */
+static int
+_covers(const struct acl_rule *r, const u32 *lo, const int *w)
+{
+    int d;
+
+    if ( r->flagmask ) {
+        return 0;
+    }
+    for ( d = 0; d < ACL_FIELDS; d++ ) {
+        if ( r->lo[d] > lo[d]
+             || (u64)r->hi[d] < (u64)lo[d] + (1ULL << w[d]) - 1 ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Allocate a node
+ */
+static int
+_node(struct acl_build *b)
+{
+    if ( _grow((void **)&b->t->nodes, &b->sznodes, b->t->nnodes + 1,
+               sizeof(struct acl_node)) < 0 ) {
+        return -1;
+    }
+    b->t->nnodes++;
+
+    return b->t->nnodes - 1;
+}
+
+/*
+ * Make the node a leaf of n rules
+ */
+static int
+_leaf(struct acl_build *b, int node, const u32 *rl, int n)
+{
+    int i;
+
+    if ( _grow((void **)&b->t->leaves, &b->szleaves, b->t->nleaves + n,
+               sizeof(u32)) < 0 ) {
+        return -1;
+    }
+    for ( i = 0; i < n; i++ ) {
+        b->t->leaves[b->t->nleaves + i] = rl[i];
+    }
+    b->t->nodes[node].dim = ACL_LEAF;
+    b->t->nodes[node].shift = 0;
+    b->t->nodes[node].n = n;
+    b->t->nodes[node].idx = b->t->nleaves;
+    b->t->nleaves += n;
+
+    return node;
+}
+
+/*
+ * Clip the range of the rule in the field d to the box
+ */
+static __inline__ void
+_clip(const struct acl_rule *r, const u32 *lo, const int *w, int d, u32 *rlo,
+      u32 *rhi)
+{
+    u64 hi;
+
+    hi = (u64)lo[d] + (1ULL << w[d]) - 1;
+    *rlo = r->lo[d] > lo[d] ? r->lo[d] : lo[d];
+    *rhi = r->hi[d] < hi ? r->hi[d] : (u32)hi;
+}
+
+/*
+ * The number of cuts (in log2) of the field d; doubled while the rules
+ * replicated over the children are within the space factor
+ */
+static int
+_ncuts(struct acl_build *b, const u32 *rl, int n, const u32 *lo, const int *w,
+       int d)
+{
+    u32 rlo;
+    u32 rhi;
+    u64 sm;
+    int lognc;
+    int shift;
+    int i;
+
+    lognc = 1;
+    while ( lognc < w[d] && (1 << (lognc + 1)) <= ACL_MAX_CUTS ) {
+        shift = w[d] - (lognc + 1);
+        sm = 1ULL << (lognc + 1);
+        for ( i = 0; i < n; i++ ) {
+            _clip(&b->t->rules[rl[i]], lo, w, d, &rlo, &rhi);
+            sm += ((rhi - lo[d]) >> shift) - ((rlo - lo[d]) >> shift) + 1;
+        }
+        if ( sm > (u64)ACL_SPFAC * n ) {
+            break;
+        }
+        lognc++;
+    }
+
+    return lognc;
+}
+
+/*
+ * The rules of the largest child when the field d is cut into 2^lognc
+ */
+static int
+_maxchild(struct acl_build *b, const u32 *rl, int n, const u32 *lo,
+          const int *w, int d, int lognc)
+{
+    int cnt[ACL_MAX_CUTS + 1];
+    u32 rlo;
+    u32 rhi;
+    int shift;
+    int max;
+    int sum;
+    int i;
+
+    shift = w[d] - lognc;
+    for ( i = 0; i <= (1 << lognc); i++ ) {
+        cnt[i] = 0;
+    }
+    for ( i = 0; i < n; i++ ) {
+        _clip(&b->t->rules[rl[i]], lo, w, d, &rlo, &rhi);
+        cnt[(rlo - lo[d]) >> shift]++;
+        cnt[((rhi - lo[d]) >> shift) + 1]--;
+    }
+    max = 0;
+    sum = 0;
+    for ( i = 0; i < (1 << lognc); i++ ) {
+        sum += cnt[i];
+        if ( sum > max ) {
+            max = sum;
+        }
+    }
+
+    return max;
+}
+
+/*
+ * Build the subtree of the rules rl[0..n-1] in the box; the box of a node
+ * is [lo[d], lo[d] + 2^w[d] - 1] of each field d.  Return the node.
+ */
+static int
+_build(struct acl_build *b, const u32 *rl, int n, const u32 *lo, const int *w,
+       int depth)
+{
+    const struct acl_rule *r;
+    u32 clo[ACL_FIELDS];
+    int cw[ACL_FIELDS];
+    u32 *tmp;
+    u32 *cur;
+    u32 *prev;
+    u32 *swap;
+    u32 cidx;
+    u64 chi;
+    int ncur;
+    int nprev;
+    int full;
+    int node;
+    int child;
+    int best;
+    int bestcnt;
+    int cnt;
+    int lognc;
+    int shift;
+    int nc;
+    int d;
+    int c;
+    int i;
+
+    if ( depth > b->t->depth ) {
+        b->t->depth = depth;
+    }
+
+    /* The rules following a rule covering the box never match */
+    for ( i = 0; i < n; i++ ) {
+        if ( _covers(&b->t->rules[rl[i]], lo, w) ) {
+            n = i + 1;
+            break;
+        }
+    }
+
+    node = _node(b);
+    if ( node < 0 ) {
+        return -1;
+    }
+    if ( n <= ACL_BINTH || depth >= ACL_MAX_DEPTH ) {
+        return _leaf(b, node, rl, n);
+    }
+
+    tmp = kmalloc(sizeof(u32) * 2 * n);
+    if ( NULL == tmp ) {
+        return -1;
+    }
+
+    /* Cut the field of which the largest child has the fewest rules */
+    best = -1;
+    bestcnt = n;
+    for ( d = 0; d < ACL_FIELDS; d++ ) {
+        if ( 0 == w[d] ) {
+            continue;
+        }
+        lognc = _ncuts(b, rl, n, lo, w, d);
+        cnt = _maxchild(b, rl, n, lo, w, d, lognc);
+        if ( cnt < bestcnt ) {
+            best = d;
+            bestcnt = cnt;
+            nc = 1 << lognc;
+            shift = w[d] - lognc;
+        }
+    }
+    if ( best < 0 ) {
+        /* Cannot be separated */
+        kfree(tmp);
+        return _leaf(b, node, rl, n);
+    }
+    d = best;
+
+    if ( _grow((void **)&b->t->children, &b->szchildren,
+               b->t->nchildren + nc, sizeof(u32)) < 0 ) {
+        kfree(tmp);
+        return -1;
+    }
+    cidx = b->t->nchildren;
+    b->t->nchildren += nc;
+    b->t->nodes[node].dim = d;
+    b->t->nodes[node].shift = shift;
+    b->t->nodes[node].n = nc - 1;
+    b->t->nodes[node].idx = cidx;
+
+    /* Children; the adjacent children of the same rules share the node if
+       the rules span the children entirely in the field cut, i.e., the
+       subtree does not depend on the position of the child */
+    cur = tmp;
+    prev = tmp + n;
+    nprev = -1;
+    child = -1;
+    for ( c = 0; c < nc; c++ ) {
+        for ( i = 0; i < ACL_FIELDS; i++ ) {
+            clo[i] = lo[i];
+            cw[i] = w[i];
+        }
+        clo[d] = lo[d] + ((u32)c << shift);
+        cw[d] = shift;
+        chi = (u64)clo[d] + (1ULL << shift) - 1;
+
+        ncur = 0;
+        full = 1;
+        for ( i = 0; i < n; i++ ) {
+            r = &b->t->rules[rl[i]];
+            if ( r->hi[d] >= clo[d] && r->lo[d] <= chi ) {
+                cur[ncur] = rl[i];
+                ncur++;
+                if ( r->lo[d] > clo[d] || r->hi[d] < chi ) {
+                    full = 0;
+                }
+            }
+        }
+        if ( !full ) {
+            /* Not to be shared by the next child either */
+            child = _build(b, cur, ncur, clo, cw, depth + 1);
+            if ( child < 0 ) {
+                kfree(tmp);
+                return -1;
+            }
+            nprev = -1;
+        } else if ( ncur != nprev
+                    || 0 != kmemcmp((u8 *)cur, (u8 *)prev,
+                                    sizeof(u32) * ncur) ) {
+            child = _build(b, cur, ncur, clo, cw, depth + 1);
+            if ( child < 0 ) {
+                kfree(tmp);
+                return -1;
+            }
+            swap = prev;
+            prev = cur;
+            cur = swap;
+            nprev = ncur;
+        }
+        b->t->children[cidx + c] = child;
+    }
+    kfree(tmp);
+
+    return node;
+}
+
+/*
+ * Compile the rule list into a tree
+ */
+struct acl_tree *
+acl_compile(struct acl *acl)
+{
+    struct acl_build b;
+    struct acl_tree *t;
+    u32 lo[ACL_FIELDS];
+    int w[ACL_FIELDS];
+    u32 *rl;
+    int i;
+
+    t = kmalloc(sizeof(struct acl_tree));
+    if ( NULL == t ) {
+        return NULL;
+    }
+    kmemset(t, 0, sizeof(struct acl_tree));
+    t->defact = acl->defact;
+    t->nr = acl->nr;
+    t->rules = kmalloc(sizeof(struct acl_rule) * (acl->nr + 1));
+    rl = kmalloc(sizeof(u32) * (acl->nr + 1));
+    if ( NULL == t->rules || NULL == rl ) {
+        if ( NULL != rl ) {
+            kfree(rl);
+        }
+        acl_tree_free(t);
+        return NULL;
+    }
+    for ( i = 0; i < acl->nr; i++ ) {
+        t->rules[i] = acl->rules[i];
+        rl[i] = i;
+    }
+    for ( i = 0; i < ACL_FIELDS; i++ ) {
+        lo[i] = 0;
+        w[i] = _bits[i];
+    }
+
+    b.t = t;
+    b.sznodes = 0;
+    b.szchildren = 0;
+    b.szleaves = 0;
+    if ( _build(&b, rl, acl->nr, lo, w, 0) < 0 ) {
+        kfree(rl);
+        acl_tree_free(t);
+        return NULL;
+    }
+    kfree(rl);
+
+    return t;
+}
+
+/*
+ * Release a tree
+ */
+void
+acl_tree_free(struct acl_tree *t)
+{
+    if ( NULL != t->rules ) {
+        kfree(t->rules);
+    }
+    if ( NULL != t->nodes ) {
+        kfree(t->nodes);
+    }
+    if ( NULL != t->children ) {
+        kfree(t->children);
+    }
+    if ( NULL != t->leaves ) {
+        kfree(t->leaves);
+    }
+    kfree(t);
+}
+
+/*
+ * Build the key from an IPv4 packet (from the IP header); the ports and the
+ * TCP flags are zero unless the packet is the first fragment
+ */
+int
+acl_key_ipv4(const u8 *ip, int len, struct acl_key *k)
+{
+    int hl;
+
+    if ( len < 20 || 4 != (ip[0] >> 4) ) {
+        return -1;
+    }
+    hl = (ip[0] & 0xf) * 4;
+    if ( hl < 20 || len < hl ) {
+        return -1;
+    }
+    k->f[ACL_F_SADDR] = bswap32(*(u32 *)(ip + 12));
+    k->f[ACL_F_DADDR] = bswap32(*(u32 *)(ip + 16));
+    k->f[ACL_F_PROTO] = ip[9];
+    k->f[ACL_F_SPORT] = 0;
+    k->f[ACL_F_DPORT] = 0;
+    k->tcpflags = 0;
+    if ( bswap16(*(u16 *)(ip + 6)) & 0x1fff ) {
+        /* Non-first fragment */
+        return 0;
+    }
+    if ( (6 == ip[9] || 17 == ip[9]) && len >= hl + 4 ) {
+        k->f[ACL_F_SPORT] = bswap16(*(u16 *)(ip + hl));
+        k->f[ACL_F_DPORT] = bswap16(*(u16 *)(ip + hl + 2));
+    }
+    if ( 6 == ip[9] && len >= hl + 14 ) {
+        k->tcpflags = ip[hl + 13];
+    }
+
+    return 0;
+}
+
+/*
+ * Match a rule
+ */
+static __inline__ int
+_match(const struct acl_rule *r, const struct acl_key *k)
+{
+    return k->f[0] >= r->lo[0] && k->f[0] <= r->hi[0]
+        && k->f[1] >= r->lo[1] && k->f[1] <= r->hi[1]
+        && k->f[2] >= r->lo[2] && k->f[2] <= r->hi[2]
+        && k->f[3] >= r->lo[3] && k->f[3] <= r->hi[3]
+        && k->f[4] >= r->lo[4] && k->f[4] <= r->hi[4]
+        && (k->tcpflags & r->flagmask) == r->tcpflags;
+}
+
+/*
+ * Search the rules of a leaf
+ */
+static __inline__ int
+_search(struct acl_tree *t, const struct acl_node *nd,
+        const struct acl_key *k)
+{
+    const u32 *l;
+    int i;
+
+    l = &t->leaves[nd->idx];
+    for ( i = 0; i < nd->n; i++ ) {
+        if ( _match(&t->rules[l[i]], k) ) {
+            return t->rules[l[i]].action;
+        }
+    }
+
+    return t->defact;
+}
+
+/*
+ * Classify a packet; return the action
+ */
+int
+acl_classify(struct acl_tree *t, const struct acl_key *k)
+{
+    const struct acl_node *nd;
+
+    nd = &t->nodes[0];
+    while ( ACL_LEAF != nd->dim ) {
+        nd = &t->nodes[t->children[nd->idx
+                                   + ((k->f[nd->dim] >> nd->shift) & nd->n)]];
+    }
+
+    return _search(t, nd, k);
+}
+
+/*
+ * Classify n packets; the keys descend the tree level by level so that the
+ * memory accesses of the keys overlap
+ */
+void
+acl_classify_bulk(struct acl_tree *t, const struct acl_key *keys, int *res,
+                  int n)
+{
+    const struct acl_node *nd[ACL_BULK];
+    const struct acl_key *k;
+    int active;
+    int m;
+    int i;
+    int j;
+
+    for ( j = 0; j < n; j += ACL_BULK ) {
+        m = n - j < ACL_BULK ? n - j : ACL_BULK;
+        for ( i = 0; i < m; i++ ) {
+            nd[i] = &t->nodes[0];
+        }
+        do {
+            active = 0;
+            for ( i = 0; i < m; i++ ) {
+                if ( ACL_LEAF == nd[i]->dim ) {
+                    continue;
+                }
+                k = &keys[j + i];
+                nd[i] = &t->nodes[t->children[nd[i]->idx
+                                              + ((k->f[nd[i]->dim]
+                                                  >> nd[i]->shift)
+                                                 & nd[i]->n)]];
+                __builtin_prefetch(nd[i]);
+                active = 1;
+            }
+        } while ( active );
+        for ( i = 0; i < m; i++ ) {
+            res[j + i] = _search(t, nd[i], &keys[j + i]);
+        }
+    }
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -20,6 +20,19 @@ u32 acpi_smi_cmd_port;
 u8 acpi_enable_val;
 u8 acpi_cmos_century;
 
+/* NUMA */
+int acpi_numa_n;
+u32 acpi_numa_domain[ACPI_NUMA_MAX_NODES];
+u8 acpi_numa_cpu[256];
+struct {
+    u64 base;
+    u64 len;
+    int node;
+} acpi_numa_mem[ACPI_NUMA_MAX_MEM];
+int acpi_numa_nmem;
+u8 acpi_numa_slit[ACPI_NUMA_MAX_NODES][ACPI_NUMA_MAX_NODES];
+int acpi_numa_slit_valid;
+
 /*
  * Compute checksum
  */
@@ -270,6 +283,140 @@ acpi_parse_fadt(struct acpi_sdt_hdr *sdt)
     return 0;
 }
 
+/*
+ * Get the node number of a proximity domain, adding a node for a new one;
+ * -1 if too many
+ */
+static int
+_numa_node(u32 domain)
+{
+    int i;
+
+    for ( i = 0; i < acpi_numa_n; i++ ) {
+        if ( acpi_numa_domain[i] == domain ) {
+            return i;
+        }
+    }
+    if ( acpi_numa_n >= ACPI_NUMA_MAX_NODES ) {
+        return -1;
+    }
+    acpi_numa_domain[acpi_numa_n] = domain;
+
+    return acpi_numa_n++;
+}
+
+/*
+ * SRAT
+ */
+int
+acpi_parse_srat(struct acpi_sdt_hdr *sdt)
+{
+    u64 addr;
+    struct acpi_sdt_srat_hdr *hdr;
+    struct acpi_sdt_srat_lapic *lapic;
+    struct acpi_sdt_srat_mem *mem;
+    struct acpi_sdt_srat_x2apic *x2apic;
+    u32 domain;
+    u32 len;
+    int node;
+
+    addr = (u64)sdt;
+    len = sizeof(struct acpi_sdt_hdr) + sizeof(struct acpi_sdt_srat);
+
+    while ( len < sdt->length ) {
+        hdr = (struct acpi_sdt_srat_hdr *)(addr + len);
+        if ( hdr->length < sizeof(struct acpi_sdt_srat_hdr)
+             || len + hdr->length > sdt->length ) {
+            /* Invalid */
+            return -1;
+        }
+        switch ( hdr->type ) {
+        case 0:
+            /* Processor Local APIC Affinity */
+            lapic = (struct acpi_sdt_srat_lapic *)hdr;
+            if ( !(lapic->flags & 1) ) {
+                break;
+            }
+            domain = lapic->domain_lo | ((u32)lapic->domain_hi[0] << 8)
+                | ((u32)lapic->domain_hi[1] << 16)
+                | ((u32)lapic->domain_hi[2] << 24);
+            node = _numa_node(domain);
+            if ( node >= 0 ) {
+                acpi_numa_cpu[lapic->apic_id] = node;
+            }
+            break;
+        case 1:
+            /* Memory Affinity */
+            mem = (struct acpi_sdt_srat_mem *)hdr;
+            if ( !(mem->flags & 1) || acpi_numa_nmem >= ACPI_NUMA_MAX_MEM ) {
+                break;
+            }
+            node = _numa_node(mem->domain);
+            if ( node >= 0 ) {
+                acpi_numa_mem[acpi_numa_nmem].base = mem->base;
+                acpi_numa_mem[acpi_numa_nmem].len = mem->length;
+                acpi_numa_mem[acpi_numa_nmem].node = node;
+                acpi_numa_nmem++;
+            }
+            break;
+        case 2:
+            /* Processor Local x2APIC Affinity */
+            x2apic = (struct acpi_sdt_srat_x2apic *)hdr;
+            if ( !(x2apic->flags & 1) || x2apic->x2apic_id >= 256 ) {
+                break;
+            }
+            node = _numa_node(x2apic->domain);
+            if ( node >= 0 ) {
+                acpi_numa_cpu[x2apic->x2apic_id] = node;
+            }
+            break;
+        default:
+            /* Other */
+            ;
+        }
+        len += hdr->length;
+    }
+
+    return 0;
+}
+
+/*
+ * SLIT; the localities are the proximity domains, so this is parsed after
+ * SRAT
+ */
+int
+acpi_parse_slit(struct acpi_sdt_hdr *sdt)
+{
+    struct acpi_sdt_slit *slit;
+    u8 *dist;
+    u64 i;
+    u64 j;
+    int a;
+    int b;
+
+    slit = (struct acpi_sdt_slit *)((u64)sdt + sizeof(struct acpi_sdt_hdr));
+    dist = (u8 *)((u64)slit + sizeof(struct acpi_sdt_slit));
+    if ( sizeof(struct acpi_sdt_hdr) + sizeof(struct acpi_sdt_slit)
+         + slit->n * slit->n > sdt->length ) {
+        /* Invalid */
+        return -1;
+    }
+
+    for ( a = 0; a < acpi_numa_n; a++ ) {
+        for ( b = 0; b < acpi_numa_n; b++ ) {
+            i = acpi_numa_domain[a];
+            j = acpi_numa_domain[b];
+            if ( i >= slit->n || j >= slit->n ) {
+                return -1;
+            }
+            acpi_numa_slit[a][b] = dist[i * slit->n + j];
+        }
+    }
+    acpi_numa_slit_valid = 1;
+
+    return 0;
+}
+
 /*
  * Parse root system description table (RSDT/XSDT)
  */
@@ -277,6 +424,7 @@ int
 acpi_parse_rsdt(struct acpi_rsdp *rsdp)
 {
     struct acpi_sdt_hdr *rsdt;
+    struct acpi_sdt_hdr *slit;
     int i;
     int nr;
     int sz;
@@ -298,6 +446,7 @@ acpi_parse_rsdt(struct acpi_rsdp *rsdp)
     }
     /* FIXME: 4byte --> 32bit */
     nr = (rsdt->length - sizeof(struct acpi_sdt_hdr)) / sz;
+    slit = NULL;
     for ( i = 0; i < nr; i++ ) {
         u64 xx;
         if ( 4 == sz ) {
@@ -312,8 +461,17 @@ acpi_parse_rsdt(struct acpi_rsdp *rsdp)
         } else if ( 0 == cmp((u8 *)tmp->signature, (u8 *)"FACP", 4) ) {
             /* FADT */
             acpi_parse_fadt(tmp);
+        } else if ( 0 == cmp((u8 *)tmp->signature, (u8 *)"SRAT", 4) ) {
+            /* SRAT */
+            acpi_parse_srat(tmp);
+        } else if ( 0 == cmp((u8 *)tmp->signature, (u8 *)"SLIT", 4) ) {
+            /* SLIT */
+            slit = tmp;
         }
     }
+    if ( NULL != slit ) {
+        acpi_parse_slit(slit);
+    }
 
     return 0;
 }
@@ -347,6 +505,7 @@ acpi_load(void)
 {
     u16 ebda;
     u64 ebda_addr;
+    int i;
 
     acpi_pm_tmr_port = 0;
     acpi_pm_tmr_ext = 0;
@@ -357,6 +516,12 @@ acpi_load(void)
     acpi_slp_typb = 0;
     acpi_smi_cmd_port = 0;
     acpi_enable_val = 0;
+    acpi_numa_n = 0;
+    acpi_numa_nmem = 0;
+    acpi_numa_slit_valid = 0;
+    for ( i = 0; i < 256; i++ ) {
+        acpi_numa_cpu[i] = 0;
+    }
 
     /* Check 1KB of EBDA, first */
     ebda = *(u16 *)0x040e;
@@ -371,6 +536,57 @@ acpi_load(void)
     return acpi_rsdp_search_range(0xe0000, 0x100000);
 }
 
+/*
+ * Get the number of NUMA nodes
+ */
+int
+acpi_numa_nodes(void)
+{
+    return acpi_numa_n > 0 ? acpi_numa_n : 1;
+}
+
+/*
+ * Get the NUMA node of a processor by its APIC ID
+ */
+int
+acpi_numa_cpu_node(int apic_id)
+{
+    if ( apic_id < 0 || apic_id >= 256 ) {
+        return 0;
+    }
+
+    return acpi_numa_cpu[apic_id];
+}
+
+/*
+ * Get the i-th memory range described in SRAT and return its NUMA node; -1
+ * if no more range
+ */
+int
+acpi_numa_mem_range(int i, u64 *base, u64 *len)
+{
+    if ( i < 0 || i >= acpi_numa_nmem ) {
+        return -1;
+    }
+    *base = acpi_numa_mem[i].base;
+    *len = acpi_numa_mem[i].len;
+
+    return acpi_numa_mem[i].node;
+}
+
+/*
+ * Get the distance between two NUMA nodes
+ */
+int
+acpi_numa_distance(int a, int b)
+{
+    if ( acpi_numa_slit_valid ) {
+        return acpi_numa_slit[a][b];
+    }
+
+    return a == b ? ACPI_NUMA_LOCAL : ACPI_NUMA_REMOTE;
+}
+
 /*
  * Get the current ACPI timer
  */
@@ -145,6 +145,70 @@ struct acpi_sdt_fadt {
 
 } __attribute__ ((packed));
 
+/*
+ * System Resource Affinity Table (SRAT)
+ *   0: Processor Local APIC Affinity
+ *   1: Memory Affinity
+ *   2: Processor Local x2APIC Affinity
+ */
+struct acpi_sdt_srat {
+    u32 reserved1;
+    u64 reserved2;
+} __attribute__ ((packed));
+
+struct acpi_sdt_srat_hdr {
+    u8 type;
+    u8 length;
+} __attribute__ ((packed));
+
+struct acpi_sdt_srat_lapic {
+    struct acpi_sdt_srat_hdr hdr;
+    u8 domain_lo;
+    u8 apic_id;
+    u32 flags;          /* bit 0: enabled */
+    u8 sapic_eid;
+    u8 domain_hi[3];
+    u32 clock_domain;
+} __attribute__ ((packed));
+
+struct acpi_sdt_srat_mem {
+    struct acpi_sdt_srat_hdr hdr;
+    u32 domain;
+    u16 reserved1;
+    u64 base;
+    u64 length;
+    u32 reserved2;
+    u32 flags;          /* bit 0: enabled */
+    u64 reserved3;
+} __attribute__ ((packed));
+
+struct acpi_sdt_srat_x2apic {
+    struct acpi_sdt_srat_hdr hdr;
+    u16 reserved1;
+    u32 domain;
+    u32 x2apic_id;
+    u32 flags;          /* bit 0: enabled */
+    u32 clock_domain;
+    u32 reserved2;
+} __attribute__ ((packed));
+
+/*
+ * System Locality Information Table (SLIT); a matrix of n x n distances
+ * follows
+ */
+struct acpi_sdt_slit {
+    u64 n;
+} __attribute__ ((packed));
+
+/*
+ * NUMA nodes; the proximity domains found in SRAT are numbered from 0 in
+ * the order of appearance
+ */
+#define ACPI_NUMA_MAX_NODES     8
+#define ACPI_NUMA_MAX_MEM       64
+#define ACPI_NUMA_LOCAL         10      /* Distance to the local node */
+#define ACPI_NUMA_REMOTE        20
+
 int acpi_load(void);
 void acpi_busy_usleep(u64);
 int acpi_poweroff(void);
@@ -153,6 +217,11 @@ volatile u32 acpi_get_timer(void);
 u64 acpi_get_timer_period(void);
 u64 acpi_get_timer_hz(void);
 
+int acpi_numa_nodes(void);
+int acpi_numa_cpu_node(int);
+int acpi_numa_mem_range(int, u64 *, u64 *);
+int acpi_numa_distance(int, int);
+
 /* acpi_dsdt.c */
 int acpi_parse_dsdt_root(u8 *, int);
 
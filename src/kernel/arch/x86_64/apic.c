@@ -138,6 +138,40 @@ lapic_start_timer(u64 freq, u8 vec)
     asm_lapic_write(APIC_BASE + APIC_INITTMR, (busfreq >> 4) / freq);
 }
 
+/*
+ * Start the local APIC timer to fire the vector once after usec
+ * microseconds; for a wakeup of the tickless processors
+ */
+void
+lapic_start_oneshot(u64 usec, u8 vec)
+{
+    struct p_data *pdata;
+    u64 cnt;
+
+    pdata = (struct p_data *)((u64)P_DATA_BASE + this_cpu() * P_DATA_SIZE);
+    cnt = (pdata->freq >> 4) * usec / 1000000;
+    if ( 0 == cnt ) {
+        cnt = 1;
+    } else if ( cnt > 0xffffffffULL ) {
+        cnt = 0xffffffffULL;
+    }
+
+    /* Vector: lvt[18:17] = 00 : oneshot */
+    asm_lapic_write(APIC_BASE + APIC_LVT_TMR, (u32)vec);
+    asm_lapic_write(APIC_BASE + APIC_TMRDIV, APIC_TMRDIV_X16);
+    asm_lapic_write(APIC_BASE + APIC_INITTMR, (u32)cnt);
+}
+
+/*
+ * Get the current count of the local APIC timer; zero once a one-shot timer
+ * has expired
+ */
+u32
+lapic_timer_count(void)
+{
+    return asm_lapic_read(APIC_BASE + APIC_CURTMR);
+}
+
 /*
  * Stop APIC timer
  */
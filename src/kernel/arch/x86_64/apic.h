@@ -18,6 +18,9 @@ void lapic_send_startup_ipi(u8);
 void lapic_send_fixed_ipi(u8);
 void lapic_send_ns_fixed_ipi(u8, u8);
 void lapic_start_timer(u64, u8);
+void lapic_start_oneshot(u64, u8);
+u32 lapic_timer_count(void);
+void lapic_stop_timer(void);
 u64 lapic_estimate_freq(void);
 
 void ioapic_init(void);
@@ -35,6 +35,10 @@ extern void trampoline_end(void);
 
 static int dbg_lock;
 
+/* Assertion: struct percpu fits in its area of struct p_data */
+typedef char _percpu_size_check[sizeof(struct percpu) <= P_PERCPU_SIZE
+                                ? 1 : -1];
+
 int
 arch_dbg_printf(const char *fmt, ...)
 {
@@ -57,6 +61,30 @@ arch_dbg_printf(const char *fmt, ...)
     return 0;
 }
 
+/*
+ * Point the GS base of this processor to its per-processor data area; the
+ * area is cleared by BSP before the APs are started
+ */
+static void
+_percpu_init(void)
+{
+    struct percpu *pc;
+    u64 base;
+    u16 id;
+
+    id = this_cpu();
+    pc = arch_percpu(id);
+    pc->self = pc;
+    pc->cpu = id;
+    pc->arch = (void *)(P_DATA_BASE + id * P_DATA_SIZE);
+
+    /* Null selector; the GS base is set through the MSR only */
+    __asm__ __volatile__ ("movl %0,%%gs" :: "r"(0));
+    base = (u64)pc;
+    __asm__ __volatile__ ("wrmsr" :: "c"(0xc0000101),
+                          "a"((u32)base), "d"((u32)(base >> 32)));
+}
+
 /*
  * Initialize BSP
  */
@@ -97,6 +125,11 @@ arch_bsp_init(void)
     /* Find configuration using ACPI */
     acpi_load();
 
+    /* Split the free memory into the NUMA nodes described by ACPI */
+    if ( 0 != phys_mem_numa_init() ) {
+        panic("Error! Cannot initialize NUMA nodes.\r\n");
+    }
+
     /* For multiprocessors */
 #if 0
     if ( 0 != phys_mem_wire((void *)P_DATA_BASE, P_DATA_SIZE*MAX_PROCESSORS) ) {
@@ -104,9 +137,11 @@ arch_bsp_init(void)
     }
 #endif
     for ( i = 0; i < MAX_PROCESSORS; i++ ) {
+        /* Including the per-processor data area */
         kmemset((u8 *)((u64)P_DATA_BASE + i * P_DATA_SIZE), 0,
                 sizeof(struct p_data));
     }
+    _percpu_init();
 
 #if 0
     /* Check CPUID */
@@ -163,6 +198,10 @@ arch_bsp_init(void)
     idt_setup_intr_gate(IV_IRQ(32), &intr_apic_int64);
     idt_setup_intr_gate(IV_LOC_TMR, &intr_apic_loc_tmr); /* Local APIC timer */
     idt_setup_intr_gate(IV_IPI, &intr_apic_ipi);
+    for ( i = 0; i < IV_MSI_NUM; i++ ) {
+        /* MSI/MSI-X; see alloc_intr_vector() */
+        idt_setup_intr_gate(IV_MSI(i), intr_apic_msi_table[i]);
+    }
     idt_setup_intr_gate(IV_CRASH, &intr_crash); /* crash */
     idt_setup_intr_gate(0xff, &intr_apic_spurious); /* Spurious interrupt */
 
@@ -289,6 +328,9 @@ arch_ap_init(void)
 
     arch_dbg_printf("Initializing application processor #%d.\r\n", this_cpu());
 
+    /* Per-processor data area */
+    _percpu_init();
+
     /* Load global descriptor table */
     gdt_load();
 
@@ -458,6 +500,35 @@ arch_crash(void)
     halt();
 }
 
+/*
+ * Get the per-processor data area of the processor (by local APIC ID)
+ */
+struct percpu *
+arch_percpu(u16 id)
+{
+    struct p_data *pdata;
+
+    pdata = (struct p_data *)(P_DATA_BASE + id * P_DATA_SIZE);
+
+    return (struct percpu *)pdata->percpu;
+}
+
+/*
+ * Get the NUMA node of the processor (by local APIC ID)
+ */
+int
+arch_cpu_node(u16 id)
+{
+    int node;
+
+    node = acpi_numa_cpu_node(id);
+    if ( node < 0 ) {
+        return 0;
+    }
+
+    return node;
+}
+
 u8
 arch_inb(u16 a)
 {
@@ -518,7 +589,7 @@ arch_set_next_task(struct ktask *ktask)
 {
     volatile struct p_data *pdata;
 
-    pdata = (volatile struct p_data *)(P_DATA_BASE + this_cpu() * P_DATA_SIZE);
+    pdata = (volatile struct p_data *)PERCPU(arch);
     pdata->next_task = (u64)ktask->arch;
 
     return 0;
@@ -546,7 +617,7 @@ arch_get_next_task(void)
     volatile struct p_data *pdata;
     struct arch_task *t;
 
-    pdata = (volatile struct p_data *)(P_DATA_BASE + this_cpu() * P_DATA_SIZE);
+    pdata = (volatile struct p_data *)PERCPU(arch);
     t = (struct arch_task *)pdata->next_task;
     if ( NULL != t ) {
         return t->ktask;
@@ -565,7 +636,7 @@ arch_get_current_task(void)
     volatile struct p_data *pdata;
     struct arch_task *t;
 
-    pdata = (volatile struct p_data *)(P_DATA_BASE + this_cpu() * P_DATA_SIZE);
+    pdata = (volatile struct p_data *)PERCPU(arch);
     t = (struct arch_task *)pdata->cur_task;
     if ( NULL != t ) {
         return t->ktask;
@@ -752,6 +823,79 @@ arch_enable_interrupts(void)
     enable_interrupts();
 }
 
+/*
+ * Disable interrupts on the current processor core and return the flags to
+ * restore
+ */
+u64
+arch_intr_save(void)
+{
+    u64 rflags;
+
+    __asm__ __volatile__ ("pushfq; popq %0; cli" : "=r"(rflags) :: "memory");
+
+    return rflags;
+}
+
+/*
+ * Enable interrupts again if they were enabled at arch_intr_save()
+ */
+void
+arch_intr_restore(u64 rflags)
+{
+    if ( rflags & (1 << 9) ) {
+        __asm__ __volatile__ ("sti" ::: "memory");
+    }
+}
+
+/*
+ * Start counting the data TLB misses causing a page walk on this processor
+ * with the general-purpose performance counter 0; -1 if the architectural
+ * performance monitoring is not supported
+ */
+int
+arch_dtlb_miss_start(void)
+{
+    u64 a;
+    u64 d;
+
+    /* CPUID.0AH:EAX[7:0] = version, EAX[15:8] = # of counters */
+    a = 0x0a;
+    __asm__ __volatile__ ("cpuid" : "+a"(a) :: "rbx", "rcx", "rdx");
+    if ( 0 == (a & 0xff) || 0 == ((a >> 8) & 0xff) ) {
+        return -1;
+    }
+
+    /* IA32_PERFEVTSEL0: DTLB_LOAD_MISSES.MISS_CAUSES_A_WALK (08H/01H) with
+       EN, OS and USR */
+    __asm__ __volatile__ ("wrmsr" :: "c"(0x186),
+                          "a"((1 << 22) | (1 << 17) | (1 << 16) | (0x01 << 8)
+                              | 0x08), "d"(0));
+    /* IA32_PMC0 */
+    __asm__ __volatile__ ("wrmsr" :: "c"(0xc1), "a"(0), "d"(0));
+    if ( (a & 0xff) >= 2 ) {
+        /* IA32_PERF_GLOBAL_CTRL: enable PMC0 */
+        __asm__ __volatile__ ("rdmsr" : "=a"(a), "=d"(d) : "c"(0x38f));
+        __asm__ __volatile__ ("wrmsr" :: "c"(0x38f), "a"(a | 1), "d"(d));
+    }
+
+    return 0;
+}
+
+/*
+ * Read the data TLB misses counted since arch_dtlb_miss_start()
+ */
+u64
+arch_dtlb_miss_read(void)
+{
+    u32 a;
+    u32 d;
+
+    __asm__ __volatile__ ("rdpmc" : "=a"(a), "=d"(d) : "c"(0));
+
+    return ((u64)d << 32) | a;
+}
+
 /*
  * Call a system call
  */
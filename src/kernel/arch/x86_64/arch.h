@@ -21,6 +21,8 @@
 #define GDT_MAX_SIZE            0x2000
 #define IDT_ADDR                (u64)0x76000
 #define IDT_MAX_SIZE            0x2000
+/* Also defined in asmconst.h */
+#define KERNEL_PGT              (u64)0x79000
 
 /* FIXME: ISA memory hole cannot be detect through ACPI */
 #define PHYS_MEM_FREE_ADDR      0x02000000
@@ -41,6 +43,9 @@
 #define P_DATA_BASE             (u64)0x01000000
 #define P_TSS_OFFSET            (0x20 + IDT_NR * 8)
 #define P_STACK_GUARD           0x10
+/* Per-processor data area (struct percpu) pointed by the GS base */
+#define P_PERCPU_OFFSET         0x1000
+#define P_PERCPU_SIZE           0x100
 
 #define APIC_BASE               (u64)0xfee00000
 #define APIC_SIVR               0x0f0
@@ -74,7 +79,9 @@
  * Stack frame for interrupts
  */
 struct stackframe64 {
-    /* Segment registers */
+    /* Segment registers; the %gs slot is never reloaded since the GS base
+       holds the per-processor data area and there is no swapgs, so no task,
+       including ring-3 ones, may load %gs */
     u16 gs;
     u16 fs;
 
@@ -171,6 +178,9 @@ struct p_data {
     u64 cur_task;
     /* P_NEXT_TASK_OFFSET */
     u64 next_task;
+    u8 reserved2[P_PERCPU_OFFSET - P_TSS_OFFSET - sizeof(struct tss) - 16];
+    /* P_PERCPU_OFFSET: struct percpu (see arch_percpu()) */
+    u8 percpu[P_PERCPU_SIZE];
     /* Stack and stack guard follow */
 } __attribute__ ((packed));
 
@@ -270,6 +280,7 @@ void intr_apic_int63(void);
 void intr_apic_int64(void);
 void intr_apic_loc_tmr(void);
 void intr_apic_ipi(void);
+extern void (*intr_apic_msi_table[])(void);
 void intr_crash(void);
 void intr_apic_spurious(void);
 
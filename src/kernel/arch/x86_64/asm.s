@@ -28,6 +28,7 @@
 	.set	P_TSS_SIZE,104
 	.set	P_CUR_TASK_OFFSET,(P_TSS_OFFSET + P_TSS_SIZE)
 	.set	P_NEXT_TASK_OFFSET,(P_CUR_TASK_OFFSET + 8)
+	.set	P_PERCPU_OFFSET,0x1000
 	.set	STACKFRAME_SIZE,164
 	.set	TASK_RP,0
 	.set	TASK_SP0,8
@@ -114,6 +115,7 @@
 	.globl	_intr_apic_int64
 	.globl	_intr_apic_loc_tmr
 	.globl	_intr_apic_ipi
+	.globl	_intr_apic_msi_table
 	.globl	_intr_crash
 	.globl	_intr_apic_spurious
 	.globl	_task_restart
@@ -454,7 +456,10 @@ _intr_pf:
 	pushq	%rdi
 	pushq	%rbp
 	pushw	%fs
-	pushw	%gs
+	/* The GS base points to the per-processor data area; keep the slot of
+	   %gs in the stack frame but never reload the selector (no task may
+	   load %gs; see struct stackframe64) */
+	subq	$2,%rsp
 
 	movq	$\vec,%rdi
 	call	_kintr_isr
@@ -475,7 +480,7 @@ _intr_pf:
 
 	.macro	intr_lapic_isr_done
 	/* Pop all registers from stackframe */
-	popw	%gs
+	addq	$2,%rsp
 	popw	%fs
 	popq	%rbp
 	popq	%rdi
@@ -673,6 +678,43 @@ _intr_apic_ipi:
 	intr_lapic_isr_done
 	iretq
 
+/* MSI/MSI-X vectors (IV_MSI(0)--IV_MSI(63)) */
+	.macro	intr_apic_msi vec
+_intr_apic_msi\vec:
+	intr_lapic_isr \vec
+	intr_lapic_isr_done
+	iretq
+	.endm
+
+	.irp	vec,96,97,98,99,100,101,102,103,104,105,106,107,108,109,110,111
+	intr_apic_msi \vec
+	.endr
+	.irp	vec,112,113,114,115,116,117,118,119,120,121,122,123,124,125,126,127
+	intr_apic_msi \vec
+	.endr
+	.irp	vec,128,129,130,131,132,133,134,135,136,137,138,139,140,141,142,143
+	intr_apic_msi \vec
+	.endr
+	.irp	vec,144,145,146,147,148,149,150,151,152,153,154,155,156,157,158,159
+	intr_apic_msi \vec
+	.endr
+
+/* Entry points of the MSI/MSI-X vectors */
+	.align	8
+_intr_apic_msi_table:
+	.irp	vec,96,97,98,99,100,101,102,103,104,105,106,107,108,109,110,111
+	.quad	_intr_apic_msi\vec
+	.endr
+	.irp	vec,112,113,114,115,116,117,118,119,120,121,122,123,124,125,126,127
+	.quad	_intr_apic_msi\vec
+	.endr
+	.irp	vec,128,129,130,131,132,133,134,135,136,137,138,139,140,141,142,143
+	.quad	_intr_apic_msi\vec
+	.endr
+	.irp	vec,144,145,146,147,148,149,150,151,152,153,154,155,156,157,158,159
+	.quad	_intr_apic_msi\vec
+	.endr
+
 _intr_crash:
 	jmp	_halt
 
@@ -682,15 +724,10 @@ _intr_apic_spurious:
 
 
 _task_restart:
-	/* Obtain current CPU ID */
-	call	_this_cpu
-	movq	%rax,%rcx
-	/* Calculate the base address */
-	movq	%rcx,%rax
-	movq	$P_DATA_SIZE,%rbx
-	mulq	%rbx	/* [rdx:rax] <= rax * rbx */
-	addq	$P_DATA_BASE,%rax
-	movq	%rax,%rbp
+	/* Obtain the base address of the data of this processor from the
+	   per-processor data area at the GS base */
+	movq	%gs:0,%rbp
+	subq	$P_PERCPU_OFFSET,%rbp
 	/* If the next task is not scheduled, immediately restart this */
 	cmpq	$0,P_NEXT_TASK_OFFSET(%rbp)
 	jz	1f
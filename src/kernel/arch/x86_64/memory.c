@@ -11,12 +11,14 @@
 #include "../../kernel.h"
 #include "memory.h"
 #include "arch.h"
+#include "acpi.h"
 #include "bootinfo.h"
 
 /* Flags */
 #define PHYS_MEM_USED           (u64)1
 #define PHYS_MEM_WIRED          (u64)(1<<1)
 #define PHYS_MEM_HEAD           (u64)(1<<2)
+#define PHYS_MEM_BUDDY          (u64)(1<<3)     /* Head of a free block */
 #define PHYS_MEM_UNAVAIL        (u64)(1<<16)
 
 #define PHYS_MEM_IS_FREE(x)     (0 == (x)->flags ? 1 : 0)
@@ -29,8 +31,147 @@
 
 static volatile int memory_lock;
 static volatile struct phys_mem *phys_mem;
+/* Set once the processor table holding the page caches is ready */
+static volatile int phys_mem_pgcache;
+/* Set if the processor supports 1 GiB pages */
+static int phys_mem_huge1g;
+/* Set once the pages are tagged with the NUMA nodes */
+static volatile int phys_mem_numa;
 
+/*
+ * Add the block of 2^k pages starting at the page i to the free list
+ */
+static __inline__ void
+_buddy_push(u64 i, int k)
+{
+    struct phys_mem_page *pg;
+
+    pg = &phys_mem->pages[i];
+    pg->flags = PHYS_MEM_BUDDY;
+    pg->order = k;
+    pg->prev = NULL;
+    pg->next = phys_mem->buddy.o[pg->node][k].head;
+    if ( NULL != pg->next ) {
+        pg->next->prev = pg;
+    }
+    phys_mem->buddy.o[pg->node][k].head = pg;
+    phys_mem->buddy.o[pg->node][k].nr++;
+}
 
+/*
+ * Remove a free block from the free list
+ */
+static __inline__ void
+_buddy_remove(struct phys_mem_page *pg)
+{
+    if ( NULL != pg->prev ) {
+        pg->prev->next = pg->next;
+    } else {
+        phys_mem->buddy.o[pg->node][pg->order].head = pg->next;
+    }
+    if ( NULL != pg->next ) {
+        pg->next->prev = pg->prev;
+    }
+    phys_mem->buddy.o[pg->node][pg->order].nr--;
+    pg->flags = 0;
+    pg->prev = NULL;
+    pg->next = NULL;
+    pg->order = -1;
+}
+
+/*
+ * Release the block of 2^k pages starting at the page i, and merge it with
+ * its buddy as long as the buddy is free in the same node
+ */
+static void
+_buddy_free_block(u64 i, int k)
+{
+    struct phys_mem_page *b;
+    u64 j;
+
+    while ( k < PHYS_MEM_BUDDY_ORDER - 1 ) {
+        j = i ^ (1ULL << k);
+        if ( j + (1ULL << k) > phys_mem->nr ) {
+            break;
+        }
+        b = &phys_mem->pages[j];
+        if ( !(b->flags & PHYS_MEM_BUDDY) || b->order != k
+             || b->node != phys_mem->pages[i].node ) {
+            /* The buddy is (partially) in use */
+            break;
+        }
+        _buddy_remove(b);
+        i &= ~(1ULL << k);
+        k++;
+    }
+    _buddy_push(i, k);
+}
+
+/*
+ * Release n pages starting at the page i as the largest aligned blocks
+ */
+static void
+_buddy_free_range(u64 i, u64 n)
+{
+    int k;
+
+    while ( n > 0 ) {
+        /* Largest block aligned at i and not exceeding n */
+        k = i ? __builtin_ctzll(i) : PHYS_MEM_BUDDY_ORDER - 1;
+        if ( k > PHYS_MEM_BUDDY_ORDER - 1 ) {
+            k = PHYS_MEM_BUDDY_ORDER - 1;
+        }
+        while ( (1ULL << k) > n ) {
+            k--;
+        }
+        _buddy_free_block(i, k);
+        i += 1ULL << k;
+        n -= 1ULL << k;
+    }
+}
+
+/*
+ * Get the end of the run of the pages of the same node from the page i, not
+ * beyond the page e
+ */
+static u64
+_node_run_end(u64 i, u64 e)
+{
+    u64 j;
+    int k;
+
+    if ( phys_mem->nbounds < 0 ) {
+        for ( j = i + 1; j < e; j++ ) {
+            if ( phys_mem->pages[j].node != phys_mem->pages[i].node ) {
+                return j;
+            }
+        }
+        return e;
+    }
+    for ( k = 0; k < phys_mem->nbounds; k++ ) {
+        if ( phys_mem->bounds[k] > i ) {
+            return phys_mem->bounds[k] < e ? phys_mem->bounds[k] : e;
+        }
+    }
+
+    return e;
+}
+
+/*
+ * Release n pages starting at the page i, split at the node boundaries
+ */
+static void
+_buddy_free_run(u64 i, u64 n)
+{
+    u64 j;
+
+    while ( n > 0 ) {
+        j = _node_run_end(i, i + n);
+        _buddy_free_range(i, j - i);
+        n -= j - i;
+        i = j;
+    }
+}
 
 
 /*
@@ -49,13 +190,19 @@ phys_mem_init(struct bootinfo *bi)
     u64 i;
     u64 j;
     int k;
-    int flag;
 
     /* Clear lock variable */
     memory_lock = 0;
 
     /* Clear physical memory space */
     phys_mem = NULL;
+    phys_mem_pgcache = 0;
+    phys_mem_numa = 0;
+
+    /* CPUID.80000001H:EDX[26] = Page1GB */
+    a = 0x80000001;
+    __asm__ __volatile__ ("cpuid" : "+a"(a), "=d"(b) :: "rbx", "rcx");
+    phys_mem_huge1g = (b >> 26) & 1;
 
     /* Check the number of address map entries */
     if ( bi->sysaddrmap.n <= 0 ) {
@@ -121,9 +268,12 @@ phys_mem_init(struct bootinfo *bi)
     for ( i = 0; i < phys_mem->nr; i++ ) {
         /* Mark as unavailable */
         phys_mem->pages[i].flags = PHYS_MEM_UNAVAIL;
-        phys_mem->pages[i].lru = NULL;
+        phys_mem->pages[i].prev = NULL;
         phys_mem->pages[i].next = NULL;
         phys_mem->pages[i].order = -1;
+        phys_mem->pages[i].nr = 0;
+        phys_mem->pages[i].slab = NULL;
+        phys_mem->pages[i].node = 0;
     }
 
     /* Check system address map obitaned from BIOS */
@@ -155,43 +305,161 @@ phys_mem_init(struct bootinfo *bi)
         phys_mem->pages[i].flags |= PHYS_MEM_WIRED;
     }
 
-    /* Initialize buddy system */
-    for ( k = 0; k < PHYS_MEM_BUDDY_ORDER; k++ ) {
-        phys_mem->buddy.o[k].head = NULL;
-    }
-    for ( k = PHYS_MEM_BUDDY_ORDER-1; k >= 0; k-- ) {
-        for ( i = 0; i < phys_mem->nr; i += (1<<k) ) {
-            flag = 0;
-            if ( phys_mem->pages[i].order >= 0 ) {
-                /* Already used in a higher order buddy list */
-                flag = 1;
+    /* Initialize buddy system with the runs of the pages neither wired nor
+       unavailable */
+    for ( i = 0; i < PHYS_MEM_MAX_NODES; i++ ) {
+        for ( k = 0; k < PHYS_MEM_BUDDY_ORDER; k++ ) {
+            phys_mem->buddy.o[i][k].head = NULL;
+            phys_mem->buddy.o[i][k].nr = 0;
+        }
+        phys_mem->fallback[0][i] = 0;
+    }
+    phys_mem->nnodes = 1;
+    phys_mem->nbounds = 0;
+    i = 0;
+    while ( i < phys_mem->nr ) {
+        if ( !PHYS_MEM_IS_FREE(&phys_mem->pages[i]) ) {
+            i++;
+            continue;
+        }
+        for ( j = i; j < phys_mem->nr; j++ ) {
+            if ( !PHYS_MEM_IS_FREE(&phys_mem->pages[j]) ) {
                 break;
             }
-            if ( !flag ) {
-                /* Not used in a higher order buddy list */
-                flag = 1;
-                for ( j = 0; i < (1<<k); j++ ) {
-                    if ( !PHYS_MEM_IS_FREE(&phys_mem->pages[i+j]) ) {
-                        /* Not free */
-                        flag = 0;
-                        break;
-                    }
+        }
+        _buddy_free_range(i, j - i);
+        i = j;
+    }
+
+    return 0;
+}
+
+/*
+ * Tag the pages with the NUMA nodes described by ACPI SRAT, and rebuild the
+ * free lists per node; called after acpi_load()
+ *    This is not thread safe.  Call this from BSP.
+ */
+int
+phys_mem_numa_init(void)
+{
+    struct phys_mem_page *pg;
+    struct phys_mem_page *list;
+    u64 base;
+    u64 len;
+    u64 a;
+    u64 b;
+    u64 i;
+    u32 used;
+    int node;
+    int best;
+    int n;
+    int j;
+    int k;
+
+    n = acpi_numa_nodes();
+    if ( n > PHYS_MEM_MAX_NODES ) {
+        n = PHYS_MEM_MAX_NODES;
+    }
+    if ( n <= 1 ) {
+        return 0;
+    }
+
+    spin_lock(&memory_lock);
+
+    /* Take all the free blocks out of the free lists */
+    list = NULL;
+    for ( k = 0; k < PHYS_MEM_BUDDY_ORDER; k++ ) {
+        while ( NULL != phys_mem->buddy.o[0][k].head ) {
+            pg = phys_mem->buddy.o[0][k].head;
+            _buddy_remove(pg);
+            pg->order = k;
+            pg->next = list;
+            list = pg;
+        }
+    }
+
+    /* Tag the pages */
+    for ( j = 0; (node = acpi_numa_mem_range(j, &base, &len)) >= 0; j++ ) {
+        if ( node >= n ) {
+            continue;
+        }
+        a = CEIL(base, PAGESIZE) / PAGESIZE;
+        b = FLOOR(base + len, PAGESIZE) / PAGESIZE;
+        for ( i = a; i < b && i < phys_mem->nr; i++ ) {
+            phys_mem->pages[i].node = node;
+        }
+    }
+
+    /* Fallback order of the nodes by the distance */
+    for ( node = 0; node < n; node++ ) {
+        used = 0;
+        for ( j = 0; j < n; j++ ) {
+            best = -1;
+            for ( k = 0; k < n; k++ ) {
+                if ( used & (1 << k) ) {
+                    continue;
                 }
-                if ( flag ) {
-                    /* All pages are free */
-                    phys_mem->pages[i].next = phys_mem->buddy.o[k].head;
-                    phys_mem->buddy.o[k].head = &phys_mem->pages[i];
-                    for ( j = 0; i < (1<<k); j++ ) {
-                        phys_mem->pages[k].order = k;
-                    }
+                if ( best < 0 || acpi_numa_distance(node, k)
+                     < acpi_numa_distance(node, best) ) {
+                    best = k;
                 }
             }
+            phys_mem->fallback[node][j] = best;
+            used |= 1 << best;
+        }
+    }
+    phys_mem->nnodes = n;
+
+    /* Record the node boundaries so that a free splits the run without
+       checking each page */
+    phys_mem->nbounds = 0;
+    for ( i = 1; i < phys_mem->nr; i++ ) {
+        if ( phys_mem->pages[i].node == phys_mem->pages[i - 1].node ) {
+            continue;
+        }
+        if ( phys_mem->nbounds >= PHYS_MEM_MAX_BOUNDS ) {
+            phys_mem->nbounds = -1;
+            break;
         }
+        phys_mem->bounds[phys_mem->nbounds++] = i;
     }
 
+    /* Put the free blocks back to the lists of their nodes */
+    while ( NULL != list ) {
+        pg = list;
+        list = pg->next;
+        k = pg->order;
+        pg->next = NULL;
+        pg->order = -1;
+        _buddy_free_run(PHYS_MEM_PAGE_POS(pg), 1ULL << k);
+    }
+
+    phys_mem_numa = 1;
+
+    spin_unlock(&memory_lock);
+
     return 0;
 }
 
+/*
+ * Get the NUMA node of this processor
+ */
+static __inline__ int
+_this_node(void)
+{
+    int node;
+
+    if ( !phys_mem_numa ) {
+        return 0;
+    }
+    node = acpi_numa_cpu_node(this_cpu());
+    if ( node >= phys_mem->nnodes ) {
+        return 0;
+    }
+
+    return node;
+}
+
 #if 0
 /*
  * Wire
@@ -230,84 +498,254 @@ phys_mem_wire(void *page, u64 size)
 
 
 /*
- * Allocate n pages for kernel
+ * Allocate n pages from the buddy system, from the node or the nearest node
+ * with a free block; memory_lock must be held
  */
-void *
-phys_mem_alloc_pages(u64 n)
+static void *
+_alloc_pages(u64 n, int node)
 {
+    struct phys_mem_page *pg;
     u64 i;
-    u64 f;
-    u64 cnt;
+    int nd;
+    int o;
+    int j;
+    int k;
 
-    /* Check address first */
-    if ( n > phys_mem->nr ) {
+    /* Calculate order */
+    o = 0;
+    while ( (1ULL << o) < n ) {
+        o++;
+    }
+    if ( o >= PHYS_MEM_BUDDY_ORDER ) {
+        /* Larger than the largest block */
         return NULL;
     }
 
-    spin_lock(&memory_lock);
-
-#if 1
-    cnt = 0;
-    f = 0;
-    for ( i = 0; i < phys_mem->nr; i++ ) {
-        if ( PHYS_MEM_IS_FREE(&phys_mem->pages[i]) ) {
-            if ( !cnt ) {
-                f = i;
-            }
-            cnt++;
-            if ( cnt == n ) {
+    if ( node < 0 || node >= phys_mem->nnodes ) {
+        node = 0;
+    }
+    nd = 0;
+    k = PHYS_MEM_BUDDY_ORDER;
+    for ( j = 0; j < phys_mem->nnodes; j++ ) {
+        nd = phys_mem->fallback[node][j];
+        for ( k = o; k < PHYS_MEM_BUDDY_ORDER; k++ ) {
+            if ( NULL != phys_mem->buddy.o[nd][k].head ) {
                 break;
             }
-        } else {
-            f = 0;
-            cnt = 0;
         }
+        if ( k < PHYS_MEM_BUDDY_ORDER ) {
+            break;
+        }
+    }
+    if ( k >= PHYS_MEM_BUDDY_ORDER ) {
+        /* No free block */
+        return NULL;
     }
+    pg = phys_mem->buddy.o[nd][k].head;
+    i = PHYS_MEM_PAGE_POS(pg);
+    _buddy_remove(pg);
+
+    /* Split; the upper halves go to the lower order lists */
+    while ( k > o ) {
+        k--;
+        _buddy_push(i + (1ULL << k), k);
+    }
+    /* Release the unused tail */
+    _buddy_free_range(i + n, (1ULL << o) - n);
+
+    pg->flags = PHYS_MEM_USED | PHYS_MEM_HEAD;
+    pg->nr = n;
+
+    return (void *)(i * PAGESIZE);
+}
+
+/*
+ * Free the pages allocated by _alloc_pages(); memory_lock must be held
+ */
+static void
+_free_pages(u64 p)
+{
+    struct phys_mem_page *pg;
+    u64 n;
+
+    pg = &phys_mem->pages[p];
+    n = pg->nr;
+    pg->flags = 0;
+    pg->nr = 0;
 
-    if ( cnt == n ) {
-        phys_mem->pages[i].flags = PHYS_MEM_HEAD;
-        for ( i = f; i < f + n; i++ ) {
-            phys_mem->pages[i].flags |= PHYS_MEM_USED;
+    /* Coalesce with the free buddies; pages allocated before the nodes were
+       known may span nodes */
+    _buddy_free_run(p, n);
+}
+
+/*
+ * Disable the interrupts on this processor; return the previous flags
+ */
+static __inline__ u64
+_intr_save(void)
+{
+    u64 rflags;
+
+    __asm__ __volatile__ ("pushfq; popq %0; cli" : "=r"(rflags) :: "memory");
+
+    return rflags;
+}
+static __inline__ void
+_intr_restore(u64 rflags)
+{
+    if ( rflags & (1 << 9) ) {
+        /* IF was set */
+        __asm__ __volatile__ ("sti" ::: "memory");
+    }
+}
+
+/*
+ * Take a page from the cache of this processor, refilling it with a batch
+ * of pages under one lock when empty
+ */
+static void *
+_pgcache_alloc(struct processor_page_cache *pc)
+{
+    void *page;
+    int i;
+
+    if ( 0 == pc->n ) {
+        /* Refill the cold end */
+        spin_lock(&memory_lock);
+        for ( i = 0; i < PROCESSOR_PAGE_CACHE_BATCH; i++ ) {
+            page = _alloc_pages(1, _this_node());
+            if ( NULL == page ) {
+                break;
+            }
+            pc->pages[(pc->head - pc->n - 1) & (PROCESSOR_PAGE_CACHE_SIZE - 1)]
+                = page;
+            pc->n++;
         }
         spin_unlock(&memory_lock);
-        return (void *)(f * PAGESIZE);
+        if ( 0 == pc->n ) {
+            return NULL;
+        }
+        pc->refills++;
     } else {
+        pc->hits++;
+    }
+
+    /* Hot end */
+    pc->head = (pc->head - 1) & (PROCESSOR_PAGE_CACHE_SIZE - 1);
+    pc->n--;
+
+    return pc->pages[pc->head];
+}
+
+/*
+ * Return a page to the cache of this processor, draining a batch of the
+ * coldest pages under one lock when full
+ */
+static void
+_pgcache_free(struct processor_page_cache *pc, void *page)
+{
+    u32 idx;
+    int i;
+
+    if ( pc->n >= PROCESSOR_PAGE_CACHE_SIZE ) {
+        spin_lock(&memory_lock);
+        for ( i = 0; i < PROCESSOR_PAGE_CACHE_BATCH; i++ ) {
+            idx = (pc->head - pc->n) & (PROCESSOR_PAGE_CACHE_SIZE - 1);
+            _free_pages((u64)pc->pages[idx] / PAGESIZE);
+            pc->n--;
+        }
         spin_unlock(&memory_lock);
-        return NULL;
+        pc->drains++;
     }
-#endif
 
-#if 0
-    u64 j;
-    int o;
-    u64 tmp;
+    /* Hot end */
+    pc->pages[pc->head] = page;
+    pc->head = (pc->head + 1) & (PROCESSOR_PAGE_CACHE_SIZE - 1);
+    pc->n++;
+}
 
-    /* Calculate order */
-    tmp = n - 1;
-    o = 0;
-    while ( tmp ) {
-        tmp >>= 1;
-        o++;
+/*
+ * Enable the page caches of the processors; called once the processor table
+ * is initialized
+ */
+void
+phys_mem_pgcache_enable(void)
+{
+    phys_mem_pgcache = 1;
+}
+
+/*
+ * Allocate n pages for kernel; the block of the smallest order covering n
+ * pages is split from a larger one if needed, and the pages beyond n are
+ * released back.  A single page is taken from the cache of this processor
+ * without the lock in the common case.
+ */
+void *
+phys_mem_alloc_pages(u64 n)
+{
+    void *ret;
+    u64 rflags;
+
+    if ( 0 == n ) {
+        return NULL;
     }
 
-    for ( i = o; i < PHYS_MEM_BUDDY_ORDER; i++ ) {
-        if ( NULL != phys_mem->buddy.o[i].head ) {
-            /* Found */
-            f = PHYS_MEM_PAGE_POS(phys_mem->buddy.o[i].head);
-            for ( j = 0; j < n; j++ ) {
-                PHYS_MEM_PAGE_POS(phys_mem->buddy.o[i].head);
-                phys_mem->pages[f + j].flags | PHYS_MEM_USED;
-            }
+    if ( 1 == n && phys_mem_pgcache ) {
+        rflags = _intr_save();
+        ret = _pgcache_alloc(&processor_this()->pgcache);
+        _intr_restore(rflags);
+        return ret;
+    }
 
-            spin_unlock(&memory_lock);
-            return (void *)(PHYS_MEM_PAGE_POS(phys_mem->buddy.o[i].head)
-                            * PAGESIZE);
-        }
+    spin_lock(&memory_lock);
+    ret = _alloc_pages(n, _this_node());
+    spin_unlock(&memory_lock);
+
+    return ret;
+}
+
+/*
+ * Allocate n pages on the NUMA node, or on the nearest node with free pages
+ */
+void *
+phys_mem_alloc_pages_node(u64 n, int node)
+{
+    void *ret;
+
+    if ( 0 == n ) {
+        return NULL;
     }
 
+    spin_lock(&memory_lock);
+    ret = _alloc_pages(n, node);
     spin_unlock(&memory_lock);
-    return NULL;
-#endif
+
+    return ret;
+}
+
+/*
+ * Get the number of the NUMA nodes
+ */
+int
+phys_mem_nodes(void)
+{
+    return phys_mem->nnodes;
+}
+
+/*
+ * Get the NUMA node of the page at the address
+ */
+int
+phys_mem_node(const void *addr)
+{
+    u64 p;
+
+    p = (u64)addr / PAGESIZE;
+    if ( p >= phys_mem->nr ) {
+        return -1;
+    }
+
+    return phys_mem->pages[p].node;
 }
 
 /*
@@ -316,7 +754,8 @@ phys_mem_alloc_pages(u64 n)
 void
 phys_mem_free_pages(void *page)
 {
-    u64 i;
+    struct phys_mem_page *pg;
+    u64 rflags;
     u64 p;
 
     p = (u64)page / PAGESIZE;
@@ -325,30 +764,133 @@ phys_mem_free_pages(void *page)
         return;
     }
 
+    /* The allocation is owned by the caller; no lock to check it */
+    pg = &phys_mem->pages[p];
+    if ( !(pg->flags & PHYS_MEM_HEAD) ) {
+        /* Invalid page type */
+        return;
+    }
+
+    /* Pages of a remote node go back to the buddy system of their node */
+    if ( 1 == pg->nr && phys_mem_pgcache && pg->node == _this_node() ) {
+        rflags = _intr_save();
+        _pgcache_free(&processor_this()->pgcache, page);
+        _intr_restore(rflags);
+        return;
+    }
+
     spin_lock(&memory_lock);
+    _free_pages(p);
+    spin_unlock(&memory_lock);
+}
 
-    if ( !(phys_mem->pages[p].flags & PHYS_MEM_HEAD) ) {
-        /* Invalid page type */
-        spin_unlock(&memory_lock);
+
+/*
+ * Map the 1 GiB region starting at the address with a single 1 GiB page;
+ * the region must be identity-mapped with 2 MiB pages by the page directory
+ * of the first 4 GiB, so the translation does not change
+ */
+static void
+_map_1g(u64 addr)
+{
+    u64 *pdpt;
+    u64 va;
+
+    pdpt = (u64 *)(KERNEL_PGT + 0x1000);
+    if ( (addr >> 30) >= 4 ) {
+        /* Mapped with 1 GiB pages at boot */
         return;
     }
-    phys_mem->pages[p].flags &= ~PHYS_MEM_HEAD;
+    pdpt[addr >> 30] = addr | 0x183;
+    for ( va = addr; va < addr + PHYS_MEM_HUGEPAGE_1G;
+          va += PHYS_MEM_HUGEPAGE_2M ) {
+        __asm__ __volatile__ ("invlpg (%0)" :: "r"(va) : "memory");
+    }
+}
 
-    /* Free */
-    for ( i = p; i < phys_mem->nr; i++ ) {
-        if ( phys_mem->pages[i].flags & PHYS_MEM_HEAD ) {
-            /* Another allocation begins */
-            break;
-        } else if ( phys_mem->pages[i].flags & PHYS_MEM_USED ) {
-            /* Free */
-            phys_mem->pages[i].flags &= ~PHYS_MEM_USED;
-        } else {
-            /* This allocation ends */
-            break;
-        }
+/*
+ * Allocate physically contiguous memory of sz bytes mapped with huge pages
+ * of pgsz bytes (PHYS_MEM_HUGEPAGE_2M or PHYS_MEM_HUGEPAGE_1G); the size is
+ * rounded up to the page size, and 1 GiB pages fall back to 2 MiB pages if
+ * the processor does not support them.  Freed with phys_mem_free_pages().
+ */
+void *
+phys_mem_alloc_hugepages(u64 sz, u64 pgsz)
+{
+    return phys_mem_alloc_hugepages_node(sz, pgsz, _this_node());
+}
+
+/*
+ * Allocate huge pages on the NUMA node, or on the nearest node with a free
+ * block
+ */
+void *
+phys_mem_alloc_hugepages_node(u64 sz, u64 pgsz, int node)
+{
+    void *ret;
+    u64 n;
+    u64 a;
+
+    if ( PHYS_MEM_HUGEPAGE_1G == pgsz && !phys_mem_huge1g ) {
+        pgsz = PHYS_MEM_HUGEPAGE_2M;
+    }
+    if ( PHYS_MEM_HUGEPAGE_2M != pgsz && PHYS_MEM_HUGEPAGE_1G != pgsz ) {
+        return NULL;
+    }
+    if ( 0 == sz ) {
+        return NULL;
     }
 
+    /* The buddy blocks are aligned to their size */
+    n = CEIL(sz, pgsz) / PAGESIZE;
+    spin_lock(&memory_lock);
+    ret = _alloc_pages(n, node);
     spin_unlock(&memory_lock);
+    if ( NULL == ret ) {
+        return NULL;
+    }
+
+    if ( PHYS_MEM_HUGEPAGE_1G == pgsz ) {
+        for ( a = (u64)ret; a < (u64)ret + n * PAGESIZE;
+              a += PHYS_MEM_HUGEPAGE_1G ) {
+            _map_1g(a);
+        }
+    }
+
+    return ret;
+}
+
+
+/*
+ * Record the slab using the n pages (NULL to clear) so that the slab of an
+ * object is found from its address
+ */
+void
+phys_mem_set_slab(void *page, u64 n, void *slab)
+{
+    u64 p;
+    u64 i;
+
+    p = (u64)page / PAGESIZE;
+    for ( i = p; i < p + n && i < phys_mem->nr; i++ ) {
+        phys_mem->pages[i].slab = slab;
+    }
+}
+
+/*
+ * Get the slab using the page of the address; NULL if not used by a slab
+ */
+void *
+phys_mem_slab(const void *addr)
+{
+    u64 p;
+
+    p = (u64)addr / PAGESIZE;
+    if ( p >= phys_mem->nr ) {
+        return NULL;
+    }
+
+    return phys_mem->pages[p].slab;
 }
 
 
@@ -13,17 +13,22 @@
 #include <aos/const.h>
 #include "bootinfo.h"
 
-#define PHYS_MEM_BUDDY_ORDER 18
+#define PHYS_MEM_BUDDY_ORDER 19
+#define PHYS_MEM_MAX_NODES 8    /* ACPI_NUMA_MAX_NODES */
+#define PHYS_MEM_MAX_BOUNDS 64
 
 /*
  * Buddy system
- *   To be implemented
+ *   The free list of the order k links the first pages of the free blocks of
+ *   2^k pages aligned to 2^k pages.  Each NUMA node has its own free lists,
+ *   and a block never spans two nodes.
  */
 struct phys_mem_buddy {
     struct phys_mem_page *head;
+    u64 nr;
 } __attribute__ ((packed));
 struct phys_mem_root {
-    struct phys_mem_buddy o[PHYS_MEM_BUDDY_ORDER];
+    struct phys_mem_buddy o[PHYS_MEM_MAX_NODES][PHYS_MEM_BUDDY_ORDER];
 } __attribute__ ((packed));
 
 /*
@@ -31,10 +36,16 @@ struct phys_mem_root {
  */
 struct phys_mem_page {
     u64 flags;
-    struct phys_mem_page *lru;
-    /* For buddy system */
+    /* For buddy system; valid at the first page of a free block */
+    struct phys_mem_page *prev;
     struct phys_mem_page *next;
     int order;
+    /* Number of pages allocated; valid at the first page of an allocation */
+    u64 nr;
+    /* Slab of the kernel memory allocator using this page */
+    void *slab;
+    /* NUMA node */
+    int node;
 } __attribute__ ((packed));
 
 /*
@@ -44,9 +55,17 @@ struct phys_mem {
     u64 nr;
     struct phys_mem_page *pages;
     struct phys_mem_root buddy;
+    /* NUMA nodes, and the nodes by the distance from each node */
+    int nnodes;
+    int fallback[PHYS_MEM_MAX_NODES][PHYS_MEM_MAX_NODES];
+    /* Pages where the node changes in ascending order; -1 if there are too
+       many, then freed runs are checked page by page */
+    int nbounds;
+    u64 bounds[PHYS_MEM_MAX_BOUNDS];
 } __attribute__ ((packed));
 
 int phys_mem_init(struct bootinfo *);
+int phys_mem_numa_init(void);
 #if 0
 int phys_mem_wire(void *, u64);
 #endif
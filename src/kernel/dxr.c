@@ -12,6 +12,32 @@
 #define DXR_X   18
 
 
+/*
+ * Allocate a replica of the compiled tables on the NUMA node; the structure
+ * is also placed on the node since it is read on every lookup
+ */
+static struct dxr *
+_replica_new(int node)
+{
+    struct dxr *rep;
+    int i;
+
+    rep = phys_mem_alloc_pages_node((sizeof(struct dxr) + PAGESIZE - 1)
+                                    / PAGESIZE, node);
+    if ( NULL == rep ) {
+        return NULL;
+    }
+    rep->tables = NULL;
+    rep->radix = NULL;
+    rep->node_cache = NULL;
+    for ( i = 0; i < DXR_MAX_NODES; i++ ) {
+        rep->replicas[i] = NULL;
+    }
+    rep->nreplicas = 0;
+
+    return rep;
+}
+
 /*
  * Initialize DXR structure
  */
@@ -19,6 +45,7 @@ struct dxr *
 dxr_init(void)
 {
     struct dxr *dxr;
+    int i;
 
     dxr = kmalloc(sizeof(struct dxr));
     if  ( NULL == dxr ) {
@@ -28,13 +55,59 @@ dxr_init(void)
     dxr->range.tail = NULL;
     dxr->nhs = NULL;
 
-    dxr->lut = NULL;
+    dxr->tables = NULL;
 
     dxr->radix = NULL;
 
+    /* One replica per NUMA node */
+    dxr->nreplicas = phys_mem_nodes();
+    if ( dxr->nreplicas > DXR_MAX_NODES ) {
+        dxr->nreplicas = DXR_MAX_NODES;
+    }
+    for ( i = 0; i < DXR_MAX_NODES; i++ ) {
+        dxr->replicas[i] = NULL;
+    }
+    dxr->replicas[0] = dxr;
+    for ( i = 1; i < dxr->nreplicas; i++ ) {
+        dxr->replicas[i] = _replica_new(i);
+        if ( NULL == dxr->replicas[i] ) {
+            return NULL;
+        }
+    }
+
+    dxr->node_cache = kmem_cache_create("dxr_node", sizeof(struct radix_node),
+                                        KMEM_CACHE_LINE, NULL);
+    if ( NULL == dxr->node_cache ) {
+        return NULL;
+    }
+
     return dxr;
 }
 
+/*
+ * Get the replica of the NUMA node; the FIB itself if the node has none
+ */
+struct dxr *
+dxr_replica(struct dxr *dxr, int node)
+{
+    if ( node < 0 || node >= dxr->nreplicas
+         || NULL == dxr->replicas[node] ) {
+        return dxr;
+    }
+
+    return dxr->replicas[node];
+}
+
+/*
+ * Get the replica of the NUMA node of this processor; forwarding processors
+ * look up this one
+ */
+struct dxr *
+dxr_local(struct dxr *dxr)
+{
+    return dxr_replica(dxr, processor_this()->node);
+}
+
 
 /*
  * Add a route
@@ -45,7 +118,7 @@ _rt_route_add(struct dxr *dxr, struct radix_node **node,
               int depth)
 {
     if ( NULL == *node ) {
-        *node = kmalloc(sizeof(struct radix_node));
+        *node = kmem_cache_alloc(dxr->node_cache);
         if ( NULL == *node ) {
             /* Memory error */
             return -1;
@@ -96,8 +169,13 @@ dxr_route_add(struct dxr *dxr, u32 prefix, int len, u32 nexthop)
 
 
 
+/*
+ * Append the ranges from begin to end, split at the chunk boundaries, to the
+ * range list; the ranges and the next hops are scratch data of the arena
+ */
 static int
-_add_range(struct dxr *dxr, u32 begin, u32 end, u64 nexthop)
+_add_range(struct dxr *dxr, struct kmem_arena *arena, u32 begin, u32 end,
+           u64 nexthop)
 {
     struct dxr_range *r;
     struct dxr_next_hop **nh;
@@ -115,7 +193,7 @@ _add_range(struct dxr *dxr, u32 begin, u32 end, u64 nexthop)
         nh = &((*nh)->next);
     }
     if ( NULL == *nh ) {
-        *nh = kmalloc(sizeof(struct dxr_next_hop));
+        *nh = kmem_arena_alloc(arena, sizeof(struct dxr_next_hop));
         if ( NULL == *nh ) {
             return -1;
         }
@@ -128,9 +206,8 @@ _add_range(struct dxr *dxr, u32 begin, u32 end, u64 nexthop)
 
     b = begin;
     for ( ; b <= end; b = (b & mask) + chunk ) {
-        r = kmalloc(sizeof(struct dxr_range));
+        r = kmem_arena_alloc(arena, sizeof(struct dxr_range));
         if ( NULL == r ) {
-            /* FIXME */
             return -1;
         }
         r->begin = b;
@@ -154,12 +231,14 @@ _add_range(struct dxr *dxr, u32 begin, u32 end, u64 nexthop)
     return 0;
 }
 
-static void
-_compile_range(struct dxr *dxr, struct radix_node *node, u64 prefix, int depth,
+static int
+_compile_range(struct dxr *dxr, struct kmem_arena *arena,
+               struct radix_node *node, u64 prefix, int depth,
                long long int *pos, u32 *nexthop, struct radix_node *en)
 {
     u32 nnh;
     u32 start;
+    int ret;
 
     if ( NULL == node ) {
         start = ((u64)prefix << (64 - depth) >> 32);
@@ -170,51 +249,132 @@ _compile_range(struct dxr *dxr, struct radix_node *node, u64 prefix, int depth,
         } else {
             nnh = NH_NOENTRY;
         }
+        ret = 0;
         if ( nnh != *nexthop ) {
             /* Different nexthop */
             if ( *pos >= 0 ) {
-                _add_range(dxr, *pos, start - 1, *nexthop);
+                ret = _add_range(dxr, arena, *pos, start - 1, *nexthop);
             } else if ( start > 0 ) {
-                _add_range(dxr, 0, start - 1, NH_NOENTRY);
+                ret = _add_range(dxr, arena, 0, start - 1, NH_NOENTRY);
             }
 
             *nexthop = nnh;
             *pos = ((u64)prefix << (64 - depth) >> 32);
         }
-        return;
+        return ret;
     }
 
     if ( node->valid ) {
         en = node;
     }
 
-    _compile_range(dxr, node->left, prefix << 1, depth + 1, pos, nexthop, en);
+    if ( _compile_range(dxr, arena, node->left, prefix << 1, depth + 1, pos,
+                        nexthop, en) < 0 ) {
+        return -1;
+    }
+
+    return _compile_range(dxr, arena, node->right, (prefix << 1) | 1,
+                          depth + 1, pos, nexthop, en);
+}
+
+/*
+ * Release the scratch data of a commit
+ */
+static void
+_release_scratch(struct dxr *dxr, struct kmem_arena *arena)
+{
+    dxr->range.head = NULL;
+    dxr->range.tail = NULL;
+    dxr->nhs = NULL;
+    kmem_arena_release(arena);
+}
+
+/*
+ * Allocate a set of the compiled tables on the NUMA node
+ */
+static struct dxr_tables *
+_tables_new(int node)
+{
+    struct dxr_tables *t;
+
+    t = phys_mem_alloc_pages_node(1, node);
+    if ( NULL == t ) {
+        return NULL;
+    }
+    t->lut = NULL;
+    t->rt = NULL;
+    t->nh = NULL;
+
+    return t;
+}
 
-    _compile_range(dxr, node->right, (prefix << 1) | 1, depth + 1, pos,
-                   nexthop, en);
+/*
+ * Free the n sets of the compiled tables
+ */
+static void
+_free_tables(struct dxr_tables **t, int n)
+{
+    int i;
+
+    for ( i = 0; i < n; i++ ) {
+        if ( NULL == t[i] ) {
+            continue;
+        }
+        if ( NULL != t[i]->lut ) {
+            phys_mem_free_pages(t[i]->lut);
+        }
+        if ( NULL != t[i]->rt ) {
+            phys_mem_free_pages(t[i]->rt);
+        }
+        if ( NULL != t[i]->nh ) {
+            kfree(t[i]->nh);
+        }
+        phys_mem_free_pages(t[i]);
+    }
 }
+
+/*
+ * Compile the routes into the tables of every replica; the tables of all the
+ * replicas are built before any of them is replaced, so the replicas are
+ * replaced together or not at all
+ */
 int
 dxr_commit(struct dxr *dxr)
 {
     int i;
+    int k;
+    struct kmem_arena arena;
     struct dxr_range *r;
     struct dxr_next_hop *nh;
     struct dxr_lookup_table_entry *ltes;
+    struct dxr *rep;
+    struct dxr_tables *t[DXR_MAX_NODES];
+    struct dxr_tables *tmp;
+    u64 nhsz;
+    u64 rtsz;
+    u64 lutsz;
     int ridx;
     int full;
     u32 v;
 
+    /* The ranges, the next hops and the lookup table entries are scratch
+       data released at once at the end of the commit */
+    kmem_arena_init(&arena);
     dxr->range.head = NULL;
     dxr->range.tail = NULL;
+    dxr->nhs = NULL;
     long long int pos = -1;
     u32 nexthop = NH_NOENTRY;
-    _compile_range(dxr, dxr->radix, 0, 0, &pos, &nexthop, NULL);
-    if ( pos >= 0 ) {
-        _add_range(dxr, pos, ((u64)1 << 32) - 1, nexthop);
+    if ( _compile_range(dxr, &arena, dxr->radix, 0, 0, &pos, &nexthop,
+                        NULL) < 0 ) {
+        _release_scratch(dxr, &arena);
+        return -1;
     }
-
-    if ( NULL != dxr->lut ) {
-        kfree(dxr->lut);
+    if ( pos >= 0 ) {
+        if ( _add_range(dxr, &arena, pos, ((u64)1 << 32) - 1, nexthop) < 0 ) {
+            _release_scratch(dxr, &arena);
+            return -1;
+        }
     }
 
     /* Indexing */
@@ -226,20 +386,39 @@ dxr_commit(struct dxr *dxr)
         nh = nh->next;
     }
 
-    /* Range */
-    dxr->nh = kmalloc(i * sizeof(u64));
-    if ( NULL == dxr->nh ) {
+    for ( k = 0; k < DXR_MAX_NODES; k++ ) {
+        t[k] = NULL;
+    }
+
+    /* Range; the tables of the first replica are built on node 0 */
+    t[0] = _tables_new(0);
+    if ( NULL == t[0] ) {
+        _release_scratch(dxr, &arena);
+        return -1;
+    }
+    nhsz = i * sizeof(u64);
+    t[0]->nh = phys_mem_alloc_pages_node(nhsz / PAGESIZE + 1, 0);
+    if ( NULL == t[0]->nh ) {
+        _free_tables(t, DXR_MAX_NODES);
+        _release_scratch(dxr, &arena);
         return -1;
     }
     i = 0;
     nh = dxr->nhs;
     while ( nh ) {
-        dxr->nh[i++] = nh->addr;
+        t[0]->nh[i++] = nh->addr;
         nh = nh->next;
     }
 
 
-    ltes = kmalloc(sizeof(struct dxr_lookup_table_entry) * (1 << DXR_X));
+    ltes = kmem_arena_alloc(&arena,
+                            sizeof(struct dxr_lookup_table_entry)
+                            * (1 << DXR_X));
+    if ( NULL == ltes ) {
+        _free_tables(t, DXR_MAX_NODES);
+        _release_scratch(dxr, &arena);
+        return -1;
+    }
     for ( i = 0; i < (1 << DXR_X); i++ ) {
         ltes[i].nr = 0;
         /* Prevent short format */
@@ -268,30 +447,31 @@ dxr_commit(struct dxr *dxr)
         }
     }
 
-    /* Range */
-    dxr->rt = kmalloc(ridx);
-    if ( NULL == dxr->rt ) {
-        kfree(dxr->nh);
-        kfree(ltes);
+    /* Range; the tables looked up per packet are backed by huge pages */
+    rtsz = ridx + 4;
+    t[0]->rt = phys_mem_alloc_hugepages_node(rtsz, PHYS_MEM_HUGEPAGE_2M, 0);
+    if ( NULL == t[0]->rt ) {
+        _free_tables(t, DXR_MAX_NODES);
+        _release_scratch(dxr, &arena);
         return -1;
     }
 
     /* Lookup table */
-    dxr->lut = kmalloc(4 * (1 << DXR_X));
-    if ( NULL == dxr->lut ) {
-        kfree(dxr->rt);
-        kfree(dxr->nh);
-        kfree(ltes);
+    lutsz = 4 * (1 << DXR_X);
+    t[0]->lut = phys_mem_alloc_hugepages_node(lutsz, PHYS_MEM_HUGEPAGE_2M, 0);
+    if ( NULL == t[0]->lut ) {
+        _free_tables(t, DXR_MAX_NODES);
+        _release_scratch(dxr, &arena);
         return -1;
     }
     ridx = 0;
     for ( i = 0; i < (1 << DXR_X); i++ ) {
         if ( ltes[i].nr <= 1 ) {
             /* Direct */
-            dxr->lut[i] = 0;
+            t[0]->lut[i] = 0;
         } else {
             /* Long: assuming D16R or D18R */
-            dxr->lut[i] = (ltes[i].nr << 20) | (ridx / 4);
+            t[0]->lut[i] = (ltes[i].nr << 20) | (ridx / 4);
             ridx += (4 * ltes[i].nr);
         }
     }
@@ -304,18 +484,52 @@ dxr_commit(struct dxr *dxr)
         v = r->begin & ((1 << (32 - DXR_X)) - 1);
         if ( ltes[i].nr <= 1 ) {
             /* Direct */
-            dxr->lut[i] = r->nh->idx;
+            t[0]->lut[i] = r->nh->idx;
         } else {
             /* Long: little endian */
-            dxr->rt[ridx++] = v & 0xff;
-            dxr->rt[ridx++] = (v >> 8) & 0xff;
-            dxr->rt[ridx++] = r->nh->idx & 0xff;
-            dxr->rt[ridx++] = (r->nh->idx >> 8) & 0xff;
+            t[0]->rt[ridx++] = v & 0xff;
+            t[0]->rt[ridx++] = (v >> 8) & 0xff;
+            t[0]->rt[ridx++] = r->nh->idx & 0xff;
+            t[0]->rt[ridx++] = (r->nh->idx >> 8) & 0xff;
         }
         r = r->next;
     }
 
-    kfree(ltes);
+    /* Copy the tables to the other replicas on their nodes */
+    for ( k = 1; k < dxr->nreplicas; k++ ) {
+        t[k] = _tables_new(k);
+        if ( NULL == t[k] ) {
+            _free_tables(t, DXR_MAX_NODES);
+            _release_scratch(dxr, &arena);
+            return -1;
+        }
+        t[k]->nh = phys_mem_alloc_pages_node(nhsz / PAGESIZE + 1, k);
+        t[k]->rt = phys_mem_alloc_hugepages_node(rtsz, PHYS_MEM_HUGEPAGE_2M,
+                                                 k);
+        t[k]->lut = phys_mem_alloc_hugepages_node(lutsz, PHYS_MEM_HUGEPAGE_2M,
+                                                  k);
+        if ( NULL == t[k]->nh || NULL == t[k]->rt || NULL == t[k]->lut ) {
+            _free_tables(t, DXR_MAX_NODES);
+            _release_scratch(dxr, &arena);
+            return -1;
+        }
+        kmemcpy(t[k]->nh, t[0]->nh, nhsz);
+        kmemcpy(t[k]->rt, t[0]->rt, rtsz);
+        kmemcpy(t[k]->lut, t[0]->lut, lutsz);
+    }
+
+    /* Publish the tables of each replica with a single store, and free the
+       old ones once no reader can refer to them */
+    for ( k = 0; k < dxr->nreplicas; k++ ) {
+        rep = dxr->replicas[k];
+        tmp = rep->tables;
+        rep->tables = t[k];
+        t[k] = tmp;
+    }
+    processor_synchronize();
+    _free_tables(t, DXR_MAX_NODES);
+
+    _release_scratch(dxr, &arena);
 
     return 0;
 }
@@ -333,27 +547,30 @@ dxr_lookup(struct dxr *dxr, u32 addr)
     int bl;
     int bh;
     u32 b;
+    struct dxr_tables *t;
 
+    /* The tables are replaced as a whole; refer to the same set throughout */
+    t = dxr->tables;
     idx = (addr >> (32 - DXR_X));
 
-    if ( 0 == (dxr->lut[idx] >> 20) ) {
+    if ( 0 == (t->lut[idx] >> 20) ) {
         /* Direct */
-        return dxr->nh[dxr->lut[idx] & ((1 << 20) - 1)];
+        return t->nh[t->lut[idx] & ((1 << 20) - 1)];
     } else {
         /* Binary search */
-        nr = (dxr->lut[idx] >> 20);
-        ridx = (dxr->lut[idx] & ((1 << 20) - 1));
+        nr = (t->lut[idx] >> 20);
+        ridx = (t->lut[idx] & ((1 << 20) - 1));
         bl = 0;
         bh = nr;
         b = addr & ((1 << (32 - DXR_X)) - 1);
         for ( ;; ) {
             i = (bh - bl) / 2 + bl;
-            if ( b >= (u16)*(u16 *)(dxr->rt + (ridx + i) * 4)
+            if ( b >= (u16)*(u16 *)(t->rt + (ridx + i) * 4)
                  && (i == nr - 1
-                     || b < (u16)*(u16 *)(dxr->rt + (ridx + i + 1) * 4)) ) {
+                     || b < (u16)*(u16 *)(t->rt + (ridx + i + 1) * 4)) ) {
                 /* Match */
-                return dxr->nh[(u16)*(u16 *)(dxr->rt + (ridx + i) * 4 + 2)];
-            } else if ( b <= (u16)*(u16 *)(dxr->rt + (ridx + i) * 4) ) {
+                return t->nh[(u16)*(u16 *)(t->rt + (ridx + i) * 4 + 2)];
+            } else if ( b <= (u16)*(u16 *)(t->rt + (ridx + i) * 4) ) {
                 bh = i;
             } else {
                 bl = i + 1;
@@ -20,6 +20,11 @@ struct dxr *dxr;
 struct sail *sail;
 struct mbt *mbt;
 
+/* Packet buffer pool shared by the network drivers */
+struct mbuf_pool *mbufpool;
+/* Dense header buffer pool for header split */
+struct mbuf_pool *mbufhdrpool;
+
 /*
  * Temporary: Keyboard drivers
  */
@@ -28,6 +33,10 @@ int kbd_read(void);
 
 int irq_handler_table_init(void);
 
+/* Handlers of the vectors allocated to MSI/MSI-X */
+static struct interrupt_handler msi_handler_table[IV_MSI_NUM];
+static volatile int msi_handler_lock;
+
 void kintr_loc_tmr(void);
 
 struct net gnet;
@@ -98,6 +107,19 @@ kmain(void)
 
     net_init(&gnet);
 
+    /* Initialize the packet buffer pool */
+    mbufpool = mbuf_pool_create(MBUF_HEADROOM, MBUF_DATAROOM);
+    if ( NULL == mbufpool ) {
+        kprintf("Error on packet buffer pool initialization\r\n");
+        return;
+    }
+    /* No headroom to keep the headers dense */
+    mbufhdrpool = mbuf_pool_create(0, MBUF_HDRROOM);
+    if ( NULL == mbufhdrpool ) {
+        kprintf("Error on header buffer pool initialization\r\n");
+        return;
+    }
+
     /* Initialize drivers */
     //e1000_init();
     //e1000e_init();
@@ -211,6 +233,11 @@ irq_handler_table_init(void)
         irq_handler_table[i].handler = NULL;
         irq_handler_table[i].user = NULL;
     }
+    for ( i = 0; i < IV_MSI_NUM; i++ ) {
+        msi_handler_table[i].handler = NULL;
+        msi_handler_table[i].user = NULL;
+    }
+    msi_handler_lock = 0;
 
     return 0;
 }
@@ -243,6 +270,49 @@ register_irq_handler(int irq, void (*handler)(int, void *), void *user)
     return 0;
 }
 
+/*
+ * Allocate an interrupt vector for MSI/MSI-X, and register the handler
+ * called with the vector; return the vector, or -1 if exhausted
+ */
+int
+alloc_intr_vector(void (*handler)(int, void *), void *user)
+{
+    int i;
+
+    if ( NULL == handler ) {
+        return -1;
+    }
+
+    arch_spin_lock(&msi_handler_lock);
+    for ( i = 0; i < IV_MSI_NUM; i++ ) {
+        if ( NULL == msi_handler_table[i].handler ) {
+            msi_handler_table[i].user = user;
+            msi_handler_table[i].handler = handler;
+            arch_spin_unlock(&msi_handler_lock);
+            return IV_MSI(i);
+        }
+    }
+    arch_spin_unlock(&msi_handler_lock);
+
+    return -1;
+}
+
+/*
+ * Release the interrupt vector allocated by alloc_intr_vector()
+ */
+void
+free_intr_vector(int vec)
+{
+    if ( vec < IV_MSI(0) || vec >= IV_MSI(IV_MSI_NUM) ) {
+        return;
+    }
+
+    arch_spin_lock(&msi_handler_lock);
+    msi_handler_table[vec - IV_MSI(0)].handler = NULL;
+    msi_handler_table[vec - IV_MSI(0)].user = NULL;
+    arch_spin_unlock(&msi_handler_lock);
+}
+
 
 
 /*
@@ -282,6 +352,8 @@ kintr_ipi(void)
 void
 kintr_isr(u64 vec)
 {
+    int irq;
+
     /* FIXME: Separate IRQ from this switch block */
     switch ( vec ) {
     case IV_IRQ(0):
@@ -332,7 +404,23 @@ kintr_isr(u64 vec)
         kintr_ipi();
         break;
     default:
-        ;
+        if ( vec >= IV_MSI(0) && vec < IV_MSI(IV_MSI_NUM) ) {
+            /* MSI/MSI-X */
+            irq = vec - IV_MSI(0);
+            if ( msi_handler_table[irq].handler ) {
+                msi_handler_table[irq].handler(vec,
+                                               msi_handler_table[irq].user);
+            }
+            break;
+        }
+        /* Other IRQs (e.g., PCI devices) */
+        if ( vec > IV_IRQ(0) && vec < IV_IRQ(32) ) {
+            irq = vec - IV_IRQ(0);
+            if ( irq_handler_table[irq].handler ) {
+                irq_handler_table[irq].handler(irq,
+                                               irq_handler_table[irq].user);
+            }
+        }
     }
 }
 
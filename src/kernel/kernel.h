@@ -19,6 +19,8 @@
 #define IV_TASK_EVENT   0x40
 #define IV_LOC_TMR      0x50
 #define IV_IPI          0x51
+#define IV_MSI(n)       (0x60 + (n))    /* Allocated to MSI/MSI-X */
+#define IV_MSI_NUM      64
 #define IV_CRASH        0xfe
 
 #define PAGESIZE        4096
@@ -129,10 +131,17 @@ struct dxr_range {
     /* Temp */
     int idx;
 };
+#define DXR_MAX_NODES   8
 struct dxr_lookup_table_entry {
     int nr;
     int stype;
 };
+/* Compiled tables; replaced as a whole by dxr_commit() */
+struct dxr_tables {
+    u32 *lut;
+    u8 *rt;
+    u64 *nh;
+};
 struct dxr {
     struct {
         struct dxr_range *head;
@@ -141,14 +150,22 @@ struct dxr {
     struct dxr_next_hop *nhs;
 
     /* Compiled */
-    u32 *lut;
-    u8 *rt;
-    u64 *nh;
+    struct dxr_tables * volatile tables;
 
     struct radix_node *radix;
+
+    /* Object cache of the radix nodes */
+    struct kmem_cache *node_cache;
+
+    /* Copies of the compiled tables on each NUMA node; the first one is
+       this structure itself */
+    struct dxr *replicas[DXR_MAX_NODES];
+    int nreplicas;
 };
 #define NH_NOENTRY 0
 struct dxr * dxr_init(void);
+struct dxr * dxr_replica(struct dxr *, int);
+struct dxr * dxr_local(struct dxr *);
 u64 dxr_lookup(struct dxr *, u32);
 int dxr_commit(struct dxr *);
 int dxr_route_add(struct dxr *, u32, int, u32);
@@ -266,6 +283,7 @@ struct sail {
 
     /* Radix trie */
     struct radix_node *radix;
+    struct kmem_cache *node_cache;
 
     /* FIB */
     struct {
@@ -282,6 +300,70 @@ u64 sail_lookup(struct sail *, u32);
 extern struct sail *sail;
 
 
+/*
+ * ACL: the rules are compiled into a decision tree cutting the space of the
+ * fields (HiCuts); a leaf holds a few rules searched in the priority order
+ */
+#define ACL_PERMIT              0
+#define ACL_DENY                1
+#define ACL_MAX_RULES           16384
+/* Fields; ranges and keys are in the host order */
+#define ACL_F_SADDR             0
+#define ACL_F_DADDR             1
+#define ACL_F_SPORT             2
+#define ACL_F_DPORT             3
+#define ACL_F_PROTO             4
+#define ACL_FIELDS              5
+struct acl_rule {
+    u32 lo[ACL_FIELDS];
+    u32 hi[ACL_FIELDS];
+    /* TCP flags matched if (flags & flagmask) == tcpflags */
+    u8 tcpflags;
+    u8 flagmask;
+    u16 action;
+};
+struct acl_key {
+    u32 f[ACL_FIELDS];
+    u8 tcpflags;
+};
+/* Rule list; the first matching rule is taken */
+struct acl {
+    int nr;
+    int sz;
+    struct acl_rule *rules;
+    int defact;
+};
+/* Node of the compiled tree; an inner node cuts the field dim into mask + 1
+   children indexed by (f[dim] >> shift) & mask, and a leaf has n rules */
+#define ACL_LEAF                0xff
+struct acl_node {
+    u8 dim;
+    u8 shift;
+    u16 n;
+    u32 idx;
+};
+struct acl_tree {
+    int defact;
+    int nr;
+    struct acl_rule *rules;
+    struct acl_node *nodes;
+    u32 *children;
+    u32 *leaves;
+    u32 nnodes;
+    u32 nchildren;
+    u32 nleaves;
+    int depth;
+};
+struct acl * acl_init(void);
+int acl_add_rule(struct acl *, const struct acl_rule *);
+void acl_clear(struct acl *);
+struct acl_tree * acl_compile(struct acl *);
+void acl_tree_free(struct acl_tree *);
+int acl_key_ipv4(const u8 *, int, struct acl_key *);
+int acl_classify(struct acl_tree *, const struct acl_key *);
+void acl_classify_bulk(struct acl_tree *, const struct acl_key *, int *, int);
+
+
 
 
 
@@ -494,10 +576,9 @@ struct netsc_papp {
     int len; /* in bytes (must be 2^n) */
     int wrap; /* len - 1 */
 
-    /* Packet buffer */
+    /* Packet buffer (mbuf; udata holds the index) */
     struct {
-        u64 base; /* Buffer exposed to the user context */
-        int sz;
+        int sz; /* Buffer exposed to the user context */
     } pkt;
     /* Header buffer */
     struct {
@@ -514,18 +595,257 @@ struct netsc_papp {
     } ring;
 };
 
+/*
+ * Packet buffer (mbuf)
+ *   Each element is laid out as [struct mbuf | headroom | dataroom] in a
+ *   contiguous chunk, so that the DMA address of a buffer can be mapped back
+ *   to its metadata.
+ */
+#define MBUF_HEADROOM           128
+#define MBUF_DATAROOM           4096
+#define MBUF_HDRROOM            256     /* Header buffers for header split */
+#define MBUF_POOL_CHUNK         8192    /* # of buffers per chunk */
+#define MBUF_POOL_MAX_CHUNKS    16
+#define MBUF_CACHE_SIZE         512
+#define MBUF_CACHE_BULK         64
+
+/* Offload flags; for the TX L4 checksum offload, the checksum field must hold
+   the pseudo-header sum (excluding the length for TSO) with l2len/l3len/l4len
+   (and mss for TSO) set.  MBUF_OL_RX_VLAN means the 802.1Q tag was stripped
+   to vlan, and MBUF_OL_TX_VLAN inserts vlan on egress. */
+#define MBUF_OL_RX_IP_CKSUM_GOOD        (1<<0)
+#define MBUF_OL_RX_L4_CKSUM_GOOD        (1<<1)
+#define MBUF_OL_RX_CKSUM_BAD            (1<<2)
+#define MBUF_OL_RX_VLAN                 (1<<3)
+#define MBUF_OL_RX_RSS_HASH             (1<<4)
+#define MBUF_OL_TX_IP_CKSUM             (1<<8)
+#define MBUF_OL_TX_TCP_CKSUM            (1<<9)
+#define MBUF_OL_TX_UDP_CKSUM            (1<<10)
+#define MBUF_OL_TX_TSO                  (1<<11)
+#define MBUF_OL_TX_VLAN                 (1<<12)
+
+struct mbuf_pool;
+struct mbuf {
+    /* Owner */
+    struct mbuf_pool *pool;
+    /* Next segment */
+    struct mbuf *next;
+    /* Data offset from the head of the buffer */
+    u16 off;
+    /* Data length of this segment */
+    u16 len;
+    /* Packet length (sum of all segments) */
+    u32 pktlen;
+    /* Input/output port */
+    u16 port;
+    /* VLAN tag (TCI) */
+    u16 vlan;
+    /* RSS hash */
+    u32 rss;
+    /* Offload flags */
+    u32 ol_flags;
+    /* Header lengths for offloading */
+    u8 l2len;
+    u8 l3len;
+    u8 l4len;
+    u8 rsvd;
+    u16 mss;
+    /* Opaque data for the owner (e.g., PAPP) */
+    u64 udata;
+} __attribute__ ((aligned(64)));
+
+#define MBUF_BUF(m)             ((u8 *)(m) + sizeof(struct mbuf))
+#define MBUF_DATA(m)            (MBUF_BUF(m) + (m)->off)
+#define MBUF_ADDR(m)            ((u64)MBUF_DATA(m))
+#define MBUF_HEADROOM_LEN(m)    ((m)->off)
+#define MBUF_TAILROOM_LEN(m)    \
+    ((m)->pool->bufsz - (m)->off - (m)->len)
+
+/* Per-processor cache */
+struct mbuf_cache {
+    int len;
+    struct mbuf *objs[MBUF_CACHE_SIZE];
+} __attribute__ ((aligned(64)));
+
+struct mbuf_pool {
+    /* Element size and buffer size (headroom + dataroom) */
+    u64 eltsz;
+    u32 bufsz;
+    u32 headroom;
+    /* Chunks of contiguous memory */
+    int nchunks;
+    u64 chunks[MBUF_POOL_MAX_CHUNKS];
+    /* The number of buffers */
+    u32 nr;
+    /* Shared free stack */
+    volatile int lock;
+    u32 nfree;
+    struct mbuf **stack;
+    /* Per-processor caches */
+    int ncaches;
+    struct mbuf_cache *caches;
+};
+struct mbuf_pool * mbuf_pool_create(u32, u32);
+struct mbuf * mbuf_alloc(struct mbuf_pool *);
+int mbuf_alloc_bulk(struct mbuf_pool *, struct mbuf **, int);
+void mbuf_free(struct mbuf *);
+void mbuf_free_bulk(struct mbuf **, int);
+struct mbuf * mbuf_from_addr(struct mbuf_pool *, u64);
+u8 * mbuf_prepend(struct mbuf *, int);
+u8 * mbuf_adj(struct mbuf *, int);
+extern struct mbuf_pool *mbufpool;
+extern struct mbuf_pool *mbufhdrpool;
+
 /* DRIVER */
 #define NETDEV_MAX_NAME 32
+#define NETDEV_RXQ_ANY  0xff    /* RX queue not assigned */
+/* Offload capabilities */
+#define NETDEV_OFFLOAD_IP_CKSUM         (1<<0)
+#define NETDEV_OFFLOAD_TCP_CKSUM        (1<<1)
+#define NETDEV_OFFLOAD_UDP_CKSUM        (1<<2)
+#define NETDEV_OFFLOAD_TSO              (1<<3)
+#define NETDEV_OFFLOAD_VLAN_STRIP       (1<<4)
+#define NETDEV_OFFLOAD_VLAN_INSERT      (1<<5)
+/* Queue filters */
+#define NETDEV_FILTER_ETYPE     1
+#define NETDEV_FILTER_5TUPLE    2
+/* Fields compared by a 5-tuple filter */
+#define NETDEV_FILTER_SADDR     (1<<0)
+#define NETDEV_FILTER_DADDR     (1<<1)
+#define NETDEV_FILTER_SPORT     (1<<2)
+#define NETDEV_FILTER_DPORT     (1<<3)
+#define NETDEV_FILTER_PROTO     (1<<4)
+struct netdev_filter {
+    int type;
+    u32 fields;
+    u16 etype;
+    u8 proto;
+    /* In network byte order */
+    u32 saddr;
+    u32 daddr;
+    u16 sport;
+    u16 dport;
+    /* Destination RX queue */
+    int q;
+};
+/* RX modes; see netdev_rx_idle() */
+#define NETDEV_RXMODE_POLL      0       /* Busy polling */
+#define NETDEV_RXMODE_HYBRID    1       /* Sleep on the interrupt when idle */
+#define NETDEV_MAX_RXQ          16      /* RX queues able to sleep */
+/* State of an RX queue */
+#define NETDEV_RXQ_POLLING      0
+#define NETDEV_RXQ_SLEEPING     1
+struct netdev_rxq_stat {
+    volatile int state;
+    /* Set while the interrupt is armed for the processor (APIC ID) */
+    volatile int armed;
+    int cpu;
+    /* Consecutive empty polls, average burst size (x16), and the
+       interrupt throttling interval in microseconds */
+    u32 idle;
+    u32 burst;
+    u32 itr;
+    /* Counters */
+    u64 polls;
+    u64 empty;
+    u64 pkts;
+    u64 intrs;
+    u64 sleeps;
+    u64 timeouts;
+    /* Interrupt to wakeup latency in nanoseconds */
+    volatile u64 intr_at;
+    u64 lat_sum;
+    u64 lat_max;
+} __attribute__ ((aligned (64)));
+/* Datapath counters (index of netdev_stats.c) */
+#define NETDEV_STAT_RX_PKTS     0
+#define NETDEV_STAT_RX_BYTES    1
+#define NETDEV_STAT_TX_PKTS     2
+#define NETDEV_STAT_TX_BYTES    3
+#define NETDEV_STAT_DROP_FILTER 4       /* Dropped by the MAC/VLAN filter */
+#define NETDEV_STAT_DROP_ACL    5       /* Denied by the ACL */
+#define NETDEV_STAT_DROP_NOROUTE 6      /* No route/neighbor */
+#define NETDEV_STAT_DROP_TXFULL 7       /* Dropped on the TX ring full */
+#define NETDEV_STAT_DROP_ERROR  8       /* Malformed, checksum error, TTL */
+#define NETDEV_STAT_LOOKUP_MISS 9       /* FDB/FIB lookup misses */
+#define NETDEV_STAT_TXFULL      10      /* TX ring full events */
+#define NETDEV_STAT_NOBUF       11      /* RX refill failures */
+#define NETDEV_STAT_RX_DOORBELL 12      /* RX tail register writes */
+#define NETDEV_STAT_TX_DOORBELL 13      /* TX tail register writes */
+#define NETDEV_STAT_NUM         14
+/* Counters of one processor; only written by the processor, and padded to
+   the cache line not to be shared with another */
+struct netdev_stats {
+    u64 c[NETDEV_STAT_NUM];
+} __attribute__ ((aligned (64)));
+/* Counters maintained by the hardware */
+#define NETDEV_HWSTAT_MAXQ      16
+struct netdev_hwstats {
+    u64 rx_pkts;
+    u64 rx_bytes;
+    u64 tx_pkts;
+    u64 tx_bytes;
+    u64 rx_missed;
+    u64 rx_crcerrs;
+    /* Per queue packets; nq queues are valid */
+    int nq;
+    u64 rxq_pkts[NETDEV_HWSTAT_MAXQ];
+    u64 txq_pkts[NETDEV_HWSTAT_MAXQ];
+};
 struct netdev {
     char name[NETDEV_MAX_NAME];
     u8 macaddr[6];
 
     void *vendor;
 
+    /* Offload capabilities (NETDEV_OFFLOAD_*) supported by tx_burst */
+    u32 offload;
+
+    /* Number of RX/TX queues, and the RX queue polled by each processor
+       (APIC ID); see netdev_rxq() */
+    int nrxq;
+    int ntxq;
+    u8 rxqmap[MAX_PROCESSORS];
+    /* RX queue for the control traffic (-1 if none); excluded from the
+       queues distributed over the processors */
+    int ctrlq;
+
     /* for per packet processing */
     int (*sendpkt)(const u8 *pkt, u32 len, struct netdev *netdev);
     int (*recvpkt)(u8 *pkt, u32 len, struct netdev *netdev);
 
+    /* for burst processing (zero copy); return the number of packets
+       received/queued to the queue q */
+    int (*rx_burst)(struct netdev *netdev, int q, struct mbuf **mbufs, int n);
+    int (*tx_burst)(struct netdev *netdev, int q, struct mbuf **mbufs, int n);
+
+    /* Header split; the headers of a received packet are placed in a
+       segment from mbufhdrpool followed by the payload segment */
+    int (*rx_hsplit)(struct netdev *netdev, int on);
+
+    /* Slow-path processing such as admin command completions and link
+       events; called periodically from a control core, not the datapath */
+    int (*poll_ctrl)(struct netdev *netdev);
+
+    /* Steer the packets matching the filter to an RX queue; filter_add
+       returns the filter ID to be passed to filter_del */
+    int (*filter_add)(struct netdev *netdev, const struct netdev_filter *f);
+    int (*filter_del)(struct netdev *netdev, int id);
+
+    /* RX interrupt of the queue q; rx_intr enables (on) or disables it, and
+       rx_itr sets the minimum interval between interrupts.  The driver calls
+       netdev_rx_intr() from the interrupt handler. */
+    int (*rx_intr)(struct netdev *netdev, int q, int on);
+    int (*rx_itr)(struct netdev *netdev, int q, int usec);
+    int rxmode;
+    struct netdev_rxq_stat rxqstat[NETDEV_MAX_RXQ];
+
+    /* Per-processor datapath counters indexed by processors->map[]; see
+       netdev_stats() */
+    struct netdev_stats *stats;
+    /* Read the hardware counters accumulated since the initialization */
+    int (*hwstats)(struct netdev *netdev, struct netdev_hwstats *hw);
+
     /* Stack chain */
     int (*papp)(void);
 
@@ -557,15 +877,49 @@ struct net_rib4 {
 struct net_fdb_entry {
     int type;
     u64 macaddr; /* Stored in the network order */
+    u16 vid;
+    /* Last time the address was seen (for NET_FDB_PORT_DYNAMIC) */
+    u64 atime;
     union {
         struct net_port *port;
         struct net_ipif *ipif;
         struct net_stack_chain_next *sc;
     } u;
 };
+/* Bucketized cuckoo hash; an entry is placed in one of the two buckets of
+   (macaddr, vid).  Lookups are lock-free and retried when ver has changed
+   (odd while an entry is being moved). */
+#define NET_FDB_WAYS            4
+#define NET_FDB_AGING           300     /* in seconds */
 struct net_fdb {
     int nr;
     struct net_fdb_entry *entries;
+    /* The number of buckets (power of 2); nr = nbuckets * NET_FDB_WAYS */
+    u32 nbuckets;
+    volatile u32 ver;
+    volatile int lock;
+    /* Aging time in nanoseconds and the sweep position */
+    u64 aging;
+    u32 sweep;
+};
+
+/* Bridge */
+#define NET_BRIDGE_MAX_PORTS    64
+#define NET_VLAN_NUM            4096
+struct net_bridge {
+    struct net_fdb fdb;
+    int nports;
+    struct net_port *ports[NET_BRIDGE_MAX_PORTS];
+    /* Bitmaps of the member ports of each VLAN and of the ports sending the
+       VLAN untagged; the frames are flooded to the members */
+    u64 members[NET_VLAN_NUM];
+    u64 untagged[NET_VLAN_NUM];
+    /* Ingress ACL (NULL for none) */
+    struct acl_tree * volatile acl;
+    /* Processors running net_bridge_forward(), and the lock of the queue
+       assignment to them */
+    u8 cpus[MAX_PROCESSORS];
+    volatile int lock;
 };
 
 
@@ -652,6 +1006,9 @@ struct net_port {
 
     /* VLAN bridges */
     struct net_bridge *bridges[4096];
+    /* Index in the bridge and the VLAN of untagged frames (0 to drop) */
+    int id;
+    u16 pvid;
 };
 
 
@@ -894,14 +1251,66 @@ struct interrupt_handler irq_handler_table[IRQ_MAX+1];
 #define PROCESSOR_BSP 1
 #define PROCESSOR_AP_TICKFULL 2
 #define PROCESSOR_AP_TICKLESS 3
+/* Per-processor cache of single pages in front of the page allocator; the
+   pages freed are pushed to the hot end and those refilled from the
+   allocator to the cold end, from which the cache is drained */
+#define PROCESSOR_PAGE_CACHE_SIZE       64      /* Power of 2 */
+#define PROCESSOR_PAGE_CACHE_BATCH      16
+struct processor_page_cache {
+    void *pages[PROCESSOR_PAGE_CACHE_SIZE];
+    /* Ring; the hot end is pages[head - 1] */
+    u32 head;
+    u32 n;
+    /* Counters */
+    u64 hits;
+    u64 refills;
+    u64 drains;
+} __attribute__ ((aligned (64)));
 struct processor {
     /* Processor ID */
     u8 id;
     /* Processor type */
     u8 type;
+    /* NUMA node */
+    int node;
     /* Idle task */
     struct ktask *idle;
+    /* Page cache; only accessed by this processor */
+    struct processor_page_cache pgcache;
 };
+/*
+ * Per-processor data area; one block per processor, aligned to the cache
+ * line and addressed with the GS base so that the hot state of a processor
+ * is reached without reading its APIC ID and never shares a line with that
+ * of another processor
+ */
+struct percpu {
+    /* This block itself, at %gs:0 */
+    struct percpu *self;
+    /* Local APIC ID, and the index in the processor table */
+    int cpu;
+    int idx;
+    /* NUMA node */
+    int node;
+    /* Processor structure */
+    struct processor *processor;
+    /* Architecture-specific data of this processor (current task) */
+    void *arch;
+    /* Object magazines of kmalloc() */
+    struct kmem_cpu_cache *kmem;
+    /* State of the pseudo random number generator (xorshift) */
+    u32 rand;
+    /* Counter of the false sharing benchmark */
+    volatile u64 bench;
+    /* Set if this processor reads the shared forwarding data (FIB, ACL),
+       and the count of its quiescent states; see processor_quiescent() */
+    volatile int qs_reader;
+    volatile u64 qs;
+} __attribute__ ((aligned (64)));
+#define PERCPU_THIS()   ({ struct percpu *__pc;                         \
+            __asm__ __volatile__ ("movq %%gs:0,%0" : "=r"(__pc));       \
+            __pc; })
+#define PERCPU(f)       (PERCPU_THIS()->f)
 struct processor_table {
     int n;
     struct processor *prs;
@@ -927,32 +1336,105 @@ struct kmem_slab_obj {
  *    object 0
  *    object 1
  *    ...
+ * The free objects are linked through their first word from the free
+ * pointer of the header
  */
+#define KMEM_NCLASS             6
+struct kmem_cache;
 struct kmem_slab {
     struct kmem_slab *next;
+    struct kmem_slab *prev;
+    /* Object cache owning the slab, or NULL for kmalloc() */
+    struct kmem_cache *cache;
+    /* Size class; the objects are of (32 << cls) bytes */
+    int cls;
+    int size;
+    int npg;
     int nr;
     int nused;
-    int free;
+    void *free;
     void *obj_head;
-    /* Free pointer follows (nr byte) */
-    u8 marks[1];
     /* Objects follows */
-} __attribute__ ((packed));
-
-
+};
 
 struct kmem_slab_free_list {
     struct kmem_slab *partial;
     struct kmem_slab *full;
     struct kmem_slab *free;
-} __attribute__ ((packed));
+};
+
+/*
+ * Magazines; a stack of objects of a size class cached by a processor, so
+ * that kmalloc()/kfree() do not take the lock but to exchange a whole
+ * magazine with the depot.  A magazine fits in an object of 256 bytes.
+ */
+#define KMEM_MAGAZINE_SIZE      30
+#define KMEM_MAGAZINE_CLS       3
+#define KMEM_DEPOT_MAX          16      /* Full magazines per size class */
+struct kmem_magazine {
+    struct kmem_magazine *next;
+    int n;
+    void *objs[KMEM_MAGAZINE_SIZE];
+};
+struct kmem_depot {
+    struct kmem_magazine *full;
+    struct kmem_magazine *empty;
+    int nfull;
+};
+struct kmem_cpu_cache {
+    /* Loaded and previously loaded magazines of each size class */
+    struct kmem_magazine *loaded[KMEM_NCLASS];
+    struct kmem_magazine *prev[KMEM_NCLASS];
+} __attribute__ ((aligned (64)));
 
 struct kmem_slab_root {
     /* Generic slabs */
     struct kmem_slab_free_list gslabs[8];
+    /* Depot of magazines */
+    struct kmem_depot depot[KMEM_NCLASS];
+    /* Magazines of each processor; only accessed by the processor */
+    struct kmem_cpu_cache cpu[MAX_PROCESSORS];
     /* Large objects */
     //struct kmem_slab_obj *lobj;
-} __attribute__ ((packed));
+};
+
+/*
+ * Object caches; slabs of objects of an exact size, optionally aligned to
+ * the cache line, for hot fixed-size kernel objects
+ */
+#define KMEM_CACHE_LINE         64
+struct kmem_cache {
+    const char *name;
+    /* Object size including the alignment padding */
+    int size;
+    int align;
+    /* Called on each object allocated */
+    void (*ctor)(void *);
+    struct kmem_slab_free_list slabs;
+    volatile int lock;
+    /* Usage */
+    u64 nused;
+    u64 nslabs;
+    u64 npgs;
+    /* List of the caches */
+    struct kmem_cache *next;
+};
+
+/*
+ * Arena; a bump-pointer allocator of scratch data released at once.  Objects
+ * larger than a quarter of a chunk are given their own chunk.
+ */
+#define KMEM_ARENA_CHUNK        (1024 * 1024)
+#define KMEM_ARENA_ALIGN        16
+struct kmem_arena_chunk {
+    struct kmem_arena_chunk *next;
+    u64 size;
+    u64 used;
+};
+struct kmem_arena {
+    struct kmem_arena_chunk *head;
+    int nchunks;
+};
 
 
 /*
@@ -1001,12 +1483,22 @@ int kmemcmp(const u8 *, const u8 *, int);
 void * kmemcpy(void *, const void *, size_t);
 void * kmemset(void *, int, size_t);
 void kmem_init(void);
+void kmem_magazine_enable(void);
+struct kmem_cache * kmem_cache_create(const char *, int, int, void (*)(void *));
+void * kmem_cache_alloc(struct kmem_cache *);
+void kmem_cache_free(struct kmem_cache *, void *);
+struct kmem_cache * kmem_cache_list(void);
+void kmem_arena_init(struct kmem_arena *);
+void * kmem_arena_alloc(struct kmem_arena *, u64);
+void kmem_arena_release(struct kmem_arena *);
 void * kmalloc(u64);
 void kfree(void *);
 size_t kstrlen(const char *);
 char * kstrdup(const char *);
 
 int register_irq_handler(int, void (*)(int, void *), void *);
+int alloc_intr_vector(void (*)(int, void *), void *);
+void free_intr_vector(int);
 
 /* in task.c */
 int ktask_init(void);
@@ -1025,6 +1517,10 @@ int ktltask_fork_execv(int, int, int (*)(int, char *[]), char **);
 int processor_init(void);
 struct processor * processor_this(void);
 struct processor * processor_get(u8);
+u32 processor_rand(void);
+void processor_qs_register(void);
+void processor_quiescent(void);
+void processor_synchronize(void);
 
 
 /* in shell.c */
@@ -1062,11 +1558,17 @@ int arch_set_next_task_other_cpu(struct ktask *, int);
 struct ktask * arch_get_next_task(void);
 
 int arch_cpu_active(u16);
+int arch_cpu_node(u16);
+struct percpu * arch_percpu(u16);
 
 void arch_scall(u64 nr);
 
 void arch_disable_interrupts(void);
 void arch_enable_interrupts(void);
+u64 arch_intr_save(void);
+void arch_intr_restore(u64);
+int arch_dtlb_miss_start(void);
+u64 arch_dtlb_miss_read(void);
 
 void syscall_setup(void);
 
@@ -1076,9 +1578,19 @@ u64 arch_clock_get(void);
 u64 arch_time(void);
 
 /* Physical memory management */
+#define PHYS_MEM_HUGEPAGE_2M    (2ULL << 20)
+#define PHYS_MEM_HUGEPAGE_1G    (1ULL << 30)
 int phys_mem_wire(void *, u64);
 void * phys_mem_alloc_pages(u64);
 void phys_mem_free_pages(void *);
+void * phys_mem_alloc_hugepages(u64, u64);
+void * phys_mem_alloc_pages_node(u64, int);
+void * phys_mem_alloc_hugepages_node(u64, u64, int);
+int phys_mem_node(const void *);
+int phys_mem_nodes(void);
+void phys_mem_pgcache_enable(void);
+void phys_mem_set_slab(void *, u64, void *);
+void * phys_mem_slab(const void *);
 
 
 /* in system.c */
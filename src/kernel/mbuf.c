@@ -0,0 +1,328 @@
+/*_
+ * Copyright (c) 2014 Hirochika Asai
+ * All rights reserved.
+ *
+ * Authors:
+ *      Hirochika Asai  <asai@jar.jp>
+ */
+
+#include <aos/const.h>
+#include "kernel.h"
+
+extern struct processor_table *processors;
+
+/*
+ * Get the cache of this processor
+ */
+static __inline__ struct mbuf_cache *
+_cache(struct mbuf_pool *pool)
+{
+    return &pool->caches[PERCPU(idx)];
+}
+
+/*
+ * Reset the metadata
+ */
+static __inline__ void
+_reset(struct mbuf *m)
+{
+    m->next = NULL;
+    m->off = m->pool->headroom;
+    m->len = 0;
+    m->pktlen = 0;
+    m->port = 0;
+    m->vlan = 0;
+    m->rss = 0;
+    m->ol_flags = 0;
+    m->l2len = 0;
+    m->l3len = 0;
+    m->l4len = 0;
+    m->mss = 0;
+    m->udata = 0;
+}
+
+/*
+ * Add a chunk of buffers to the pool (the pool lock must be held)
+ *   The chunk is taken from 2 MiB pages so that the buffers touched by the
+ *   processors and the NICs take as few TLB entries as possible.
+ */
+static int
+_grow(struct mbuf_pool *pool)
+{
+    u64 base;
+    struct mbuf *m;
+    int i;
+
+    if ( pool->nchunks >= MBUF_POOL_MAX_CHUNKS ) {
+        return -1;
+    }
+
+    base = (u64)phys_mem_alloc_hugepages(pool->eltsz * MBUF_POOL_CHUNK,
+                                         PHYS_MEM_HUGEPAGE_2M);
+    if ( 0 == base ) {
+        return -1;
+    }
+    pool->chunks[pool->nchunks] = base;
+    pool->nchunks++;
+
+    for ( i = 0; i < MBUF_POOL_CHUNK; i++ ) {
+        m = (struct mbuf *)(base + i * pool->eltsz);
+        m->pool = pool;
+        _reset(m);
+        pool->stack[pool->nfree] = m;
+        pool->nfree++;
+    }
+    pool->nr += MBUF_POOL_CHUNK;
+
+    return 0;
+}
+
+/*
+ * Create a packet buffer pool
+ */
+struct mbuf_pool *
+mbuf_pool_create(u32 headroom, u32 dataroom)
+{
+    struct mbuf_pool *pool;
+    int i;
+
+    pool = kmalloc(sizeof(struct mbuf_pool));
+    if ( NULL == pool ) {
+        return NULL;
+    }
+    pool->headroom = headroom;
+    pool->bufsz = headroom + dataroom;
+    /* Keep every buffer aligned to the cache line */
+    pool->eltsz = (sizeof(struct mbuf) + pool->bufsz + 63) & ~63ULL;
+    pool->nchunks = 0;
+    pool->nr = 0;
+    pool->lock = 0;
+    pool->nfree = 0;
+
+    pool->stack = kmalloc(sizeof(struct mbuf *) * MBUF_POOL_CHUNK
+                          * MBUF_POOL_MAX_CHUNKS);
+    if ( NULL == pool->stack ) {
+        kfree(pool);
+        return NULL;
+    }
+
+    /* Per-processor caches */
+    pool->ncaches = processors->n;
+    pool->caches = kmalloc(sizeof(struct mbuf_cache) * pool->ncaches);
+    if ( NULL == pool->caches ) {
+        kfree(pool->stack);
+        kfree(pool);
+        return NULL;
+    }
+    for ( i = 0; i < pool->ncaches; i++ ) {
+        pool->caches[i].len = 0;
+    }
+
+    /* First chunk */
+    if ( _grow(pool) < 0 ) {
+        kfree(pool->caches);
+        kfree(pool->stack);
+        kfree(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+/*
+ * Allocate n buffers (n <= MBUF_CACHE_BULK) through the cache
+ */
+static int
+_alloc_bulk(struct mbuf_pool *pool, struct mbuf **mbufs, int n)
+{
+    struct mbuf_cache *c;
+    int req;
+    int i;
+
+    c = _cache(pool);
+
+    if ( c->len < n ) {
+        /* Refill the cache from the shared stack */
+        req = n - c->len + MBUF_CACHE_BULK;
+        arch_spin_lock(&pool->lock);
+        while ( pool->nfree < req ) {
+            if ( _grow(pool) < 0 ) {
+                break;
+            }
+        }
+        if ( pool->nfree < req ) {
+            req = pool->nfree;
+        }
+        if ( c->len + req < n ) {
+            /* Exhausted */
+            arch_spin_unlock(&pool->lock);
+            return -1;
+        }
+        for ( i = 0; i < req; i++ ) {
+            pool->nfree--;
+            c->objs[c->len] = pool->stack[pool->nfree];
+            c->len++;
+        }
+        arch_spin_unlock(&pool->lock);
+    }
+
+    for ( i = 0; i < n; i++ ) {
+        c->len--;
+        mbufs[i] = c->objs[c->len];
+        _reset(mbufs[i]);
+    }
+
+    return 0;
+}
+
+/*
+ * Allocate n buffers; all or nothing
+ */
+int
+mbuf_alloc_bulk(struct mbuf_pool *pool, struct mbuf **mbufs, int n)
+{
+    int i;
+    int m;
+
+    for ( i = 0; i < n; i += m ) {
+        m = n - i < MBUF_CACHE_BULK ? n - i : MBUF_CACHE_BULK;
+        if ( _alloc_bulk(pool, mbufs + i, m) < 0 ) {
+            mbuf_free_bulk(mbufs, i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Allocate a buffer
+ */
+struct mbuf *
+mbuf_alloc(struct mbuf_pool *pool)
+{
+    struct mbuf *m;
+
+    if ( _alloc_bulk(pool, &m, 1) < 0 ) {
+        return NULL;
+    }
+
+    return m;
+}
+
+/*
+ * Return a segment to the cache of this processor
+ */
+static __inline__ void
+_free_seg(struct mbuf *m)
+{
+    struct mbuf_pool *pool;
+    struct mbuf_cache *c;
+    int i;
+
+    pool = m->pool;
+    c = _cache(pool);
+
+    if ( c->len >= MBUF_CACHE_SIZE ) {
+        /* Flush the half of the cache to the shared stack */
+        arch_spin_lock(&pool->lock);
+        for ( i = 0; i < MBUF_CACHE_SIZE / 2; i++ ) {
+            c->len--;
+            pool->stack[pool->nfree] = c->objs[c->len];
+            pool->nfree++;
+        }
+        arch_spin_unlock(&pool->lock);
+    }
+    c->objs[c->len] = m;
+    c->len++;
+}
+
+/*
+ * Free a buffer (and the following segments)
+ */
+void
+mbuf_free(struct mbuf *m)
+{
+    struct mbuf *next;
+
+    while ( NULL != m ) {
+        next = m->next;
+        _free_seg(m);
+        m = next;
+    }
+}
+
+/*
+ * Free n buffers
+ */
+void
+mbuf_free_bulk(struct mbuf **mbufs, int n)
+{
+    int i;
+
+    for ( i = 0; i < n; i++ ) {
+        mbuf_free(mbufs[i]);
+    }
+}
+
+/*
+ * Get the buffer from an address in its buffer (e.g., DMA address)
+ */
+struct mbuf *
+mbuf_from_addr(struct mbuf_pool *pool, u64 addr)
+{
+    u64 base;
+    int i;
+
+    for ( i = 0; i < pool->nchunks; i++ ) {
+        base = pool->chunks[i];
+        if ( addr >= base && addr < base + pool->eltsz * MBUF_POOL_CHUNK ) {
+            return (struct mbuf *)(base + ((addr - base) / pool->eltsz)
+                                   * pool->eltsz);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Prepend len bytes to the data using the headroom
+ */
+u8 *
+mbuf_prepend(struct mbuf *m, int len)
+{
+    if ( len > m->off ) {
+        /* No space */
+        return NULL;
+    }
+    m->off -= len;
+    m->len += len;
+    m->pktlen += len;
+
+    return MBUF_DATA(m);
+}
+
+/*
+ * Remove len bytes from the head of the data
+ */
+u8 *
+mbuf_adj(struct mbuf *m, int len)
+{
+    if ( len > m->len ) {
+        return NULL;
+    }
+    m->off += len;
+    m->len -= len;
+    m->pktlen -= len;
+
+    return MBUF_DATA(m);
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
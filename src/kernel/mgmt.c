@@ -18,11 +18,14 @@ int net_sc_rx_ether(struct net *, u8 *, int, void *);
 int net_sc_rx_port_host(struct net *, u8 *, int, void *);
 int net_rib4_add(struct net_rib4 *, const u32, int, u32);
 u32 bswap32(u32);
+int netdev_rx_poll(struct netdev *, int, struct mbuf **, int);
+
+#define MGMT_RX_BURST   32
 
 /*
  * Like inet_pton
  */
-static int
+int
 str2v4addr(const char *s, u32 *addr, int *mask)
 {
     u32 a;
@@ -143,6 +146,10 @@ mgmt_main(int argc, char *argv[])
         kprintf("netdev %s cannot be found\r\n", nic);
         return -1;
     }
+    if ( NULL == netdev->rx_burst || NULL == netdev->tx_burst ) {
+        kprintf("netdev %s does not support burst I/O\r\n", nic);
+        return -1;
+    }
 
     ret = str2v4addr(ipaddr, &ipa, &ipm);
     if ( ret < 0 || ipm < 0 ) {
@@ -198,18 +205,41 @@ mgmt_main(int argc, char *argv[])
 
     u64 tsc0 = rdtsc();
     u64 tsc1;
+    struct mbuf *mbufs[MGMT_RX_BURST];
+    struct mbuf *seg;
+    struct netdev_list *nl;
+    int j;
     for ( ;; ) {
-        n = port.netdev->recvpkt(pkt, gnet.sys_mtu, port.netdev);
-        if ( n <= 0 ) {
-            continue;
+        /* Sleeps on the RX interrupt while idle in the hybrid mode */
+        n = netdev_rx_poll(port.netdev, 0, mbufs, MGMT_RX_BURST);
+        for ( i = 0; i < n; i++ ) {
+            if ( NULL == mbufs[i]->next ) {
+                port.next.func(&gnet, MBUF_DATA(mbufs[i]), mbufs[i]->len,
+                               port.next.data);
+            } else if ( mbufs[i]->pktlen <= gnet.sys_mtu ) {
+                /* Linearize the segments */
+                j = 0;
+                for ( seg = mbufs[i]; NULL != seg; seg = seg->next ) {
+                    kmemcpy(pkt + j, MBUF_DATA(seg), seg->len);
+                    j += seg->len;
+                }
+                port.next.func(&gnet, pkt, j, port.next.data);
+            }
+            mbuf_free(mbufs[i]);
         }
-        port.next.func(&gnet, pkt, n, port.next.data);
 
         /* Trigger for TCP transmission */
         tsc1 = rdtsc();
         if ( tsc1 - tsc0 > 3000 * 1000 * 100 /* ~100ms FIXME */ ) {
             net_tcp_trigger(&gnet);
             tsc0 = tsc1;
+
+            /* Slow-path processing of the devices */
+            for ( nl = netdev_head; NULL != nl; nl = nl->next ) {
+                if ( NULL != nl->netdev->poll_ctrl ) {
+                    nl->netdev->poll_ctrl(nl->netdev);
+                }
+            }
         }
     }
 
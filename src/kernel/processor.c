@@ -13,6 +13,8 @@
 struct processor_table *processors;
 
 int this_cpu(void);
+void mfence(void);
+void pause(void);
 
 /*
  * Initialize the processor table
@@ -20,6 +22,7 @@ int this_cpu(void);
 int
 processor_init(void)
 {
+    struct percpu *pc;
     int i;
     int npr;
 
@@ -41,17 +44,32 @@ processor_init(void)
                 return -1;
             }
             processors->prs[npr].id = i;
+            processors->prs[npr].node = arch_cpu_node(i);
             if ( i == 0 ) {
                 processors->prs[npr].type = PROCESSOR_BSP;
             } else {
                 processors->prs[npr].type = PROCESSOR_AP_TICKLESS;
             }
             processors->map[i] = npr;
+            kmemset(&processors->prs[npr].pgcache, 0,
+                    sizeof(struct processor_page_cache));
+
+            /* Per-processor data area */
+            pc = arch_percpu(i);
+            pc->idx = npr;
+            pc->node = processors->prs[npr].node;
+            pc->processor = &processors->prs[npr];
+            pc->rand = ((u32)arch_clock_get() ^ (npr * 0x9e3779b9U)) | 1;
 
             npr++;
         }
     }
 
+    /* Single pages and small objects are allocated through the caches of
+       each processor */
+    phys_mem_pgcache_enable();
+    kmem_magazine_enable();
+
     return 0;
 }
 
@@ -61,7 +79,7 @@ processor_init(void)
 struct processor *
 processor_this(void)
 {
-    return &processors->prs[processors->map[this_cpu()]];
+    return PERCPU(processor);
 }
 
 /*
@@ -73,6 +91,79 @@ processor_get(u8 id)
     return &processors->prs[processors->map[id]];
 }
 
+/*
+ * Get a pseudo random number from the generator of this processor; not for
+ * cryptographic use
+ */
+u32
+processor_rand(void)
+{
+    struct percpu *pc;
+    u32 x;
+
+    pc = PERCPU_THIS();
+    x = pc->rand;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pc->rand = x;
+
+    return x;
+}
+
+/*
+ * Register this processor as a reader of the data shared with the forwarders
+ * (e.g., the FIB and the ACL); it must call processor_quiescent() whenever it
+ * holds no reference to them.  The registration is cleared when the processor
+ * switches to its idle task, e.g., by the stop command.
+ */
+void
+processor_qs_register(void)
+{
+    PERCPU(qs_reader) = 1;
+    /* Visible before the first reference */
+    mfence();
+}
+
+/*
+ * Report a quiescent state of this processor, i.e., no reference held
+ */
+void
+processor_quiescent(void)
+{
+    PERCPU(qs)++;
+}
+
+/*
+ * Wait until every reader other than this processor has passed a quiescent
+ * state, after which the data replaced before the call are not referred and
+ * can be freed
+ */
+void
+processor_synchronize(void)
+{
+    struct percpu *pc;
+    u64 qs[MAX_PROCESSORS];
+    int i;
+
+    /* Make the replacement visible before taking the counters */
+    mfence();
+    for ( i = 0; i < processors->n; i++ ) {
+        qs[i] = arch_percpu(processors->prs[i].id)->qs;
+    }
+    for ( i = 0; i < processors->n; i++ ) {
+        pc = arch_percpu(processors->prs[i].id);
+        if ( pc == PERCPU_THIS() ) {
+            continue;
+        }
+        /* A reader stopped while waiting leaves the flag cleared by its idle
+           task */
+        while ( pc->qs_reader && pc->qs == qs[i] ) {
+            pause();
+        }
+    }
+}
+
 /*
  * Local variables:
  * tab-width: 4
@@ -1270,8 +1270,8 @@ _rx_ipv4_to_self(struct l3if *l3if, const u8 *pkt, u32 len, int vlan)
             txpkt[15] = 0x00;
             txpkt[16] = (ip_hdrlen + p_len) >> 8;
             txpkt[17] = (ip_hdrlen + p_len) & 0xff;
-            txpkt[18] = rng_random();
-            txpkt[19] = rng_random();
+            txpkt[18] = processor_rand();
+            txpkt[19] = processor_rand();
             txpkt[20] = 0;
             txpkt[21] = 0;
             txpkt[22] = 64;
@@ -1380,8 +1380,8 @@ _rx_ipv4_routing(struct l3if *l3if, const u8 *pkt, u32 len, int vlan)
         txpkt[15] = 0x00;
         txpkt[16] = (ip_hdrlen + ip_hdrlen + p_len2 + 8) >> 8;
         txpkt[17] = (ip_hdrlen + ip_hdrlen + p_len2 + 8) & 0xff;
-        txpkt[18] = rng_random();
-        txpkt[19] = rng_random();
+        txpkt[18] = processor_rand();
+        txpkt[19] = processor_rand();
         txpkt[20] = 0;
         txpkt[21] = 0;
         txpkt[22] = 64;
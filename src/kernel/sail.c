@@ -17,7 +17,8 @@ sail_init(void)
 
     sail = kmalloc(sizeof(struct sail));
 
-    bcn16 = kmalloc(sizeof(u16) * (1 << 16));
+    bcn16 = phys_mem_alloc_hugepages(sizeof(u16) * (1 << 16),
+                                     PHYS_MEM_HUGEPAGE_2M);
     if ( NULL == bcn16 ) {
         return NULL;
     }
@@ -27,6 +28,12 @@ sail_init(void)
     }
 
     sail->radix = NULL;
+    sail->node_cache = kmem_cache_create("sail_node",
+                                         sizeof(struct radix_node),
+                                         KMEM_CACHE_LINE, NULL);
+    if ( NULL == sail->node_cache ) {
+        return NULL;
+    }
     sail->bcn16 = bcn16;
     sail->bn24 = NULL;
     sail->c24 = NULL;
@@ -46,7 +53,7 @@ _rt_route_add(struct sail *sail, struct radix_node **node,
               int depth)
 {
     if ( NULL == *node ) {
-        *node = kmalloc(sizeof(struct radix_node));
+        *node = kmem_cache_alloc(sail->node_cache);
         if ( NULL == *node ) {
             /* Memory error */
             return -1;
@@ -180,23 +187,41 @@ _getnh(struct radix_node *node, u32 prefix, int depth, int len,
     }
 }
 
+/*
+ * Free the tables being built
+ */
+static void
+_free_tables(u16 *bcn16, u16 *bn24, u16 *c24, u16 *n32)
+{
+    if ( bcn16 ) {
+        phys_mem_free_pages(bcn16);
+    }
+    if ( bn24 ) {
+        phys_mem_free_pages(bn24);
+    }
+    if ( c24 ) {
+        phys_mem_free_pages(c24);
+    }
+    if ( n32 ) {
+        phys_mem_free_pages(n32);
+    }
+}
+
 int
 sail_commit(struct sail *sail)
 {
-    u8 *b[25];
-    u16 *n[25];
+    struct kmem_arena arena;
     int i;
 
-    for ( i = 0; i < 25; i++ ) {
-        b[i] = kmalloc(((1<<i) + 7) / 8);
-        kmemset(b[i], 0, ((1<<i) + 7) / 8);
-        n[i] = kmalloc(sizeof(u16) * (1<<i));
-        kmemset(n[i], 0, sizeof(u16) * (1<<i));
+    /* The bitmaps are scratch data released at once at the end */
+    kmem_arena_init(&arena);
+    u8 *b16 = kmem_arena_alloc(&arena, ((1<<16) + 7) / 8);
+    u8 *b24 = kmem_arena_alloc(&arena, ((1<<24) + 7) / 8);
+    if ( NULL == b16 || NULL == b24 ) {
+        kmem_arena_release(&arena);
+        return -1;
     }
-
-    u8 *b16 = kmalloc(((1<<16) + 7) / 8);
     kmemset(b16, 0, ((1<<16) + 7) / 8);
-    u8 *b24 = kmalloc(((1<<24) + 7) / 8);
     kmemset(b24, 0, ((1<<24) + 7) / 8);
 
     /* Mark b16 and b24, which have children */
@@ -218,11 +243,21 @@ sail_commit(struct sail *sail)
         }
     }
 
-    u16 *bcn16 = kmalloc(sizeof(u16) * (1<<16));
-    u16 *bn24 = kmalloc(sizeof(u16) * 256 * cnt24);
-    u16 *c24 = kmalloc(sizeof(u16) * (1<<24));
-    u16 *n32 = kmalloc(sizeof(u16) * 256 * cnt32);
+    /* The tables looked up per packet are backed by huge pages */
+    u16 *bcn16 = phys_mem_alloc_hugepages(sizeof(u16) * (1<<16),
+                                          PHYS_MEM_HUGEPAGE_2M);
+    u16 *bn24 = phys_mem_alloc_hugepages(sizeof(u16) * 256 * (cnt24 + 1),
+                                         PHYS_MEM_HUGEPAGE_2M);
+    u16 *c24 = phys_mem_alloc_hugepages(sizeof(u16) * (1<<24),
+                                        PHYS_MEM_HUGEPAGE_2M);
+    u16 *n32 = phys_mem_alloc_hugepages(sizeof(u16) * 256 * (cnt32 + 1),
+                                        PHYS_MEM_HUGEPAGE_2M);
     u16 nh;
+    if ( NULL == bcn16 || NULL == bn24 || NULL == c24 || NULL == n32 ) {
+        _free_tables(bcn16, bn24, c24, n32);
+        kmem_arena_release(&arena);
+        return -1;
+    }
 
     int a;
     int j;
@@ -254,6 +289,8 @@ sail_commit(struct sail *sail)
             bn24[tmp + (i & 0xff)] = 0;
             c24[i] = a + 1;
             if ( 0 != (bcn16[i >> 8] & 1) ) {
+                _free_tables(bcn16, bn24, c24, n32);
+                kmem_arena_release(&arena);
                 return -1;
             }
             for ( j = 0; j < 256; j++ ) {
@@ -272,25 +309,9 @@ sail_commit(struct sail *sail)
         }
     }
 
-    for ( i = 0; i < 25; i++ ) {
-        kfree(b[i]);
-        kfree(n[i]);
-    }
-    kfree(b16);
-    kfree(b24);
+    kmem_arena_release(&arena);
 
-    if ( sail->bcn16 ) {
-        kfree(sail->bcn16);
-    }
-    if ( sail->bn24 ) {
-        kfree(sail->bn24);
-    }
-    if ( sail->c24 ) {
-        kfree(sail->c24);
-    }
-    if ( sail->n32 ) {
-        kfree(sail->n32);
-    }
+    _free_tables(sail->bcn16, sail->bn24, sail->c24, sail->n32);
 
     sail->bcn16 = bcn16;
     sail->bn24 = bn24;
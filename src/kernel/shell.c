@@ -10,6 +10,7 @@
 #include <aos/const.h>
 #include "kernel.h"
 #include "../drivers/pci/pci.h"
+#include "../drivers/net/bridge.h"
 
 #define CMDBUF_SIZE 4096
 #define ARGS_MAX 128
@@ -19,12 +20,22 @@ volatile static u64 globaldata;
 
 extern struct ktask_table *ktasks;
 extern struct ktltask_table *ktltasks;
+extern struct processor_table *processors;
+void netdev_stats_read(struct netdev *, struct netdev_stats *);
 
 extern struct net gnet;
 
 static struct tcp_session *saved_sess;
 static int last_status;
 
+/* L2 bridge; created by "set bridge" */
+#define BRIDGE_FDB_BUCKETS  4096
+static struct net_bridge *bridge;
+
+/* ACL edited by "acl" and the tree compiled from it */
+static struct acl *acl;
+static struct acl_tree *acltree;
+
 void lapic_send_ns_fixed_ipi(u8, u8);
 
 /*
@@ -150,6 +161,89 @@ _builtin_uptime(char *const argv[])
     return 0;
 }
 
+/*
+ * Find a network device by name
+ */
+static struct netdev *
+_netdev_lookup(const char *name)
+{
+    struct netdev_list *list;
+
+    list = netdev_head;
+    while ( NULL != list ) {
+        if ( 0 == kstrcmp(name, list->netdev->name) ) {
+            return list->netdev;
+        }
+        list = list->next;
+    }
+
+    return NULL;
+}
+
+/*
+ * Print the datapath counters of the device aggregated over the processors,
+ * then the per-processor packets and the hardware counters if detail is set
+ */
+static void
+_netdev_show_stats(struct netdev *netdev, int detail)
+{
+    static const char *names[NETDEV_STAT_NUM] = {
+        "rx packets:     ", "rx bytes:       ", "tx packets:     ",
+        "tx bytes:       ", "drop (filter):  ", "drop (acl):     ",
+        "drop (no route):", "drop (tx full): ", "drop (error):   ",
+        "lookup misses:  ", "tx full events: ", "rx no buffers:  ",
+        "rx doorbells:   ", "tx doorbells:   ",
+    };
+    struct netdev_stats sum;
+    struct netdev_hwstats hw;
+    u64 drops;
+    int i;
+    int j;
+
+    netdev_stats_read(netdev, &sum);
+    drops = 0;
+    for ( i = NETDEV_STAT_DROP_FILTER; i <= NETDEV_STAT_DROP_ERROR; i++ ) {
+        drops += sum.c[i];
+    }
+    if ( !detail ) {
+        kprintf("   rx: %llu packets %llu bytes, tx: %llu packets %llu bytes,"
+                " drops %llu\r\n", sum.c[NETDEV_STAT_RX_PKTS],
+                sum.c[NETDEV_STAT_RX_BYTES], sum.c[NETDEV_STAT_TX_PKTS],
+                sum.c[NETDEV_STAT_TX_BYTES], drops);
+        return;
+    }
+
+    kprintf(" %s\r\n", netdev->name);
+    for ( i = 0; i < NETDEV_STAT_NUM; i++ ) {
+        kprintf("   %s %llu\r\n", names[i], sum.c[i]);
+    }
+    for ( i = 0; i < processors->n && i < MAX_PROCESSORS; i++ ) {
+        if ( 0 == netdev->stats[i].c[NETDEV_STAT_RX_PKTS]
+             && 0 == netdev->stats[i].c[NETDEV_STAT_TX_PKTS] ) {
+            continue;
+        }
+        kprintf("   cpu %3d: rx %llu tx %llu\r\n", i,
+                netdev->stats[i].c[NETDEV_STAT_RX_PKTS],
+                netdev->stats[i].c[NETDEV_STAT_TX_PKTS]);
+    }
+
+    if ( NULL == netdev->hwstats || netdev->hwstats(netdev, &hw) < 0 ) {
+        return;
+    }
+    kprintf("   hardware: rx %llu packets %llu bytes, tx %llu packets"
+            " %llu bytes\r\n", hw.rx_pkts, hw.rx_bytes, hw.tx_pkts,
+            hw.tx_bytes);
+    kprintf("   hardware: rx missed %llu, crc errors %llu\r\n", hw.rx_missed,
+            hw.rx_crcerrs);
+    for ( j = 0; j < hw.nq && j < NETDEV_HWSTAT_MAXQ; j++ ) {
+        if ( 0 == hw.rxq_pkts[j] && 0 == hw.txq_pkts[j] ) {
+            continue;
+        }
+        kprintf("   queue %2d: rx %llu tx %llu\r\n", j, hw.rxq_pkts[j],
+                hw.txq_pkts[j]);
+    }
+}
+
 /*
  * show
  */
@@ -180,8 +274,34 @@ _builtin_show(char *const argv[])
                     list->netdev->macaddr[3],
                     list->netdev->macaddr[4],
                     list->netdev->macaddr[5]);
+            _netdev_show_stats(list->netdev, 0);
             list = list->next;
         }
+    } else if ( 0 == kstrcmp("stats", argv[1]) ) {
+        /* Datapath counters of a device or all the devices */
+        struct netdev_list *list;
+        struct netdev *netdev;
+        if ( NULL != argv[2] ) {
+            netdev = _netdev_lookup(argv[2]);
+            if ( NULL == netdev ) {
+                kprintf("%s: No such interface\r\n", argv[2]);
+                return -1;
+            }
+            _netdev_show_stats(netdev, 1);
+        } else {
+            for ( list = netdev_head; NULL != list; list = list->next ) {
+                _netdev_show_stats(list->netdev, 1);
+            }
+        }
+    } else if ( 0 == kstrcmp("kmem", argv[1]) ) {
+        /* Usage of the object caches */
+        struct kmem_cache *cache;
+        for ( cache = kmem_cache_list(); NULL != cache;
+              cache = cache->next ) {
+            kprintf(" %s: %d bytes (align %d), %llu in use, %llu slabs"
+                    " (%llu pages)\r\n", cache->name, cache->size,
+                    cache->align, cache->nused, cache->nslabs, cache->npgs);
+        }
     } else if ( 0 == kstrcmp("pci", argv[1]) ) {
         struct pci *list;
         list = pci_list();
@@ -285,8 +405,97 @@ _builtin_show(char *const argv[])
             dd = f;
         }
         kprintf("%04d-%02d-%02d %02d:%02d:%02d\r\n", yy, mm, dd, h, m, s);
+    } else if ( 0 == kstrcmp("rxq", argv[1]) ) {
+        /* RX mode and latency of the queues */
+        struct netdev *netdev;
+        struct netdev_rxq_stat *st;
+        int q;
+        if ( NULL == argv[2] ) {
+            kprintf("show rxq <nic>\r\n");
+            return -1;
+        }
+        netdev = _netdev_lookup(argv[2]);
+        if ( NULL == netdev ) {
+            kprintf("%s: No such interface\r\n", argv[2]);
+            return -1;
+        }
+        kprintf(" %s: mode %s\r\n", netdev->name,
+                NETDEV_RXMODE_HYBRID == netdev->rxmode ? "hybrid" : "poll");
+        for ( q = 0; q < netdev->nrxq && q < NETDEV_MAX_RXQ; q++ ) {
+            st = &netdev->rxqstat[q];
+            kprintf("   rxq %d: %s itr %dus\r\n", q,
+                    NETDEV_RXQ_SLEEPING == st->state ? "sleeping" : "polling",
+                    st->itr);
+            kprintf("     polls %llu (empty %llu) packets %llu\r\n",
+                    st->polls, st->empty, st->pkts);
+            kprintf("     sleeps %llu (timeout %llu) interrupts %llu\r\n",
+                    st->sleeps, st->timeouts, st->intrs);
+            kprintf("     wakeup latency avg %llu ns max %llu ns\r\n",
+                    st->sleeps > st->timeouts
+                    ? st->lat_sum / (st->sleeps - st->timeouts) : 0,
+                    st->lat_max);
+        }
+    } else if ( 0 == kstrcmp("fdb", argv[1]) ) {
+        /* Forwarding database of the bridge */
+        struct net_fdb_entry *e;
+        u64 now;
+        int i;
+        if ( NULL == bridge ) {
+            kprintf("No bridge\r\n");
+            return -1;
+        }
+        now = arch_clock_get();
+        kprintf(" FDB: %d buckets x %d ways\r\n", bridge->fdb.nbuckets,
+                NET_FDB_WAYS);
+        for ( i = 0; i < bridge->fdb.nr; i++ ) {
+            e = &bridge->fdb.entries[i];
+            if ( NET_FDB_PORT_DYNAMIC != e->type
+                 && NET_FDB_PORT_STATIC != e->type ) {
+                continue;
+            }
+            kprintf("   %.2x:%.2x:%.2x:%.2x:%.2x:%.2x vlan %4d %s %s",
+                    (u32)(e->macaddr & 0xff), (u32)((e->macaddr >> 8) & 0xff),
+                    (u32)((e->macaddr >> 16) & 0xff),
+                    (u32)((e->macaddr >> 24) & 0xff),
+                    (u32)((e->macaddr >> 32) & 0xff),
+                    (u32)((e->macaddr >> 40) & 0xff), e->vid,
+                    e->u.port->netdev->name,
+                    NET_FDB_PORT_STATIC == e->type ? "static" : "dynamic");
+            if ( NET_FDB_PORT_DYNAMIC == e->type ) {
+                kprintf(" (%llu s)", (now - e->atime) / 1000000000ULL);
+            }
+            kprintf("\r\n");
+        }
+    } else if ( 0 == kstrcmp("acl", argv[1]) ) {
+        /* Rules and the tree in use */
+        struct acl_rule *r;
+        int i;
+        if ( NULL == acl ) {
+            kprintf("No ACL\r\n");
+            return -1;
+        }
+        for ( i = 0; i < acl->nr; i++ ) {
+            r = &acl->rules[i];
+            kprintf(" %4d %s %08x-%08x %08x-%08x %u-%u %u-%u %u-%u"
+                    " flags %02x/%02x\r\n", i,
+                    ACL_DENY == r->action ? "deny  " : "permit",
+                    r->lo[ACL_F_SADDR], r->hi[ACL_F_SADDR],
+                    r->lo[ACL_F_DADDR], r->hi[ACL_F_DADDR],
+                    r->lo[ACL_F_PROTO], r->hi[ACL_F_PROTO],
+                    r->lo[ACL_F_SPORT], r->hi[ACL_F_SPORT],
+                    r->lo[ACL_F_DPORT], r->hi[ACL_F_DPORT],
+                    r->tcpflags, r->flagmask);
+        }
+        kprintf(" default %s\r\n",
+                ACL_DENY == acl->defact ? "deny" : "permit");
+        if ( NULL != acltree ) {
+            kprintf(" committed: %d rules, %u nodes, %u leaf entries,"
+                    " depth %d\r\n", acltree->nr, acltree->nnodes,
+                    acltree->nleaves, acltree->depth);
+        }
     } else {
-        kprintf("show <interfaces|pci|processors|processes|clock>\r\n");
+        kprintf("show <interfaces|stats|pci|processors|processes|clock|rxq|fdb"
+                "|acl|kmem>\r\n");
     }
 
     return 0;
@@ -313,6 +522,887 @@ _builtin_request(char *const argv[])
     return 0;
 }
 
+/*
+ * set
+ */
+void ixgbe_set_dca(int);
+int netdev_set_rxq(struct netdev *, int, int);
+int netdev_set_rxmode(struct netdev *, int);
+int atoi(const char *);
+int
+_builtin_set(char *const argv[])
+{
+    struct netdev *netdev;
+    int on;
+
+    if ( NULL != argv[1] && 0 == kstrcmp("hsplit", argv[1]) ) {
+        if ( NULL == argv[2] || NULL == argv[3] ) {
+            kprintf("set hsplit <nic> <on|off>\r\n");
+            return -1;
+        }
+        if ( 0 == kstrcmp("on", argv[3]) ) {
+            on = 1;
+        } else if ( 0 == kstrcmp("off", argv[3]) ) {
+            on = 0;
+        } else {
+            kprintf("set hsplit <nic> <on|off>\r\n");
+            return -1;
+        }
+        netdev = _netdev_lookup(argv[2]);
+        if ( NULL == netdev ) {
+            kprintf("%s: No such interface\r\n", argv[2]);
+            return -1;
+        }
+        if ( NULL == netdev->rx_hsplit ) {
+            kprintf("%s: Header split is not supported\r\n", argv[2]);
+            return -1;
+        }
+        if ( netdev->rx_hsplit(netdev, on) < 0 ) {
+            kprintf("%s: Cannot set header split\r\n", argv[2]);
+            return -1;
+        }
+    } else if ( NULL != argv[1] && 0 == kstrcmp("rxq", argv[1]) ) {
+        /* Assign an RX queue to a processor */
+        if ( NULL == argv[2] || NULL == argv[3] || NULL == argv[4] ) {
+            kprintf("set rxq <nic> <id> <queue>\r\n");
+            return -1;
+        }
+        netdev = _netdev_lookup(argv[2]);
+        if ( NULL == netdev ) {
+            kprintf("%s: No such interface\r\n", argv[2]);
+            return -1;
+        }
+        if ( netdev_set_rxq(netdev, atoi(argv[3]), atoi(argv[4])) < 0 ) {
+            kprintf("%s: Invalid queue (%d queues)\r\n", argv[2],
+                    netdev->nrxq);
+            return -1;
+        }
+    } else if ( NULL != argv[1] && 0 == kstrcmp("rxmode", argv[1]) ) {
+        /* Busy polling or sleeping on the interrupt while idle */
+        if ( NULL == argv[2] || NULL == argv[3] ) {
+            kprintf("set rxmode <nic> <poll|hybrid>\r\n");
+            return -1;
+        }
+        if ( 0 == kstrcmp("poll", argv[3]) ) {
+            on = NETDEV_RXMODE_POLL;
+        } else if ( 0 == kstrcmp("hybrid", argv[3]) ) {
+            on = NETDEV_RXMODE_HYBRID;
+        } else {
+            kprintf("set rxmode <nic> <poll|hybrid>\r\n");
+            return -1;
+        }
+        netdev = _netdev_lookup(argv[2]);
+        if ( NULL == netdev ) {
+            kprintf("%s: No such interface\r\n", argv[2]);
+            return -1;
+        }
+        if ( netdev_set_rxmode(netdev, on) < 0 ) {
+            kprintf("%s: RX interrupt is not supported\r\n", argv[2]);
+            return -1;
+        }
+    } else if ( NULL != argv[1] && 0 == kstrcmp("dca", argv[1]) ) {
+        /* Direct cache access or software prefetch for the forwarder */
+        if ( NULL != argv[2] && 0 == kstrcmp("on", argv[2]) ) {
+            ixgbe_set_dca(1);
+        } else if ( NULL != argv[2] && 0 == kstrcmp("off", argv[2]) ) {
+            ixgbe_set_dca(0);
+        } else {
+            kprintf("set dca <on|off>\r\n");
+            return -1;
+        }
+    } else if ( NULL != argv[1] && 0 == kstrcmp("bridge", argv[1]) ) {
+        /* Add a port to the bridge; untagged frames belong to pvid */
+        if ( NULL == argv[2] ) {
+            kprintf("set bridge <nic> [<pvid>]\r\n");
+            return -1;
+        }
+        netdev = _netdev_lookup(argv[2]);
+        if ( NULL == netdev ) {
+            kprintf("%s: No such interface\r\n", argv[2]);
+            return -1;
+        }
+        if ( NULL == bridge ) {
+            bridge = net_bridge_create(BRIDGE_FDB_BUCKETS);
+            if ( NULL == bridge ) {
+                kprintf("Cannot create a bridge\r\n");
+                return -1;
+            }
+            bridge->acl = acltree;
+        }
+        if ( net_bridge_add_port(bridge, netdev,
+                                 NULL != argv[3] ? atoi(argv[3]) : 1) < 0 ) {
+            kprintf("%s: Cannot add to the bridge\r\n", argv[2]);
+            return -1;
+        }
+    } else if ( NULL != argv[1] && 0 == kstrcmp("vlan", argv[1]) ) {
+        /* VLAN membership of a bridge port */
+        if ( NULL == argv[2] || NULL == argv[3] || NULL == argv[4] ) {
+            kprintf("set vlan <nic> <vid> <tagged|untagged|off>\r\n");
+            return -1;
+        }
+        netdev = _netdev_lookup(argv[2]);
+        if ( NULL == netdev ) {
+            kprintf("%s: No such interface\r\n", argv[2]);
+            return -1;
+        }
+        if ( NULL == bridge || NULL == netdev->port ) {
+            kprintf("%s: Not a bridge port\r\n", argv[2]);
+            return -1;
+        }
+        if ( 0 == kstrcmp("tagged", argv[4]) ) {
+            on = net_bridge_vlan_add(bridge, netdev->port->id, atoi(argv[3]),
+                                     0);
+        } else if ( 0 == kstrcmp("untagged", argv[4]) ) {
+            on = net_bridge_vlan_add(bridge, netdev->port->id, atoi(argv[3]),
+                                     1);
+        } else if ( 0 == kstrcmp("off", argv[4]) ) {
+            on = net_bridge_vlan_del(bridge, netdev->port->id, atoi(argv[3]));
+        } else {
+            kprintf("set vlan <nic> <vid> <tagged|untagged|off>\r\n");
+            return -1;
+        }
+        if ( on < 0 ) {
+            kprintf("%s: Invalid VLAN %s\r\n", argv[2], argv[3]);
+            return -1;
+        }
+    } else {
+        kprintf("set <hsplit|dca|rxq|rxmode|bridge|vlan>\r\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * acl
+ */
+int str2v4addr(const char *, u32 *, int *);
+struct acl_tree * ixgbe_set_acl(struct acl_tree *);
+
+/*
+ * Parse a number; return the pointer following it
+ */
+static const char *
+_acl_num(const char *s, u32 *v)
+{
+    const char *s0;
+
+    s0 = s;
+    *v = 0;
+    while ( *s >= '0' && *s <= '9' ) {
+        *v = *v * 10 + (*s - '0');
+        s++;
+    }
+
+    return s == s0 ? NULL : s;
+}
+
+/*
+ * Parse an address prefix (a.b.c.d[/len] or any) to a range
+ */
+static int
+_acl_prefix(const char *s, u32 *lo, u32 *hi)
+{
+    u32 a;
+    u32 mask;
+    int len;
+
+    if ( 0 == kstrcmp("any", s) ) {
+        *lo = 0;
+        *hi = 0xffffffff;
+        return 0;
+    }
+    if ( str2v4addr(s, &a, &len) < 0 ) {
+        return -1;
+    }
+    if ( len < 0 ) {
+        len = 32;
+    }
+    mask = len ? 0xffffffffU << (32 - len) : 0;
+    *lo = a & mask;
+    *hi = *lo | ~mask;
+
+    return 0;
+}
+
+/*
+ * Parse a port range (n, n-m or any)
+ */
+static int
+_acl_port(const char *s, u32 *lo, u32 *hi)
+{
+    if ( 0 == kstrcmp("any", s) ) {
+        *lo = 0;
+        *hi = 65535;
+        return 0;
+    }
+    s = _acl_num(s, lo);
+    if ( NULL == s ) {
+        return -1;
+    }
+    if ( '-' == *s ) {
+        s = _acl_num(s + 1, hi);
+        if ( NULL == s ) {
+            return -1;
+        }
+    } else {
+        *hi = *lo;
+    }
+    if ( *s || *lo > *hi || *hi > 65535 ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Parse a rule:
+ *   <permit|deny> <src> <dst> <proto> <sport> <dport> [syn|ack]
+ */
+static int
+_acl_rule(char *const argv[], struct acl_rule *r)
+{
+    const char *s;
+    u32 v;
+    int i;
+
+    for ( i = 0; i < 6; i++ ) {
+        if ( NULL == argv[i] ) {
+            return -1;
+        }
+    }
+    if ( 0 == kstrcmp("permit", argv[0]) ) {
+        r->action = ACL_PERMIT;
+    } else if ( 0 == kstrcmp("deny", argv[0]) ) {
+        r->action = ACL_DENY;
+    } else {
+        return -1;
+    }
+    if ( _acl_prefix(argv[1], &r->lo[ACL_F_SADDR], &r->hi[ACL_F_SADDR]) < 0
+         || _acl_prefix(argv[2], &r->lo[ACL_F_DADDR], &r->hi[ACL_F_DADDR])
+         < 0 ) {
+        return -1;
+    }
+    if ( 0 == kstrcmp("any", argv[3]) ) {
+        r->lo[ACL_F_PROTO] = 0;
+        r->hi[ACL_F_PROTO] = 255;
+    } else {
+        if ( 0 == kstrcmp("icmp", argv[3]) ) {
+            v = 1;
+        } else if ( 0 == kstrcmp("tcp", argv[3]) ) {
+            v = 6;
+        } else if ( 0 == kstrcmp("udp", argv[3]) ) {
+            v = 17;
+        } else {
+            s = _acl_num(argv[3], &v);
+            if ( NULL == s || *s || v > 255 ) {
+                return -1;
+            }
+        }
+        r->lo[ACL_F_PROTO] = v;
+        r->hi[ACL_F_PROTO] = v;
+    }
+    if ( _acl_port(argv[4], &r->lo[ACL_F_SPORT], &r->hi[ACL_F_SPORT]) < 0
+         || _acl_port(argv[5], &r->lo[ACL_F_DPORT], &r->hi[ACL_F_DPORT])
+         < 0 ) {
+        return -1;
+    }
+    r->tcpflags = 0;
+    r->flagmask = 0;
+    if ( NULL != argv[6] ) {
+        if ( 0 == kstrcmp("syn", argv[6]) ) {
+            /* SYN without ACK */
+            r->tcpflags = 0x02;
+            r->flagmask = 0x12;
+        } else if ( 0 == kstrcmp("ack", argv[6]) ) {
+            r->tcpflags = 0x10;
+            r->flagmask = 0x10;
+        } else {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Pseudo random numbers for the benchmarks (xorshift)
+ */
+static u32
+_bench_rand(u32 *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+
+    return *x;
+}
+
+/*
+ * Random rule for the benchmark
+ */
+static void
+_acl_rand_rule(u32 *x, struct acl_rule *r)
+{
+    u32 mask;
+    int len;
+    int d;
+
+    for ( d = ACL_F_SADDR; d <= ACL_F_DADDR; d++ ) {
+        len = _bench_rand(x) % 16 ? 8 + _bench_rand(x) % 25 : 0;
+        mask = len ? 0xffffffffU << (32 - len) : 0;
+        r->lo[d] = _bench_rand(x) & mask;
+        r->hi[d] = r->lo[d] | ~mask;
+    }
+    for ( d = ACL_F_SPORT; d <= ACL_F_DPORT; d++ ) {
+        switch ( _bench_rand(x) % 3 ) {
+        case 0:
+            r->lo[d] = 0;
+            r->hi[d] = 65535;
+            break;
+        case 1:
+            r->lo[d] = _bench_rand(x) % 65536;
+            r->hi[d] = r->lo[d];
+            break;
+        default:
+            r->lo[d] = _bench_rand(x) % 1024;
+            r->hi[d] = r->lo[d] + _bench_rand(x) % 4096;
+        }
+    }
+    switch ( _bench_rand(x) % 3 ) {
+    case 0:
+        r->lo[ACL_F_PROTO] = 0;
+        r->hi[ACL_F_PROTO] = 255;
+        break;
+    case 1:
+        r->lo[ACL_F_PROTO] = 6;
+        r->hi[ACL_F_PROTO] = 6;
+        break;
+    default:
+        r->lo[ACL_F_PROTO] = 17;
+        r->hi[ACL_F_PROTO] = 17;
+    }
+    r->tcpflags = 0;
+    r->flagmask = 0;
+    r->action = _bench_rand(x) & 1;
+}
+
+#define ACL_BENCH_KEYS      4096
+#define ACL_BENCH_ROUNDS    256
+
+/*
+ * Release the buffers of the ACL benchmark
+ */
+static void
+_acl_bench_release(struct acl *a, struct acl_key *keys, int *res)
+{
+    if ( NULL != res ) {
+        kfree(res);
+    }
+    if ( NULL != keys ) {
+        kfree(keys);
+    }
+    if ( NULL != a ) {
+        kfree(a->rules);
+        kfree(a);
+    }
+}
+
+/*
+ * Measure the classification rate against the number of random rules; half
+ * of the keys are taken from the rules
+ */
+static int
+_acl_bench(void)
+{
+    static const int nrs[] = { 16, 64, 256, 1024, 4096 };
+    struct acl *a;
+    struct acl_tree *t;
+    struct acl_rule r;
+    struct acl_key *keys;
+    int *res;
+    u64 tc;
+    u64 tb;
+    u64 ts;
+    u64 sum;
+    u32 x;
+    int i;
+    int j;
+    int k;
+    int d;
+
+    a = acl_init();
+    keys = kmalloc(sizeof(struct acl_key) * ACL_BENCH_KEYS);
+    res = kmalloc(sizeof(int) * ACL_BENCH_KEYS);
+    if ( NULL == a || NULL == keys || NULL == res ) {
+        _acl_bench_release(a, keys, res);
+        return -1;
+    }
+
+    x = 2463534242U;
+    for ( k = 0; k < sizeof(nrs) / sizeof(nrs[0]); k++ ) {
+        acl_clear(a);
+        for ( i = 0; i < nrs[k]; i++ ) {
+            _acl_rand_rule(&x, &r);
+            acl_add_rule(a, &r);
+        }
+        tc = arch_clock_get();
+        t = acl_compile(a);
+        tc = arch_clock_get() - tc;
+        if ( NULL == t ) {
+            kprintf("%5d rules: Cannot compile\r\n", nrs[k]);
+            continue;
+        }
+
+        for ( i = 0; i < ACL_BENCH_KEYS; i++ ) {
+            j = _bench_rand(&x) % a->nr;
+            for ( d = 0; d < ACL_FIELDS; d++ ) {
+                if ( i & 1 ) {
+                    keys[i].f[d] = a->rules[j].lo[d]
+                        + _bench_rand(&x) % ((u64)a->rules[j].hi[d]
+                                           - a->rules[j].lo[d] + 1);
+                } else {
+                    keys[i].f[d] = _bench_rand(&x);
+                }
+            }
+            keys[i].f[ACL_F_SPORT] &= 0xffff;
+            keys[i].f[ACL_F_DPORT] &= 0xffff;
+            keys[i].f[ACL_F_PROTO] &= 0xff;
+            keys[i].tcpflags = 0;
+        }
+
+        /* Batched */
+        tb = arch_clock_get();
+        for ( i = 0; i < ACL_BENCH_ROUNDS; i++ ) {
+            for ( j = 0; j < ACL_BENCH_KEYS; j += 32 ) {
+                acl_classify_bulk(t, keys + j, res + j, 32);
+            }
+        }
+        tb = arch_clock_get() - tb;
+
+        /* One by one */
+        sum = 0;
+        ts = arch_clock_get();
+        for ( i = 0; i < ACL_BENCH_ROUNDS; i++ ) {
+            for ( j = 0; j < ACL_BENCH_KEYS; j++ ) {
+                sum += acl_classify(t, &keys[j]);
+            }
+        }
+        ts = arch_clock_get() - ts;
+        globaldata = sum;
+
+        kprintf("%5d rules: %6u nodes %6u KB depth %2d compile %6llu us:"
+                " %llu kpps batched, %llu kpps single\r\n", nrs[k],
+                t->nnodes,
+                (u32)(((u64)t->nnodes * sizeof(struct acl_node)
+                       + (u64)t->nchildren * sizeof(u32)
+                       + (u64)t->nleaves * sizeof(u32)
+                       + (u64)t->nr * sizeof(struct acl_rule)) / 1024),
+                t->depth, tc / 1000,
+                (u64)ACL_BENCH_KEYS * ACL_BENCH_ROUNDS * 1000000 / (tb + 1),
+                (u64)ACL_BENCH_KEYS * ACL_BENCH_ROUNDS * 1000000 / (ts + 1));
+        acl_tree_free(t);
+    }
+
+    _acl_bench_release(a, keys, res);
+
+    return 0;
+}
+
+/*
+ * Measure kmalloc/kfree pairs against the number of live objects; a fixed
+ * size pair, then a random object of the live set replaced with one of a
+ * random size class
+ */
+#define KMEM_BENCH_MAX_LIVE     65536
+#define KMEM_BENCH_PAIRS        100000
+static int
+_kmem_bench(void)
+{
+    static const int lives[] = { 0, 256, 4096, KMEM_BENCH_MAX_LIVE };
+    void **live;
+    void *p;
+    u64 tf;
+    u64 tr;
+    u32 x;
+    int n;
+    int i;
+    int j;
+    int k;
+
+    live = kmalloc(sizeof(void *) * KMEM_BENCH_MAX_LIVE);
+    if ( NULL == live ) {
+        return -1;
+    }
+
+    x = 2463534242U;
+    for ( k = 0; k < sizeof(lives) / sizeof(lives[0]); k++ ) {
+        for ( n = 0; n < lives[k]; n++ ) {
+            live[n] = kmalloc(32 << (_bench_rand(&x) % 6));
+            if ( NULL == live[n] ) {
+                break;
+            }
+        }
+
+        tf = arch_clock_get();
+        for ( i = 0; i < KMEM_BENCH_PAIRS; i++ ) {
+            p = kmalloc(64);
+            kfree(p);
+        }
+        tf = arch_clock_get() - tf;
+
+        tr = arch_clock_get();
+        for ( i = 0; i < KMEM_BENCH_PAIRS && n > 0; i++ ) {
+            j = _bench_rand(&x) % n;
+            kfree(live[j]);
+            live[j] = kmalloc(32 << (_bench_rand(&x) % 6));
+        }
+        tr = arch_clock_get() - tr;
+
+        kprintf("%6d live: %llu ns/pair (64 B), %llu ns/pair (random)\r\n",
+                n, tf / KMEM_BENCH_PAIRS, n > 0 ? tr / KMEM_BENCH_PAIRS : 0);
+
+        for ( i = 0; i < n; i++ ) {
+            kfree(live[i]);
+        }
+    }
+    kfree(live);
+
+    return 0;
+}
+
+/*
+ * Kernel memory allocator
+ */
+int
+_builtin_kmem(char *const argv[])
+{
+    if ( NULL != argv[1] && 0 == kstrcmp("bench", argv[1]) ) {
+        return _kmem_bench();
+    }
+    kprintf("kmem <bench>\r\n");
+
+    return -1;
+}
+
+/*
+ * Measure the lookup rate of the committed DXR with random addresses, and
+ * the data TLB misses causing a page walk
+ */
+#define FIB_BENCH_LOOKUPS       (1 << 22)
+static u64
+_fib_lookups(struct dxr *fib)
+{
+    u64 t;
+    u64 sum;
+    u32 x;
+    int i;
+
+    x = 2463534242U;
+    sum = 0;
+    t = arch_clock_get();
+    for ( i = 0; i < FIB_BENCH_LOOKUPS; i++ ) {
+        sum += dxr_lookup(fib, _bench_rand(&x));
+    }
+    t = arch_clock_get() - t;
+    globaldata = sum;
+
+    return t;
+}
+static int
+_fib_bench(void)
+{
+    u64 t;
+    u64 m;
+    int pmc;
+
+    if ( NULL == dxr || NULL == dxr->tables ) {
+        kprintf("No FIB committed\r\n");
+        return -1;
+    }
+
+    pmc = arch_dtlb_miss_start();
+    m = arch_dtlb_miss_read();
+    t = _fib_lookups(dxr_local(dxr));
+    m = arch_dtlb_miss_read() - m;
+
+    kprintf("DXR: %llu klps", (u64)FIB_BENCH_LOOKUPS * 1000000 / (t + 1));
+    if ( pmc >= 0 ) {
+        kprintf(", %llu DTLB misses (%llu per 1M lookups)", m,
+                m * 1000000 / FIB_BENCH_LOOKUPS);
+    }
+    kprintf("\r\n");
+
+    return 0;
+}
+
+/*
+ * Measure the lookup rate from this processor on the replica of each NUMA
+ * node, i.e., the local and the remote placement of the FIB
+ */
+static int
+_fib_bench_numa(void)
+{
+    u64 t;
+    int node;
+    int i;
+
+    if ( NULL == dxr || NULL == dxr->tables ) {
+        kprintf("No FIB committed\r\n");
+        return -1;
+    }
+
+    node = processor_this()->node;
+    for ( i = 0; i < dxr->nreplicas; i++ ) {
+        t = _fib_lookups(dxr_replica(dxr, i));
+        kprintf("Node %d (%s): %llu klps\r\n", i,
+                i == node ? "local" : "remote",
+                (u64)FIB_BENCH_LOOKUPS * 1000000 / (t + 1));
+    }
+
+    return 0;
+}
+
+/*
+ * FIB
+ */
+int
+_builtin_fib(char *const argv[])
+{
+    if ( NULL != argv[1] && 0 == kstrcmp("bench", argv[1]) ) {
+        if ( NULL != argv[2] && 0 == kstrcmp("numa", argv[2]) ) {
+            return _fib_bench_numa();
+        }
+        return _fib_bench();
+    }
+    kprintf("fib bench [numa]\r\n");
+
+    return -1;
+}
+
+/*
+ * False sharing benchmark: each of the tickless processors increments its
+ * own counter, placed either next to those of the others in the same cache
+ * line or in its per-processor data area
+ */
+#define PERCPU_BENCH_ITER       (1 << 24)
+#define PERCPU_BENCH_WAIT       10000   /* in milliseconds */
+struct percpu_bench {
+    /* 0: adjacent counters, 1: per-processor data area */
+    int mode;
+    volatile int start;
+    volatile u64 *shared;
+    volatile int ready[MAX_PROCESSORS];
+    volatile u64 t[MAX_PROCESSORS];
+};
+static struct percpu_bench *percpu_bench;
+static int
+_percpu_bench_main(int argc, char *argv[])
+{
+    struct percpu_bench *b;
+    volatile u64 *cnt;
+    u64 t;
+    int idx;
+    int i;
+
+    b = percpu_bench;
+    idx = PERCPU(idx);
+    if ( b->mode ) {
+        cnt = &PERCPU_THIS()->bench;
+    } else {
+        cnt = &b->shared[idx];
+    }
+    *cnt = 0;
+
+    /* Start all at once */
+    b->ready[idx] = 1;
+    while ( !b->start ) {
+        arch_busy_usleep(1);
+    }
+    t = arch_clock_get();
+    for ( i = 0; i < PERCPU_BENCH_ITER; i++ ) {
+        (*cnt)++;
+    }
+    t = arch_clock_get() - t;
+    b->t[idx] = t + 1;
+
+    return 0;
+}
+static int
+_percpu_bench_wait(volatile int *flag)
+{
+    int i;
+
+    for ( i = 0; i < PERCPU_BENCH_WAIT && !*flag; i++ ) {
+        arch_busy_usleep(1000);
+    }
+
+    return *flag ? 0 : -1;
+}
+static int
+_percpu_bench_run(struct percpu_bench *b, int mode, int n)
+{
+    char **nargv;
+    u64 tmax;
+    int i;
+
+    b->mode = mode;
+    b->start = 0;
+    for ( i = 0; i < MAX_PROCESSORS; i++ ) {
+        b->ready[i] = 0;
+        b->t[i] = 0;
+    }
+    for ( i = 1; i <= n; i++ ) {
+        nargv = kmalloc(sizeof(char *) * 2);
+        if ( NULL == nargv ) {
+            return -1;
+        }
+        nargv[0] = "percpu";
+        nargv[1] = NULL;
+        if ( ktltask_fork_execv(TASK_POLICY_KERNEL, processors->prs[i].id,
+                                &_percpu_bench_main, nargv) < 0 ) {
+            kprintf("Cannot launch on CPU #%d\r\n", processors->prs[i].id);
+            return -1;
+        }
+    }
+    for ( i = 1; i <= n; i++ ) {
+        if ( _percpu_bench_wait(&b->ready[i]) < 0 ) {
+            kprintf("Timeout on CPU #%d\r\n", processors->prs[i].id);
+            return -1;
+        }
+    }
+    b->start = 1;
+    tmax = 0;
+    for ( i = 1; i <= n; i++ ) {
+        while ( 0 == b->t[i] ) {
+            arch_busy_usleep(1000);
+        }
+        if ( b->t[i] > tmax ) {
+            tmax = b->t[i];
+        }
+    }
+
+    kprintf("%s: %llu Mops/s\r\n",
+            mode ? "Per-processor area" : "Adjacent counters",
+            (u64)PERCPU_BENCH_ITER * n * 1000 / tmax);
+
+    return 0;
+}
+static int
+_percpu_bench(int n)
+{
+    struct percpu_bench *b;
+
+    if ( n <= 0 || n >= processors->n ) {
+        n = processors->n - 1;
+    }
+    if ( n <= 0 ) {
+        kprintf("No application processor\r\n");
+        return -1;
+    }
+
+    b = kmalloc(sizeof(struct percpu_bench));
+    if ( NULL == b ) {
+        return -1;
+    }
+    b->shared = kmalloc(sizeof(u64) * processors->n);
+    if ( NULL == b->shared ) {
+        kfree(b);
+        return -1;
+    }
+    percpu_bench = b;
+
+    kprintf("%d processors, %d increments each\r\n", n, PERCPU_BENCH_ITER);
+    /* The workers may still refer to the data on failure; not released */
+    if ( _percpu_bench_run(b, 0, n) < 0 || _percpu_bench_run(b, 1, n) < 0 ) {
+        return -1;
+    }
+    kfree((void *)b->shared);
+    kfree(b);
+
+    return 0;
+}
+
+/*
+ * Per-processor data
+ */
+int
+_builtin_percpu(char *const argv[])
+{
+    if ( NULL != argv[1] && 0 == kstrcmp("bench", argv[1]) ) {
+        return _percpu_bench(NULL != argv[2] ? atoi(argv[2]) : 0);
+    }
+    kprintf("percpu bench [<#processors>]\r\n");
+
+    return -1;
+}
+
+int
+_builtin_acl(char *const argv[])
+{
+    struct acl_tree *t;
+    struct acl_tree *old;
+    struct acl_rule r;
+
+    if ( NULL != argv[1] && 0 == kstrcmp("bench", argv[1]) ) {
+        return _acl_bench();
+    }
+    if ( NULL == acl ) {
+        acl = acl_init();
+        if ( NULL == acl ) {
+            return -1;
+        }
+    }
+
+    if ( NULL != argv[1] && 0 == kstrcmp("add", argv[1]) ) {
+        if ( _acl_rule(&argv[2], &r) < 0 ) {
+            kprintf("acl add <permit|deny> <src> <dst> <proto> <sport>"
+                    " <dport> [syn|ack]\r\n");
+            return -1;
+        }
+        if ( acl_add_rule(acl, &r) < 0 ) {
+            kprintf("Cannot add the rule\r\n");
+            return -1;
+        }
+    } else if ( NULL != argv[1] && 0 == kstrcmp("default", argv[1]) ) {
+        if ( NULL != argv[2] && 0 == kstrcmp("permit", argv[2]) ) {
+            acl->defact = ACL_PERMIT;
+        } else if ( NULL != argv[2] && 0 == kstrcmp("deny", argv[2]) ) {
+            acl->defact = ACL_DENY;
+        } else {
+            kprintf("acl default <permit|deny>\r\n");
+            return -1;
+        }
+    } else if ( NULL != argv[1] && 0 == kstrcmp("clear", argv[1]) ) {
+        acl_clear(acl);
+    } else if ( NULL != argv[1] && 0 == kstrcmp("commit", argv[1]) ) {
+        /* Compile and install the rules to the forwarders */
+        t = acl_compile(acl);
+        if ( NULL == t ) {
+            kprintf("Cannot compile the ACL\r\n");
+            return -1;
+        }
+        old = acltree;
+        acltree = t;
+        ixgbe_set_acl(t);
+        if ( NULL != bridge ) {
+            bridge->acl = t;
+        }
+        if ( NULL != old ) {
+            /* Wait for the forwarders to finish the batches in process */
+            processor_synchronize();
+            acl_tree_free(old);
+        }
+        kprintf("ACL: %d rules, %u nodes, depth %d\r\n", t->nr, t->nnodes,
+                t->depth);
+    } else {
+        kprintf("acl <add|default|clear|commit|bench>\r\n");
+        return -1;
+    }
+
+    return 0;
+}
+
 /*
  * test packet
  */
@@ -713,8 +1803,11 @@ _mgmt_main(int argc, char *argv[])
 
     /* Search network device for management */
     struct netdev_list *list;
-    u8 pkt[512];
-    u8 pkt2[512];
+    struct mbuf *mbufs[32];
+    struct mbuf *reply;
+    int k;
+    u8 *pkt;
+    u8 *pkt2;
     u8 *ip;
     u8 *udp;
     u8 *data;
@@ -740,72 +1833,90 @@ _mgmt_main(int argc, char *argv[])
     /* FIXME: Choose the first interface for management */
     list = netdev_head;
 
-    kprintf("MGMT: %s %x\r\n", list->netdev->name, list->netdev->recvpkt);
+    kprintf("MGMT: %s %x\r\n", list->netdev->name, list->netdev->rx_burst);
+    if ( NULL == list->netdev->rx_burst || NULL == list->netdev->tx_burst ) {
+        return -1;
+    }
     while ( 1 ) {
-        n = list->netdev->recvpkt(pkt, 512, list->netdev);
-        if ( n >= 60 && 0x08 == pkt[12] && 0x00 == pkt[13] ) {
-            //kprintf("XXXX\r\n");
-            ip = pkt + 14;
-            if ( 17 == ip[9] ) {
-                udp = ip + (int)(ip[0] & 0xf) * 4;
-                /* Check port 5000 */
-                if ( udp[2] == 0x13 && udp[3] == 0x88 ) {
-                    data = udp + 8;
-                    ret = _mgmt_operate(data);
+        n = list->netdev->rx_burst(list->netdev, 0, mbufs, 32);
+        for ( k = 0; k < n; k++ ) {
+            pkt = MBUF_DATA(mbufs[k]);
+            if ( mbufs[k]->len >= 60 && 0x08 == pkt[12] && 0x00 == pkt[13] ) {
+                //kprintf("XXXX\r\n");
+                ip = pkt + 14;
+                if ( 17 == ip[9] ) {
+                    udp = ip + (int)(ip[0] & 0xf) * 4;
+                    /* Check port 5000 */
+                    if ( udp[2] == 0x13 && udp[3] == 0x88 ) {
+                        data = udp + 8;
+                        ret = _mgmt_operate(data);
 #if 0
-                    kprintf("%d (%d) %x %x %x %x\r\n",
-                            n, udp - pkt, udp[0], udp[1], udp[2], udp[3]);
+                        kprintf("%d (%d) %x %x %x %x\r\n",
+                                n, udp - pkt, udp[0], udp[1], udp[2], udp[3]);
 #endif
-                    kmemcpy(pkt2, pkt + 6, 6);
-                    kmemcpy(pkt2 + 6, pkt, 6);
-                    pkt2[12] = 0x08;
-                    pkt2[13] = 0x00;
-                    pkt2[14] = 0x45;
-                    pkt2[15] = 0;
-                    pkt2[16] = 0;
-                    pkt2[17] = 20 + 8 + 8;
-                    pkt2[18] = 0;
-                    pkt2[19] = 0;
-                    pkt2[20] = 0;
-                    pkt2[21] = 0;
-                    pkt2[22] = 64;
-                    pkt2[23] = 17;
-                    pkt2[24] = 0;
-                    pkt2[25] = 0;
-                    kmemcpy(pkt2 + 26, pkt + 30, 4);
-                    kmemcpy(pkt2 + 30, pkt + 26, 4);
-                    pkt2[34] = 0x13;
-                    pkt2[35] = 0x88;
-                    pkt2[36] = 0x13;
-                    pkt2[37] = 0x88;
-                    pkt2[38] = 0;
-                    pkt2[39] = 8 + 8;
-                    pkt2[40] = 0;
-                    pkt2[41] = 0;
-                    *(u64 *)(pkt2 + 42) = ret;
-                    kmemset(pkt2 + 50, 0, 8);
-
-                    /* Compute checksum */
-                    u16 *tmp;
-                    u32 cs;
-                    int i;
-                    pkt2[24] = 0x0;
-                    pkt2[25] = 0x0;
-                    tmp = (u16 *)pkt2;
-                    cs = 0;
-                    for ( i = 7; i < 17; i++ ) {
-                        cs += (u32)tmp[i];
-                        cs = (cs & 0xffff) + (cs >> 16);
-                    }
-                    cs = 0xffff - cs;
-                    pkt2[24] = cs & 0xff;
-                    pkt2[25] = cs >> 8;
-
-                    //kprintf("ret = %x\r\n", ret);
-                    list->netdev->sendpkt(pkt2, 60, list->netdev);
+                        reply = mbuf_alloc(mbufpool);
+                        if ( NULL == reply ) {
+                            mbuf_free(mbufs[k]);
+                            continue;
+                        }
+                        pkt2 = MBUF_DATA(reply);
+                        kmemcpy(pkt2, pkt + 6, 6);
+                        kmemcpy(pkt2 + 6, pkt, 6);
+                        pkt2[12] = 0x08;
+                        pkt2[13] = 0x00;
+                        pkt2[14] = 0x45;
+                        pkt2[15] = 0;
+                        pkt2[16] = 0;
+                        pkt2[17] = 20 + 8 + 8;
+                        pkt2[18] = 0;
+                        pkt2[19] = 0;
+                        pkt2[20] = 0;
+                        pkt2[21] = 0;
+                        pkt2[22] = 64;
+                        pkt2[23] = 17;
+                        pkt2[24] = 0;
+                        pkt2[25] = 0;
+                        kmemcpy(pkt2 + 26, pkt + 30, 4);
+                        kmemcpy(pkt2 + 30, pkt + 26, 4);
+                        pkt2[34] = 0x13;
+                        pkt2[35] = 0x88;
+                        pkt2[36] = 0x13;
+                        pkt2[37] = 0x88;
+                        pkt2[38] = 0;
+                        pkt2[39] = 8 + 8;
+                        pkt2[40] = 0;
+                        pkt2[41] = 0;
+                        *(u64 *)(pkt2 + 42) = ret;
+                        kmemset(pkt2 + 50, 0, 8);
+
+                        /* Compute checksum */
+                        u16 *tmp;
+                        u32 cs;
+                        int i;
+                        pkt2[24] = 0x0;
+                        pkt2[25] = 0x0;
+                        tmp = (u16 *)pkt2;
+                        cs = 0;
+                        for ( i = 7; i < 17; i++ ) {
+                            cs += (u32)tmp[i];
+                            cs = (cs & 0xffff) + (cs >> 16);
+                        }
+                        cs = 0xffff - cs;
+                        pkt2[24] = cs & 0xff;
+                        pkt2[25] = cs >> 8;
+
+                        //kprintf("ret = %x\r\n", ret);
+                        reply->len = 60;
+                        reply->pktlen = 60;
+                        if ( list->netdev->tx_burst(list->netdev, 0, &reply, 1)
+                             < 1 ) {
+                            mbuf_free(reply);
+                        }
 
+                    }
                 }
             }
+            mbuf_free(mbufs[k]);
         }
     }
 
@@ -817,6 +1928,45 @@ _mgmt_main(int argc, char *argv[])
 
     return 0;
 }
+/*
+ * Forwarding between two ports on the RX queue assigned to this processor
+ */
+static int
+_fwd_main(int argc, char *argv[])
+{
+    struct netdev *in;
+    struct netdev *out;
+
+    if ( argc < 3 || NULL == argv[1] || NULL == argv[2] ) {
+        return -1;
+    }
+    in = _netdev_lookup(argv[1]);
+    out = _netdev_lookup(argv[2]);
+    if ( NULL == in || NULL == out ) {
+        kprintf("fwd: No such interface\r\n");
+        return -1;
+    }
+    if ( NULL == in->rx_burst || NULL == out->tx_burst ) {
+        kprintf("fwd: Burst mode is not supported\r\n");
+        return -1;
+    }
+
+    i40e_forwarding_test(in, out);
+
+    return 0;
+}
+
+/*
+ * Bridging on the RX queues assigned to this processor
+ */
+static int
+_bridge_main(int argc, char *argv[])
+{
+    net_bridge_forward(bridge);
+
+    return 0;
+}
+
 static int
 _routing_main(int argc, char *argv[])
 {
@@ -1193,8 +2343,40 @@ _builtin_start(char *const argv[])
             return -1;
         }
         kprintf("Launch routing @ CPU #%d\r\n", id);
+    } else if ( 0 == kstrcmp("fwd", argv[1]) ) {
+        /* Start forwarding on the RX queue assigned to the processor */
+        if ( NULL == argv[3] || NULL == argv[4] ) {
+            kprintf("start fwd <id> <in> <out>\r\n");
+            return -1;
+        }
+        char **nargv = kmalloc(sizeof(char *) * 4);
+        nargv[0] = "fwd";
+        nargv[1] = kstrdup(argv[3]);
+        nargv[2] = kstrdup(argv[4]);
+        nargv[3] = NULL;
+        ret = ktltask_fork_execv(TASK_POLICY_KERNEL, id, &_fwd_main, nargv);
+        if ( ret < 0 ) {
+            kprintf("Cannot launch fwd\r\n");
+            return -1;
+        }
+        kprintf("Launch fwd @ CPU #%d\r\n", id);
+    } else if ( 0 == kstrcmp("bridge", argv[1]) ) {
+        /* Start bridging on the queues of the processor */
+        if ( NULL == bridge ) {
+            kprintf("No bridge\r\n");
+            return -1;
+        }
+        char **nargv = kmalloc(sizeof(char *) * 2);
+        nargv[0] = "bridge";
+        nargv[1] = NULL;
+        ret = ktltask_fork_execv(TASK_POLICY_KERNEL, id, &_bridge_main, nargv);
+        if ( ret < 0 ) {
+            kprintf("Cannot launch bridge\r\n");
+            return -1;
+        }
+        kprintf("Launch bridge @ CPU #%d\r\n", id);
     } else {
-        kprintf("start <routing|mgmt> <id>\r\n");
+        kprintf("start <routing|mgmt|fwd|bridge> <id>\r\n");
         return -1;
     }
 
@@ -1237,6 +2419,7 @@ _builtin_help(char *const argv[])
     kprintf("    start   Start a daemon\r\n");
     kprintf("    stop    Stop a daemon\r\n");
     kprintf("    request Request a command\r\n");
+    kprintf("    set     Set a configuration\r\n");
 
     return 0;
 }
@@ -1373,8 +2556,18 @@ _exec_cmdbuf(char *cmd)
         ret =_builtin_show(argv);
     } else if ( 0 == kstrcmp("request", argv[0]) ) {
         ret = _builtin_request(argv);
+    } else if ( 0 == kstrcmp("set", argv[0]) ) {
+        ret = _builtin_set(argv);
     } else if ( 0 == kstrcmp("start", argv[0]) ) {
         ret =_builtin_start(argv);
+    } else if ( 0 == kstrcmp("acl", argv[0]) ) {
+        ret = _builtin_acl(argv);
+    } else if ( 0 == kstrcmp("kmem", argv[0]) ) {
+        ret = _builtin_kmem(argv);
+    } else if ( 0 == kstrcmp("fib", argv[0]) ) {
+        ret = _builtin_fib(argv);
+    } else if ( 0 == kstrcmp("percpu", argv[0]) ) {
+        ret = _builtin_percpu(argv);
     } else if ( 0 == kstrcmp("stop", argv[0]) ) {
         ret = _builtin_stop(argv);
     } else if ( 0 == kstrcmp("debug", argv[0]) ) {
@@ -727,6 +727,10 @@ int
 ktask_idle_main(int argc, char *argv[])
 {
     for ( ;; ) {
+        /* The task reading the forwarding data on this processor, if any,
+           has been stopped; processor_synchronize() no longer waits for
+           this processor */
+        PERCPU(qs_reader) = 0;
         /* Execute the architecture-specific idle procedure */
         arch_idle();
     }
@@ -17,6 +17,10 @@
 //struct kmem_slab_page_hdr *kmem_slab_head;
 struct kmem_slab_root *kmem_slab_head;
 static volatile int kmem_lock;
+static volatile int kmem_magazine;
+static struct kmem_cache *kmem_caches;
+
+int this_cpu(void);
 
 /*
  * Put a character to the standard output of the kernel
@@ -370,23 +374,326 @@ kmem_init(void)
         kmem_slab_head->gslabs[i].full = NULL;
         kmem_slab_head->gslabs[i].free = NULL;
     }
+    for ( i = 0; i < KMEM_NCLASS; i++ ) {
+        kmem_slab_head->depot[i].full = NULL;
+        kmem_slab_head->depot[i].empty = NULL;
+        kmem_slab_head->depot[i].nfull = 0;
+    }
+    kmemset(kmem_slab_head->cpu, 0, sizeof(kmem_slab_head->cpu));
     kmem_lock = 0;
+    kmem_magazine = 0;
+    kmem_caches = NULL;
+}
+
+/*
+ * Allocate small objects through the magazines of each processor; called
+ * once the processor table is built
+ */
+void
+kmem_magazine_enable(void)
+{
+    int i;
+
+    for ( i = 0; i < MAX_PROCESSORS; i++ ) {
+        if ( arch_cpu_active(i) ) {
+            arch_percpu(i)->kmem = &kmem_slab_head->cpu[i];
+        }
+    }
+    kmem_magazine = 1;
+}
+
+/*
+ * Link a slab to the head of a list
+ */
+static __inline__ void
+_slab_link(struct kmem_slab **list, struct kmem_slab *hdr)
+{
+    hdr->prev = NULL;
+    hdr->next = *list;
+    if ( NULL != hdr->next ) {
+        hdr->next->prev = hdr;
+    }
+    *list = hdr;
+}
+
+/*
+ * Unlink a slab from a list
+ */
+static __inline__ void
+_slab_unlink(struct kmem_slab **list, struct kmem_slab *hdr)
+{
+    if ( NULL != hdr->prev ) {
+        hdr->prev->next = hdr->next;
+    } else {
+        *list = hdr->next;
+    }
+    if ( NULL != hdr->next ) {
+        hdr->next->prev = hdr->prev;
+    }
+    hdr->next = NULL;
+    hdr->prev = NULL;
+}
+
+/*
+ * Allocate a new slab of npg pages for objects of sz bytes aligned to align
+ * bytes; the pages are recorded as used by the slab so that kfree() finds it
+ * from an object
+ */
+static struct kmem_slab *
+_slab_create(u64 npg, int sz, int align)
+{
+    struct kmem_slab *hdr;
+    void **obj;
+    u64 end;
+    int i;
+
+    hdr = phys_mem_alloc_pages(npg);
+    if ( NULL == hdr ) {
+        return NULL;
+    }
+    end = (u64)hdr + npg * PAGESIZE;
+    hdr->cache = NULL;
+    hdr->cls = -1;
+    hdr->size = sz;
+    hdr->npg = npg;
+    hdr->nr = (end - (u64)hdr - sizeof(struct kmem_slab)) / sz;
+    hdr->obj_head = (void *)((end - (u64)sz * hdr->nr) & ~((u64)align - 1));
+    if ( (u64)hdr->obj_head < (u64)hdr + sizeof(struct kmem_slab) ) {
+        /* No room for the alignment */
+        hdr->nr--;
+        hdr->obj_head = (void *)((end - (u64)sz * hdr->nr)
+                                 & ~((u64)align - 1));
+    }
+    hdr->nused = 0;
+    hdr->next = NULL;
+    hdr->prev = NULL;
+
+    /* Link all the objects to the free list */
+    hdr->free = hdr->obj_head;
+    for ( i = 0; i < hdr->nr; i++ ) {
+        obj = (void **)((u64)hdr->obj_head + (u64)i * sz);
+        if ( i + 1 < hdr->nr ) {
+            *obj = (void *)((u64)obj + sz);
+        } else {
+            *obj = NULL;
+        }
+    }
+    phys_mem_set_slab(hdr, npg, hdr);
+
+    return hdr;
+}
+
+/*
+ * Take an object from the partial or the empty slabs of a list; NULL if
+ * none of them remains
+ */
+static void *
+_slab_take(struct kmem_slab_free_list *list)
+{
+    struct kmem_slab *hdr;
+    void *ret;
+
+    hdr = list->partial;
+    if ( NULL == hdr ) {
+        hdr = list->free;
+        if ( NULL == hdr ) {
+            return NULL;
+        }
+        _slab_unlink(&list->free, hdr);
+        _slab_link(&list->partial, hdr);
+    }
+
+    ret = hdr->free;
+    hdr->free = *(void **)ret;
+    hdr->nused++;
+    if ( NULL == hdr->free ) {
+        /* Becomes full */
+        _slab_unlink(&list->partial, hdr);
+        _slab_link(&list->full, hdr);
+    }
+
+    return ret;
+}
+
+/*
+ * Take an object of the size class from the slabs; kmem_lock must be held
+ */
+static void *
+_slab_alloc(int cls)
+{
+    struct kmem_slab_free_list *list;
+    struct kmem_slab *hdr;
+    void *ret;
+
+    list = &kmem_slab_head->gslabs[cls];
+    ret = _slab_take(list);
+    if ( NULL == ret ) {
+        hdr = _slab_create((((1ULL << (cls + 8)) - 1) / PAGESIZE) + 1,
+                           32 << cls, 32 << cls);
+        if ( NULL == hdr ) {
+            return NULL;
+        }
+        hdr->cls = cls;
+        _slab_link(&list->partial, hdr);
+        ret = _slab_take(list);
+    }
+
+    return ret;
+}
+
+/*
+ * Return an object to its slab; the lock of the slab list must be held
+ */
+static void
+_slab_free(struct kmem_slab *hdr, void *ptr)
+{
+    struct kmem_slab_free_list *list;
+
+    if ( NULL != hdr->cache ) {
+        list = &hdr->cache->slabs;
+    } else {
+        list = &kmem_slab_head->gslabs[hdr->cls];
+    }
+    if ( NULL == hdr->free ) {
+        /* To partial list */
+        _slab_unlink(&list->full, hdr);
+        _slab_link(&list->partial, hdr);
+    }
+    *(void **)ptr = hdr->free;
+    hdr->free = ptr;
+    hdr->nused--;
+    if ( hdr->nused <= 0 ) {
+        _slab_unlink(&list->partial, hdr);
+        if ( NULL == list->free ) {
+            /* Keep one empty slab per list */
+            _slab_link(&list->free, hdr);
+        } else {
+            /* Release the pages */
+            if ( NULL != hdr->cache ) {
+                hdr->cache->nslabs--;
+                hdr->cache->npgs -= hdr->npg;
+            }
+            phys_mem_set_slab(hdr, hdr->npg, NULL);
+            phys_mem_free_pages(hdr);
+        }
+    }
+}
+
+/*
+ * Take an object from the magazines of this processor; a full magazine is
+ * exchanged with the depot when both are empty
+ */
+static void *
+_magazine_alloc(struct kmem_cpu_cache *cc, int cls)
+{
+    struct kmem_depot *depot;
+    struct kmem_magazine *mag;
+    void *ret;
+
+    mag = cc->loaded[cls];
+    if ( NULL != mag && mag->n > 0 ) {
+        return mag->objs[--mag->n];
+    }
+    mag = cc->prev[cls];
+    if ( NULL != mag && mag->n > 0 ) {
+        cc->prev[cls] = cc->loaded[cls];
+        cc->loaded[cls] = mag;
+        return mag->objs[--mag->n];
+    }
+
+    depot = &kmem_slab_head->depot[cls];
+    arch_spin_lock(&kmem_lock);
+    mag = depot->full;
+    if ( NULL == mag ) {
+        ret = _slab_alloc(cls);
+        arch_spin_unlock(&kmem_lock);
+        return ret;
+    }
+    depot->full = mag->next;
+    depot->nfull--;
+    if ( NULL != cc->prev[cls] ) {
+        cc->prev[cls]->next = depot->empty;
+        depot->empty = cc->prev[cls];
+    }
+    arch_spin_unlock(&kmem_lock);
+
+    cc->prev[cls] = cc->loaded[cls];
+    cc->loaded[cls] = mag;
+
+    return mag->objs[--mag->n];
+}
+
+/*
+ * Put an object to the magazines of this processor; a full magazine is
+ * exchanged with an empty one of the depot when both are full
+ */
+static void
+_magazine_free(struct kmem_cpu_cache *cc, struct kmem_slab *hdr, void *ptr)
+{
+    struct kmem_depot *depot;
+    struct kmem_magazine *mag;
+    int cls;
+    int i;
+
+    cls = hdr->cls;
+    mag = cc->loaded[cls];
+    if ( NULL != mag && mag->n < KMEM_MAGAZINE_SIZE ) {
+        mag->objs[mag->n++] = ptr;
+        return;
+    }
+    mag = cc->prev[cls];
+    if ( NULL != mag && 0 == mag->n ) {
+        cc->prev[cls] = cc->loaded[cls];
+        cc->loaded[cls] = mag;
+        mag->objs[mag->n++] = ptr;
+        return;
+    }
+
+    depot = &kmem_slab_head->depot[cls];
+    arch_spin_lock(&kmem_lock);
+    if ( NULL != mag && depot->nfull >= KMEM_DEPOT_MAX ) {
+        /* The depot is full; return the objects to the slabs instead */
+        for ( i = 0; i < mag->n; i++ ) {
+            _slab_free(phys_mem_slab(mag->objs[i]), mag->objs[i]);
+        }
+        mag->n = 0;
+    } else {
+        if ( NULL != mag ) {
+            mag->next = depot->full;
+            depot->full = mag;
+            depot->nfull++;
+        }
+        mag = depot->empty;
+        if ( NULL != mag ) {
+            depot->empty = mag->next;
+        } else {
+            mag = _slab_alloc(KMEM_MAGAZINE_CLS);
+            if ( NULL == mag ) {
+                cc->prev[cls] = NULL;
+                _slab_free(hdr, ptr);
+                arch_spin_unlock(&kmem_lock);
+                return;
+            }
+        }
+        mag->n = 0;
+    }
+    arch_spin_unlock(&kmem_lock);
+
+    cc->prev[cls] = cc->loaded[cls];
+    cc->loaded[cls] = mag;
+    mag->objs[mag->n++] = ptr;
 }
 
 /*
  * Memory allocation
- * ** FIXME **
  */
 void *
 kmalloc(u64 sz)
 {
     u64 tmp;
     u64 bsz;
-    u64 asz;
+    u64 rflags;
     void *ret;
-    int i;
-    u64 npg;
-    struct kmem_slab *hdr;
 
     /* Calculate aligned size */
     tmp = sz - 1;
@@ -397,204 +704,257 @@ kmalloc(u64 sz)
     }
     /* No smaller than 32 (= 1<<5) */
     if ( bsz >= 5 ) {
-        asz = (1<<bsz);
         bsz -= 5;
     } else {
-        asz = (1<<5);
         bsz = 0;
     }
 
-    arch_spin_lock(&kmem_lock);
-
-    if ( bsz < 6 ) {
-        /* Small objects */
-        if ( kmem_slab_head->gslabs[bsz].partial ) {
-            /* Has partial list */
-            hdr = kmem_slab_head->gslabs[bsz].partial;
-            ret = (void *)((u64)hdr->obj_head + hdr->free * asz);
-            hdr->marks[hdr->free] = 1;
-            hdr->nused++;
-            if ( hdr->nr <= hdr->nused ) {
-                hdr->free = -1;
-                /* Becomes full */
-                kmem_slab_head->gslabs[bsz].partial = hdr->next;
-                /* Prepend to the full list */
-                hdr->next = kmem_slab_head->gslabs[bsz].full;
-                kmem_slab_head->gslabs[bsz].full = hdr;
-            } else {
-                /* Search free space */
-                for ( i = 0; i < hdr->nr; i++ ) {
-                    if ( 0 == hdr->marks[i] ) {
-                        hdr->free = i;
-                        break;
-                    }
-                }
-            }
-        } else if ( kmem_slab_head->gslabs[bsz].free ) {
-            /* Has free list */
-            hdr = kmem_slab_head->gslabs[bsz].free;
-            ret = (void *)((u64)hdr->obj_head + hdr->free * asz);
-            hdr->marks[hdr->free] = 1;
-            hdr->nused++;
-            if ( hdr->nr <= hdr->nused ) {
-                hdr->free = -1;
-                /* Becomes full */
-                kmem_slab_head->gslabs[bsz].partial = hdr->next;
-                /* Prepend to the full list */
-                hdr->next = kmem_slab_head->gslabs[bsz].full;
-                kmem_slab_head->gslabs[bsz].full = hdr;
-            } else {
-                /* To partial */
-                hdr->next = kmem_slab_head->gslabs[bsz].partial;
-                kmem_slab_head->gslabs[bsz].partial = hdr;
-
-                /* Search free space */
-                for ( i = 0; i < hdr->nr; i++ ) {
-                    if ( 0 == hdr->marks[i] ) {
-                        hdr->free = i;
-                        break;
-                    }
-                }
-            }
-        } else {
-            /* No free space, then allocate new page */
-            npg = (((1<<(bsz+8)) - 1) / PAGESIZE) + 1;
-            hdr = phys_mem_alloc_pages(npg);
-            if ( NULL == hdr ) {
-                arch_spin_unlock(&kmem_lock);
-                return NULL;
-            }
-            hdr->nr = (npg * PAGESIZE - sizeof(struct kmem_slab)) / (asz + 1);
-            hdr->nused = 0;
-            hdr->free = 0;
-            hdr->obj_head = (void *)((u64)hdr + (npg * PAGESIZE)
-                                     - (asz * hdr->nr));
-            hdr->next = NULL;
-            kmemset(hdr->marks, 0, hdr->nr);
-
-            ret = (void *)((u64)hdr->obj_head + hdr->free * asz);
-            hdr->marks[hdr->free] = 1;
-            hdr->nused++;
-            if ( hdr->nr <= hdr->nused ) {
-                hdr->free = -1;
-                /* Becomes full */
-                kmem_slab_head->gslabs[bsz].partial = hdr->next;
-                /* Prepend to the full list */
-                hdr->next = kmem_slab_head->gslabs[bsz].full;
-                kmem_slab_head->gslabs[bsz].full = hdr;
-            } else {
-                /* To partial */
-                hdr->next = kmem_slab_head->gslabs[bsz].partial;
-                kmem_slab_head->gslabs[bsz].partial = hdr;
-                /* Search free space */
-                for ( i = 0; i < hdr->nr; i++ ) {
-                    if ( 0 == hdr->marks[i] ) {
-                        hdr->free = i;
-                        break;
-                    }
-                }
-            }
-        }
-    } else {
+    if ( bsz >= KMEM_NCLASS ) {
         /* Large objects */
-        ret = phys_mem_alloc_pages(((sz - 1) / PAGESIZE) + 1);
+        return phys_mem_alloc_pages(((sz - 1) / PAGESIZE) + 1);
+    }
+
+    /* Small objects */
+    if ( kmem_magazine ) {
+        rflags = arch_intr_save();
+        ret = _magazine_alloc(PERCPU(kmem), bsz);
+        arch_intr_restore(rflags);
+        return ret;
     }
 
+    arch_spin_lock(&kmem_lock);
+    ret = _slab_alloc(bsz);
     arch_spin_unlock(&kmem_lock);
+
     return ret;
 }
 
 /*
- * Free allocated memory
- * ** FIXME **
+ * Free allocated memory; the slab of the object is derived from the address
+ * in constant time
  */
 void
 kfree(void *ptr)
 {
     struct kmem_slab *hdr;
-    struct kmem_slab **hdrp;
-    int i;
-    int j;
-    int found;
-    u64 asz;
+    u64 off;
+    u64 rflags;
 
-    arch_spin_lock(&kmem_lock);
-
-    if ( 0 == (u64)ptr % PAGESIZE ) {
+    hdr = phys_mem_slab(ptr);
+    if ( NULL == hdr ) {
+        /* Large object */
         phys_mem_free_pages(ptr);
-    } else {
+        return;
+    }
+    if ( NULL != hdr->cache ) {
+        kmem_cache_free(hdr->cache, ptr);
+        return;
+    }
+    off = (u64)ptr - (u64)hdr->obj_head;
+    if ( (u64)ptr < (u64)hdr->obj_head || (off & ((32ULL << hdr->cls) - 1))
+         || (off >> (hdr->cls + 5)) >= hdr->nr ) {
+        /* Not an object */
+        return;
+    }
 
-        for ( i = 0; i < 8; i++ ) {
-            asz = (1<<(i + 5));
+    if ( kmem_magazine ) {
+        rflags = arch_intr_save();
+        _magazine_free(PERCPU(kmem), hdr, ptr);
+        arch_intr_restore(rflags);
+        return;
+    }
 
-            /* Search from partial */
-            hdrp = &kmem_slab_head->gslabs[i].partial;
+    arch_spin_lock(&kmem_lock);
+    _slab_free(hdr, ptr);
+    arch_spin_unlock(&kmem_lock);
+}
 
-            while ( NULL != *hdrp ) {
-                hdr = *hdrp;
+/*
+ * Create an object cache of objects of sz bytes; align is the alignment of
+ * the objects (0 for the pointer size, or KMEM_CACHE_LINE), and ctor, if
+ * not NULL, is called on each object allocated
+ */
+struct kmem_cache *
+kmem_cache_create(const char *name, int sz, int align, void (*ctor)(void *))
+{
+    struct kmem_cache *cache;
 
-                found = -1;
-                for ( j = 0; j < hdr->nr; j++ ) {
-                    if ( ptr == (void *)((u64)hdr->obj_head + j * asz) ) {
-                        /* Found */
-                        found = j;
-                        break;
-                    }
-                }
-                if ( found >= 0 ) {
-                    hdr->nused--;
-                    hdr->marks[found] = 0;
-                    hdr->free = found;
-                    if ( hdr->nused <= 0 ) {
-                        /* To free list */
-                        *hdrp = hdr->next;
-                        hdr->next = kmem_slab_head->gslabs[i].free;
-                        kmem_slab_head->gslabs[i].free = hdr;
-                    }
-                    arch_spin_unlock(&kmem_lock);
-                    return;
-                }
-                hdrp = &hdr->next;
-            }
+    if ( align < (int)sizeof(void *) ) {
+        align = sizeof(void *);
+    }
+    if ( sz <= 0 || (align & (align - 1)) ) {
+        return NULL;
+    }
 
-            /* Search from full */
-            hdrp = &kmem_slab_head->gslabs[i].full;
+    cache = kmalloc(sizeof(struct kmem_cache));
+    if ( NULL == cache ) {
+        return NULL;
+    }
+    cache->name = name;
+    cache->size = (sz + align - 1) & ~(align - 1);
+    cache->align = align;
+    cache->ctor = ctor;
+    cache->slabs.partial = NULL;
+    cache->slabs.full = NULL;
+    cache->slabs.free = NULL;
+    cache->lock = 0;
+    cache->nused = 0;
+    cache->nslabs = 0;
+    cache->npgs = 0;
 
-            while ( NULL != *hdrp ) {
-                hdr = *hdrp;
+    arch_spin_lock(&kmem_lock);
+    cache->next = kmem_caches;
+    kmem_caches = cache;
+    arch_spin_unlock(&kmem_lock);
 
-                found = -1;
-                for ( j = 0; j < hdr->nr; j++ ) {
-                    if ( ptr == (void *)((u64)hdr->obj_head + j * asz) ) {
-                        /* Found */
-                        found = j;
-                        break;
-                    }
-                }
-                if ( found >= 0 ) {
-                    hdr->nused--;
-                    hdr->marks[found] = 0;
-                    hdr->free = found;
-                    if ( hdr->nused <= 0 ) {
-                        /* To free list */
-                        *hdrp = hdr->next;
-                        hdr->next = kmem_slab_head->gslabs[i].free;
-                        kmem_slab_head->gslabs[i].free = hdr;
-                    } else {
-                        /* To partial list */
-                        *hdrp = hdr->next;
-                        hdr->next = kmem_slab_head->gslabs[i].partial;
-                        kmem_slab_head->gslabs[i].partial = hdr;
-                    }
-                    arch_spin_unlock(&kmem_lock);
-                    return;
-                }
-                hdrp = &hdr->next;
-            }
+    return cache;
+}
+
+/*
+ * Allocate an object from an object cache
+ */
+void *
+kmem_cache_alloc(struct kmem_cache *cache)
+{
+    struct kmem_slab *hdr;
+    u64 npg;
+    void *ret;
+
+    arch_spin_lock(&cache->lock);
+    ret = _slab_take(&cache->slabs);
+    if ( NULL == ret ) {
+        /* Allocate a slab of at least 16 objects */
+        npg = (sizeof(struct kmem_slab) + cache->align
+               + (u64)cache->size * 16 - 1) / PAGESIZE + 1;
+        hdr = _slab_create(npg, cache->size, cache->align);
+        if ( NULL == hdr ) {
+            arch_spin_unlock(&cache->lock);
+            return NULL;
         }
+        hdr->cache = cache;
+        cache->nslabs++;
+        cache->npgs += npg;
+        _slab_link(&cache->slabs.partial, hdr);
+        ret = _slab_take(&cache->slabs);
     }
+    cache->nused++;
+    arch_spin_unlock(&cache->lock);
 
-    arch_spin_unlock(&kmem_lock);
+    if ( NULL != cache->ctor ) {
+        cache->ctor(ret);
+    }
+
+    return ret;
+}
+
+/*
+ * Free an object to its object cache
+ */
+void
+kmem_cache_free(struct kmem_cache *cache, void *ptr)
+{
+    struct kmem_slab *hdr;
+    u64 off;
+
+    hdr = phys_mem_slab(ptr);
+    if ( NULL == hdr || hdr->cache != cache ) {
+        /* Not an object of the cache */
+        return;
+    }
+    off = (u64)ptr - (u64)hdr->obj_head;
+    if ( (u64)ptr < (u64)hdr->obj_head || off % hdr->size
+         || off / hdr->size >= (u64)hdr->nr ) {
+        return;
+    }
+
+    arch_spin_lock(&cache->lock);
+    _slab_free(hdr, ptr);
+    cache->nused--;
+    arch_spin_unlock(&cache->lock);
+}
+
+/*
+ * Get the list of the object caches
+ */
+struct kmem_cache *
+kmem_cache_list(void)
+{
+    return kmem_caches;
+}
+
+/*
+ * Initialize an arena
+ */
+void
+kmem_arena_init(struct kmem_arena *arena)
+{
+    arena->head = NULL;
+    arena->nchunks = 0;
+}
+
+/*
+ * Allocate scratch memory from an arena; it is released only with the arena
+ */
+void *
+kmem_arena_alloc(struct kmem_arena *arena, u64 sz)
+{
+    struct kmem_arena_chunk *chunk;
+    u64 hsz;
+    u64 csz;
+    void *ret;
+
+    hsz = (sizeof(struct kmem_arena_chunk) + KMEM_ARENA_ALIGN - 1)
+        & ~(u64)(KMEM_ARENA_ALIGN - 1);
+    sz = (sz + KMEM_ARENA_ALIGN - 1) & ~(u64)(KMEM_ARENA_ALIGN - 1);
+
+    chunk = arena->head;
+    if ( NULL != chunk && chunk->used + sz <= chunk->size ) {
+        /* Bump */
+        ret = (void *)((u64)chunk + chunk->used);
+        chunk->used += sz;
+        return ret;
+    }
+
+    /* New chunk */
+    if ( sz > KMEM_ARENA_CHUNK / 4 ) {
+        csz = hsz + sz;
+    } else {
+        csz = KMEM_ARENA_CHUNK;
+    }
+    csz = ((csz - 1) / PAGESIZE + 1) * PAGESIZE;
+    chunk = phys_mem_alloc_pages(csz / PAGESIZE);
+    if ( NULL == chunk ) {
+        return NULL;
+    }
+    chunk->size = csz;
+    chunk->used = hsz + sz;
+    if ( csz - chunk->used < KMEM_ARENA_CHUNK / 4 && NULL != arena->head ) {
+        /* Keep bumping the current chunk */
+        chunk->next = arena->head->next;
+        arena->head->next = chunk;
+    } else {
+        chunk->next = arena->head;
+        arena->head = chunk;
+    }
+    arena->nchunks++;
+
+    return (void *)((u64)chunk + hsz);
+}
+
+/*
+ * Release all the memory allocated from an arena
+ */
+void
+kmem_arena_release(struct kmem_arena *arena)
+{
+    struct kmem_arena_chunk *chunk;
+
+    while ( NULL != arena->head ) {
+        chunk = arena->head;
+        arena->head = chunk->next;
+        phys_mem_free_pages(chunk);
+    }
+    arena->nchunks = 0;
 }
 
 /*